@@ -319,6 +319,15 @@ if [ "$HOST_OS" = "Linux" ]; then
 fi
 
 
+# The slirp TCP, goldfish_net and packet capture tests use POSIX sockets,
+# FIFOs and threads, they are not built for Windows.
+SLIRP_UNITTESTS=
+SLIRP64_UNITTESTS=
+if [ -z "$MINGW" ]; then
+    SLIRP_UNITTESTS="emulator_slirp_unittests emulator_goldfish_net_unittests emulator_tcpdump_unittests"
+    SLIRP64_UNITTESTS="emulator64_slirp_unittests emulator64_goldfish_net_unittests emulator64_tcpdump_unittests"
+fi
+
 if [ -z "$NO_TESTS" ]; then
     FAILURES=""
 
@@ -340,7 +349,7 @@ if [ -z "$NO_TESTS" ]; then
 
     if [ "$RUN_32BIT_TESTS" ]; then
         echo "Running 32-bit unit test suite."
-        for UNIT_TEST in emulator_unittests emugl_common_host_unittests android_skin_unittests; do
+        for UNIT_TEST in emulator_unittests emugl_common_host_unittests android_skin_unittests emulator_softfloat_unittests emulator_phys_dispatch_unittests emulator_shaper_unittests emulator_timer_unittests emulator_proxy_unittests emulator_audio_unittests $SLIRP_UNITTESTS; do
         echo "   - $UNIT_TEST"
         run $TEST_SHELL $OUT_DIR/$UNIT_TEST$EXE_SUFFIX || FAILURES="$FAILURES $UNIT_TEST"
         done
@@ -348,7 +357,7 @@ if [ -z "$NO_TESTS" ]; then
 
     if [ "$RUN_64BIT_TESTS" ]; then
         echo "Running 64-bit unit test suite."
-        for UNIT_TEST in emulator64_unittests emugl64_common_host_unittests android64_skin_unittests; do
+        for UNIT_TEST in emulator64_unittests emugl64_common_host_unittests android64_skin_unittests emulator64_softfloat_unittests emulator64_phys_dispatch_unittests emulator64_shaper_unittests emulator64_timer_unittests emulator64_proxy_unittests emulator64_audio_unittests $SLIRP64_UNITTESTS; do
             echo "   - $UNIT_TEST"
             run $TEST_SHELL $OUT_DIR/$UNIT_TEST$EXE_SUFFIX || FAILURES="$FAILURES $UNIT_TEST"
         done
@@ -365,19 +365,17 @@ _camera_service_get_camera_info_by_device_name(CameraServiceDesc* cs,
  * Helpers for handling camera client queries
  *******************************************************************************/
 
-/* Formats paload size according to the protocol, and sends it to the client.
- * To simplify endianess handling we convert payload size to an eight characters
- * string, representing payload size value in hexadecimal format.
+/* Formats paload size according to the protocol. To simplify endianess
+ * handling we convert payload size to an eight characters string, representing
+ * payload size value in hexadecimal format.
  * Param:
- *  qc - Qemu client to send the payload size to.
+ *  payload_size_str - Buffer of 9 characters receiving the formatted size.
  *  payload_size - Payload size to report to the client.
  */
 static void
-_qemu_client_reply_payload(QemudClient* qc, size_t payload_size)
+_qemu_client_format_payload(char* payload_size_str, size_t payload_size)
 {
-    char payload_size_str[9];
-    snprintf(payload_size_str, sizeof(payload_size_str), "%08zx", payload_size);
-    qemud_client_send(qc, (const uint8_t*)payload_size_str, 8);
+    snprintf(payload_size_str, 9, "%08zx", payload_size);
 }
 
 /*
@@ -412,6 +410,9 @@ _qemu_client_query_reply(QemudClient* qc,
 {
     const char* ok_ko_str;
     size_t payload_size;
+    char payload_size_str[9];
+    struct iovec iov[3];
+    int iov_count = 0;
 
     /* Make sure extra_size is 0 if extra is NULL. */
     if (extra == NULL && extra_size != 0) {
@@ -432,15 +433,20 @@ _qemu_client_query_reply(QemudClient* qc,
     }
 
     /* Send payload size first. */
-    _qemu_client_reply_payload(qc, payload_size);
+    _qemu_client_format_payload(payload_size_str, payload_size);
+    iov[iov_count].iov_base = payload_size_str;
+    iov[iov_count++].iov_len = 8;
     /* Send 'ok[:]'/'ko[:]' next. Note that if there is no extra data, we still
      * need to send a zero-terminator for 'ok'/'ko' string instead of the ':'
      * separator. So, one way or another, the prefix is always 3 bytes. */
-    qemud_client_send(qc, (const uint8_t*)ok_ko_str, 3);
+    iov[iov_count].iov_base = (void*)ok_ko_str;
+    iov[iov_count++].iov_len = 3;
     /* Send extra data (if present). */
     if (extra != NULL) {
-        qemud_client_send(qc, (const uint8_t*)extra, extra_size);
+        iov[iov_count].iov_base = (void*)extra;
+        iov[iov_count++].iov_len = extra_size;
     }
+    qemud_client_sendv(qc, iov, iov_count);
 }
 
 /* Replies query success ("OK") back to the client.
@@ -1001,6 +1007,9 @@ _camera_client_query_frame(CameraClient* cc, QemudClient* qc, const char* param)
     ClientFrameBuffer fbs[2];
     int fbs_num = 0;
     size_t payload_size;
+    char payload_size_str[9];
+    struct iovec iov[4];
+    int iov_count = 0;
     uint64_t tick;
     float r_scale = 1.0f, g_scale = 1.0f, b_scale = 1.0f, exp_comp = 1.0f;
     char tmp[256];
@@ -1116,26 +1125,34 @@ _camera_client_query_frame(CameraClient* cc, QemudClient* qc, const char* param)
     payload_size = 3 + video_size + preview_size;
 
     /* Send payload size first. */
-    _qemu_client_reply_payload(qc, payload_size);
+    _qemu_client_format_payload(payload_size_str, payload_size);
+    iov[iov_count].iov_base = payload_size_str;
+    iov[iov_count++].iov_len = 8;
 
     /* After that send the 'ok:'. Note that if there is no frames sent, we should
      * use prefix "ok" instead of "ok:" */
     if (video_size || preview_size) {
-        qemud_client_send(qc, (const uint8_t*)"ok:", 3);
+        iov[iov_count].iov_base = "ok:";
     } else {
         /* Still 3 bytes: zero terminator is required in this case. */
-        qemud_client_send(qc, (const uint8_t*)"ok", 3);
+        iov[iov_count].iov_base = "ok";
     }
+    iov[iov_count++].iov_len = 3;
 
     /* After that send video frame (if requested). */
     if (video_size) {
-        qemud_client_send(qc, cc->video_frame, video_size);
+        iov[iov_count].iov_base = cc->video_frame;
+        iov[iov_count++].iov_len = video_size;
     }
 
     /* After that send preview frame (if requested). */
     if (preview_size) {
-        qemud_client_send(qc, (const uint8_t*)cc->preview_frame, preview_size);
+        iov[iov_count].iov_base = cc->preview_frame;
+        iov[iov_count++].iov_len = preview_size;
     }
+
+    /* The whole reply goes out as a single message. */
+    qemud_client_sendv(qc, iov, iov_count);
 }
 
 /* Handles a message received from the emulated camera client.
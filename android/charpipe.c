@@ -26,9 +26,12 @@
  * between two QEMU character drivers that merge well into the
  * QEMU event loop.
  *
- * each half of the channel has its own object and buffer, and
- * we implement communication through charpipe_poll() which
- * must be called by the main event loop after its call to select()
+ * each half of the channel has its own object and buffer. data that
+ * cannot be delivered immediately by a write is buffered, and the
+ * corresponding object is put on a pending list that is flushed from
+ * a bottom-half. objects whose receiver is not ready stay on the list
+ * and are retried by charpipe_poll(), which must be called by the main
+ * event loop after its call to select(). idle pipes are never visited.
  *
  */
 
@@ -73,8 +76,36 @@ typedef struct CharPipeHalf {
     BipBuffer*            bip_first;
     BipBuffer*            bip_last;
     struct CharPipeHalf*  peer;         /* NULL if closed */
+    struct CharPipeHalf*  next_pending;
+    char                  pending;
 } CharPipeHalf;
 
+/* the list of charpipe halves and charbuffers with buffered data */
+static CharPipeHalf*       _pending_halves;
+static struct CharBuffer*  _pending_buffers;
+static QEMUBH*             _pending_bh;
+
+static void  charpipe_flush_pending( void* opaque );
+
+static void
+charpipe_schedule( void )
+{
+    if (_pending_bh == NULL)
+        _pending_bh = qemu_bh_new( charpipe_flush_pending, NULL );
+
+    qemu_bh_schedule( _pending_bh );
+}
+
+static void
+charpipehalf_set_pending( CharPipeHalf*  ph )
+{
+    if (!ph->pending) {
+        ph->pending       = 1;
+        ph->next_pending  = _pending_halves;
+        _pending_halves   = ph;
+    }
+}
+
 
 
 static void
@@ -148,6 +179,9 @@ charpipehalf_write( CharDriverState*  cs, const uint8_t*  buf, int  len )
         bip->next = ph->bip_last;
         bip       = ph->bip_last;
     }
+
+    charpipehalf_set_pending(ph);
+    charpipe_schedule();
     return  ret;
 }
 
@@ -200,6 +234,22 @@ charpipehalf_poll( CharPipeHalf*  ph )
 }
 
 
+/* called when the read handlers of 'cs' change, i.e. when data buffered
+ * by our peer may now be delivered */
+static void
+charpipehalf_update_read_handler( CharDriverState*  cs )
+{
+    CharPipeHalf*  ph   = cs->opaque;
+    CharPipeHalf*  peer = ph->peer;
+
+    if (peer != NULL && peer->bip_first != NULL) {
+        charpipehalf_set_pending(peer);
+        charpipe_schedule();
+    }
+}
+
+/* NOTE: this doesn't touch the pending state, since a recycled half may
+ * still be linked in the pending list. */
 static void
 charpipehalf_init( CharPipeHalf*  ph, CharPipeHalf*  peer )
 {
@@ -213,6 +263,7 @@ charpipehalf_init( CharPipeHalf*  ph, CharPipeHalf*  peer )
     cs->chr_ioctl            = NULL;
     cs->chr_send_event       = NULL;
     cs->chr_close            = charpipehalf_close;
+    cs->chr_update_read_handler = charpipehalf_update_read_handler;
     cs->opaque               = ph;
 }
 
@@ -268,8 +319,20 @@ typedef struct CharBuffer {
     BipBuffer*       bip_last;
     CharDriverState* endpoint;  /* NULL if closed */
     char             closing;
+    char             pending;
+    struct CharBuffer*  next_pending;
 } CharBuffer;
 
+static void
+charbuffer_set_pending( CharBuffer*  cbuf )
+{
+    if (!cbuf->pending) {
+        cbuf->pending      = 1;
+        cbuf->next_pending = _pending_buffers;
+        _pending_buffers   = cbuf;
+    }
+}
+
 
 static void
 charbuffer_close( CharDriverState*  cs )
@@ -338,6 +401,9 @@ charbuffer_write( CharDriverState*  cs, const uint8_t*  buf, int  len )
         bip->next = cbuf->bip_last;
         bip       = cbuf->bip_last;
     }
+
+    charbuffer_set_pending(cbuf);
+    charpipe_schedule();
     return  ret;
 }
 
@@ -396,6 +462,7 @@ charbuffer_update_handlers( CharDriverState*  cs )
 }
 
 
+
 static void
 charbuffer_init( CharBuffer*  cbuf, CharDriverState*  endpoint )
 {
@@ -439,31 +506,52 @@ qemu_chr_open_buffer( CharDriverState*  endpoint )
 }
 
 
-void
-charpipe_poll( void )
+/* flush all pending objects. those that still have buffered data
+ * afterwards (because their receiver is not ready) are put back on
+ * the pending list, unless they have no receiver at all, in which
+ * case charpipehalf_update_read_handler() will requeue them. */
+static void
+charpipe_flush_pending( void*  opaque )
 {
-    CharPipeState*  cp     = _s_charpipes;
-    CharPipeState*  cp_end = cp + MAX_CHAR_PIPES;
+    CharPipeHalf*  half = _pending_halves;
+    CharBuffer*    cb   = _pending_buffers;
 
-    CharBuffer*     cb     = _s_charbuffers;
-    CharBuffer*     cb_end = cb + MAX_CHAR_BUFFERS;
+    _pending_halves  = NULL;
+    _pending_buffers = NULL;
 
-    /* poll the charpipes */
-    for ( ; cp < cp_end; cp++ ) {
-        CharPipeHalf*  half;
-
-        half = cp->a;
-        if (half->peer != NULL)
-            charpipehalf_poll(half);
+    while (half != NULL) {
+        CharPipeHalf*  next = half->next_pending;
 
-        half = cp->b;
-        if (half->peer != NULL)
+        half->pending      = 0;
+        half->next_pending = NULL;
+        if (half->peer != NULL) {
             charpipehalf_poll(half);
+            if (half->bip_first != NULL && half->peer != NULL &&
+                half->peer->cs->chr_read != NULL)
+                charpipehalf_set_pending(half);
+        }
+        half = next;
     }
 
-    /* poll the charbuffers */
-    for ( ; cb < cb_end; cb++ ) {
-        if (cb->endpoint != NULL)
+    while (cb != NULL) {
+        CharBuffer*  next = cb->next_pending;
+
+        cb->pending      = 0;
+        cb->next_pending = NULL;
+        if (cb->endpoint != NULL) {
             charbuffer_poll(cb);
+            if (cb->bip_first != NULL && cb->endpoint != NULL)
+                charbuffer_set_pending(cb);
+        }
+        cb = next;
     }
 }
+
+void
+charpipe_poll( void )
+{
+    /* only retry the objects that are still waiting for their receiver,
+     * new data is flushed by the bottom-half. */
+    if (_pending_halves != NULL || _pending_buffers != NULL)
+        charpipe_flush_pending(NULL);
+}
@@ -40,6 +40,7 @@
 #include "android/utils/utf8_utils.h"
 #include "android/config/config.h"
 #include "android/tcpdump.h"
+#include "audio/audio.h"
 #include "net/net.h"
 #include "monitor/monitor.h"
 
@@ -61,6 +62,10 @@
 #include "libslirp.h"
 #endif
 
+#ifdef CONFIG_KVM
+#include "sysemu/kvm.h"
+#endif
+
 extern void android_emulator_set_window_scale(double, int);
 
 #define  DEBUG  1
@@ -677,6 +682,21 @@ do_quit( ControlClient  client, char*  args )
 /********************************************************************************************/
 /********************************************************************************************/
 
+/* packet loss and jitter applied by both slirp shapers */
+static NetShaperRandomModel  network_model;
+
+static void
+network_update_model( void )
+{
+    const NetShaperModel*  model = NULL;
+
+    if (network_model.loss > 0. || network_model.jitter_ns > 0)
+        model = &netshaper_random_model;
+
+    netshaper_set_model( slirp_shaper_in,  model, &network_model );
+    netshaper_set_model( slirp_shaper_out, model, &network_model );
+}
+
 static int
 do_network_status( ControlClient  client, char*  args )
 {
@@ -690,6 +710,27 @@ do_network_status( ControlClient  client, char*  args )
 
     control_write( client, "  minimum latency:  %ld ms\r\n", qemu_net_min_latency );
     control_write( client, "  maximum latency:  %ld ms\r\n", qemu_net_max_latency );
+    control_write( client, "  packet loss:      %g %%\r\n", network_model.loss * 100. );
+    control_write( client, "  jitter:           %ld ms\r\n",
+                   (long)(network_model.jitter_ns / 1000000) );
+    return 0;
+}
+
+static int
+do_network_mbufs( ControlClient  client, char*  args )
+{
+    SlirpMbufStats  stats[8];
+    int             n, nn;
+
+    n = slirp_get_mbuf_stats( stats, 8 );
+    control_write( client, "  %-6s %6s %6s %6s %6s %10s %10s\r\n",
+                   "class", "size", "inuse", "hiwat", "cached", "allocs", "mallocs" );
+    for (nn = 0; nn < n; nn++) {
+        control_write( client, "  %-6s %6d %6d %6d %6d %10u %10u\r\n",
+                       stats[nn].name, stats[nn].size, stats[nn].inuse,
+                       stats[nn].hiwat, stats[nn].cached,
+                       stats[nn].allocs, stats[nn].mallocs );
+    }
     return 0;
 }
 
@@ -761,13 +802,70 @@ describe_network_delay( ControlClient  client )
     /* XXX: TODO */
 }
 
+static int
+do_network_loss( ControlClient  client, char*  args )
+{
+    char*   end;
+    double  percent;
+
+    if ( !args ) {
+        control_write( client, "KO: missing <percent> argument, see 'help network loss'\r\n" );
+        return -1;
+    }
+    percent = strtod( args, &end );
+    if (end == args || *end != 0 || percent < 0. || percent > 100.) {
+        control_write( client, "KO: invalid <percent> argument, see 'help network loss'\r\n" );
+        return -1;
+    }
+    network_model.loss = percent / 100.;
+    network_update_model();
+    return 0;
+}
+
+static int
+do_network_jitter( ControlClient  client, char*  args )
+{
+    char*  end;
+    long   ms;
+
+    if ( !args ) {
+        control_write( client, "KO: missing <ms> argument, see 'help network jitter'\r\n" );
+        return -1;
+    }
+    ms = strtol( args, &end, 10 );
+    if (end == args || *end != 0 || ms < 0 || ms > 10000) {
+        control_write( client, "KO: invalid <ms> argument, see 'help network jitter'\r\n" );
+        return -1;
+    }
+    network_model.jitter_ns = (int64_t)ms * 1000000;
+    network_update_model();
+    return 0;
+}
+
 static int
 do_network_capture_start( ControlClient  client, char*  args )
 {
+    char*  snaplen;
+
     if ( !args ) {
         control_write( client, "KO: missing <file> argument, see 'help network capture start'\r\n" );
         return -1;
     }
+    snaplen = strchr( args, ' ' );
+    if (snaplen != NULL) {
+        char*  end;
+        long   len;
+
+        *snaplen++ = 0;
+        len = strtol( snaplen, &end, 10 );
+        if (end == snaplen || *end != 0 || len <= 0) {
+            control_write( client, "KO: invalid <snaplen> argument, see 'help network capture start'\r\n" );
+            return -1;
+        }
+        qemu_tcpdump_set_snaplen( len );
+    } else {
+        qemu_tcpdump_set_snaplen( 0 );
+    }
     if ( qemu_tcpdump_start(args) < 0) {
         control_write( client, "KO: could not start capture: %s", strerror(errno) );
         return -1;
@@ -778,18 +876,44 @@ do_network_capture_start( ControlClient  client, char*  args )
 static int
 do_network_capture_stop( ControlClient  client, char*  args )
 {
+    uint64_t  count, size, dropped;
+
     /* no need to return an error here */
     qemu_tcpdump_stop();
+
+    qemu_tcpdump_stats( &count, &size, &dropped );
+    if (dropped > 0) {
+        control_write( client, "warning: %llu packets were dropped from the capture\r\n",
+                       (unsigned long long)dropped );
+    }
+    return 0;
+}
+
+static int
+do_network_capture_status( ControlClient  client, char*  args )
+{
+    uint64_t  count, size, dropped;
+
+    qemu_tcpdump_stats( &count, &size, &dropped );
+    control_write( client, "capture %s\r\n", qemu_tcpdump_active ? "running" : "stopped" );
+    control_write( client, "  packets: %llu\r\n", (unsigned long long)count );
+    control_write( client, "  bytes:   %llu\r\n", (unsigned long long)size );
+    control_write( client, "  dropped: %llu\r\n", (unsigned long long)dropped );
     return 0;
 }
 
 static const CommandDefRec  network_capture_commands[] =
 {
     { "start", "start network capture",
-      "'network capture start <file>' starts a new capture of network packets\r\n"
-      "into a specific <file>. This will stop any capture already in progress.\r\n"
+      "'network capture start <file> [<snaplen>]' starts a new capture of network\r\n"
+      "packets into a specific <file>. This will stop any capture already in progress.\r\n"
       "the capture file can later be analyzed by tools like WireShark. It uses\r\n"
-      "the libpcap file format.\r\n\r\n"
+      "the pcapng file format if <file> ends with '.pcapng', with the direction of\r\n"
+      "each packet, and the libpcap file format otherwise.\r\n"
+      "only the first <snaplen> bytes of each packet are saved (default 65535).\r\n\r\n"
+      "packets are written by a background thread. if it cannot keep up, packets\r\n"
+      "are dropped from the capture (never from the network), see\r\n"
+      "'network capture status'.\r\n\r\n"
       "you can stop the capture anytime with 'network capture stop'\r\n", NULL,
       do_network_capture_start, NULL },
 
@@ -798,6 +922,12 @@ static const CommandDefRec  network_capture_commands[] =
       "you can start one with 'network capture start <file>'\r\n", NULL,
       do_network_capture_stop, NULL },
 
+    { "status", "report network capture statistics",
+      "'network capture status' reports the number of packets and bytes captured,\r\n"
+      "and the number of packets dropped because the capture file could not be\r\n"
+      "written fast enough.\r\n", NULL,
+      do_network_capture_status, NULL },
+
     { NULL, NULL, NULL, NULL, NULL, NULL }
 };
 
@@ -806,12 +936,30 @@ static const CommandDefRec  network_commands[] =
     { "status", "dump network status", NULL, NULL,
        do_network_status, NULL },
 
+    { "mbufs", "dump network buffer usage",
+      "'network mbufs' lists, for each buffer size class of the user-mode network\r\n"
+      "stack, the buffers in use, the high-water mark, the buffers kept for reuse\r\n"
+      "and the number of allocations that had to reach the system allocator.\r\n", NULL,
+      do_network_mbufs, NULL },
+
     { "speed", "change network speed", NULL, describe_network_speed,
       do_network_speed, NULL },
 
     { "delay", "change network latency", NULL, describe_network_delay,
        do_network_delay, NULL },
 
+    { "loss", "change network packet loss",
+      "'network loss <percent>' drops the given percentage of the packets sent or\r\n"
+      "received by the emulated device, chosen at random. use 0 to disable it.\r\n", NULL,
+      do_network_loss, NULL },
+
+    { "jitter", "change network jitter",
+      "'network jitter <ms>' delays each packet sent or received by the emulated\r\n"
+      "device by a random amount between 0 and <ms> milliseconds, on top of the\r\n"
+      "latency set by 'network delay'. packets are never reordered. use 0 to\r\n"
+      "disable it.\r\n", NULL,
+      do_network_jitter, NULL },
+
     { "capture", "dump network packets to file",
       "allows to start/stop capture of network packets to a file for later analysis\r\n", NULL,
       NULL, network_capture_commands },
@@ -2567,6 +2715,104 @@ INPUT_ERROR:
     return -1;
 }
 
+/* queue a batch of timestamped sensor samples */
+static int
+do_sensors_batch( ControlClient client, char* args )
+{
+    static const char  usage[] =
+        "KO: Usage: \"batch <delay-us>:<sensorname>:<value-a>[:<value-b>[:<value-c>]] ...\"\r\n";
+    char*  args_dup;
+    char*  item;
+    char*  saveptr = NULL;
+    int    count = 0;
+
+    if (! args) {
+        control_write( client, usage );
+        return -1;
+    }
+
+    args_dup = strdup( args );
+    if (args_dup == NULL) {
+        control_write( client, "KO: Memory allocation failed.\r\n" );
+        return -1;
+    }
+
+    for (item = strtok_r(args_dup, " \t", &saveptr);
+         item != NULL;
+         item = strtok_r(NULL, " \t", &saveptr)) {
+        char*      sensor;
+        char*      value;
+        char*      end;
+        long long  delay_us;
+        float      fvalues[3];
+        int        sensor_id, status, i;
+
+        delay_us = strtoll( item, &end, 10 );
+        if (end == item || *end != ':' || delay_us < 0)
+            goto INPUT_ERROR;
+
+        sensor = end + 1;
+        value  = strchr( sensor, ':' );
+        if (value == NULL || value[1] == 0)
+            goto INPUT_ERROR;
+        *value++ = 0;
+
+        sensor_id = android_sensors_get_id_from_name( sensor );
+        status    = sensor_id;
+        if (sensor_id >= 0)
+            status = android_sensors_get( sensor_id, &fvalues[0], &fvalues[1], &fvalues[2] );
+
+        if (status == SENSOR_STATUS_OK) {
+            /* Missing values keep the current sensor value. */
+            for (i = 0; i < 3 && value != NULL; i++) {
+                char*  pnext = strchr( value, ':' );
+                if (pnext)
+                    *pnext++ = 0;
+                if (*value && 1 != sscanf( value, "%g", &fvalues[i] ))
+                    goto INPUT_ERROR;
+                value = pnext;
+            }
+            status = android_sensors_inject( sensor_id, (int64_t)delay_us,
+                                             fvalues[0], fvalues[1], fvalues[2] );
+        }
+
+        switch (status) {
+        case SENSOR_STATUS_OK:
+            count++;
+            break;
+        case SENSOR_STATUS_NO_SERVICE:
+            control_write( client, "KO: No sensor service found!\r\n" );
+            free( args_dup );
+            return -1;
+        case SENSOR_STATUS_DISABLED:
+            control_write( client, "KO: '%s' sensor is disabled.\r\n", sensor );
+            free( args_dup );
+            return -1;
+        case SENSOR_STATUS_QUEUE_FULL:
+            control_write( client, "KO: sample queue full after %d samples.\r\n", count );
+            free( args_dup );
+            return -1;
+        default:
+            control_write( client,
+                "KO: unknown sensor name: %s, run 'sensor status' to get available sensors.\r\n", sensor );
+            free( args_dup );
+            return -1;
+        }
+    }
+
+    free( args_dup );
+    if (count == 0) {
+        control_write( client, usage );
+        return -1;
+    }
+    return 0;
+
+INPUT_ERROR:
+    control_write( client, usage );
+    free( args_dup );
+    return -1;
+}
+
 /* get all available sensor names and enable status respectively. */
 static int
 do_sensors_status( ControlClient client, char* args )
@@ -2599,6 +2845,12 @@ static const CommandDefRec sensor_commands[] =
       "'set <sensorname> <value-a>[:<value-b>[:<value-c>]]' set the values of a given sensor.\r\n",
       NULL, do_sensors_set, NULL },
 
+    { "batch", "queue timestamped sensor samples",
+      "'batch <delay-us>:<sensorname>:<value-a>[:<value-b>[:<value-c>]] ...' queues one or\r\n"
+      "more samples, each applied <delay-us> micro-seconds of virtual time from now.\r\n"
+      "Guests using the binary sensors protocol receive every sample with its own timestamp.\r\n",
+      NULL, do_sensors_batch, NULL },
+
     { NULL, NULL, NULL, NULL, NULL, NULL }
 };
 
@@ -2707,6 +2959,89 @@ do_qemu_monitor( ControlClient client, char* args )
     return -1;
 }
 
+#ifdef CONFIG_KVM
+static int
+do_qemu_kvm_stats( ControlClient client, char* args )
+{
+    KVMExitStats  stats;
+
+    if (!kvm_enabled()) {
+        control_write(client, "KO: KVM is not enabled\r\n");
+        return -1;
+    }
+    kvm_get_exit_stats(&stats);
+    control_write(client, "total exits:     %llu\r\n",
+                  (unsigned long long)stats.total);
+    control_write(client, "i/o exits:       %llu\r\n",
+                  (unsigned long long)stats.io);
+    control_write(client, "mmio exits:      %llu\r\n",
+                  (unsigned long long)stats.mmio);
+    control_write(client, "coalesced mmio:  %llu\r\n",
+                  (unsigned long long)stats.coalesced_mmio);
+    control_write(client, "ioeventfd:       %s\r\n",
+                  kvm_has_ioeventfd() ? "supported" : "unsupported");
+    return 0;
+}
+#endif  // CONFIG_KVM
+
+static int
+do_qemu_wakeups( ControlClient client, char* args )
+{
+    static MainLoopWakeupStats  last;
+    MainLoopWakeupStats         stats;
+    int64_t                     period_ns;
+
+    main_loop_get_wakeup_stats(&stats);
+    control_write(client, "alarm timer:     %s\r\n", qemu_alarm_timer_name());
+    control_write(client, "host wakeups:    %llu\r\n",
+                  (unsigned long long)stats.wakeups);
+    control_write(client, "timer wakeups:   %llu\r\n",
+                  (unsigned long long)stats.timer_wakeups);
+    control_write(client, "i/o wakeups:     %llu\r\n",
+                  (unsigned long long)stats.io_wakeups);
+
+    /* rate since the previous query, or since startup for the first one */
+    period_ns = stats.elapsed_ns - last.elapsed_ns;
+    if (period_ns > 0) {
+        control_write(client, "wakeups/s:       %.1f\r\n",
+                      (stats.wakeups - last.wakeups) * 1e9 / period_ns);
+    }
+    last = stats;
+    return 0;
+}
+
+static int
+do_qemu_audio( ControlClient client, char* args )
+{
+    static AudioStats  last;
+    AudioStats         stats;
+    uint64_t           count;
+
+    AUD_get_stats(&stats);
+    control_write(client, "host driver:     %s\r\n",
+                  stats.driver ? stats.driver : "none");
+    control_write(client, "polled voices:   %d\r\n", stats.polled_voices);
+    control_write(client, "timed voices:    %d\r\n", stats.timed_voices);
+    control_write(client, "mixer runs:      %llu\r\n",
+                  (unsigned long long)stats.runs);
+    control_write(client, "timer runs:      %llu\r\n",
+                  (unsigned long long)stats.timer_runs);
+
+    /* latency of the audio mixed since the previous query */
+    count = stats.latency_count - last.latency_count;
+    if (count > 0) {
+        control_write(client, "latency avg:     %.1f ms\r\n",
+                      (stats.latency_sum_ns - last.latency_sum_ns) /
+                      (count * 1e6));
+        control_write(client, "latency min:     %.1f ms\r\n",
+                      stats.latency_min_ns / 1e6);
+        control_write(client, "latency max:     %.1f ms\r\n",
+                      stats.latency_max_ns / 1e6);
+    }
+    last = stats;
+    return 0;
+}
+
 #ifdef CONFIG_STANDALONE_CORE
 /* UI settings, passed to the core via -ui-settings command line parameter. */
 extern char* android_op_ui_settings;
@@ -2906,6 +3241,24 @@ static const CommandDefRec  qemu_commands[] =
     "Enter the QEMU virtual machine monitor\r\n",
     NULL, do_qemu_monitor, NULL },
 
+    { "wakeups", "display main loop host wakeups",
+    "'qemu wakeups' displays the number of times the emulator woke up the\r\n"
+    "host to handle timers or i/o, and the rate since the previous query.\r\n",
+    NULL, do_qemu_wakeups, NULL },
+
+    { "audio", "display audio scheduling and latency",
+    "'qemu audio' tells whether host audio voices ask for data themselves or\r\n"
+    "are run by the periodic audio timer, and reports the time between mixing\r\n"
+    "audio and the host playing it since the previous query.\r\n",
+    NULL, do_qemu_audio, NULL },
+
+#ifdef CONFIG_KVM
+    { "kvm-stats", "display KVM exit counters",
+    "'qemu kvm-stats' displays the cumulative number of VCPU exits handled\r\n"
+    "by the emulator, per exit reason. Sample it twice to get a rate.\r\n",
+    NULL, do_qemu_kvm_stats, NULL },
+#endif  // CONFIG_KVM
+
 #ifdef CONFIG_STANDALONE_CORE
     { "attach-UI", "attach UI to the core",
     "Attach UI to the core\r\n",
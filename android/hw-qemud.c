@@ -43,6 +43,11 @@
  */
 #define  MAX_FRAME_PAYLOAD  65535
 
+/* max framed data payload for clients connected through the "qemud-bin"
+ * pipe, whose frame headers carry a binary 32-bit length.
+ */
+#define  MAX_BINARY_FRAME_PAYLOAD  (1 << 20)
+
 /* Version number of snapshots code. Increment whenever the data saved
  * or the layout in which it is saved is changed.
  */
@@ -658,6 +663,7 @@ struct QemudClient {
 
     /* framing support */
     int               framing;
+    ABool             binary_framing; /* LE32 length headers ("qemud-bin") */
     ABool             need_header;
     ABool             closing;
     QemudSink         header[1];
@@ -711,6 +717,29 @@ qemud_client_prepend( QemudClient*  c, QemudClient** plist )
         c->next->pref = &c->next;
 }
 
+/* decode a frame header received from a client. Clients connected through
+ * the "qemud-bin" pipe use a 32-bit little-endian length, all others use
+ * 4 hex chars. Returns the payload size, or -1 if the header is corrupted.
+ */
+static int
+qemud_client_frame_size( QemudClient*  c, const uint8_t*  header )
+{
+    uint32_t  size;
+
+    if (!c->binary_framing)
+        return hex2int(header, FRAME_HEADER_SIZE);
+
+    size = (uint32_t)header[0]         |
+           ((uint32_t)header[1] << 8)  |
+           ((uint32_t)header[2] << 16) |
+           ((uint32_t)header[3] << 24);
+
+    if (size > MAX_BINARY_FRAME_PAYLOAD)
+        return -1;
+
+    return (int)size;
+}
+
 /* receive a new message from a client, and dispatch it to
  * the real service implementation.
  */
@@ -737,7 +766,7 @@ qemud_client_recv( void*  opaque, uint8_t*  msg, int  msglen )
         c->need_header == 1          &&
         qemud_sink_needed(c->header) == 0)
     {
-        int  len = hex2int( msg, FRAME_HEADER_SIZE );
+        int  len = qemud_client_frame_size( c, msg );
 
         if (len >= 0 && msglen == len + FRAME_HEADER_SIZE) {
             if (c->clie_recv)
@@ -760,14 +789,16 @@ qemud_client_recv( void*  opaque, uint8_t*  msg, int  msglen )
             if (!qemud_sink_fill(c->header, (const uint8_t**)&msg, &msglen))
                 break;
 
-            frame_size = hex2int(c->header0, 4);
-            if (frame_size == 0) {
-                D("%s: ignoring empty frame", __FUNCTION__);
-                continue;
-            }
-            if (frame_size < 0) {
-                D("%s: ignoring corrupted frame header '.*s'",
-                  __FUNCTION__, FRAME_HEADER_SIZE, c->header0 );
+            frame_size = qemud_client_frame_size(c, c->header0);
+            if (frame_size <= 0) {
+                /* drop the header and start over with the next one */
+                if (frame_size == 0) {
+                    D("%s: ignoring empty frame", __FUNCTION__);
+                } else {
+                    D("%s: ignoring corrupted frame header '%.*s'",
+                      __FUNCTION__, FRAME_HEADER_SIZE, c->header0 );
+                }
+                c->header->used = 0;
                 continue;
             }
 
@@ -1603,33 +1634,81 @@ qemud_client_new( QemudService*     service,
     return c;
 }
 
-/* Caches a service message into the client's descriptor.
+/* Writes the frame header for a 'size' bytes message sent to a pipe client.
+ */
+static void
+_qemud_pipe_frame_header(QemudClient* client, uint8_t* header, size_t size)
+{
+    if (client->binary_framing) {
+        header[0] = (uint8_t)(size);
+        header[1] = (uint8_t)(size >> 8);
+        header[2] = (uint8_t)(size >> 16);
+        header[3] = (uint8_t)(size >> 24);
+    } else {
+        int2hex(header, FRAME_HEADER_SIZE, size);
+    }
+}
+
+/* Caches a service message, made of 'count' buffers, into the client's
+ * descriptor.
+ *
+ * The frame header (when framing is enabled) and all the buffers are gathered
+ * into a single QemudPipeMessage, so the guest is woken up only once per
+ * message. Unlike the serial port, a pipe has no MTU, so there is no need to
+ * packetize the payload either.
  *
  * See comments on QemudPipeMessage structure for more info.
  */
 static void
-_qemud_pipe_cache_buffer(QemudClient* client, const uint8_t*  msg, int  msglen)
+_qemud_pipe_sendv(QemudClient* client, const struct iovec* iov, int count)
 {
     QemudPipeMessage* buf;
     QemudPipeMessage** ins_at = &client->ProtocolSelector.Pipe.messages;
+    size_t  header_size = client->framing ? FRAME_HEADER_SIZE : 0;
+    size_t  msglen = 0;
+    uint8_t* dst;
+    int n;
+
+    for (n = 0; n < count; n++) {
+        msglen += iov[n].iov_len;
+    }
+    if (msglen == 0)
+        return;
 
     /* Allocate descriptor big enough to contain message as well. */
-    buf = (QemudPipeMessage*)malloc(msglen + sizeof(QemudPipeMessage));
-    if (buf != NULL) {
-        /* Message starts right after the descriptor. */
-        buf->message = (uint8_t*)buf + sizeof(QemudPipeMessage);
-        buf->size = msglen;
-        memcpy(buf->message, msg, msglen);
-        buf->offset = 0;
-        buf->next = NULL;
-        while (*ins_at != NULL) {
-            ins_at = &(*ins_at)->next;
-        }
-        *ins_at = buf;
-        /* Notify the pipe that there is data to read. */
-        goldfish_pipe_wake(client->ProtocolSelector.Pipe.qemud_pipe->hwpipe,
-                           PIPE_WAKE_READ);
+    buf = (QemudPipeMessage*)malloc(sizeof(QemudPipeMessage) + header_size + msglen);
+    if (buf == NULL) {
+        D("%s: unable to allocate %d bytes message", __FUNCTION__, (int)msglen);
+        return;
     }
+
+    /* Message starts right after the descriptor. */
+    buf->message = (uint8_t*)buf + sizeof(QemudPipeMessage);
+    buf->size = header_size + msglen;
+    buf->offset = 0;
+    buf->next = NULL;
+
+    dst = buf->message;
+    if (header_size) {
+        _qemud_pipe_frame_header(client, dst, msglen);
+        T("%s: header for %d bytes", __FUNCTION__, (int)msglen);
+        dst += header_size;
+    }
+    for (n = 0; n < count; n++) {
+        memcpy(dst, iov[n].iov_base, iov[n].iov_len);
+        dst += iov[n].iov_len;
+    }
+
+    D("%s: len=%3d '%s'", __FUNCTION__, (int)msglen,
+      quote_bytes((const void*)(buf->message + header_size), msglen));
+
+    while (*ins_at != NULL) {
+        ins_at = &(*ins_at)->next;
+    }
+    *ins_at = buf;
+    /* Notify the pipe that there is data to read. */
+    goldfish_pipe_wake(client->ProtocolSelector.Pipe.qemud_pipe->hwpipe,
+                       PIPE_WAKE_READ);
 }
 
 /* Sends service message to the client.
@@ -1637,43 +1716,14 @@ _qemud_pipe_cache_buffer(QemudClient* client, const uint8_t*  msg, int  msglen)
 static void
 _qemud_pipe_send(QemudClient*  client, const uint8_t*  msg, int  msglen)
 {
-    uint8_t   frame[FRAME_HEADER_SIZE];
-    int       avail, len = msglen;
-    int framing = client->framing;
+    struct iovec  iov;
 
     if (msglen <= 0)
         return;
 
-    D("%s: len=%3d '%s'",
-      __FUNCTION__, msglen, quote_bytes((const void*)msg, msglen));
-
-    if (framing) {
-        len += FRAME_HEADER_SIZE;
-    }
-
-    /* packetize the payload for the serial MTU */
-    while (len > 0)
-    {
-        avail = len;
-        if (avail > MAX_SERIAL_PAYLOAD)
-            avail = MAX_SERIAL_PAYLOAD;
-
-        /* insert frame header when needed */
-        if (framing) {
-            int2hex(frame, FRAME_HEADER_SIZE, msglen);
-            T("%s: '%.*s'", __FUNCTION__, FRAME_HEADER_SIZE, frame);
-            _qemud_pipe_cache_buffer(client, frame, FRAME_HEADER_SIZE);
-            avail  -= FRAME_HEADER_SIZE;
-            len    -= FRAME_HEADER_SIZE;
-            framing = 0;
-        }
-
-        /* write message content */
-        T("%s: '%.*s'", __FUNCTION__, avail, msg);
-        _qemud_pipe_cache_buffer(client, msg, avail);
-        msg += avail;
-        len -= avail;
-    }
+    iov.iov_base = (void*)msg;
+    iov.iov_len  = msglen;
+    _qemud_pipe_sendv(client, &iov, 1);
 }
 
 /* this can be used by a service implementation to send an answer
@@ -1691,6 +1741,47 @@ qemud_client_send ( QemudClient*  client, const uint8_t*  msg, int  msglen )
     }
 }
 
+/* this can be used by a service implementation to send a message made
+ * of several buffers to a specific client, without gathering them first.
+ * This is equivalent to calling qemud_client_send() on the concatenation
+ * of all buffers.
+ */
+void
+qemud_client_sendv( QemudClient*  client, const struct iovec*  iov, int  count )
+{
+    uint8_t*  msg;
+    uint8_t*  wrk;
+    size_t    msglen = 0;
+    int       n;
+
+    if (_is_pipe_client(client)) {
+        _qemud_pipe_sendv(client, iov, count);
+        return;
+    }
+
+    if (count == 1) {
+        qemud_client_send(client, iov->iov_base, iov->iov_len);
+        return;
+    }
+
+    /* The serial protocol re-frames and packetizes every message, so the
+     * buffers have to be gathered first. */
+    for (n = 0; n < count; n++) {
+        msglen += iov[n].iov_len;
+    }
+    if (msglen == 0)
+        return;
+
+    AARRAY_NEW(msg, msglen);
+    wrk = msg;
+    for (n = 0; n < count; n++) {
+        memcpy(wrk, iov[n].iov_base, iov[n].iov_len);
+        wrk += iov[n].iov_len;
+    }
+    qemud_client_send(client, msg, msglen);
+    AFREE(msg);
+}
+
 /* enable framing for this client. When TRUE, this will
  * use internally a simple 4-hexchar header before each
  * message exchanged through the serial port.
@@ -1893,10 +1984,11 @@ _load_pipe_message(QEMUFile* f)
 /* This is a callback that gets invoked when guest is connecting to the service.
  *
  * Here we will create a new client as well as pipe descriptor representing new
- * connection.
+ * connection. 'binary' is true for connections made through the "qemud-bin"
+ * pipe, whose framed messages use a binary length header.
  */
 static void*
-_qemudPipe_init(void* hwpipe, void* _looper, const char* args)
+_qemudPipe_open(void* hwpipe, void* _looper, const char* args, ABool binary)
 {
     QemudMultiplexer *m = _multiplexer;
     QemudService* sv = m->services;
@@ -1943,6 +2035,7 @@ _qemudPipe_init(void* hwpipe, void* _looper, const char* args)
      * is a pipe client. */
     client = qemud_service_connect_client(sv, -1, client_args);
     if (client != NULL) {
+        client->binary_framing = binary;
         ANEW0(pipe);
         pipe->hwpipe = hwpipe;
         pipe->looper = _looper;
@@ -1954,6 +2047,18 @@ _qemudPipe_init(void* hwpipe, void* _looper, const char* args)
     return pipe;
 }
 
+static void*
+_qemudPipe_init(void* hwpipe, void* _looper, const char* args)
+{
+    return _qemudPipe_open(hwpipe, _looper, args, false);
+}
+
+static void*
+_qemudPipe_initBinary(void* hwpipe, void* _looper, const char* args)
+{
+    return _qemudPipe_open(hwpipe, _looper, args, true);
+}
+
 /* Called when the guest wants to close the channel.
 */
 static void
@@ -1990,6 +2095,16 @@ _qemudPipe_sendBuffers(void* opaque,
         D("%s: %s", __FUNCTION__, quote_bytes((char*)buffers->data, buffers->size));
         qemud_client_recv(client, buffers->data, buffers->size);
         transferred = buffers->size;
+    } else if (client->framing) {
+        /* Framed messages are reassembled by qemud_client_recv() itself, so
+         * the guest buffers can be handed over as they are. Note that a pipe
+         * client is never freed from a service callback (see
+         * qemud_client_disconnect()), so 'client' remains valid here. */
+        int n;
+        for (n = 0; n < numBuffers; n++) {
+            qemud_client_recv(client, buffers[n].data, buffers[n].size);
+            transferred += buffers[n].size;
+        }
     } else {
         /* If there are multiple buffers involved, collect all data in one buffer
          * before calling the high level client. */
@@ -2127,7 +2242,7 @@ _qemudPipe_save(void* opaque, QEMUFile* f )
 }
 
 static void*
-_qemudPipe_load(void* hwpipe, void* pipeOpaque, const char* args, QEMUFile* f)
+_qemudPipe_loadCommon(void* hwpipe, void* pipeOpaque, QEMUFile* f, ABool binary)
 {
     QemudPipe* qemud_pipe = NULL;
     char* param;
@@ -2149,6 +2264,7 @@ _qemudPipe_load(void* hwpipe, void* pipeOpaque, const char* args, QEMUFile* f)
     QemudClient* c = qemud_service_connect_client(sv, -1, param);
     if(c == NULL)
         return NULL;
+    c->binary_framing = binary;
 
     /* Load pending messages. */
     c->ProtocolSelector.Pipe.messages = _load_pipe_message(f);
@@ -2206,6 +2322,18 @@ _qemudPipe_load(void* hwpipe, void* pipeOpaque, const char* args, QEMUFile* f)
     return qemud_pipe;
 }
 
+static void*
+_qemudPipe_load(void* hwpipe, void* pipeOpaque, const char* args, QEMUFile* f)
+{
+    return _qemudPipe_loadCommon(hwpipe, pipeOpaque, f, false);
+}
+
+static void*
+_qemudPipe_loadBinary(void* hwpipe, void* pipeOpaque, const char* args, QEMUFile* f)
+{
+    return _qemudPipe_loadCommon(hwpipe, pipeOpaque, f, true);
+}
+
 /* QEMUD pipe functions.
  */
 static const GoldfishPipeFuncs _qemudPipe_funcs = {
@@ -2219,6 +2347,22 @@ static const GoldfishPipeFuncs _qemudPipe_funcs = {
     _qemudPipe_load,
 };
 
+/* Same as above, for the "qemud-bin" pipe. The only difference is that the
+ * frame headers of framed clients carry a 32-bit little-endian payload size
+ * instead of 4 hex chars. Guests that support it should try to open this
+ * pipe first, and fall back to "qemud" (or the serial port) on failure.
+ */
+static const GoldfishPipeFuncs _qemudPipeBin_funcs = {
+    _qemudPipe_initBinary,
+    _qemudPipe_closeFromGuest,
+    _qemudPipe_sendBuffers,
+    _qemudPipe_recvBuffers,
+    _qemudPipe_poll,
+    _qemudPipe_wakeOn,
+    _qemudPipe_save,
+    _qemudPipe_loadBinary,
+};
+
 /* Initializes QEMUD pipe interface.
  */
 static void
@@ -2227,7 +2371,9 @@ _android_qemud_pipe_init(void)
     static ABool _qemud_pipe_initialized = false;
 
     if (!_qemud_pipe_initialized) {
-        goldfish_pipe_add_type( "qemud", looper_newCore(), &_qemudPipe_funcs );
+        void* looper = looper_newCore();
+        goldfish_pipe_add_type( "qemud", looper, &_qemudPipe_funcs );
+        goldfish_pipe_add_type( "qemud-bin", looper, &_qemudPipeBin_funcs );
         _qemud_pipe_initialized = true;
     }
 }
@@ -106,6 +106,12 @@ extern void           qemud_client_set_framing( QemudClient*  client, int  enabl
  */
 extern void   qemud_client_send ( QemudClient*  client, const uint8_t*  msg, int  msglen );
 
+/* Send a message made of 'count' buffers to a given qemud client. This is
+ * equivalent to qemud_client_send() on the concatenation of the buffers, but
+ * avoids an intermediate copy for clients connected through a qemu pipe.
+ */
+extern void   qemud_client_sendv( QemudClient*  client, const struct iovec*  iov, int  count );
+
 /* Force-close the connection to a given qemud client.
  */
 extern void   qemud_client_close( QemudClient*  client );
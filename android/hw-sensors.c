@@ -162,10 +162,55 @@ typedef struct {
  *   was "taken" by this code. This is adjusted by the HAL module to
  *   emulated system time (using the first sync: to compute an adjustment
  *   offset).
+ *
+ * - a HAL module that supports it can send "set-format:binary" to switch
+ *   to the binary report format. This code replies with "format:binary"
+ *   (an older emulator will not reply at all). "set-format:text" goes
+ *   back to the text format described above.
+ *
+ *   In binary mode, each timer tick sends a single message containing
+ *   all enabled sensors, with the following fixed layout (all fields are
+ *   little-endian):
+ *
+ *      offset  size  description
+ *       0       4    magic, SENSORS_BINARY_MAGIC ("SNSB")
+ *       4       4    number of value slots (N), currently MAX_SENSORS
+ *       8       8    VM time in micro-seconds when the sample was taken
+ *      16       4    bitmask of the slots that hold valid values
+ *      20       4    reserved, 0
+ *      24    N*12    N slots of 3 IEEE-754 floats, indexed by sensor id
+ *
+ *   No "sync:" message is sent in this mode. Samples injected through
+ *   android_sensors_inject() are sent as soon as they are due, each in
+ *   its own record stamped with the sample's own time, and with only the
+ *   corresponding bit set in the mask.
+ *
+ *   The binary mode also lowers the minimum delay between reports from
+ *   SENSORS_TEXT_MIN_DELAY_MS to SENSORS_BINARY_MIN_DELAY_MS.
  */
 #define  HEADER_SIZE  4
 #define  BUFFER_SIZE  512
 
+#define  SENSORS_BINARY_MAGIC         0x42534e53  /* "SNSB" in little-endian */
+#define  SENSORS_BINARY_HEADER_SIZE   24
+#define  SENSORS_BINARY_RECORD_SIZE   (SENSORS_BINARY_HEADER_SIZE + MAX_SENSORS*12)
+
+#define  SENSORS_TEXT_MIN_DELAY_MS    20
+#define  SENSORS_BINARY_MIN_DELAY_MS  1
+
+/* Set in the enabledMask saved to snapshots when the client uses the
+ * binary format. Sensor ids never get that high. */
+#define  SENSORS_MASK_BINARY  (1U << 31)
+
+/* Maximum number of samples waiting in android_sensors_inject() queue. */
+#define  MAX_INJECTED_SAMPLES  256
+
+typedef struct {
+    int64_t  time_ns;
+    int      sensor_id;
+    float    a, b, c;
+} InjectedSample;
+
 typedef struct HwSensorClient   HwSensorClient;
 
 typedef struct {
@@ -173,6 +218,11 @@ typedef struct {
     Sensor              sensors[MAX_SENSORS];
     HwSensorClient*     clients;
     AndroidSensorsPort* sensors_port;
+    /* Queue of samples from android_sensors_inject(), in time order. */
+    InjectedSample      injected[MAX_INJECTED_SAMPLES];
+    int                 injected_head;
+    int                 injected_count;
+    QEMUTimer*          inject_timer;
 } HwSensors;
 
 struct HwSensorClient {
@@ -182,6 +232,8 @@ struct HwSensorClient {
     QEMUTimer*       timer;
     uint32_t         enabledMask;
     int32_t          delay_ms;
+    char             binary;
+    int64_t          deadline_ns;
 };
 
 static void
@@ -281,17 +333,58 @@ _hwSensorClient_enabled( HwSensorClient*  cl, int  sensorId )
     return (cl->enabledMask & (1 << sensorId)) != 0;
 }
 
-/* this function is called periodically to send sensor reports
- * to the HAL module, and re-arm the timer if necessary
- */
 static void
-_hwSensorClient_tick( void*  opaque )
+_sensors_put_le32( uint8_t*  p, uint32_t  v )
+{
+    p[0] = (uint8_t)v;
+    p[1] = (uint8_t)(v >> 8);
+    p[2] = (uint8_t)(v >> 16);
+    p[3] = (uint8_t)(v >> 24);
+}
+
+static void
+_sensors_put_float( uint8_t*  p, float  f )
+{
+    uint32_t  v;
+    memcpy(&v, &f, sizeof v);
+    _sensors_put_le32(p, v);
+}
+
+/* send one binary report record for the sensors in 'mask' */
+static void
+_hwSensorClient_sendRecord( HwSensorClient*  cl, uint32_t  mask, int64_t  time_ns )
+{
+    HwSensors*  hw = cl->sensors;
+    uint8_t     record[SENSORS_BINARY_RECORD_SIZE];
+    uint8_t*    p;
+    uint64_t    time_us = (uint64_t)(time_ns / 1000);
+    int         nn;
+
+    memset(record, 0, sizeof record);
+    _sensors_put_le32(record + 0, SENSORS_BINARY_MAGIC);
+    _sensors_put_le32(record + 4, MAX_SENSORS);
+    _sensors_put_le32(record + 8, (uint32_t)time_us);
+    _sensors_put_le32(record + 12, (uint32_t)(time_us >> 32));
+    _sensors_put_le32(record + 16, mask);
+
+    p = record + SENSORS_BINARY_HEADER_SIZE;
+    for (nn = 0; nn < MAX_SENSORS; nn++, p += 12) {
+        if (mask & (1U << nn)) {
+            const SensorValues*  v = &hw->sensors[nn].u.value;
+            _sensors_put_float(p + 0, v->a);
+            _sensors_put_float(p + 4, v->b);
+            _sensors_put_float(p + 8, v->c);
+        }
+    }
+    T("%s: mask=0x%x time_us=%" PRIu64, __FUNCTION__, mask, time_us);
+    qemud_client_send(cl->client, record, sizeof record);
+}
+
+/* send the text reports for all enabled sensors, followed by "sync:" */
+static void
+_hwSensorClient_sendText( HwSensorClient*  cl, int64_t  now_ns )
 {
-    HwSensorClient*  cl = opaque;
     HwSensors*       hw  = cl->sensors;
-    int64_t          delay = cl->delay_ms;
-    int64_t          now_ns;
-    uint32_t         mask  = cl->enabledMask;
     Sensor*          sensor;
     char             buffer[128];
 
@@ -337,22 +430,57 @@ _hwSensorClient_tick( void*  opaque )
         _hwSensorClient_send(cl, (uint8_t*) buffer, strlen(buffer));
     }
 
-    now_ns = qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL);
-
     snprintf(buffer, sizeof buffer, "sync:%" PRId64, now_ns/1000);
     _hwSensorClient_send(cl, (uint8_t*)buffer, strlen(buffer));
+}
+
+/* this function is called periodically to send sensor reports
+ * to the HAL module, and re-arm the timer if necessary
+ */
+static void
+_hwSensorClient_tick( void*  opaque )
+{
+    HwSensorClient*  cl = opaque;
+    int64_t          delay = cl->delay_ms;
+    int64_t          now_ns;
+    int64_t          next_ns;
+    uint32_t         mask  = cl->enabledMask;
+
+    now_ns = qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL);
+
+    if (cl->binary)
+        _hwSensorClient_sendRecord(cl, mask, now_ns);
+    else
+        _hwSensorClient_sendText(cl, now_ns);
 
-    /* rearm timer, use a minimum delay of 20 ms, just to
-     * be safe.
+    /* rearm timer, use a minimum delay of 20 ms (1 ms in binary
+     * mode), just to be safe.
      */
     if (mask == 0)
         return;
 
-    if (delay < 20)
-        delay = 20;
+    if (cl->binary) {
+        if (delay < SENSORS_BINARY_MIN_DELAY_MS)
+            delay = SENSORS_BINARY_MIN_DELAY_MS;
+    } else {
+        if (delay < SENSORS_TEXT_MIN_DELAY_MS)
+            delay = SENSORS_TEXT_MIN_DELAY_MS;
+    }
 
     delay *= 1000000LL;  /* convert to nanoseconds */
-    timer_mod(cl->timer, now_ns + delay);
+
+    /* In binary mode, arm from the previous deadline instead of 'now' so
+     * that the report period does not drift with timer latency. */
+    next_ns = now_ns + delay;
+    if (cl->binary && cl->deadline_ns != 0 &&
+        cl->deadline_ns + delay > now_ns) {
+        next_ns = cl->deadline_ns + delay;
+    }
+    cl->deadline_ns = next_ns;
+    /* let reports slip by up to 1/16th of the period so they can be
+     * batched with other timers */
+    timer_set_slack_ns(cl->timer, delay / 16);
+    timer_mod(cl->timer, next_ns);
 }
 
 /* handle incoming messages from the HAL module */
@@ -395,12 +523,32 @@ _hwSensorClient_receive( HwSensorClient*  cl, uint8_t*  msg, int  msglen )
      */
     if (msglen > 10 && !memcmp(msg, "set-delay:", 10)) {
         cl->delay_ms = atoi((const char*)msg+10);
+        cl->deadline_ns = 0;
         if (cl->enabledMask != 0)
             _hwSensorClient_tick(cl);
 
         return;
     }
 
+    /* "set-format:<format>" selects the report format, <format> must be
+     * either "text" or "binary".
+     */
+    if (msglen > 11 && !memcmp(msg, "set-format:", 11)) {
+        if (msglen == 17 && !memcmp(msg + 11, "binary", 6)) {
+            cl->binary = 1;
+            _hwSensorClient_send(cl, (const uint8_t*)"format:binary", 13);
+        } else if (msglen == 15 && !memcmp(msg + 11, "text", 4)) {
+            cl->binary = 0;
+            _hwSensorClient_send(cl, (const uint8_t*)"format:text", 11);
+        } else {
+            D("%s: ignore unknown format '%.*s'", __FUNCTION__,
+              msglen - 11, msg + 11);
+            return;
+        }
+        cl->deadline_ns = 0;
+        return;
+    }
+
     /* "set:<name>:<state>" is used to enable/disable a given
      * sensor. <state> must be 0 or 1
      */
@@ -446,6 +594,7 @@ _hwSensorClient_receive( HwSensorClient*  cl, uint8_t*  msg, int  msglen )
             }
         }
 
+        cl->deadline_ns = 0;
         _hwSensorClient_tick(cl);
         return;
     }
@@ -460,7 +609,7 @@ _hwSensorClient_save( QEMUFile*  f, QemudClient*  client, void*  opaque  )
     HwSensorClient* sc = opaque;
 
     qemu_put_be32(f, sc->delay_ms);
-    qemu_put_be32(f, sc->enabledMask);
+    qemu_put_be32(f, sc->enabledMask | (sc->binary ? SENSORS_MASK_BINARY : 0));
     timer_put(f, sc->timer);
 }
 
@@ -472,6 +621,9 @@ _hwSensorClient_load( QEMUFile*  f, QemudClient*  client, void*  opaque  )
 
     sc->delay_ms = qemu_get_be32(f);
     sc->enabledMask = qemu_get_be32(f);
+    sc->binary = (sc->enabledMask & SENSORS_MASK_BINARY) != 0;
+    sc->enabledMask &= ~SENSORS_MASK_BINARY;
+    sc->deadline_ns = 0;
     timer_get(f, sc->timer);
 
     return 0;
@@ -507,6 +659,54 @@ _hwSensors_setSensorValue( HwSensors*  h, int sensor_id, float a, float b, float
     s->u.value.c = c;
 }
 
+/* apply all injected samples that are due, and re-arm the injection
+ * timer for the next one, if any */
+static void
+_hwSensors_injectTick( void*  opaque )
+{
+    HwSensors*  h = opaque;
+    int64_t     now_ns = qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL);
+
+    while (h->injected_count > 0) {
+        InjectedSample*  sample = &h->injected[h->injected_head];
+        HwSensorClient*  cl;
+
+        if (sample->time_ns > now_ns) {
+            timer_mod(h->inject_timer, sample->time_ns);
+            break;
+        }
+
+        _hwSensors_setSensorValue(h, sample->sensor_id,
+                                  sample->a, sample->b, sample->c);
+
+        for (cl = h->clients; cl != NULL; cl = cl->next) {
+            if (cl->binary && _hwSensorClient_enabled(cl, sample->sensor_id))
+                _hwSensorClient_sendRecord(cl, 1U << sample->sensor_id,
+                                           sample->time_ns);
+        }
+
+        h->injected_head = (h->injected_head + 1) % MAX_INJECTED_SAMPLES;
+        h->injected_count--;
+    }
+}
+
+/* the injection queue is not saved in snapshots: apply all pending
+ * samples at once, so that the saved values are the latest ones */
+static void
+_hwSensors_flushInjected( HwSensors*  h )
+{
+    while (h->injected_count > 0) {
+        InjectedSample*  sample = &h->injected[h->injected_head];
+
+        _hwSensors_setSensorValue(h, sample->sensor_id,
+                                  sample->a, sample->b, sample->c);
+        h->injected_head = (h->injected_head + 1) % MAX_INJECTED_SAMPLES;
+        h->injected_count--;
+    }
+    if (h->inject_timer != NULL)
+        timer_del(h->inject_timer);
+}
+
 /* Saves available sensors to allow checking availability when loaded.
  */
 static void
@@ -514,6 +714,8 @@ _hwSensors_save( QEMUFile*  f, QemudService*  sv, void*  opaque)
 {
     HwSensors* h = opaque;
 
+    _hwSensors_flushInjected(h);
+
     // number of sensors
     qemu_put_be32(f, MAX_SENSORS);
     AndroidSensor i;
@@ -809,6 +1011,56 @@ android_sensors_set( int sensor_id, float a, float b, float c )
     return SENSOR_STATUS_OK;
 }
 
+/* Queue a timestamped sensor sample */
+extern int
+android_sensors_inject( int sensor_id, int64_t delay_us, float a, float b, float c )
+{
+    HwSensors*       hw = _sensorsState;
+    InjectedSample*  sample;
+    int64_t          time_ns;
+
+    if (sensor_id < 0 || sensor_id >= MAX_SENSORS)
+        return SENSOR_STATUS_UNKNOWN;
+
+    if (hw->service != NULL) {
+        if (! hw->sensors[sensor_id].enabled)
+            return SENSOR_STATUS_DISABLED;
+    } else
+        return SENSOR_STATUS_NO_SERVICE;
+
+    if (hw->injected_count >= MAX_INJECTED_SAMPLES)
+        return SENSOR_STATUS_QUEUE_FULL;
+
+    if (hw->inject_timer == NULL) {
+        hw->inject_timer = timer_new(QEMU_CLOCK_VIRTUAL, SCALE_NS,
+                                     _hwSensors_injectTick, hw);
+    }
+
+    if (delay_us < 0)
+        delay_us = 0;
+    time_ns = qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL) + delay_us * 1000;
+
+    /* Keep the queue in time order. */
+    if (hw->injected_count > 0) {
+        int  last = (hw->injected_head + hw->injected_count - 1) % MAX_INJECTED_SAMPLES;
+        if (time_ns < hw->injected[last].time_ns)
+            time_ns = hw->injected[last].time_ns;
+    }
+
+    sample = &hw->injected[(hw->injected_head + hw->injected_count) % MAX_INJECTED_SAMPLES];
+    sample->time_ns   = time_ns;
+    sample->sensor_id = sensor_id;
+    sample->a         = a;
+    sample->b         = b;
+    sample->c         = c;
+    hw->injected_count++;
+
+    if (hw->injected_count == 1)
+        timer_mod(hw->inject_timer, time_ns);
+
+    return SENSOR_STATUS_OK;
+}
+
 /* Get Sensor from sensor id */
 extern uint8_t
 android_sensors_get_sensor_status( int sensor_id )
@@ -27,8 +27,10 @@ extern void android_hw_sensors_init_remote_controller( void );
  *       SENSOR_STATUS_DISABLED: sensor is disabled.
  *       SENSOR_STATUS_UNKNOWN: wrong sensor name.
  *       SENSOR_STATUS_OK: Everything is OK to the current sensor.
+ *       SENSOR_STATUS_QUEUE_FULL: too many injected samples are pending.
  * */
 typedef enum{
+    SENSOR_STATUS_QUEUE_FULL = -4,
     SENSOR_STATUS_NO_SERVICE = -3,
     SENSOR_STATUS_DISABLED   = -2,
     SENSOR_STATUS_UNKNOWN    = -1,
@@ -73,6 +75,15 @@ extern int android_sensors_get( int sensor_id, float* a, float* b, float* c );
 /* set sensor values */
 extern int android_sensors_set( int sensor_id, float a, float b, float c );
 
+/* queue sensor values to be applied 'delay_us' micro-seconds of VM time
+ * from now. Samples are applied in time order; a sample that would come
+ * before the last queued one is delayed to the same time. Clients using
+ * the binary protocol receive one report per applied sample, stamped with
+ * the sample's time. Pending samples are not saved in snapshots, saving
+ * applies them all at once. */
+extern int android_sensors_inject( int sensor_id, int64_t delay_us,
+                                   float a, float b, float c );
+
 /* Get sensor id from sensor name */
 extern int android_sensors_get_id_from_name( char* sensorname );
 
@@ -10,38 +10,116 @@
 ** GNU General Public License for more details.
 */
 #include "android/tcpdump.h"
+#include "qemu/atomic.h"
+#include "qemu/thread.h"
+#include "qemu/timer.h"
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <sys/time.h>
 
+/* Packets are not written to the capture file from the network path.
+ * qemu_tcpdump_packet() only copies them, with a monotonic timestamp,
+ * into a single-producer/single-consumer ring. A writer thread drains
+ * the ring, formats the records and writes them out in large blocks.
+ * When the ring is full, packets are dropped and counted rather than
+ * stalling the network.
+ */
+
 int  qemu_tcpdump_active;
 
-static FILE*     capture_file;
+#define  CAPTURE_RING_SIZE     (4 * 1024 * 1024)  /* must be a power of 2 */
+#define  CAPTURE_ALIGN         32
+#define  CAPTURE_OUTBUF_SIZE   (256 * 1024)
+/* wake up the writer when the ring is that full, otherwise it polls */
+#define  CAPTURE_KICK_LEVEL    (CAPTURE_RING_SIZE / 4)
+#define  CAPTURE_POLL_MS       50
+
+#define  CAPTURE_PAD           0xffffffff  /* 'direction' of filler records */
+
+/* record header in the ring, followed by 'incl_len' packet bytes */
+typedef struct {
+    uint32_t  size;       /* whole record, multiple of CAPTURE_ALIGN */
+    uint32_t  direction;
+    uint32_t  incl_len;
+    uint32_t  orig_len;
+    int64_t   ts;         /* get_clock() nanoseconds */
+    uint8_t   pad[8];
+} CaptureRecord;
+
+typedef struct {
+    FILE*          file;
+    int            pcapng;
+    uint32_t       snaplen;
+    /* ring indices are free-running, 'head' is only written by the
+     * producer and 'tail' by the writer thread */
+    uint8_t*       ring;
+    uint32_t       head;
+    uint32_t       tail;
+    int            kicked;
+    int            quit;
+    QemuThread     thread;
+    QemuSemaphore  wake;
+    /* wall-clock time matching 'mono_base', in nanoseconds */
+    int64_t        wall_base;
+    int64_t        mono_base;
+    /* writer thread output buffer */
+    uint8_t*       out;
+    int            out_len;
+} Capture;
+
+static Capture   capture[1];
+static uint32_t  capture_snaplen = QEMU_TCPDUMP_SNAPLEN;
 static uint64_t  capture_count;
 static uint64_t  capture_size;
+static uint64_t  capture_dropped;
 static int       capture_init;
 
 static void
 capture_atexit(void)
 {
-    if (qemu_tcpdump_active) {
-        fclose(capture_file);
-        qemu_tcpdump_active = 0;
-    }
+    qemu_tcpdump_stop();
 }
 
-/* See http://wiki.wireshark.org/Development/LibpcapFileFormat for
- * the complete description of the packet capture file format
+/* See http://wiki.wireshark.org/Development/LibpcapFileFormat and
+ * http://www.winpcap.org/ntar/draft/PCAP-DumpFileFormat.html for
+ * the complete description of the packet capture file formats
  */
 
 #define  PCAP_MAGIC     0xa1b2c3d4
 #define  PCAP_MAJOR     2
 #define  PCAP_MINOR     4
-#define  PCAP_SNAPLEN   65535
 #define  PCAP_ETHERNET  1
 
+#define  PCAPNG_SHB          0x0a0d0d0a
+#define  PCAPNG_IDB          0x00000001
+#define  PCAPNG_EPB          0x00000006
+#define  PCAPNG_BYTE_ORDER   0x1a2b3c4d
+#define  PCAPNG_OPT_END      0
+#define  PCAPNG_IF_NAME      2
+#define  PCAPNG_IF_TSRESOL   9
+#define  PCAPNG_EPB_FLAGS    2
+#define  PCAPNG_INBOUND      1
+#define  PCAPNG_OUTBOUND     2
+
+#define  PCAPNG_IF_NAME_STR  "slirp"
+
+static uint8_t*
+put_u16( uint8_t*  p, uint16_t  v )
+{
+    memcpy(p, &v, sizeof(v));
+    return p + sizeof(v);
+}
+
+static uint8_t*
+put_u32( uint8_t*  p, uint32_t  v )
+{
+    memcpy(p, &v, sizeof(v));
+    return p + sizeof(v);
+}
+
 static int
-pcap_write_header( FILE*  out )
+pcap_write_header( Capture*  c )
 {
     typedef struct {
         uint32_t   magic;
@@ -60,18 +138,169 @@ pcap_write_header( FILE*  out )
     h.version_minor = PCAP_MINOR;
     h.this_zone     = 0;
     h.sigfigs       = 0;  /* all tools set it to 0 in practice */
-    h.snaplen       = PCAP_SNAPLEN;
+    h.snaplen       = c->snaplen;
     h.network       = PCAP_ETHERNET;
 
-    if (fwrite(&h, sizeof(h), 1, out) != 1) {
+    if (fwrite(&h, sizeof(h), 1, c->file) != 1) {
         return -1;
     }
     return 0;
 }
 
+/* Write a section header and the description of our single interface,
+ * with nanosecond timestamps. */
+static int
+pcapng_write_header( Capture*  c )
+{
+    uint8_t   buf[128];
+    uint8_t*  p = buf;
+    uint8_t*  block;
+    int       name_len = sizeof(PCAPNG_IF_NAME_STR) - 1;
+
+    /* section header block */
+    p = put_u32(p, PCAPNG_SHB);
+    p = put_u32(p, 28);
+    p = put_u32(p, PCAPNG_BYTE_ORDER);
+    p = put_u16(p, 1);                  /* major version */
+    p = put_u16(p, 0);                  /* minor version */
+    p = put_u32(p, 0xffffffff);         /* section length: unknown */
+    p = put_u32(p, 0xffffffff);
+    p = put_u32(p, 28);
+
+    /* interface description block */
+    block = p;
+    p = put_u32(p, PCAPNG_IDB);
+    p = put_u32(p, 0);                  /* patched below */
+    p = put_u16(p, PCAP_ETHERNET);
+    p = put_u16(p, 0);
+    p = put_u32(p, c->snaplen);
+    p = put_u16(p, PCAPNG_IF_NAME);
+    p = put_u16(p, name_len);
+    memset(p, 0, (name_len + 3) & ~3);
+    memcpy(p, PCAPNG_IF_NAME_STR, name_len);
+    p += (name_len + 3) & ~3;
+    p = put_u16(p, PCAPNG_IF_TSRESOL);
+    p = put_u16(p, 1);
+    p = put_u32(p, 9);                  /* 10^-9, padded */
+    p = put_u16(p, PCAPNG_OPT_END);
+    p = put_u16(p, 0);
+    p = put_u32(p, (uint32_t)(p - block) + 4);
+    put_u32(block + 4, (uint32_t)(p - block));
+
+    if (fwrite(buf, p - buf, 1, c->file) != 1) {
+        return -1;
+    }
+    return 0;
+}
+
+/* Writer thread: append one ring record to the output buffer. */
+static void
+capture_format( Capture*  c, const CaptureRecord*  r )
+{
+    const uint8_t*  data = (const uint8_t*)(r + 1);
+    int64_t         ts   = c->wall_base + (r->ts - c->mono_base);
+    uint8_t*        p;
+    int             need;
+
+    if (c->pcapng) {
+        need = 28 + ((r->incl_len + 3) & ~3) + 12 + 4;
+    } else {
+        need = 16 + r->incl_len;
+    }
+    if (c->out_len + need > CAPTURE_OUTBUF_SIZE) {
+        fwrite(c->out, 1, c->out_len, c->file);
+        c->out_len = 0;
+    }
+    p = c->out + c->out_len;
+
+    if (c->pcapng) {
+        uint32_t  pad = ((r->incl_len + 3) & ~3) - r->incl_len;
+
+        p = put_u32(p, PCAPNG_EPB);
+        p = put_u32(p, need);
+        p = put_u32(p, 0);              /* interface id */
+        p = put_u32(p, (uint32_t)((uint64_t)ts >> 32));
+        p = put_u32(p, (uint32_t)ts);
+        p = put_u32(p, r->incl_len);
+        p = put_u32(p, r->orig_len);
+        memcpy(p, data, r->incl_len);
+        p += r->incl_len;
+        memset(p, 0, pad);
+        p += pad;
+        p = put_u16(p, PCAPNG_EPB_FLAGS);
+        p = put_u16(p, 4);
+        p = put_u32(p, r->direction == QEMU_TCPDUMP_IN ? PCAPNG_INBOUND
+                                                       : PCAPNG_OUTBOUND);
+        p = put_u16(p, PCAPNG_OPT_END);
+        p = put_u16(p, 0);
+        p = put_u32(p, need);
+    } else {
+        p = put_u32(p, (uint32_t)(ts / 1000000000));
+        p = put_u32(p, (uint32_t)(ts % 1000000000) / 1000);
+        p = put_u32(p, r->incl_len);
+        p = put_u32(p, r->orig_len);
+        memcpy(p, data, r->incl_len);
+    }
+    c->out_len += need;
+}
+
+static void*
+capture_thread( void*  opaque )
+{
+    Capture*  c = opaque;
+
+    for (;;) {
+        int       quit = atomic_read(&c->quit);
+        uint32_t  head, tail = c->tail;
+
+        smp_rmb();
+        head = atomic_read(&c->head);
+        smp_rmb();
+        while (tail != head) {
+            const CaptureRecord*  r = (const CaptureRecord*)
+                    (c->ring + (tail & (CAPTURE_RING_SIZE - 1)));
+
+            if (r->direction != CAPTURE_PAD)
+                capture_format(c, r);
+            tail += r->size;
+        }
+        smp_mb();
+        atomic_set(&c->tail, tail);
+        atomic_set(&c->kicked, 0);
+
+        if (quit)
+            break;
+
+        /* keep filling the output buffer while packets keep coming,
+         * write it out as soon as the network goes idle */
+        if (qemu_sem_timedwait(&c->wake, CAPTURE_POLL_MS) < 0 &&
+            c->out_len > 0) {
+            fwrite(c->out, 1, c->out_len, c->file);
+            fflush(c->file);
+            c->out_len = 0;
+        }
+    }
+
+    fwrite(c->out, 1, c->out_len, c->file);
+    c->out_len = 0;
+    return NULL;
+}
+
+void
+qemu_tcpdump_set_snaplen( int  snaplen )
+{
+    if (snaplen <= 0 || snaplen > QEMU_TCPDUMP_SNAPLEN)
+        snaplen = QEMU_TCPDUMP_SNAPLEN;
+    capture_snaplen = snaplen;
+}
+
 int
 qemu_tcpdump_start( const char*  filepath )
 {
+    Capture*     c = capture;
+    const char*  ext;
+    int          ret;
+
     if (!capture_init) {
         capture_init = 1;
         atexit(capture_atexit);
@@ -82,12 +311,37 @@ qemu_tcpdump_start( const char*  filepath )
     if (filepath == NULL)
         return -1;
 
-    capture_file = fopen(filepath, "wb");
-    if (capture_file == NULL)
+    c->file = fopen(filepath, "wb");
+    if (c->file == NULL)
         return -1;
 
-    if (pcap_write_header(capture_file) < 0)
+    ext = strrchr(filepath, '.');
+    c->pcapng  = (ext != NULL && !strcmp(ext, ".pcapng"));
+    c->snaplen = capture_snaplen;
+
+    ret = c->pcapng ? pcapng_write_header(c) : pcap_write_header(c);
+    if (ret < 0) {
+        fclose(c->file);
+        c->file = NULL;
         return -1;
+    }
+    fflush(c->file);
+
+    c->ring      = malloc(CAPTURE_RING_SIZE);
+    c->out       = malloc(CAPTURE_OUTBUF_SIZE);
+    c->out_len   = 0;
+    c->head      = c->tail = 0;
+    c->kicked    = 0;
+    c->quit      = 0;
+    c->mono_base = get_clock();
+    c->wall_base = get_clock_realtime();
+
+    capture_count   = 0;
+    capture_size    = 0;
+    capture_dropped = 0;
+
+    qemu_sem_init(&c->wake, 0);
+    qemu_thread_create(&c->thread, capture_thread, c, QEMU_THREAD_JOINABLE);
 
     qemu_tcpdump_active = 1;
     return 0;
@@ -96,52 +350,82 @@ qemu_tcpdump_start( const char*  filepath )
 void
 qemu_tcpdump_stop( void )
 {
+    Capture*  c = capture;
+
     if (!qemu_tcpdump_active)
         return;
 
     qemu_tcpdump_active = 0;
 
-    capture_count = 0;
-    capture_size  = 0;
+    atomic_set(&c->quit, 1);
+    qemu_sem_post(&c->wake);
+    qemu_thread_join(&c->thread);
+    qemu_sem_destroy(&c->wake);
 
-    fclose(capture_file);
-    capture_file = NULL;
+    fclose(c->file);
+    c->file = NULL;
+    free(c->ring);
+    c->ring = NULL;
+    free(c->out);
+    c->out = NULL;
 }
 
 void
-qemu_tcpdump_packet( const void*  base, int  len )
+qemu_tcpdump_packet( const void*  base, int  len, int  direction )
 {
-    typedef struct {
-        uint32_t  ts_sec;
-        uint32_t  ts_usec;
-        uint32_t  incl_len;
-        uint32_t  orig_len;
-    } PacketHeader;
+    Capture*        c    = capture;
+    uint32_t        len2 = len;
+    uint32_t        head = c->head;
+    uint32_t        used, need, offset, room;
+    CaptureRecord*  r;
+
+    if (len2 > c->snaplen)
+        len2 = c->snaplen;
 
-    PacketHeader    h;
-    struct timeval  now;
-    int             len2 = len;
+    need   = (sizeof(*r) + len2 + CAPTURE_ALIGN - 1) & ~(CAPTURE_ALIGN - 1);
+    offset = head & (CAPTURE_RING_SIZE - 1);
+    room   = CAPTURE_RING_SIZE - offset;
+    used   = head - atomic_read(&c->tail);
+    smp_mb();
+
+    /* records are contiguous, skip the end of the ring if needed */
+    if (CAPTURE_RING_SIZE - used < need + (room < need ? room : 0)) {
+        capture_dropped += 1;
+        return;
+    }
+    if (room < need) {
+        r = (CaptureRecord*)(c->ring + offset);
+        r->size      = room;
+        r->direction = CAPTURE_PAD;
+        head   += room;
+        used   += room;
+        offset  = 0;
+    }
 
-    if (len2 > PCAP_SNAPLEN)
-        len2 = PCAP_SNAPLEN;
+    r = (CaptureRecord*)(c->ring + offset);
+    r->size      = need;
+    r->direction = direction;
+    r->incl_len  = len2;
+    r->orig_len  = (uint32_t) len;
+    r->ts        = get_clock();
+    memcpy(r + 1, base, len2);
 
-    gettimeofday(&now, NULL);
-    h.ts_sec   = (uint32_t) now.tv_sec;
-    h.ts_usec  = (uint32_t) now.tv_usec;
-    h.incl_len = (uint32_t) len2;
-    h.orig_len = (uint32_t) len;
+    smp_wmb();
+    atomic_set(&c->head, head + need);
 
-    fwrite( &h, sizeof(h), 1, capture_file );
-    fwrite( base, 1, len2, capture_file );
+    if (used + need >= CAPTURE_KICK_LEVEL && !atomic_read(&c->kicked)) {
+        atomic_set(&c->kicked, 1);
+        qemu_sem_post(&c->wake);
+    }
 
     capture_count += 1;
     capture_size  += len2;
 }
 
 void
-qemu_tcpdump_stats( uint64_t  *pcount, uint64_t*  psize )
+qemu_tcpdump_stats( uint64_t  *pcount, uint64_t*  psize, uint64_t*  pdropped )
 {
-    *pcount = capture_count;
-    *psize  = capture_size;
+    *pcount   = capture_count;
+    *psize    = capture_size;
+    *pdropped = capture_dropped;
 }
-
@@ -0,0 +1,317 @@
+// Copyright 2014 The Android Open Source Project
+//
+// This software is licensed under the terms of the GNU General Public
+// License version 2, as published by the Free Software Foundation, and
+// may be copied, distributed, and modified under those terms.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+#include "android/base/testing/TestTempDir.h"
+#include "android/base/testing/TestThread.h"
+
+#include <gtest/gtest.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include <vector>
+
+extern "C" {
+#include "android/tcpdump.h"
+}
+
+// These tests run the capture writer thread for real. The overflow test
+// captures into a FIFO that nobody reads at first, so that the writer
+// blocks in fwrite() and the ring fills up, then drains the FIFO and
+// keeps going until the ring has wrapped around.
+
+namespace {
+
+using android::base::String;
+using android::base::TestTempDir;
+using android::base::TestThread;
+
+// Same values as CAPTURE_RING_SIZE and CAPTURE_ALIGN in qemu-tcpdump.c.
+const uint32_t kRingSize = 4 * 1024 * 1024;
+const uint32_t kRecordHeader = 32;
+const uint32_t kRecordAlign = 32;
+
+const uint32_t kPcapMagic = 0xa1b2c3d4;
+const uint32_t kPcapngShb = 0x0a0d0d0a;
+const uint32_t kPcapngIdb = 0x00000001;
+const uint32_t kPcapngEpb = 0x00000006;
+const uint32_t kPcapngByteOrder = 0x1a2b3c4d;
+const uint32_t kPcapngInbound = 1;
+const uint32_t kPcapngOutbound = 2;
+
+uint32_t recordSize(uint32_t len) {
+    return (kRecordHeader + len + kRecordAlign - 1) & ~(kRecordAlign - 1);
+}
+
+// Packet |seq| carries its sequence number in its first 4 bytes, and an
+// odd length every other time so that pcapng has to pad it.
+int packetLength(uint32_t seq) {
+    return 60 + (seq * 37) % 1400;
+}
+
+int packetDirection(uint32_t seq) {
+    return (seq & 1) ? QEMU_TCPDUMP_OUT : QEMU_TCPDUMP_IN;
+}
+
+void sendPacket(uint32_t seq) {
+    uint8_t packet[1500];
+    int len = packetLength(seq);
+    memset(packet, (uint8_t)seq, len);
+    memcpy(packet, &seq, sizeof(seq));
+    qemu_tcpdump_packet(packet, len, packetDirection(seq));
+}
+
+uint32_t get32(const std::vector<uint8_t>& data, size_t pos) {
+    uint32_t v;
+    memcpy(&v, &data[pos], sizeof(v));
+    return v;
+}
+
+uint16_t get16(const std::vector<uint8_t>& data, size_t pos) {
+    uint16_t v;
+    memcpy(&v, &data[pos], sizeof(v));
+    return v;
+}
+
+bool readFile(const char* path, std::vector<uint8_t>* data) {
+    FILE* f = fopen(path, "rb");
+    if (!f) {
+        return false;
+    }
+    uint8_t buf[4096];
+    size_t n;
+    while ((n = fread(buf, 1, sizeof(buf), f)) > 0) {
+        data->insert(data->end(), buf, buf + n);
+    }
+    fclose(f);
+    return true;
+}
+
+struct FifoReader {
+    int fd;
+    std::vector<uint8_t> data;
+
+    static void* run(void* opaque) {
+        FifoReader* r = static_cast<FifoReader*>(opaque);
+        std::vector<uint8_t> buf(65536);
+        for (;;) {
+            ssize_t n = read(r->fd, &buf[0], buf.size());
+            if (n < 0 && errno == EINTR) {
+                continue;
+            }
+            if (n <= 0) {
+                break;
+            }
+            r->data.insert(r->data.end(), &buf[0], &buf[0] + n);
+        }
+        return NULL;
+    }
+};
+
+// What parsePcapng() found in a capture.
+struct Parsed {
+    uint64_t packets;
+    uint64_t bytes;
+    uint32_t lastSeq;
+};
+
+// Walks every block of a pcapng capture of packets sent by sendPacket(),
+// which must come out in order, with their contents, lengths, timestamps
+// and direction flags intact. Stops at the first failure.
+void parsePcapng(const std::vector<uint8_t>& data, Parsed* out) {
+    out->packets = 0;
+    out->bytes = 0;
+    out->lastSeq = 0;
+
+    ASSERT_GE(data.size(), 28U);
+    ASSERT_EQ(kPcapngShb, get32(data, 0));
+    ASSERT_EQ(28U, get32(data, 4));
+    ASSERT_EQ(kPcapngByteOrder, get32(data, 8));
+    ASSERT_EQ(28U, get32(data, 24));
+
+    size_t pos = 28;
+    ASSERT_GE(data.size(), pos + 20);
+    ASSERT_EQ(kPcapngIdb, get32(data, pos));
+    uint32_t idbLen = get32(data, pos + 4);
+    ASSERT_EQ(0U, idbLen % 4);
+    ASSERT_GE(data.size(), pos + idbLen);
+    ASSERT_EQ(1U, get16(data, pos + 8));   // LINKTYPE_ETHERNET
+    ASSERT_EQ((uint32_t)QEMU_TCPDUMP_SNAPLEN, get32(data, pos + 12));
+    ASSERT_EQ(idbLen, get32(data, pos + idbLen - 4));
+    bool nanoseconds = false;
+    for (size_t opt = pos + 16; opt + 4 <= pos + idbLen - 4; ) {
+        uint16_t code = get16(data, opt);
+        uint16_t len = get16(data, opt + 2);
+        if (code == 0) {
+            break;
+        }
+        if (code == 9) {   // if_tsresol
+            ASSERT_EQ(1U, len);
+            nanoseconds = (data[opt + 4] == 9);
+        }
+        opt += 4 + ((len + 3) & ~3);
+    }
+    ASSERT_TRUE(nanoseconds);
+    pos += idbLen;
+
+    bool first = true;
+    uint64_t lastTs = 0;
+    while (pos < data.size()) {
+        ASSERT_GE(data.size(), pos + 28);
+        ASSERT_EQ(kPcapngEpb, get32(data, pos));
+        uint32_t blockLen = get32(data, pos + 4);
+        ASSERT_GE(data.size(), pos + blockLen);
+        ASSERT_EQ(blockLen, get32(data, pos + blockLen - 4));
+        ASSERT_EQ(0U, get32(data, pos + 8));
+
+        uint64_t ts = ((uint64_t)get32(data, pos + 12) << 32) |
+                      get32(data, pos + 16);
+        uint32_t inclLen = get32(data, pos + 20);
+        uint32_t origLen = get32(data, pos + 24);
+        ASSERT_EQ(inclLen, origLen);
+        ASSERT_GE(inclLen, 4U);
+
+        uint32_t seq = get32(data, pos + 28);
+        if (!first) {
+            ASSERT_GT(seq, out->lastSeq);
+            ASSERT_GE(ts, lastTs);
+        }
+        ASSERT_EQ((uint32_t)packetLength(seq), inclLen);
+        ASSERT_EQ((uint8_t)seq, data[pos + 28 + inclLen - 1]);
+
+        size_t opt = pos + 28 + ((inclLen + 3) & ~3);
+        ASSERT_EQ(opt + 12 + 4, pos + blockLen);
+        ASSERT_EQ(2U, get16(data, opt));       // epb_flags
+        ASSERT_EQ(4U, get16(data, opt + 2));
+        ASSERT_EQ(packetDirection(seq) == QEMU_TCPDUMP_IN ? kPcapngInbound
+                                                          : kPcapngOutbound,
+                  get32(data, opt + 4) & 3);
+        ASSERT_EQ(0U, get32(data, opt + 8));  // opt_endofopt
+
+        out->packets += 1;
+        out->bytes += inclLen;
+        out->lastSeq = seq;
+        lastTs = ts;
+        first = false;
+        pos += blockLen;
+    }
+}
+
+}  // namespace
+
+TEST(QemuTcpdump, PcapRecords) {
+    TestTempDir dir("tcpdump_test");
+    String path = dir.makeSubPath("capture.pcap");
+
+    qemu_tcpdump_set_snaplen(100);
+    ASSERT_EQ(0, qemu_tcpdump_start(path.c_str()));
+    EXPECT_TRUE(qemu_tcpdump_active);
+    for (uint32_t seq = 0; seq < 10; seq++) {
+        sendPacket(seq);
+    }
+    uint64_t count, size, dropped;
+    qemu_tcpdump_stats(&count, &size, &dropped);
+    qemu_tcpdump_stop();
+    qemu_tcpdump_set_snaplen(0);
+    EXPECT_FALSE(qemu_tcpdump_active);
+
+    EXPECT_EQ(10U, count);
+    EXPECT_EQ(0U, dropped);
+
+    std::vector<uint8_t> data;
+    ASSERT_TRUE(readFile(path.c_str(), &data));
+    ASSERT_GE(data.size(), 24U);
+    EXPECT_EQ(kPcapMagic, get32(data, 0));
+    EXPECT_EQ(100U, get32(data, 16));
+    EXPECT_EQ(1U, get32(data, 20));
+
+    size_t pos = 24;
+    uint64_t bytes = 0;
+    for (uint32_t seq = 0; seq < 10; seq++) {
+        ASSERT_GE(data.size(), pos + 16);
+        uint32_t inclLen = get32(data, pos + 8);
+        uint32_t origLen = get32(data, pos + 12);
+        uint32_t len = packetLength(seq);
+        EXPECT_EQ(len, origLen);
+        EXPECT_EQ(len < 100 ? len : 100, inclLen);
+        ASSERT_GE(data.size(), pos + 16 + inclLen);
+        EXPECT_EQ(seq, get32(data, pos + 16));
+        bytes += inclLen;
+        pos += 16 + inclLen;
+    }
+    EXPECT_EQ(data.size(), pos);
+    EXPECT_EQ(bytes, size);
+}
+
+TEST(QemuTcpdump, RingOverflowAndWraparound) {
+    TestTempDir dir("tcpdump_test");
+    String path = dir.makeSubPath("capture.pcapng");
+    ASSERT_EQ(0, mkfifo(path.c_str(), 0600));
+
+    // Open the read side first so that the writer can open the FIFO,
+    // but do not read anything yet.
+    FifoReader reader;
+    reader.fd = open(path.c_str(), O_RDONLY | O_NONBLOCK);
+    ASSERT_GE(reader.fd, 0);
+    ASSERT_EQ(0, qemu_tcpdump_start(path.c_str()));
+    fcntl(reader.fd, F_SETFL, fcntl(reader.fd, F_GETFL) & ~O_NONBLOCK);
+
+    // Send much more than the ring, the writer's output buffer and the
+    // FIFO can hold together.
+    const uint32_t kBurst = 40000;
+    uint32_t seq = 0;
+    for (; seq < kBurst; seq++) {
+        sendPacket(seq);
+    }
+    uint64_t count, size, dropped;
+    qemu_tcpdump_stats(&count, &size, &dropped);
+    EXPECT_GT(dropped, 0U);
+    EXPECT_EQ(kBurst, count + dropped);
+    EXPECT_LT(count * recordSize(60), 2ULL * kRingSize);
+
+    // Let the writer go, and keep sending until more than a whole ring
+    // has gone through, backing off whenever the ring is full.
+    TestThread thread(&FifoReader::run, &reader);
+    uint64_t ringBytes = 0;
+    uint64_t lastDropped = dropped;
+    while (ringBytes <= 2ULL * kRingSize && seq < 50 * kBurst) {
+        sendPacket(seq);
+        qemu_tcpdump_stats(&count, &size, &dropped);
+        if (dropped != lastDropped) {
+            lastDropped = dropped;
+            usleep(1000);
+        } else {
+            ringBytes += recordSize(packetLength(seq));
+        }
+        seq++;
+    }
+    EXPECT_GT(ringBytes, 2ULL * kRingSize);
+
+    qemu_tcpdump_stats(&count, &size, &dropped);
+    qemu_tcpdump_stop();
+    thread.join();
+    close(reader.fd);
+
+    EXPECT_EQ(seq, count + dropped);
+
+    Parsed parsed;
+    parsePcapng(reader.data, &parsed);
+    ASSERT_FALSE(HasFatalFailure());
+    EXPECT_EQ(count, parsed.packets);
+    EXPECT_EQ(size, parsed.bytes);
+    EXPECT_EQ(seq - 1, parsed.lastSeq);
+}
@@ -15,7 +15,6 @@
 #include <stdlib.h>
 
 #define  SHAPER_CLOCK        QEMU_CLOCK_REALTIME
-#define  SHAPER_CLOCK_UNIT   1000.
 
 static int
 _packet_is_internal( const uint8_t*  data, size_t  size )
@@ -39,18 +38,27 @@ _packet_is_internal( const uint8_t*  data, size_t  size )
 }
 
 /* here's how we implement network shaping. we want to limit the network
- * rate to a given constant MAX_RATE expressed as bits/second. this means
- * that it takes 1/MAX_RATE seconds to send a single bit, and count*8/MAX_RATE
- * seconds to send 'count' bytes.
+ * rate to a given constant MAX_RATE expressed as bits/second, using a
+ * token bucket.
  *
- * we're going to implement a scheme where, when we send a packet of
- * 'count' bytes, no other packet will go through in the same direction for
- * at least 'count*8/MAX_RATE' seconds. any successive packet that is "sent"
- * in this interval is placed in a queue, associated to a timer
+ * the bucket holds 'tokens', expressed in bit-nanoseconds (bits * 10^9),
+ * so that refilling it for 'elapsed' nanoseconds at 'rate' bits/second
+ * is an exact integer product, and no rounding error accumulates at any
+ * rate. a packet may be sent when the bucket is not empty, and sending
+ * it removes its size from the bucket, possibly making it negative. the
+ * bucket can hold at most SHAPER_BURST_NS worth of traffic.
+ *
+ * packets that cannot be sent immediately are copied to a ring of
+ * preallocated slots, and sent in order by the shaper's timer. packets
+ * that do not fit in the ring go to an overflow list instead.
  *
  * there are different (queue/timer/rate) values for the input and output
  * direction of the user vlan.
  */
+#define  SHAPER_BURST_NS     1000000LL   /* 1 ms */
+#define  SHAPER_NUM_SLOTS    256         /* must be a power of 2 */
+#define  SHAPER_SLOT_SIZE    2048        /* enough for any Ethernet frame */
+
 typedef struct QueuedPacketRec_ {
     int64_t                    expiration;
     struct QueuedPacketRec_*   next;
@@ -95,37 +103,206 @@ queued_packet_free( QueuedPacket  packet )
     }
 }
 
+typedef struct {
+    int64_t   expiration;   /* not before this time, for jitter */
+    size_t    size;
+    void*     opaque;
+    void*     data;
+} ShaperSlot;
+
 typedef struct NetShaperRec_ {
-    QueuedPacket   packets;   /* list of queued packets, ordered by expiration date */
+    ShaperSlot*    slots;     /* ring of queued packets, allocated on demand */
+    uint8_t*       slot_data; /* SHAPER_SLOT_SIZE bytes per slot */
+    unsigned       slot_head; /* free-running ring indices */
+    unsigned       slot_tail;
+    QueuedPacket   overflow;  /* packets queued after the ring ones */
+    QueuedPacket*  overflow_tail;
     int            num_packets;
+    int64_t        last_expiration;
+
     int            active;    /* is this shaper active ? */
-    int64_t        block_until;
-    double         max_rate;  /* max rate expressed in bytes/second */
-    double         inv_rate;  /* inverse of max rate                */
+    int            limited;   /* is there a rate limit ? */
+    double         max_rate;  /* max rate expressed in bits/second */
+    int64_t        rate;      /* same, as an integer */
+    int64_t        tokens;    /* in bit-nanoseconds, may be negative */
+    int64_t        max_tokens;
+    int64_t        last_refill;
     QEMUTimer*     timer;     /* QEMU timer */
 
+    const NetShaperModel*  model;
+    void*                  model_opaque;
+
     int                do_copy;
     NetShaperSendFunc  send_func;
 
 } NetShaperRec;
 
 
+static int64_t
+netshaper_now( void )
+{
+    return qemu_clock_get_ns( SHAPER_CLOCK );
+}
+
+/* add the tokens earned since the last refill */
+static void
+netshaper_refill( NetShaper  shaper, int64_t  now )
+{
+    int64_t  elapsed = now - shaper->last_refill;
+
+    shaper->last_refill = now;
+    if (elapsed <= 0 || shaper->tokens >= shaper->max_tokens)
+        return;
+
+    /* avoid overflowing the product below */
+    if (elapsed > (shaper->max_tokens - shaper->tokens) / shaper->rate)
+        shaper->tokens = shaper->max_tokens;
+    else
+        shaper->tokens += elapsed * shaper->rate;
+}
+
+static int
+netshaper_has_tokens( NetShaper  shaper )
+{
+    return !shaper->limited || shaper->tokens >= 0;
+}
+
+static void
+netshaper_consume( NetShaper  shaper, size_t  size )
+{
+    if (shaper->limited)
+        shaper->tokens -= (int64_t)size * 8 * 1000000000LL;
+}
+
+/* returns the first queued packet, if any */
+static int
+netshaper_peek( NetShaper  shaper, int64_t*  expiration )
+{
+    if (shaper->slot_head != shaper->slot_tail) {
+        *expiration = shaper->slots[shaper->slot_head & (SHAPER_NUM_SLOTS-1)].expiration;
+        return 1;
+    }
+    if (shaper->overflow) {
+        *expiration = shaper->overflow->expiration;
+        return 1;
+    }
+    return 0;
+}
+
+/* send the first queued packet, and remove it from the queue */
+static void
+netshaper_send_first( NetShaper  shaper )
+{
+    if (shaper->slot_head != shaper->slot_tail) {
+        ShaperSlot*  slot = &shaper->slots[shaper->slot_head & (SHAPER_NUM_SLOTS-1)];
+
+        netshaper_consume( shaper, slot->size );
+        shaper->send_func( slot->data, slot->size, slot->opaque );
+        /* only release the slot now, 'data' may point into it */
+        shaper->slot_head++;
+    } else {
+        QueuedPacket  packet = shaper->overflow;
+
+        shaper->overflow = packet->next;
+        if (shaper->overflow == NULL)
+            shaper->overflow_tail = &shaper->overflow;
+
+        netshaper_consume( shaper, packet->size );
+        shaper->send_func( packet->data, packet->size, packet->opaque );
+        queued_packet_free(packet);
+    }
+    shaper->num_packets--;
+}
+
+static void
+netshaper_enqueue( NetShaper  shaper,
+                   void*      data,
+                   size_t     size,
+                   void*      opaque,
+                   int64_t    expiration )
+{
+    /* keep packets in order, even with jitter */
+    if (expiration < shaper->last_expiration)
+        expiration = shaper->last_expiration;
+    shaper->last_expiration = expiration;
+
+    if (shaper->overflow == NULL &&
+        shaper->slot_tail - shaper->slot_head < SHAPER_NUM_SLOTS &&
+        (size <= SHAPER_SLOT_SIZE || !shaper->do_copy))
+    {
+        unsigned     index = shaper->slot_tail & (SHAPER_NUM_SLOTS-1);
+        ShaperSlot*  slot  = &shaper->slots[index];
+
+        slot->expiration = expiration;
+        slot->size       = size;
+        slot->opaque     = opaque;
+        if (shaper->do_copy) {
+            slot->data = shaper->slot_data + index*SHAPER_SLOT_SIZE;
+            memcpy( slot->data, data, size );
+        } else {
+            slot->data = data;
+        }
+        shaper->slot_tail++;
+    } else {
+        QueuedPacket  packet;
+
+        packet = queued_packet_create( data, size, opaque, shaper->do_copy );
+        packet->expiration     = expiration;
+        *shaper->overflow_tail = packet;
+        shaper->overflow_tail  = &packet->next;
+    }
+    shaper->num_packets += 1;
+}
+
+/* program the timer for the first queued packet */
+static void
+netshaper_schedule( NetShaper  shaper, int64_t  now )
+{
+    int64_t  expiration;
+
+    if (!netshaper_peek(shaper, &expiration)) {
+        timer_del( shaper->timer );
+        return;
+    }
+    if (!netshaper_has_tokens(shaper)) {
+        /* when the bucket gets back to 0 */
+        int64_t  empty = now + (-shaper->tokens + shaper->rate - 1) / shaper->rate;
+        if (empty > expiration)
+            expiration = empty;
+    }
+    timer_mod( shaper->timer, expiration );
+}
+
+/* send all queued packets, regardless of rate */
+static void
+netshaper_flush( NetShaper  shaper )
+{
+    int64_t  expiration;
+
+    while (netshaper_peek(shaper, &expiration))
+        netshaper_send_first(shaper);
+
+    shaper->last_expiration = 0;
+}
+
 void
 netshaper_destroy( NetShaper  shaper )
 {
     if (shaper) {
         shaper->active = 0;
 
-        while (shaper->packets) {
-            QueuedPacket  packet = shaper->packets;
-            shaper->packets = packet->next;
-            packet->next    = NULL;
+        while (shaper->overflow) {
+            QueuedPacket  packet = shaper->overflow;
+            shaper->overflow = packet->next;
+            packet->next     = NULL;
             queued_packet_free(packet);
         }
 
         timer_del(shaper->timer);
         timer_free(shaper->timer);
         shaper->timer = NULL;
+        g_free(shaper->slots);
+        g_free(shaper->slot_data);
         g_free(shaper);
     }
 }
@@ -134,27 +311,20 @@ netshaper_destroy( NetShaper  shaper )
 static void
 netshaper_expires( NetShaper  shaper )
 {
-    QueuedPacket  packet;
+    int64_t  now = netshaper_now();
+    int64_t  expiration;
 
-    while ((packet = shaper->packets) != NULL) {
-        int64_t   now = qemu_clock_get_ms( SHAPER_CLOCK );
+    if (shaper->limited)
+        netshaper_refill(shaper, now);
 
-       if (packet->expiration > now)
-           break;
-
-       shaper->packets = packet->next;
-       shaper->send_func( packet->data, packet->size, packet->opaque );
-       queued_packet_free(packet);
-       shaper->num_packets--;
-   }
+    while (netshaper_peek(shaper, &expiration)) {
+        if (expiration > now || !netshaper_has_tokens(shaper))
+            break;
+        netshaper_send_first(shaper);
+    }
 
-   /* reprogram timer if needed */
-   if (shaper->packets) {
-       shaper->block_until = shaper->packets->expiration;
-       timer_mod( shaper->timer, shaper->block_until );
-   } else {
-       shaper->block_until = -1;
-   }
+    /* reprogram timer if needed */
+    netshaper_schedule(shaper, now);
 }
 
 
@@ -162,45 +332,70 @@ NetShaper
 netshaper_create( int                do_copy,
                   NetShaperSendFunc  send_func )
 {
-    NetShaper  shaper = g_malloc(sizeof(*shaper));
+    NetShaper  shaper = g_malloc0(sizeof(*shaper));
 
-    shaper->active = 0;
-    shaper->packets = NULL;
-    shaper->num_packets = 0;
-    shaper->timer   = timer_new( SHAPER_CLOCK, SCALE_MS,
+    shaper->active  = 0;
+    shaper->overflow_tail = &shaper->overflow;
+    shaper->timer   = timer_new( SHAPER_CLOCK, SCALE_NS,
                                  (QEMUTimerCB*) netshaper_expires,
                                  shaper );
+    shaper->do_copy   = do_copy;
     shaper->send_func = send_func;
     shaper->max_rate  = 1e6;
-    shaper->inv_rate  = 0.;
-
-    shaper->block_until = -1; /* magic value, means to not block */
 
     return shaper;
 }
 
+static void
+netshaper_update( NetShaper  shaper )
+{
+    shaper->active = shaper->limited || shaper->model != NULL;
+
+    if (shaper->active && shaper->slots == NULL) {
+        shaper->slots = g_malloc0(SHAPER_NUM_SLOTS * sizeof(ShaperSlot));
+        if (shaper->do_copy)
+            shaper->slot_data = g_malloc(SHAPER_NUM_SLOTS * SHAPER_SLOT_SIZE);
+    }
+}
+
 void
 netshaper_set_rate( NetShaper  shaper,
                     double     rate )
 {
     /* send all current packets when changing the rate */
-    while (shaper->packets) {
-        QueuedPacket  packet = shaper->packets;
-        shaper->packets = packet->next;
-        shaper->send_func(packet->data, packet->size, packet->opaque);
-        g_free(packet);
-        shaper->num_packets = 0;
-    }
+    netshaper_flush(shaper);
+    timer_del(shaper->timer);
 
     shaper->max_rate = rate;
     if (rate > 1.) {
-        shaper->inv_rate = (8.*SHAPER_CLOCK_UNIT)/rate;  /* qemu_get_clock returns time in ms */
-        shaper->active   = 1;                            /* for the real-time clock           */
+        shaper->limited     = 1;
+        shaper->rate        = (int64_t)rate;
+        shaper->max_tokens  = shaper->rate * SHAPER_BURST_NS;
+        shaper->tokens      = shaper->max_tokens;
+        shaper->last_refill = netshaper_now();
     } else {
-        shaper->active = 0;
+        shaper->limited = 0;
     }
+    netshaper_update(shaper);
+}
 
-    shaper->block_until = -1;
+void
+netshaper_set_model( NetShaper              shaper,
+                     const NetShaperModel*  model,
+                     void*                  opaque )
+{
+    /* send all current packets, then start again from a full bucket
+     * like netshaper_set_rate(), since flushing drained it */
+    netshaper_flush(shaper);
+    timer_del(shaper->timer);
+
+    if (shaper->limited) {
+        shaper->tokens      = shaper->max_tokens;
+        shaper->last_refill = netshaper_now();
+    }
+    shaper->model        = model;
+    shaper->model_opaque = opaque;
+    netshaper_update(shaper);
 }
 
 void
@@ -210,48 +405,35 @@ netshaper_send_aux( NetShaper  shaper,
                     void*      opaque )
 {
     int64_t   now;
+    int64_t   jitter = 0;
 
     if (!shaper->active || _packet_is_internal(data, size)) {
         shaper->send_func( data, size, opaque );
         return;
     }
 
-    now = qemu_clock_get_ms( SHAPER_CLOCK );
-    if (now >= shaper->block_until) {
-        shaper->send_func( data, size, opaque );
-        shaper->block_until = now + size*shaper->inv_rate;
-        //fprintf(stderr, "NETSHAPER: block for %.2fms\n", (shaper->block_until - now)*1.0 );
-        return;
+    if (shaper->model) {
+        if (shaper->model->drop &&
+            shaper->model->drop(shaper->model_opaque, size))
+            return;
+        if (shaper->model->jitter)
+            jitter = shaper->model->jitter(shaper->model_opaque, size);
     }
 
-    /* create new packet, add it to the queue */
-    {
-        QueuedPacket   packet;
+    now = netshaper_now();
+    if (shaper->limited)
+        netshaper_refill(shaper, now);
 
-        packet = queued_packet_create( data, size, opaque, shaper->do_copy );
-
-        packet->expiration = shaper->block_until;
-
-        {
-            QueuedPacket  *pnode, node;
-
-            pnode = &shaper->packets;
-            for (;;) {
-                node = *pnode;
-                if (node == NULL || node->expiration > packet->expiration )
-                    break;
-                pnode = &node->next;
-            }
-            packet->next = *pnode;
-            *pnode       = packet;
-
-            if (packet == shaper->packets)
-                timer_mod( shaper->timer, packet->expiration );
-        }
-        shaper->num_packets += 1;
+    if (jitter <= 0 && shaper->num_packets == 0 && netshaper_has_tokens(shaper)) {
+        netshaper_consume( shaper, size );
+        shaper->send_func( data, size, opaque );
+        return;
     }
-    shaper->block_until += size*shaper->inv_rate;
-    //fprintf(stderr, "NETSHAPER: block2 for %.2fms\n", (shaper->block_until - now)*1.0 );
+
+    /* add the packet to the queue */
+    netshaper_enqueue( shaper, data, size, opaque, now + jitter );
+    if (shaper->num_packets == 1)
+        netshaper_schedule( shaper, now );
 }
 
 void
@@ -266,20 +448,41 @@ netshaper_send( NetShaper  shaper,
 int
 netshaper_can_send( NetShaper  shaper )
 {
-    int64_t  now;
-
-    if (!shaper->active || shaper->block_until < 0)
+    if (!shaper->active)
         return 1;
 
-    if (shaper->packets)
+    if (shaper->num_packets > 0)
         return 0;
 
-    now = qemu_clock_get_ms( SHAPER_CLOCK );
-    return (now >= shaper->block_until);
+    if (shaper->limited)
+        netshaper_refill( shaper, netshaper_now() );
+
+    return netshaper_has_tokens(shaper);
 }
 
 
+static int
+netshaper_random_drop( void*  opaque, size_t  size )
+{
+    NetShaperRandomModel*  model = opaque;
 
+    return model->loss > 0. && rand() < model->loss * RAND_MAX;
+}
+
+static int64_t
+netshaper_random_jitter( void*  opaque, size_t  size )
+{
+    NetShaperRandomModel*  model = opaque;
+
+    if (model->jitter_ns <= 0)
+        return 0;
+    return (int64_t)((double)rand() / RAND_MAX * model->jitter_ns);
+}
+
+const NetShaperModel  netshaper_random_model = {
+    netshaper_random_drop,
+    netshaper_random_jitter,
+};
 
 
 
@@ -288,7 +491,8 @@ netshaper_can_send( NetShaper  shaper )
  */
 typedef struct SessionRec_ {
     int64_t               expiration;
-    struct SessionRec_*   next;
+    struct SessionRec_*   next;          /* in hash bucket */
+    struct SessionRec_*   next_pending;  /* in list of delayed sessions */
     unsigned              src_ip;
     unsigned              dst_ip;
     unsigned short        src_port;
@@ -380,9 +584,12 @@ _packet_SYN_flags( const void*  _data, size_t   size, Session  info )
 }
 
 
+#define  NETDELAY_HASH_SIZE  256   /* must be a power of 2 */
+
 typedef struct NetDelayRec_
 {
-    Session     sessions;
+    Session     sessions[NETDELAY_HASH_SIZE];
+    Session     pending;   /* sessions with a delayed packet */
     int         num_sessions;
     QEMUTimer*  timer;
     int         active;
@@ -394,10 +601,22 @@ typedef struct NetDelayRec_
 } NetDelayRec;
 
 
+static unsigned
+netdelay_hash( Session  info )
+{
+    unsigned  h;
+
+    h  = info->src_ip * 31 + info->dst_ip;
+    h  = h * 31 + ((info->src_port << 16) | info->dst_port);
+    h  = h * 31 + info->protocol;
+    h ^= h >> 16;
+    return h & (NETDELAY_HASH_SIZE - 1);
+}
+
 static Session*
 netdelay_lookup_session( NetDelay  delay, Session  info )
 {
-    Session*  pnode = &delay->sessions;
+    Session*  pnode = &delay->sessions[netdelay_hash(info)];
     Session   node;
 
     for (;;) {
@@ -417,38 +636,53 @@ netdelay_lookup_session( NetDelay  delay, Session  info )
     return pnode;
 }
 
+static void
+netdelay_remove_pending( NetDelay  delay, Session  session )
+{
+    Session*  pnode = &delay->pending;
+
+    while (*pnode != NULL) {
+        if (*pnode == session) {
+            *pnode = session->next_pending;
+            break;
+        }
+        pnode = &(*pnode)->next_pending;
+    }
+}
 
 
 /* called by the delay's timer on expiration */
 static void
 netdelay_expires( NetDelay  delay )
 {
-    Session  session;
-    int64_t  now = qemu_clock_get_ms(SHAPER_CLOCK);
-    int      rearm = 0;
-    int64_t  rearm_time = 0;
+    Session*  pnode = &delay->pending;
+    Session   session;
+    int64_t   now = qemu_clock_get_ms(SHAPER_CLOCK);
+    int       rearm = 0;
+    int64_t   rearm_time = 0;
 
-    for (session = delay->sessions; session != NULL; session = session->next)
+    while ((session = *pnode) != NULL)
     {
         QueuedPacket  packet = session->packet;
 
-        if (packet == NULL)
-            continue;
-
         if (session->expiration <= now) {
             /* send the SYN packet now */
                     //fprintf(stderr, "NetDelay:RST: sending creation for %s\n", session_to_string(session) );
-            delay->send_func( packet->data, packet->size, packet->opaque );
+            *pnode = session->next_pending;
             session->packet = NULL;
+            delay->send_func( packet->data, packet->size, packet->opaque );
             queued_packet_free( packet );
-        } else {
-            if (!rearm) {
-                rearm      = 1;
-                rearm_time = session->expiration;
-            }
-            else if ( session->expiration < rearm_time )
-                rearm_time = session->expiration;
+            continue;
         }
+
+        if (!rearm) {
+            rearm      = 1;
+            rearm_time = session->expiration;
+        }
+        else if ( session->expiration < rearm_time )
+            rearm_time = session->expiration;
+
+        pnode = &session->next_pending;
     }
 
     if (rearm)
@@ -459,9 +693,8 @@ netdelay_expires( NetDelay  delay )
 NetDelay
 netdelay_create( NetShaperSendFunc  send_func )
 {
-    NetDelay  delay = g_malloc(sizeof(*delay));
+    NetDelay  delay = g_malloc0(sizeof(*delay));
 
-    delay->sessions     = NULL;
     delay->num_sessions = 0;
     delay->timer        = timer_new( SHAPER_CLOCK, SCALE_MS,
                                      (QEMUTimerCB*) netdelay_expires,
@@ -475,22 +708,34 @@ netdelay_create( NetShaperSendFunc  send_func )
     return delay;
 }
 
+/* remove all sessions, sending their delayed packets if 'send' is set */
+static void
+netdelay_clear( NetDelay  delay, int  send )
+{
+    int  nn;
+
+    for (nn = 0; nn < NETDELAY_HASH_SIZE; nn++) {
+        while (delay->sessions[nn]) {
+            Session  session = delay->sessions[nn];
+            delay->sessions[nn] = session->next;
+            session->next = NULL;
+            if (send && session->packet) {
+                QueuedPacket  packet = session->packet;
+                delay->send_func( packet->data, packet->size, packet->opaque );
+            }
+            session_free(session);
+            delay->num_sessions--;
+        }
+    }
+    delay->pending = NULL;
+}
+
 
 void
 netdelay_set_latency( NetDelay  delay, int  min_ms, int  max_ms )
 {
     /* when changing the latency, accept all sessions */
-    while (delay->sessions) {
-        Session  session = delay->sessions;
-        delay->sessions = session->next;
-        session->next = NULL;
-        if (session->packet) {
-            QueuedPacket  packet = session->packet;
-            delay->send_func( packet->data, packet->size, packet->opaque );
-        }
-        session_free(session);
-        delay->num_sessions--;
-    }
+    netdelay_clear(delay, 1);
 
     delay->min_ms = min_ms;
     delay->max_ms = max_ms;
@@ -520,6 +765,8 @@ netdelay_send_aux( NetDelay  delay, const void*  data, size_t  size, void* opaqu
                 //fprintf(stderr, "NetDelay:RST: dropping %s\n", session_to_string(info) );
 
                 *lookup = session->next;
+                if (session->packet != NULL)
+                    netdelay_remove_pending( delay, session );
                 session_free( session );
                 delay->num_sessions -= 1;
             }
@@ -549,8 +796,8 @@ netdelay_send_aux( NetDelay  delay, const void*  data, size_t  size, void* opaqu
                     //fprintf(stderr, "NetDelay:RST: delay creation for %s\n", session_to_string(info) );
                 session = g_malloc( sizeof(*session) );
 
-                session->next        = delay->sessions;
-                delay->sessions      = session;
+                session->next        = *lookup;
+                *lookup              = session;
                 delay->num_sessions += 1;
 
                 session->expiration = qemu_clock_get_ms(SHAPER_CLOCK) + latency;
@@ -562,6 +809,8 @@ netdelay_send_aux( NetDelay  delay, const void*  data, size_t  size, void* opaqu
                 session->protocol = info->protocol;
 
                 session->packet = queued_packet_create( data, size, opaque, 1 );
+                session->next_pending = delay->pending;
+                delay->pending        = session;
 
                 netdelay_expires(delay);
                 return;
@@ -577,12 +826,9 @@ void
 netdelay_destroy( NetDelay  delay )
 {
     if (delay) {
-        while (delay->sessions) {
-            Session  session = delay->sessions;
-            delay->sessions = session->next;
-            session_free(session);
-            delay->num_sessions -= 1;
-        }
+        netdelay_clear(delay, 0);
+        timer_del(delay->timer);
+        timer_free(delay->timer);
         delay->active = 0;
         g_free( delay );
     }
@@ -0,0 +1,249 @@
+// Copyright 2014 The Android Open Source Project
+//
+// This software is licensed under the terms of the GNU General Public
+// License version 2, as published by the Free Software Foundation, and
+// may be copied, distributed, and modified under those terms.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+#include <gtest/gtest.h>
+
+#include <stdio.h>
+#include <string.h>
+
+#include <vector>
+
+// The QEMU headers include C library headers, which must not end up in
+// the extern "C" block when first seen.
+
+extern "C" {
+#include "android/shaper.h"
+#include "qemu-common.h"
+#include "qemu/timer.h"
+}
+
+// These tests run android/shaper.c on a simulated clock, with the QEMU
+// timer functions below standing in for qemu-timer.c.
+
+QEMUTimerListGroup main_loop_tlg;
+
+namespace {
+
+int64_t sNow;
+QEMUTimer* sTimer;
+
+const size_t kFrameSize = 1514;
+const int64_t kSecond = 1000000000LL;
+
+// Run the timer of the shaper if it expired.
+void runTimer() {
+    if (sTimer && sTimer->heap_index && sTimer->expire_time <= sNow) {
+        sTimer->heap_index = 0;
+        sTimer->cb(sTimer->opaque);
+    }
+}
+
+struct Received {
+    int64_t bytes;
+    std::vector<int> ids;
+};
+
+void receive(void* data, size_t size, void* opaque) {
+    Received* received = static_cast<Received*>(opaque);
+    received->bytes += size;
+    int id;
+    memcpy(&id, data, sizeof(id));
+    received->ids.push_back(id);
+}
+
+// A frame that the shaper doesn't consider internal traffic.
+std::vector<uint8_t> makeFrame(int id) {
+    std::vector<uint8_t> frame(kFrameSize);
+    memcpy(&frame[0], &id, sizeof(id));
+    return frame;
+}
+
+// The rates below are measured after the first tenth of the run, once
+// the initial burst allowed by the full bucket is over.
+double steadyRate(int64_t bytes, int64_t duration) {
+    return bytes * 8. * kSecond / (duration - duration / 10);
+}
+
+// A sender that sends a frame whenever netshaper_can_send() allows it,
+// polling every |step| nanoseconds for |duration| nanoseconds. Returns
+// the rate seen by the receiver, in bits per second.
+double saturatedRate(double rate, int64_t step, int64_t duration) {
+    Received received = {};
+    NetShaper shaper = netshaper_create(1, receive);
+    netshaper_set_rate(shaper, rate);
+    std::vector<uint8_t> frame = makeFrame(0);
+
+    const int64_t start = sNow;
+    int64_t warmupBytes = -1;
+    while (sNow - start < duration) {
+        if (warmupBytes < 0 && sNow - start >= duration / 10) {
+            warmupBytes = received.bytes;
+        }
+        runTimer();
+        while (netshaper_can_send(shaper)) {
+            netshaper_send_aux(shaper, &frame[0], frame.size(), &received);
+        }
+        sNow += step;
+    }
+    netshaper_destroy(shaper);
+    return steadyRate(received.bytes - warmupBytes, duration);
+}
+
+// A sender that sends frames at |offered| bits per second regardless of
+// netshaper_can_send(), so that they queue up in the shaper and its
+// timer sends them. Returns the rate seen by the receiver.
+double queuedRate(double rate, double offered, int64_t duration) {
+    Received received = {};
+    NetShaper shaper = netshaper_create(1, receive);
+    netshaper_set_rate(shaper, rate);
+
+    const int64_t interval =
+            static_cast<int64_t>(kFrameSize * 8 * kSecond / offered);
+    const int64_t start = sNow;
+    int id = 0;
+    int64_t nextSend = start;
+    int64_t warmupBytes = -1;
+    while (sNow - start < duration) {
+        if (warmupBytes < 0 && sNow - start >= duration / 10) {
+            warmupBytes = received.bytes;
+        }
+        if (sNow >= nextSend) {
+            std::vector<uint8_t> frame = makeFrame(id++);
+            netshaper_send_aux(shaper, &frame[0], frame.size(), &received);
+            nextSend += interval;
+        }
+        runTimer();
+        // Jump to the next event.
+        int64_t next = nextSend;
+        if (sTimer && sTimer->heap_index && sTimer->expire_time < next) {
+            next = sTimer->expire_time;
+        }
+        sNow = next > sNow ? next : sNow + 1;
+    }
+    const double result = steadyRate(received.bytes - warmupBytes, duration);
+
+    // Packets are delivered in order.
+    for (size_t n = 0; n < received.ids.size(); ++n) {
+        EXPECT_EQ(static_cast<int>(n), received.ids[n]);
+    }
+    netshaper_destroy(shaper);
+    return result;
+}
+
+}  // namespace
+
+extern "C" {
+
+void timer_init(QEMUTimer* ts, QEMUTimerList* timer_list, int scale,
+                QEMUTimerCB* cb, void* opaque) {
+    ts->timer_list = timer_list;
+    ts->scale = scale;
+    ts->cb = cb;
+    ts->opaque = opaque;
+    ts->heap_index = 0;
+    sTimer = ts;
+}
+
+void timer_mod(QEMUTimer* ts, int64_t expire_time) {
+    ts->expire_time = expire_time;
+    ts->heap_index = 1;
+}
+
+void timer_del(QEMUTimer* ts) {
+    ts->heap_index = 0;
+}
+
+void timer_free(QEMUTimer* ts) {
+    if (sTimer == ts) {
+        sTimer = NULL;
+    }
+    g_free(ts);
+}
+
+int64_t qemu_clock_get_ns(QEMUClockType type) {
+    return sNow;
+}
+
+}  // extern "C"
+
+TEST(NetShaper, SaturatedRate1Gbps) {
+    const double rate = saturatedRate(1e9, 1000, kSecond);
+    printf("1 Gbps: %.5f Gbps\n", rate / 1e9);
+    EXPECT_NEAR(1e9, rate, 1e9 * 0.001);
+}
+
+TEST(NetShaper, SaturatedRate64kbps) {
+    const double rate = saturatedRate(64000, 100000, 120 * kSecond);
+    printf("64 kbps: %.3f kbps\n", rate / 1e3);
+    // One frame more or less over the measured 108 s is 0.18%.
+    EXPECT_NEAR(64000, rate, 64000 * 0.0025);
+}
+
+TEST(NetShaper, QueuedRate1Gbps) {
+    const double rate = queuedRate(1e9, 1.1e9, kSecond / 10);
+    printf("1 Gbps, queued: %.5f Gbps\n", rate / 1e9);
+    EXPECT_NEAR(1e9, rate, 1e9 * 0.001);
+}
+
+TEST(NetShaper, QueuedRate64kbps) {
+    const double rate = queuedRate(64000, 70400, 120 * kSecond);
+    printf("64 kbps, queued: %.3f kbps\n", rate / 1e3);
+    // One frame more or less over the measured 108 s is 0.18%.
+    EXPECT_NEAR(64000, rate, 64000 * 0.0025);
+}
+
+TEST(NetShaper, SetModelRefillsBucket) {
+    Received received = {};
+    NetShaper shaper = netshaper_create(1, receive);
+    netshaper_set_rate(shaper, 64000);
+    for (int n = 0; n < 10; ++n) {
+        std::vector<uint8_t> frame = makeFrame(n);
+        netshaper_send_aux(shaper, &frame[0], frame.size(), &received);
+    }
+    EXPECT_FALSE(netshaper_can_send(shaper));
+
+    // Changing the model sends the queued frames at once, which must not
+    // be charged to the traffic that follows.
+    netshaper_set_model(shaper, NULL, NULL);
+    EXPECT_EQ(10U, received.ids.size());
+    EXPECT_TRUE(netshaper_can_send(shaper));
+    netshaper_destroy(shaper);
+}
+
+TEST(NetShaper, RandomModel) {
+    Received received = {};
+    NetShaper shaper = netshaper_create(1, receive);
+    NetShaperRandomModel model = { 1.0, 0 };
+
+    // Everything is dropped.
+    netshaper_set_model(shaper, &netshaper_random_model, &model);
+    std::vector<uint8_t> frame = makeFrame(0);
+    netshaper_send_aux(shaper, &frame[0], frame.size(), &received);
+    EXPECT_EQ(0U, received.ids.size());
+
+    // Jitter delays packets, but never reorders them.
+    model.loss = 0.;
+    model.jitter_ns = 10000000;
+    netshaper_set_model(shaper, &netshaper_random_model, &model);
+    for (int n = 0; n < 100; ++n) {
+        frame = makeFrame(n);
+        netshaper_send_aux(shaper, &frame[0], frame.size(), &received);
+        sNow += 100000;
+        runTimer();
+    }
+    sNow += model.jitter_ns;
+    runTimer();
+    ASSERT_EQ(100U, received.ids.size());
+    for (int n = 0; n < 100; ++n) {
+        EXPECT_EQ(n, received.ids[n]);
+    }
+    netshaper_destroy(shaper);
+}
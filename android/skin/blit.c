@@ -0,0 +1,527 @@
+/* Copyright (C) 2014 The Android Open Source Project
+**
+** This software is licensed under the terms of the GNU General Public
+** License version 2, as published by the Free Software Foundation, and
+** may be copied, distributed, and modified under those terms.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+*/
+#include "android/skin/blit.h"
+
+#include <string.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+// Side of the square tiles used by 90 and 270 degree rotations, in pixels.
+// A 32x32 ARGB32 tile is 4 KiB, so the 32 source lines and 32 destination
+// lines touched by a tile easily fit in the L1 cache.
+#define  TILE_SIZE  32
+
+static __inline__ uint32_t rgb565_to_argb32(uint32_t pix) {
+    uint32_t r8 = ((pix & 0xf800) >>  8) | ((pix & 0xe000) >> 13);
+    uint32_t g8 = ((pix & 0x07e0) >>  3) | ((pix & 0x0600) >>  9);
+    uint32_t b8 = ((pix & 0x001f) <<  3) | ((pix & 0x001c) >>  2);
+    return (r8 << 16) | (g8 << 8) | (b8 << 0) | 0xff000000U;
+}
+
+// Compute the address of the source pixel that goes to the top-left
+// corner of |rect|, and the byte offsets to add to it to move by one
+// destination pixel horizontally (|*step_x|) and vertically (|*step_y|).
+static const uint8_t* blit_setup(const uint8_t* src,
+                                 int src_w,
+                                 int src_h,
+                                 int src_pitch,
+                                 int bpp,
+                                 const SkinRect* rect,
+                                 SkinRotation rotation,
+                                 int* step_x,
+                                 int* step_y) {
+    int x = rect->pos.x;
+    int y = rect->pos.y;
+
+    switch (rotation & 3) {
+    case SKIN_ROTATION_0:
+        *step_x = bpp;
+        *step_y = src_pitch;
+        return src + x * bpp + y * src_pitch;
+
+    case SKIN_ROTATION_90:
+        *step_x = -src_pitch;
+        *step_y = bpp;
+        return src + y * bpp + (src_h - 1 - x) * src_pitch;
+
+    case SKIN_ROTATION_180:
+        *step_x = -bpp;
+        *step_y = -src_pitch;
+        return src + (src_w - 1 - x) * bpp + (src_h - 1 - y) * src_pitch;
+
+    default:  // SKIN_ROTATION_270
+        *step_x = src_pitch;
+        *step_y = -bpp;
+        return src + (src_w - 1 - y) * bpp + x * src_pitch;
+    }
+}
+
+/** ARGB32
+ **/
+
+// Generic copy of a |w| x |h| block, one pixel at a time.
+static void blit_block_argb32_c(uint8_t* dst,
+                                int dst_pitch,
+                                const uint8_t* src,
+                                int step_x,
+                                int step_y,
+                                int w,
+                                int h) {
+    int i, j;
+
+    for (j = 0; j < h; j++) {
+        uint32_t* d = (uint32_t*)(dst + j * dst_pitch);
+        const uint8_t* s = src + j * step_y;
+
+        for (i = 0; i < w; i++) {
+            d[i] = *(const uint32_t*)s;
+            s += step_x;
+        }
+    }
+}
+
+#if defined(__SSE2__)
+// Transpose the 4x4 block whose rows are |r0| to |r3| and store its
+// columns as destination lines, in reverse order if |reverse| is set.
+static __inline__ void transpose4_store_argb32(uint8_t* dst,
+                                               int dst_pitch,
+                                               __m128i r0,
+                                               __m128i r1,
+                                               __m128i r2,
+                                               __m128i r3,
+                                               int reverse) {
+    __m128i t0 = _mm_unpacklo_epi32(r0, r1);
+    __m128i t1 = _mm_unpacklo_epi32(r2, r3);
+    __m128i t2 = _mm_unpackhi_epi32(r0, r1);
+    __m128i t3 = _mm_unpackhi_epi32(r2, r3);
+    __m128i c[4];
+    int m;
+
+    c[0] = _mm_unpacklo_epi64(t0, t1);
+    c[1] = _mm_unpackhi_epi64(t0, t1);
+    c[2] = _mm_unpacklo_epi64(t2, t3);
+    c[3] = _mm_unpackhi_epi64(t2, t3);
+
+    for (m = 0; m < 4; m++) {
+        int row = reverse ? 3 - m : m;
+        _mm_storeu_si128((__m128i*)(dst + row * dst_pitch), c[m]);
+    }
+}
+#endif  // __SSE2__
+
+// Copy a |w| x |h| tile for a 90 or 270 degree rotation, i.e. when
+// |step_y| is +4 or -4 and |step_x| is a multiple of the source pitch.
+static void blit_tile_transpose_argb32(uint8_t* dst,
+                                       int dst_pitch,
+                                       const uint8_t* src,
+                                       int step_x,
+                                       int step_y,
+                                       int w,
+                                       int h) {
+    int j = 0;
+#if defined(__SSE2__)
+    const int reverse = (step_y < 0);
+    int i;
+
+    for (; j + 4 <= h; j += 4) {
+        for (i = 0; i + 4 <= w; i += 4) {
+            const uint8_t* s = src + i * step_x + j * step_y;
+
+            if (reverse)
+                s -= 3 * 4;
+
+            transpose4_store_argb32(
+                    dst + j * dst_pitch + i * 4, dst_pitch,
+                    _mm_loadu_si128((const __m128i*)(s)),
+                    _mm_loadu_si128((const __m128i*)(s + step_x)),
+                    _mm_loadu_si128((const __m128i*)(s + 2 * step_x)),
+                    _mm_loadu_si128((const __m128i*)(s + 3 * step_x)),
+                    reverse);
+        }
+        blit_block_argb32_c(dst + j * dst_pitch + i * 4, dst_pitch,
+                            src + i * step_x + j * step_y, step_x, step_y,
+                            w - i, 4);
+    }
+#endif  // __SSE2__
+
+    // Remaining lines, if any.
+    blit_block_argb32_c(dst + j * dst_pitch, dst_pitch,
+                        src + j * step_y, step_x, step_y,
+                        w, h - j);
+}
+
+void skin_blit_rotate_argb32(uint8_t* dst,
+                             int dst_pitch,
+                             const uint8_t* src,
+                             int src_w,
+                             int src_h,
+                             int src_pitch,
+                             const SkinRect* rect,
+                             SkinRotation rotation) {
+    int w = rect->size.w;
+    int h = rect->size.h;
+    int step_x, step_y;
+    int i, j;
+
+    src = blit_setup(src, src_w, src_h, src_pitch, 4, rect, rotation,
+                     &step_x, &step_y);
+
+    switch (rotation & 3) {
+    case SKIN_ROTATION_0:
+        for (j = 0; j < h; j++) {
+            memcpy(dst, src, w * 4);
+            src += src_pitch;
+            dst += dst_pitch;
+        }
+        break;
+
+    case SKIN_ROTATION_180:
+        for (j = 0; j < h; j++) {
+            uint32_t* d = (uint32_t*)dst;
+            const uint32_t* s = (const uint32_t*)src;
+
+            i = 0;
+#if defined(__SSE2__)
+            for (; i + 4 <= w; i += 4) {
+                __m128i v = _mm_loadu_si128((const __m128i*)(s - i - 3));
+                _mm_storeu_si128((__m128i*)(d + i),
+                                 _mm_shuffle_epi32(v, _MM_SHUFFLE(0, 1, 2, 3)));
+            }
+#endif
+            for (; i < w; i++)
+                d[i] = s[-i];
+
+            src -= src_pitch;
+            dst += dst_pitch;
+        }
+        break;
+
+    default:  // SKIN_ROTATION_90 and SKIN_ROTATION_270
+        for (j = 0; j < h; j += TILE_SIZE) {
+            int th = (h - j < TILE_SIZE) ? h - j : TILE_SIZE;
+
+            for (i = 0; i < w; i += TILE_SIZE) {
+                int tw = (w - i < TILE_SIZE) ? w - i : TILE_SIZE;
+
+                blit_tile_transpose_argb32(dst + j * dst_pitch + i * 4,
+                                           dst_pitch,
+                                           src + i * step_x + j * step_y,
+                                           step_x, step_y, tw, th);
+            }
+        }
+    }
+}
+
+/** RGB565
+ **/
+
+static void blit_block_rgb565_c(uint8_t* dst,
+                                int dst_pitch,
+                                const uint8_t* src,
+                                int step_x,
+                                int step_y,
+                                int w,
+                                int h) {
+    int i, j;
+
+    for (j = 0; j < h; j++) {
+        uint32_t* d = (uint32_t*)(dst + j * dst_pitch);
+        const uint8_t* s = src + j * step_y;
+
+        for (i = 0; i < w; i++) {
+            d[i] = rgb565_to_argb32(*(const uint16_t*)s);
+            s += step_x;
+        }
+    }
+}
+
+#if defined(__SSE2__)
+// Convert 8 RGB565 pixels to ARGB32 and store them at |dst|.
+static __inline__ void rgb565x8_store_argb32(uint8_t* dst, __m128i p) {
+    const __m128i mask5 = _mm_set1_epi16(0x1f);
+    const __m128i mask6 = _mm_set1_epi16(0x3f);
+    const __m128i alpha = _mm_set1_epi16((short)0xff00);
+
+    __m128i r = _mm_srli_epi16(p, 11);
+    __m128i g = _mm_and_si128(_mm_srli_epi16(p, 5), mask6);
+    __m128i b = _mm_and_si128(p, mask5);
+
+    // Replicate the top bits in the low bits, as rgb565_to_argb32() does.
+    r = _mm_or_si128(_mm_slli_epi16(r, 3), _mm_srli_epi16(r, 2));
+    g = _mm_or_si128(_mm_slli_epi16(g, 2), _mm_srli_epi16(g, 4));
+    b = _mm_or_si128(_mm_slli_epi16(b, 3), _mm_srli_epi16(b, 2));
+
+    {
+        __m128i bg = _mm_or_si128(b, _mm_slli_epi16(g, 8));
+        __m128i ra = _mm_or_si128(r, alpha);
+
+        _mm_storeu_si128((__m128i*)dst, _mm_unpacklo_epi16(bg, ra));
+        _mm_storeu_si128((__m128i*)(dst + 16), _mm_unpackhi_epi16(bg, ra));
+    }
+}
+
+// Reverse the order of the 8 16-bit values of |v|.
+static __inline__ __m128i reverse_epi16(__m128i v) {
+    v = _mm_shufflelo_epi16(v, _MM_SHUFFLE(0, 1, 2, 3));
+    v = _mm_shufflehi_epi16(v, _MM_SHUFFLE(0, 1, 2, 3));
+    return _mm_shuffle_epi32(v, _MM_SHUFFLE(1, 0, 3, 2));
+}
+#endif  // __SSE2__
+
+static void blit_tile_transpose_rgb565(uint8_t* dst,
+                                       int dst_pitch,
+                                       const uint8_t* src,
+                                       int step_x,
+                                       int step_y,
+                                       int w,
+                                       int h) {
+    int j = 0;
+#if defined(__SSE2__)
+    const int reverse = (step_y < 0);
+    int i;
+
+    for (; j + 8 <= h; j += 8) {
+        for (i = 0; i + 8 <= w; i += 8) {
+            const uint8_t* s = src + i * step_x + j * step_y;
+            __m128i r[8], a[8], b[8];
+            int k;
+
+            if (reverse)
+                s -= 7 * 2;
+            for (k = 0; k < 8; k++)
+                r[k] = _mm_loadu_si128((const __m128i*)(s + k * step_x));
+
+            // 8x8 transpose of 16-bit values.
+            for (k = 0; k < 8; k += 2) {
+                a[k]     = _mm_unpacklo_epi16(r[k], r[k + 1]);
+                a[k + 1] = _mm_unpackhi_epi16(r[k], r[k + 1]);
+            }
+            for (k = 0; k < 8; k += 4) {
+                b[k]     = _mm_unpacklo_epi32(a[k], a[k + 2]);
+                b[k + 1] = _mm_unpackhi_epi32(a[k], a[k + 2]);
+                b[k + 2] = _mm_unpacklo_epi32(a[k + 1], a[k + 3]);
+                b[k + 3] = _mm_unpackhi_epi32(a[k + 1], a[k + 3]);
+            }
+            for (k = 0; k < 4; k++) {
+                __m128i c0 = _mm_unpacklo_epi64(b[k], b[k + 4]);
+                __m128i c1 = _mm_unpackhi_epi64(b[k], b[k + 4]);
+                int row0 = reverse ? 7 - 2 * k : 2 * k;
+                int row1 = reverse ? 6 - 2 * k : 2 * k + 1;
+                uint8_t* d = dst + j * dst_pitch + i * 4;
+
+                rgb565x8_store_argb32(d + row0 * dst_pitch, c0);
+                rgb565x8_store_argb32(d + row1 * dst_pitch, c1);
+            }
+        }
+        blit_block_rgb565_c(dst + j * dst_pitch + i * 4, dst_pitch,
+                            src + i * step_x + j * step_y, step_x, step_y,
+                            w - i, 8);
+    }
+#endif  // __SSE2__
+
+    blit_block_rgb565_c(dst + j * dst_pitch, dst_pitch,
+                        src + j * step_y, step_x, step_y,
+                        w, h - j);
+}
+
+void skin_blit_rotate_rgb565(uint8_t* dst,
+                             int dst_pitch,
+                             const uint8_t* src,
+                             int src_w,
+                             int src_h,
+                             int src_pitch,
+                             const SkinRect* rect,
+                             SkinRotation rotation) {
+    int w = rect->size.w;
+    int h = rect->size.h;
+    int step_x, step_y;
+    int i, j;
+
+    src = blit_setup(src, src_w, src_h, src_pitch, 2, rect, rotation,
+                     &step_x, &step_y);
+
+    switch (rotation & 3) {
+    case SKIN_ROTATION_0:
+    case SKIN_ROTATION_180:
+        for (j = 0; j < h; j++) {
+            uint32_t* d = (uint32_t*)dst;
+            const uint16_t* s = (const uint16_t*)src;
+
+            i = 0;
+#if defined(__SSE2__)
+            if (step_x > 0) {
+                for (; i + 8 <= w; i += 8) {
+                    rgb565x8_store_argb32((uint8_t*)(d + i),
+                            _mm_loadu_si128((const __m128i*)(s + i)));
+                }
+            } else {
+                for (; i + 8 <= w; i += 8) {
+                    __m128i v = _mm_loadu_si128((const __m128i*)(s - i - 7));
+                    rgb565x8_store_argb32((uint8_t*)(d + i),
+                                          reverse_epi16(v));
+                }
+            }
+#endif
+            for (; i < w; i++)
+                d[i] = rgb565_to_argb32(step_x > 0 ? s[i] : s[-i]);
+
+            src += step_y;
+            dst += dst_pitch;
+        }
+        break;
+
+    default:  // SKIN_ROTATION_90 and SKIN_ROTATION_270
+        for (j = 0; j < h; j += TILE_SIZE) {
+            int th = (h - j < TILE_SIZE) ? h - j : TILE_SIZE;
+
+            for (i = 0; i < w; i += TILE_SIZE) {
+                int tw = (w - i < TILE_SIZE) ? w - i : TILE_SIZE;
+
+                blit_tile_transpose_rgb565(dst + j * dst_pitch + i * 4,
+                                           dst_pitch,
+                                           src + i * step_x + j * step_y,
+                                           step_x, step_y, tw, th);
+            }
+        }
+    }
+}
+
+/** Brightness
+ **/
+
+void skin_blit_darken_argb32(uint32_t* pixels,
+                             int w,
+                             int h,
+                             int pitch,
+                             unsigned alpha) {
+    for (; h > 0; h--) {
+        uint32_t* line = pixels;
+        int nn = 0;
+
+#if defined(__AVX2__)
+        {
+            const __m256i zero = _mm256_setzero_si256();
+            const __m256i a = _mm256_set1_epi16((short)alpha);
+
+            for (; nn + 8 <= w; nn += 8) {
+                __m256i v  = _mm256_loadu_si256((const __m256i*)(line + nn));
+                __m256i lo = _mm256_unpacklo_epi8(v, zero);
+                __m256i hi = _mm256_unpackhi_epi8(v, zero);
+
+                lo = _mm256_srli_epi16(_mm256_mullo_epi16(lo, a), 8);
+                hi = _mm256_srli_epi16(_mm256_mullo_epi16(hi, a), 8);
+                _mm256_storeu_si256((__m256i*)(line + nn),
+                                    _mm256_packus_epi16(lo, hi));
+            }
+        }
+#endif
+#if defined(__SSE2__)
+        {
+            const __m128i zero = _mm_setzero_si128();
+            const __m128i a = _mm_set1_epi16((short)alpha);
+
+            for (; nn + 4 <= w; nn += 4) {
+                __m128i v  = _mm_loadu_si128((const __m128i*)(line + nn));
+                __m128i lo = _mm_unpacklo_epi8(v, zero);
+                __m128i hi = _mm_unpackhi_epi8(v, zero);
+
+                lo = _mm_srli_epi16(_mm_mullo_epi16(lo, a), 8);
+                hi = _mm_srli_epi16(_mm_mullo_epi16(hi, a), 8);
+                _mm_storeu_si128((__m128i*)(line + nn),
+                                 _mm_packus_epi16(lo, hi));
+            }
+        }
+#endif
+        for (; nn < w; nn++) {
+            uint32_t c = line[nn];
+            uint32_t ag = (c >> 8) & 0x00ff00ff;
+            uint32_t rb = (c)      & 0x00ff00ff;
+
+            ag = (ag * alpha)        & 0xff00ff00;
+            rb = ((rb * alpha) >> 8) & 0x00ff00ff;
+
+            line[nn] = ag | rb;
+        }
+        pixels += pitch / sizeof(uint32_t);
+    }
+}
+
+void skin_blit_lighten_argb32(uint32_t* pixels,
+                              int w,
+                              int h,
+                              int pitch,
+                              unsigned alpha) {
+    unsigned ialpha = 255 - alpha;
+
+    for (; h > 0; h--) {
+        uint32_t* line = pixels;
+        int nn = 0;
+
+#if defined(__AVX2__)
+        {
+            const __m256i zero = _mm256_setzero_si256();
+            const __m256i ia = _mm256_set1_epi16((short)ialpha);
+            const __m256i white = _mm256_set1_epi16((short)(255 * alpha));
+
+            for (; nn + 8 <= w; nn += 8) {
+                __m256i v  = _mm256_loadu_si256((const __m256i*)(line + nn));
+                __m256i lo = _mm256_unpacklo_epi8(v, zero);
+                __m256i hi = _mm256_unpackhi_epi8(v, zero);
+
+                lo = _mm256_add_epi16(_mm256_mullo_epi16(lo, ia), white);
+                hi = _mm256_add_epi16(_mm256_mullo_epi16(hi, ia), white);
+                _mm256_storeu_si256((__m256i*)(line + nn),
+                                    _mm256_packus_epi16(
+                                            _mm256_srli_epi16(lo, 8),
+                                            _mm256_srli_epi16(hi, 8)));
+            }
+        }
+#endif
+#if defined(__SSE2__)
+        {
+            const __m128i zero = _mm_setzero_si128();
+            const __m128i ia = _mm_set1_epi16((short)ialpha);
+            const __m128i white = _mm_set1_epi16((short)(255 * alpha));
+
+            for (; nn + 4 <= w; nn += 4) {
+                __m128i v  = _mm_loadu_si128((const __m128i*)(line + nn));
+                __m128i lo = _mm_unpacklo_epi8(v, zero);
+                __m128i hi = _mm_unpackhi_epi8(v, zero);
+
+                // The sums never exceed 255 * 255, so they fit in 16 bits.
+                lo = _mm_add_epi16(_mm_mullo_epi16(lo, ia), white);
+                hi = _mm_add_epi16(_mm_mullo_epi16(hi, ia), white);
+                _mm_storeu_si128((__m128i*)(line + nn),
+                                 _mm_packus_epi16(_mm_srli_epi16(lo, 8),
+                                                  _mm_srli_epi16(hi, 8)));
+            }
+        }
+#endif
+        for (; nn < w; nn++) {
+            uint32_t c = line[nn];
+            uint32_t ag = (c >> 8) & 0x00ff00ff;
+            uint32_t rb = (c)      & 0x00ff00ff;
+
+            // interpolate towards bright white, i.e. 0x00ffffff
+            ag = ((ag * ialpha + 0x00ff00ff * alpha)) & 0xff00ff00;
+            rb = ((rb * ialpha + 0x00ff00ff * alpha) >> 8) & 0x00ff00ff;
+
+            line[nn] = ag | rb;
+        }
+        pixels += pitch / sizeof(uint32_t);
+    }
+}
@@ -0,0 +1,76 @@
+/* Copyright (C) 2014 The Android Open Source Project
+**
+** This software is licensed under the terms of the GNU General Public
+** License version 2, as published by the Free Software Foundation, and
+** may be copied, distributed, and modified under those terms.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+*/
+#ifndef _ANDROID_SKIN_BLIT_H
+#define _ANDROID_SKIN_BLIT_H
+
+#include "android/skin/rect.h"
+#include "android/utils/compiler.h"
+
+#include <stdint.h>
+
+ANDROID_BEGIN_HEADER
+
+/**  Pixel copy and conversion routines used to update the skin display
+ **/
+
+// Copy a rectangle of the framebuffer into an ARGB32 pixel buffer,
+// rotating it by |rotation| on the fly.
+// |dst| is the destination buffer, with |dst_pitch| bytes per line. The
+// top-left pixel of |rect| is written at |dst|.
+// |src| is the framebuffer, made of |src_w| x |src_h| pixels, with
+// |src_pitch| bytes per line.
+// |rect| is the rectangle to copy, in rotated coordinates, i.e. relative
+// to the display as seen by the user.
+//
+// 90 and 270 degree rotations are done by square tiles so that both the
+// source and destination lines of a tile stay in the cache, and by
+// transposing small blocks in SIMD registers when the host supports it.
+void skin_blit_rotate_argb32(uint8_t* dst,
+                             int dst_pitch,
+                             const uint8_t* src,
+                             int src_w,
+                             int src_h,
+                             int src_pitch,
+                             const SkinRect* rect,
+                             SkinRotation rotation);
+
+// Same as skin_blit_rotate_argb32(), but for a RGB565 framebuffer. The
+// pixels are converted to opaque ARGB32 during the copy.
+void skin_blit_rotate_rgb565(uint8_t* dst,
+                             int dst_pitch,
+                             const uint8_t* src,
+                             int src_w,
+                             int src_h,
+                             int src_pitch,
+                             const SkinRect* rect,
+                             SkinRotation rotation);
+
+// Darken a |w| x |h| block of ARGB32 pixels, with |pitch| bytes per line.
+// Each channel |c| becomes (c * alpha) >> 8, with |alpha| in [0..255].
+void skin_blit_darken_argb32(uint32_t* pixels,
+                             int w,
+                             int h,
+                             int pitch,
+                             unsigned alpha);
+
+// Interpolate a block of ARGB32 pixels towards bright white. Each channel
+// |c| becomes (c * (255 - alpha) + 255 * alpha) >> 8, with |alpha| in
+// [0..255].
+void skin_blit_lighten_argb32(uint32_t* pixels,
+                              int w,
+                              int h,
+                              int pitch,
+                              unsigned alpha);
+
+ANDROID_END_HEADER
+
+#endif  // _ANDROID_SKIN_BLIT_H
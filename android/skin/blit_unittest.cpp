@@ -0,0 +1,389 @@
+/* Copyright (C) 2014 The Android Open Source Project
+**
+** This software is licensed under the terms of the GNU General Public
+** License version 2, as published by the Free Software Foundation, and
+** may be copied, distributed, and modified under those terms.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+*/
+#include "android/skin/blit.h"
+
+#include <gtest/gtest.h>
+
+#include <stdio.h>
+#include <time.h>
+
+#include <algorithm>
+#include <vector>
+
+namespace android_skin {
+
+namespace {
+
+// Simple deterministic pseudo-random generator used to fill buffers.
+class Random {
+public:
+    Random() : mState(1U) {}
+
+    uint32_t next() {
+        mState = mState * 1103515245U + 12345U;
+        return (mState >> 8) ^ (mState << 24);
+    }
+
+private:
+    uint32_t mState;
+};
+
+uint32_t rgb565ToArgb32(uint16_t pix) {
+    uint32_t r = (pix >> 11) & 0x1f;
+    uint32_t g = (pix >> 5) & 0x3f;
+    uint32_t b = pix & 0x1f;
+    r = (r << 3) | (r >> 2);
+    g = (g << 2) | (g >> 4);
+    b = (b << 3) | (b >> 2);
+    return 0xff000000U | (r << 16) | (g << 8) | b;
+}
+
+// Return the offset, in pixels, of the framebuffer pixel that appears at
+// (|x|,|y|) on a display rotated by |rotation|.
+int sourceOffset(int x, int y, int src_w, int src_h, SkinRotation rotation) {
+    switch (rotation) {
+    case SKIN_ROTATION_0:
+        return y * src_w + x;
+    case SKIN_ROTATION_90:
+        return (src_h - 1 - x) * src_w + y;
+    case SKIN_ROTATION_180:
+        return (src_h - 1 - y) * src_w + (src_w - 1 - x);
+    case SKIN_ROTATION_270:
+    default:
+        return x * src_w + (src_w - 1 - y);
+    }
+}
+
+// Sizes chosen to exercise both the SIMD paths and the scalar tails.
+const struct {
+    int w;
+    int h;
+} kSizes[] = {
+    { 1, 1 },
+    { 3, 7 },
+    { 32, 32 },
+    { 33, 17 },
+    { 64, 40 },
+    { 101, 67 },
+};
+
+const SkinRotation kRotations[] = {
+    SKIN_ROTATION_0,
+    SKIN_ROTATION_90,
+    SKIN_ROTATION_180,
+    SKIN_ROTATION_270,
+};
+
+// Return a list of rectangles to update for a display of |w| x |h|
+// pixels, i.e. the whole display and a few odd sub-rectangles.
+std::vector<SkinRect> updateRects(int w, int h) {
+    std::vector<SkinRect> result;
+    SkinRect r;
+
+    r.pos.x = 0;
+    r.pos.y = 0;
+    r.size.w = w;
+    r.size.h = h;
+    result.push_back(r);
+
+    r.pos.x = w / 3;
+    r.pos.y = h / 5;
+    r.size.w = w - w / 3;
+    r.size.h = (h - h / 5 + 1) / 2;
+    result.push_back(r);
+
+    r.pos.x = w - 1;
+    r.pos.y = h / 2;
+    r.size.w = 1;
+    r.size.h = h - h / 2;
+    result.push_back(r);
+
+    return result;
+}
+
+// The per-pixel loop that the kernels replace, for the benchmark.
+void referenceRotateArgb32(uint32_t* dst, const uint32_t* src,
+                           int src_w, int src_h, SkinRotation rotation) {
+    const bool swap = (rotation & 1) != 0;
+    const int disp_w = swap ? src_h : src_w;
+    const int disp_h = swap ? src_w : src_h;
+    for (int y = 0; y < disp_h; ++y) {
+        for (int x = 0; x < disp_w; ++x) {
+            *dst++ = src[sourceOffset(x, y, src_w, src_h, rotation)];
+        }
+    }
+}
+
+void referenceRotateRgb565(uint32_t* dst, const uint16_t* src,
+                           int src_w, int src_h, SkinRotation rotation) {
+    const bool swap = (rotation & 1) != 0;
+    const int disp_w = swap ? src_h : src_w;
+    const int disp_h = swap ? src_w : src_h;
+    for (int y = 0; y < disp_h; ++y) {
+        for (int x = 0; x < disp_w; ++x) {
+            *dst++ = rgb565ToArgb32(
+                    src[sourceOffset(x, y, src_w, src_h, rotation)]);
+        }
+    }
+}
+
+// Best time of a few full frame updates, in milliseconds.
+const int kBenchmarkRounds = 10;
+
+double elapsedMs(clock_t start) {
+    return (clock() - start) * 1000.0 / CLOCKS_PER_SEC;
+}
+
+}  // namespace
+
+TEST(blit, skin_blit_rotate_argb32) {
+    Random random;
+    for (size_t n = 0; n < sizeof(kSizes) / sizeof(kSizes[0]); ++n) {
+        const int src_w = kSizes[n].w;
+        const int src_h = kSizes[n].h;
+        std::vector<uint32_t> src(src_w * src_h);
+        for (size_t i = 0; i < src.size(); ++i) {
+            src[i] = random.next();
+        }
+        for (size_t r = 0; r < 4; ++r) {
+            const SkinRotation rotation = kRotations[r];
+            const bool swap = (rotation & 1) != 0;
+            const int disp_w = swap ? src_h : src_w;
+            const int disp_h = swap ? src_w : src_h;
+            const std::vector<SkinRect> rects = updateRects(disp_w, disp_h);
+
+            for (size_t k = 0; k < rects.size(); ++k) {
+                const SkinRect& rect = rects[k];
+                // Add some padding to each line to check that it is
+                // left untouched.
+                const int dst_stride = rect.size.w + 3;
+                std::vector<uint32_t> dst(dst_stride * rect.size.h,
+                                          0xdeadbeefU);
+
+                skin_blit_rotate_argb32(
+                        reinterpret_cast<uint8_t*>(&dst[0]),
+                        dst_stride * 4,
+                        reinterpret_cast<const uint8_t*>(&src[0]),
+                        src_w,
+                        src_h,
+                        src_w * 4,
+                        &rect,
+                        rotation);
+
+                for (int y = 0; y < rect.size.h; ++y) {
+                    for (int x = 0; x < dst_stride; ++x) {
+                        uint32_t expected = 0xdeadbeefU;
+                        if (x < rect.size.w) {
+                            expected = src[sourceOffset(rect.pos.x + x,
+                                                        rect.pos.y + y,
+                                                        src_w,
+                                                        src_h,
+                                                        rotation)];
+                        }
+                        EXPECT_EQ(expected, dst[y * dst_stride + x])
+                                << "size " << src_w << "x" << src_h
+                                << " rotation " << rotation
+                                << " rect #" << k << " at " << x << "," << y;
+                    }
+                }
+            }
+        }
+    }
+}
+
+TEST(blit, skin_blit_rotate_rgb565) {
+    Random random;
+    for (size_t n = 0; n < sizeof(kSizes) / sizeof(kSizes[0]); ++n) {
+        const int src_w = kSizes[n].w;
+        const int src_h = kSizes[n].h;
+        std::vector<uint16_t> src(src_w * src_h);
+        for (size_t i = 0; i < src.size(); ++i) {
+            src[i] = static_cast<uint16_t>(random.next());
+        }
+        for (size_t r = 0; r < 4; ++r) {
+            const SkinRotation rotation = kRotations[r];
+            const bool swap = (rotation & 1) != 0;
+            const int disp_w = swap ? src_h : src_w;
+            const int disp_h = swap ? src_w : src_h;
+            const std::vector<SkinRect> rects = updateRects(disp_w, disp_h);
+
+            for (size_t k = 0; k < rects.size(); ++k) {
+                const SkinRect& rect = rects[k];
+                const int dst_stride = rect.size.w + 3;
+                std::vector<uint32_t> dst(dst_stride * rect.size.h,
+                                          0xdeadbeefU);
+
+                skin_blit_rotate_rgb565(
+                        reinterpret_cast<uint8_t*>(&dst[0]),
+                        dst_stride * 4,
+                        reinterpret_cast<const uint8_t*>(&src[0]),
+                        src_w,
+                        src_h,
+                        src_w * 2,
+                        &rect,
+                        rotation);
+
+                for (int y = 0; y < rect.size.h; ++y) {
+                    for (int x = 0; x < dst_stride; ++x) {
+                        uint32_t expected = 0xdeadbeefU;
+                        if (x < rect.size.w) {
+                            expected = rgb565ToArgb32(
+                                    src[sourceOffset(rect.pos.x + x,
+                                                     rect.pos.y + y,
+                                                     src_w,
+                                                     src_h,
+                                                     rotation)]);
+                        }
+                        EXPECT_EQ(expected, dst[y * dst_stride + x])
+                                << "size " << src_w << "x" << src_h
+                                << " rotation " << rotation
+                                << " rect #" << k << " at " << x << "," << y;
+                    }
+                }
+            }
+        }
+    }
+}
+
+TEST(blit, skin_blit_darken_argb32) {
+    static const unsigned kAlphas[] = { 0, 1, 51, 128, 200, 255 };
+    Random random;
+    const int w = 37;
+    const int h = 5;
+    const int stride = w + 2;
+    for (size_t n = 0; n < sizeof(kAlphas) / sizeof(kAlphas[0]); ++n) {
+        const unsigned alpha = kAlphas[n];
+        std::vector<uint32_t> pixels(stride * h);
+        for (size_t i = 0; i < pixels.size(); ++i) {
+            pixels[i] = random.next();
+        }
+        const std::vector<uint32_t> original = pixels;
+
+        skin_blit_darken_argb32(&pixels[0], w, h, stride * 4, alpha);
+
+        for (int i = 0; i < stride * h; ++i) {
+            uint32_t expected = original[i];
+            if (i % stride < w) {
+                expected = 0;
+                for (int shift = 0; shift < 32; shift += 8) {
+                    uint32_t c = (original[i] >> shift) & 0xff;
+                    expected |= ((c * alpha) >> 8) << shift;
+                }
+            }
+            EXPECT_EQ(expected, pixels[i]) << "alpha " << alpha
+                                           << " pixel #" << i;
+        }
+    }
+}
+
+TEST(blit, skin_blit_lighten_argb32) {
+    static const unsigned kAlphas[] = { 0, 1, 51, 102, 200, 255 };
+    Random random;
+    const int w = 37;
+    const int h = 5;
+    const int stride = w + 2;
+    for (size_t n = 0; n < sizeof(kAlphas) / sizeof(kAlphas[0]); ++n) {
+        const unsigned alpha = kAlphas[n];
+        std::vector<uint32_t> pixels(stride * h);
+        for (size_t i = 0; i < pixels.size(); ++i) {
+            pixels[i] = random.next();
+        }
+        const std::vector<uint32_t> original = pixels;
+
+        skin_blit_lighten_argb32(&pixels[0], w, h, stride * 4, alpha);
+
+        for (int i = 0; i < stride * h; ++i) {
+            uint32_t expected = original[i];
+            if (i % stride < w) {
+                expected = 0;
+                for (int shift = 0; shift < 32; shift += 8) {
+                    uint32_t c = (original[i] >> shift) & 0xff;
+                    expected |=
+                            ((c * (255 - alpha) + 255 * alpha) >> 8) << shift;
+                }
+            }
+            EXPECT_EQ(expected, pixels[i]) << "alpha " << alpha
+                                           << " pixel #" << i;
+        }
+    }
+}
+
+// Not a pass/fail test: reports the time of a full frame update for all
+// four rotations of 1080x1920 and 1600x2560 framebuffers, with the blit.c
+// kernels and with a per-pixel loop. Run it with
+// --gtest_also_run_disabled_tests.
+TEST(blit, DISABLED_rotate_benchmark) {
+    static const struct {
+        int w;
+        int h;
+    } kFrames[] = {
+        { 1080, 1920 },
+        { 1600, 2560 },
+    };
+    Random random;
+    for (size_t n = 0; n < sizeof(kFrames) / sizeof(kFrames[0]); ++n) {
+        const int src_w = kFrames[n].w;
+        const int src_h = kFrames[n].h;
+        std::vector<uint32_t> src32(src_w * src_h);
+        std::vector<uint16_t> src16(src_w * src_h);
+        for (size_t i = 0; i < src32.size(); ++i) {
+            src32[i] = random.next();
+            src16[i] = static_cast<uint16_t>(src32[i]);
+        }
+        std::vector<uint32_t> dst(src_w * src_h);
+
+        for (size_t r = 0; r < 4; ++r) {
+            const SkinRotation rotation = kRotations[r];
+            const bool swap = (rotation & 1) != 0;
+            SkinRect rect;
+            rect.pos.x = 0;
+            rect.pos.y = 0;
+            rect.size.w = swap ? src_h : src_w;
+            rect.size.h = swap ? src_w : src_h;
+
+            double best[4] = { 1e9, 1e9, 1e9, 1e9 };
+            for (int round = 0; round < kBenchmarkRounds; ++round) {
+                clock_t start = clock();
+                skin_blit_rotate_argb32(
+                        reinterpret_cast<uint8_t*>(&dst[0]),
+                        rect.size.w * 4,
+                        reinterpret_cast<const uint8_t*>(&src32[0]),
+                        src_w, src_h, src_w * 4, &rect, rotation);
+                best[0] = std::min(best[0], elapsedMs(start));
+
+                start = clock();
+                referenceRotateArgb32(&dst[0], &src32[0], src_w, src_h,
+                                      rotation);
+                best[1] = std::min(best[1], elapsedMs(start));
+
+                start = clock();
+                skin_blit_rotate_rgb565(
+                        reinterpret_cast<uint8_t*>(&dst[0]),
+                        rect.size.w * 4,
+                        reinterpret_cast<const uint8_t*>(&src16[0]),
+                        src_w, src_h, src_w * 2, &rect, rotation);
+                best[2] = std::min(best[2], elapsedMs(start));
+
+                start = clock();
+                referenceRotateRgb565(&dst[0], &src16[0], src_w, src_h,
+                                      rotation);
+                best[3] = std::min(best[3], elapsedMs(start));
+            }
+            printf("%dx%d rotation %3d: argb32 %6.2f ms (per pixel %6.2f), "
+                   "rgb565 %6.2f ms (per pixel %6.2f)\n",
+                   src_w, src_h, 90 * (int)rotation,
+                   best[0], best[1], best[2], best[3]);
+        }
+    }
+}
+
+}  // namespace android_skin
@@ -6,6 +6,7 @@ ANDROID_SKIN_QT_MOC_SRC_FILES :=
 ANDROID_SKIN_QT_RESOURCES :=
 
 ANDROID_SKIN_SOURCES := \
+    android/skin/blit.c \
     android/skin/charmap.c \
     android/skin/rect.c \
     android/skin/region.c \
@@ -11,6 +11,7 @@
 */
 #include "android/skin/window.h"
 
+#include "android/skin/blit.h"
 #include "android/skin/charmap.h"
 #include "android/skin/event.h"
 #include "android/skin/image.h"
@@ -19,7 +20,6 @@
 #include "android/utils/debug.h"
 #include "android/utils/setenv.h"
 #include "android/utils/system.h"
-#include "android/utils/duff.h"
 
 #include <math.h>
 #include <stdio.h>
@@ -165,20 +165,6 @@ static int adisplay_init(ADisplay* disp,
     return (disp->data == NULL) ? -1 : 0;
 }
 
-static __inline__ uint32_t rgb565_to_argb32(uint32_t pix) {
-#if 1
-    uint32_t r8 = ((pix & 0xf800) >>  8) | ((pix & 0xe000) >> 13);
-    uint32_t g8 = ((pix & 0x07e0) >>  3) | ((pix & 0x0600) >>  9);
-    uint32_t b8 = ((pix & 0x001f) <<  3) | ((pix & 0x001c) >>  2);
-    return (r8 << 16) | (g8 << 8) | (b8 << 0) | 0xff000000U;
-#else
-    uint32_t r8 = ((pix & 0xf800) << 8) | ((pix & 0xe000) >> 5);
-    uint32_t g8 = ((pix & 0x07e0) << 5) | ((pix & 0x0600) >> 1);
-    uint32_t b8 = ((pix & 0x001f) <<  3) | ((pix & 0x001c) >>  2);
-    return r8 | g8 | b8 | 0xff000000U;
-#endif
-}
-
 static void adisplay_set_onion(ADisplay* disp,
                                SkinImage* onion,
                                SkinRotation rotation,
@@ -329,225 +315,16 @@ static void lcd_brightness_argb32(uint32_t* pixels,
 
         alpha = alpha_min + ((alpha - b_min) * alpha_range) / (b_low - b_min);
 
-        for (; h > 0; h--) {
-            unsigned* line = (unsigned*) pixels;
-            int nn = 0;
-
-            DUFF4(w, {
-                unsigned c = line[nn];
-                unsigned ag = (c >> 8) & 0x00ff00ff;
-                unsigned rb = (c)      & 0x00ff00ff;
-
-                ag = (ag * alpha)        & 0xff00ff00;
-                rb = ((rb * alpha) >> 8) & 0x00ff00ff;
-
-                line[nn] = (unsigned)(ag | rb);
-                nn++;
-            });
-            pixels += (pitch / sizeof(uint32_t));
-        }
+        skin_blit_darken_argb32(pixels, w, h, pitch, alpha);
     }
     else if (alpha > LCD_BRIGHTNESS_HIGH) /* 'superluminous' mode */
     {
         const unsigned  alpha_max   = (255 * LCD_ALPHA_HIGH_MAX);
         const unsigned  alpha_range = (255 - alpha_max);
-        unsigned ialpha;
 
         alpha  = ((alpha - b_high) * alpha_range) / (b_max - b_high);
-        ialpha = 255 - alpha;
-
-        for ( ; h > 0; h-- ) {
-            unsigned* line = (unsigned*) pixels;
-            int nn = 0;
-
-            DUFF4(w, {
-                unsigned c = line[nn];
-                unsigned ag = (c >> 8) & 0x00ff00ff;
-                unsigned rb = (c)      & 0x00ff00ff;
-
-                /* interpolate towards bright white, i.e. 0x00ffffff */
-                ag = ((ag*ialpha + 0x00ff00ff*alpha)) & 0xff00ff00;
-                rb = ((rb*ialpha + 0x00ff00ff*alpha) >> 8) & 0x00ff00ff;
-
-                line[nn] = (unsigned)(ag | rb);
-                nn++;
-            });
-            pixels += (pitch / sizeof(uint32_t));
-        }
-    }
-}
-
-static void adisplay_update_surface_pixels_16(ADisplay* disp,
-                                              SkinRect* dst_rect,
-                                              uint8_t* dst_pixels,
-                                              int dst_pitch) {
-    int           x  = dst_rect->pos.x;
-    int           y  = dst_rect->pos.y;
-    int           w  = dst_rect->size.w;
-    int           h  = dst_rect->size.h;
-    int           src_w    = disp->datasize.w;
-    int           src_h    = disp->datasize.h;
-    int           src_pitch = src_w * 2;
-    uint8_t*      src_line  = (uint8_t*)disp->data;
-    uint8_t*      dst_line  = dst_pixels;
-    int           yy, xx;
-
-    switch ( disp->rotation & 3 )
-    {
-    case SKIN_ROTATION_0:
-        src_line += (x * 2) + (y * src_pitch);
-
-        for (yy = h; yy > 0; yy--) {
-            uint32_t* dst = (uint32_t*)dst_line;
-            uint16_t* src = (uint16_t*)src_line;
-
-            xx = 0;
-            DUFF4(w, {
-                dst[xx] = rgb565_to_argb32(src[xx]);
-                xx++;
-            });
-            src_line += src_pitch;
-            dst_line += dst_pitch;
-        }
-        break;
-
-    case SKIN_ROTATION_90:
-        src_line += (y * 2) + ((src_h - x - 1) * src_pitch);
-
-        for (yy = h; yy > 0; yy--) {
-            uint32_t* dst = (uint32_t*)dst_line;
-            uint8_t* src = src_line;
-
-            DUFF4(w, {
-                dst[0] = rgb565_to_argb32(((uint16_t*)src)[0]);
-                src -= src_pitch;
-                dst += 1;
-            });
-            src_line += 2;
-            dst_line += dst_pitch;
-        }
-        break;
-
-    case SKIN_ROTATION_180:
-        src_line += ((src_w - 1 - x) * 2) + ((src_h - 1 - y) * src_pitch);
-
-        for (yy = h; yy > 0; yy--) {
-            uint16_t* src = (uint16_t*)src_line;
-            uint32_t* dst = (uint32_t*)dst_line;
-
-            DUFF4(w, {
-                dst[0] = rgb565_to_argb32(src[0]);
-                src -= 1;
-                dst += 1;
-            });
-            src_line -= src_pitch;
-            dst_line += dst_pitch;
-    }
-    break;
-
-    default:  /* SKIN_ROTATION_270 */
-        src_line += ((src_w - 1 - y) * 2) + (x * src_pitch);
-
-        for (yy = h; yy > 0; yy--) {
-            uint32_t* dst = (uint32_t*)dst_line;
-            uint8_t* src = src_line;
-
-            DUFF4(w, {
-                dst[0] = rgb565_to_argb32(((uint16_t*)src)[0]);
-                dst += 1;
-                src += src_pitch;
-            });
-            src_line -= 2;
-            dst_line += dst_pitch;
-        }
-    }
-}
-
-static void adisplay_update_surface_pixels_32(ADisplay* disp,
-                                              SkinRect* rect,
-                                              uint8_t* dst_pixels,
-                                              int dst_pitch,
-                                              const void* src_pixels) {
-    int           x  = rect->pos.x;
-    int           y  = rect->pos.y;
-    int           w  = rect->size.w;
-    int           h  = rect->size.h;
-    int           src_w     = disp->datasize.w;
-    int           src_h     = disp->datasize.h;
-    uint8_t*      dst_line  = dst_pixels;
-    int           src_pitch = disp->datasize.w * 4;
-    const uint8_t* src_line  = (const uint8_t*)src_pixels;
-    int           yy;
-
-    switch ( disp->rotation & 3 )
-    {
-    case SKIN_ROTATION_0:
-        src_line += (x * 4) + (y * src_pitch);
-
-        for (yy = h; yy > 0; yy--) {
-            uint32_t*  src = (uint32_t*)src_line;
-            uint32_t*  dst = (uint32_t*)dst_line;
-
-            DUFF4(w, {
-                dst[0] = src[0];
-                dst++;
-                src++;
-            });
-            src_line += src_pitch;
-            dst_line += dst_pitch;
-        }
-        break;
-
-    case SKIN_ROTATION_90:
-        src_line += (y * 4) + ((src_h - x - 1) * src_pitch);
-
-        for (yy = h; yy > 0; yy--) {
-            uint32_t* dst = (uint32_t*)dst_line;
-            const uint8_t*  src = src_line;
-
-            DUFF4(w, {
-                dst[0] = *(uint32_t*)src;
-                src -= src_pitch;
-                dst += 1;
-            });
-            src_line += 4;
-            dst_line += dst_pitch;
-        }
-        break;
 
-    case SKIN_ROTATION_180:
-        src_line += ((src_w - 1 - x) * 4) + ((src_h - 1 - y) * src_pitch);
-
-        for (yy = h; yy > 0; yy--) {
-            const uint32_t*  src = (const uint32_t*)src_line;
-            uint32_t*  dst = (uint32_t*)dst_line;
-
-            DUFF4(w, {
-                dst[0] = src[0];
-                src -= 1;
-                dst += 1;
-            });
-            src_line -= src_pitch;
-            dst_line += dst_pitch;
-    }
-    break;
-
-    default:  /* SKIN_ROTATION_270 */
-        src_line += ((src_w - 1 - y) * 4) + (x * src_pitch);
-
-        for (yy = h; yy > 0; yy--)
-        {
-            uint32_t*  dst = (uint32_t*)dst_line;
-            const uint8_t*   src = src_line;
-
-            DUFF4(w, {
-                dst[0] = *(uint32_t*)src;
-                dst   += 1;
-                src   += src_pitch;
-            });
-            src_line -= 4;
-            dst_line += dst_pitch;
-        }
+        skin_blit_lighten_argb32(pixels, w, h, pitch, alpha);
     }
 }
 
@@ -584,10 +361,12 @@ static void adisplay_update_surface(ADisplay* disp,
     }
 
     // Allocate a temporary buffer to get the potentially rotated / converted
-    // content.
-    int sz = disp->datasize.h > disp->datasize.w ? disp->datasize.h : disp->datasize.w;
-    int dst_pitch = 4 * sz;
-    uint8_t* dst_pixels = calloc(sz, dst_pitch);
+    // content. Only the update rectangle is needed here.
+    int dst_pitch = 4 * w;
+    uint8_t* dst_pixels = malloc(dst_pitch * h);
+    if (!dst_pixels) {
+        return;
+    }
 
     SkinRect dst_r = {
         .pos.x = x,
@@ -597,23 +376,39 @@ static void adisplay_update_surface(ADisplay* disp,
 
     if (disp->gpu_frame) {
         // Content comes from the emulated GPU.
-        adisplay_update_surface_pixels_32(
-                disp, &dst_r, dst_pixels, dst_pitch, disp->gpu_frame);
-    } else {
+        skin_blit_rotate_argb32(dst_pixels,
+                                dst_pitch,
+                                disp->gpu_frame,
+                                disp->datasize.w,
+                                disp->datasize.h,
+                                disp->datasize.w * 4,
+                                &dst_r,
+                                disp->rotation);
+    } else if (disp->bits_per_pixel == 32) {
         // Content comes from the emulated framebuffer.
-        if (disp->bits_per_pixel == 32) {
-            adisplay_update_surface_pixels_32(
-                    disp, &dst_r, dst_pixels, dst_pitch, disp->data);
-        } else {
-            adisplay_update_surface_pixels_16(
-                    disp, &dst_r, dst_pixels, dst_pitch);
-        }
+        skin_blit_rotate_argb32(dst_pixels,
+                                dst_pitch,
+                                disp->data,
+                                disp->datasize.w,
+                                disp->datasize.h,
+                                disp->datasize.w * 4,
+                                &dst_r,
+                                disp->rotation);
+    } else {
+        skin_blit_rotate_rgb565(dst_pixels,
+                                dst_pitch,
+                                disp->data,
+                                disp->datasize.w,
+                                disp->datasize.h,
+                                disp->datasize.w * 2,
+                                &dst_r,
+                                disp->rotation);
     }
 
     // Apply brightness modulation.
     lcd_brightness_argb32((uint32_t*)dst_pixels,
-                          disp->datasize.w,
-                          disp->datasize.h,
+                          w,
+                          h,
                           dst_pitch,
                           disp->brightness);
 
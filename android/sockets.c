@@ -1210,6 +1210,16 @@ int socket_get_error(int fd)
     return socket_getoption(fd, SOL_SOCKET, SO_ERROR, -1);
 }
 
+int socket_get_rcvbuf(int fd)
+{
+    return socket_getoption(fd, SOL_SOCKET, SO_RCVBUF, -1);
+}
+
+int socket_get_sndbuf(int fd)
+{
+    return socket_getoption(fd, SOL_SOCKET, SO_SNDBUF, -1);
+}
+
 #ifdef _WIN32
 #include <stdlib.h>
 
@@ -203,7 +203,9 @@ void qemu_bh_update_timeout(int *timeout)
             if (bh->idle) {
                 /* idle bottom halves will be polled at least
                  * every 10ms */
-                *timeout = MIN(10, *timeout);
+                if (*timeout < 0 || *timeout > 10) {
+                    *timeout = 10;
+                }
             } else {
                 /* non-idle bottom halves will be executed
                  * immediately */
@@ -806,6 +806,8 @@ static int alsa_run_out (HWVoiceOut *hw, int live)
     decr = audio_MIN (live, avail);
     decr = audio_pcm_hw_clip_out (hw, alsa->pcm_buf, decr, alsa->pending);
     alsa->pending += decr;
+    /* frames queued in the device, plus those still to be written to it */
+    hw->delay = audio_MAX (hw->samples - (int) avail, 0) + alsa->pending;
     alsa_write_pending (alsa);
     return decr;
 }
@@ -25,7 +25,9 @@
 #include "hw/hw.h"
 #include "audio.h"
 #include "monitor/monitor.h"
+#include "qemu/atomic.h"
 #include "qemu/timer.h"
+#include "sysemu/char.h"
 #include "sysemu/sysemu.h"
 
 #define AUDIO_CAP "audio"
@@ -160,6 +162,9 @@ static struct {
     int log_to_monitor;
     int try_poll_in;
     int try_poll_out;
+    int timer_poll_out;
+    int watermark;
+    int resample_quality;
 } conf = {
     .fixed_out = { /* DAC fixed settings */
         .enabled = 1,
@@ -190,6 +195,9 @@ static struct {
     .log_to_monitor = 0,
     .try_poll_in = 1,
     .try_poll_out = 1,
+    .timer_poll_out = 0,
+    .watermark = 10,
+    .resample_quality = RATE_QUALITY_MEDIUM,
 };
 
 static AudioState glob_audio_state;
@@ -914,7 +922,8 @@ static int audio_attach_capture (HWVoiceOut *hw)
         sw->active = hw->enabled;
         sw->conv = noop_conv;
         sw->ratio = ((int64_t) hw_cap->info.freq << 32) / sw->info.freq;
-        sw->rate = st_rate_start (sw->info.freq, hw_cap->info.freq);
+        sw->rate = st_rate_start (sw->info.freq, hw_cap->info.freq,
+                                  conf.resample_quality);
         if (!sw->rate) {
             dolog ("Could not start rate conversion for `%s'\n", SW_NAME (sw));
             g_free (sw);
@@ -1133,6 +1142,9 @@ int audio_pcm_sw_write (SWVoiceOut *sw, void *buf, int size)
     dead = hwsamples - live;
     swlim = ((int64_t) dead << 32) / sw->ratio;
     swlim = audio_MIN (swlim, samples);
+    /* sw->buf holds hwsamples samples, which is less than what fits in the
+       dead area when downsampling */
+    swlim = audio_MIN (swlim, hwsamples);
     if (swlim) {
         sw->conv (sw->buf, buf, swlim, &sw->vol);
     }
@@ -1192,7 +1204,29 @@ static void audio_pcm_print_info (const char *cap, struct audio_pcm_info *info)
 
 /*
  * Timer
+ *
+ * Host voices that are not in poll mode are run from audio_timer() every
+ * conf.period.ticks. Voices in poll mode ask for data themselves when less
+ * than a watermark is left to play: ALSA and OSS from their descriptors,
+ * PulseAudio from its writer thread with audio_notify(), and, with
+ * DAC_TIMER_POLL, the drivers that play at the pace of the virtual clock by
+ * arming the timer with audio_run_at(). Once every enabled voice is in poll mode, the timer no
+ * longer fires periodically.
  */
+static int audio_is_timer_needed (void)
+{
+    HWVoiceIn *hwi = NULL;
+    HWVoiceOut *hwo = NULL;
+
+    while ((hwo = audio_pcm_hw_find_any_enabled_out (hwo))) {
+        if (!hwo->poll_mode) return 1;
+    }
+    while ((hwi = audio_pcm_hw_find_any_enabled_in (hwi))) {
+        if (!hwi->poll_mode) return 1;
+    }
+    return 0;
+}
+
 static void audio_timer (void *opaque)
 {
     AudioState *s = opaque;
@@ -1226,34 +1260,112 @@ static void audio_timer (void *opaque)
     last = now;
 #endif
 
+    /* re-armed first, so that audio_run_at() can only bring it closer */
+    if (audio_is_timer_needed ()) {
+        s->stats.timer_runs++;
+        timer_mod(s->ts, qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL) + conf.period.ticks);
+    }
     audio_run ("timer");
-    timer_mod(s->ts, qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL) + conf.period.ticks);
 }
 
+static void audio_reset_timer (void)
+{
+    AudioState *s = &glob_audio_state;
 
-static int audio_is_timer_needed (void)
+    /* voices in poll mode reschedule themselves from the first run */
+    if (audio_pcm_hw_find_any_enabled_out (NULL) ||
+        audio_pcm_hw_find_any_enabled_in (NULL)) {
+        timer_mod(s->ts, qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL) + 1);
+    }
+    else {
+        timer_del(s->ts);
+    }
+}
+
+void audio_run_at (int64_t when)
 {
-    HWVoiceIn *hwi = NULL;
-    HWVoiceOut *hwo = NULL;
+    AudioState *s = &glob_audio_state;
 
-    while ((hwo = audio_pcm_hw_find_any_enabled_out (hwo))) {
-        if (!hwo->poll_mode) return 1;
+    if (!timer_pending (s->ts) ||
+        when < (int64_t) timer_expire_time_ns (s->ts)) {
+        timer_mod (s->ts, when);
     }
-    while ((hwi = audio_pcm_hw_find_any_enabled_in (hwi))) {
-        if (!hwi->poll_mode) return 1;
+}
+
+#ifndef _WIN32
+static void audio_notify_read (void *opaque)
+{
+    AudioState *s = opaque;
+    char buf[64];
+
+    while (read (s->notify_fds[0], buf, sizeof (buf)) > 0) {
     }
-    return 0;
+    /* requests made from now on need another wakeup */
+    atomic_xchg (&s->notify_pending, 0);
+    audio_run ("notify");
 }
 
-static void audio_reset_timer (void)
+/* Can be called from any thread: runs the mixer from the main loop as
+   soon as possible. Requests made before it gets to run are merged. */
+void audio_notify (void)
 {
     AudioState *s = &glob_audio_state;
+    char byte = 0;
 
-    if (audio_is_timer_needed ()) {
-        timer_mod(s->ts, qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL) + 1);
+    if (s->notify_fds[1] < 0 || atomic_xchg (&s->notify_pending, 1)) {
+        return;
     }
-    else {
-        timer_del(s->ts);
+    if (write (s->notify_fds[1], &byte, 1) != 1) {
+        /* the pipe is full, so a wakeup is pending already */
+    }
+}
+
+static void audio_notify_init (AudioState *s)
+{
+    s->notify_fds[0] = s->notify_fds[1] = -1;
+    s->notify_pending = 0;
+
+    if (qemu_pipe (s->notify_fds) < 0) {
+        dolog ("Could not create notification pipe: %s\n"
+               "Polled voices will not be able to ask for data\n",
+               strerror (errno));
+        s->notify_fds[0] = s->notify_fds[1] = -1;
+        return;
+    }
+    fcntl (s->notify_fds[0], F_SETFL, O_NONBLOCK);
+    fcntl (s->notify_fds[1], F_SETFL, O_NONBLOCK);
+    qemu_set_fd_handler (s->notify_fds[0], audio_notify_read, NULL, s);
+}
+#endif
+
+void audio_pcm_hw_set_poll_out (HWVoiceOut *hw, int poll_mode)
+{
+    hw->poll_mode = poll_mode;
+    if (poll_mode) {
+        int watermark = muldiv64 (conf.watermark, hw->info.freq, 1000);
+
+        hw->watermark = audio_MAX (audio_MIN (watermark, hw->samples / 2), 1);
+    }
+}
+
+/* The drivers that play at the pace of the virtual clock only know that a
+   card has new data when it calls AUD_wakeup_out(), which not every card
+   does, so they stay on the periodic timer unless DAC_TIMER_POLL is set. */
+void audio_pcm_hw_set_timer_poll_out (HWVoiceOut *hw, int poll_mode)
+{
+    audio_pcm_hw_set_poll_out (hw, poll_mode && conf.timer_poll_out);
+}
+
+/* For drivers that play at the pace of the virtual clock: when a polled
+   voice had @live samples to play, the mixer tops it up to twice the
+   watermark on the same run, so it needs data again one watermark later.
+   Idle voices are restarted by AUD_wakeup_out(). */
+void audio_pcm_hw_schedule_out (HWVoiceOut *hw, int live)
+{
+    if (hw->poll_mode && live) {
+        audio_run_at (qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL) +
+                      muldiv64 (hw->watermark, get_ticks_per_sec (),
+                                hw->info.freq));
     }
 }
 
@@ -1296,6 +1408,21 @@ int AUD_read (SWVoiceIn *sw, void *buf, int size)
     return bytes;
 }
 
+void AUD_wakeup_out (SWVoiceOut *sw)
+{
+    HWVoiceOut *hw;
+
+    if (!sw || !sw->active) {
+        return;
+    }
+
+    hw = sw->hw;
+    if (hw->poll_mode && hw->watermark &&
+        audio_pcm_hw_get_live_out (hw, NULL) < hw->watermark) {
+        audio_run_at (qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL));
+    }
+}
+
 int AUD_get_buffer_size_out (SWVoiceOut *sw)
 {
     return sw->hw->samples << sw->hw->info.shift;
@@ -1414,7 +1541,7 @@ static int audio_get_avail (SWVoiceIn *sw)
 
 static int audio_get_free (SWVoiceOut *sw)
 {
-    int live, dead;
+    int live, dead, limit;
 
     if (!sw) {
         return 0;
@@ -1427,7 +1554,17 @@ static int audio_get_free (SWVoiceOut *sw)
         return 0;
     }
 
-    dead = sw->hw->samples - live;
+    /* a voice that asks for data at the watermark is only mixed that much
+       ahead again, which is what bounds its latency */
+    limit = sw->hw->samples;
+    if (sw->hw->poll_mode && sw->hw->watermark) {
+        limit = audio_MIN (limit, 2 * sw->hw->watermark);
+    }
+    if (live >= limit) {
+        return 0;
+    }
+
+    dead = limit - live;
 
 #ifdef DEBUG_OUT
     dolog ("%s: get_free live %d dead %d ret %" PRId64 "\n",
@@ -1475,6 +1612,40 @@ static void audio_capture_mix_and_clear (HWVoiceOut *hw, int rpos, int samples)
     mixeng_clear (hw->mix_buf, samples - n);
 }
 
+static void audio_pcm_hw_fill_out (HWVoiceOut *hw)
+{
+    SWVoiceOut *sw;
+
+    for (sw = hw->sw_head.lh_first; sw; sw = sw->entries.le_next) {
+        if (sw->active) {
+            int free = audio_get_free (sw);
+            if (free > 0) {
+                sw->callback.fn (sw->callback.opaque, free);
+            }
+        }
+    }
+}
+
+static void audio_update_latency (AudioState *s, HWVoiceOut *hw)
+{
+    int samples = audio_pcm_hw_get_live_out (hw, NULL) + hw->delay;
+    int64_t ns;
+
+    if (samples <= 0) {
+        return;
+    }
+
+    ns = muldiv64 (samples, get_ticks_per_sec (), hw->info.freq);
+    if (!s->stats.latency_min_ns || ns < s->stats.latency_min_ns) {
+        s->stats.latency_min_ns = ns;
+    }
+    if (ns > s->stats.latency_max_ns) {
+        s->stats.latency_max_ns = ns;
+    }
+    s->stats.latency_sum_ns += ns;
+    s->stats.latency_count++;
+}
+
 static void audio_run_out (AudioState *s)
 {
     HWVoiceOut *hw = NULL;
@@ -1484,6 +1655,12 @@ static void audio_run_out (AudioState *s)
         int played;
         int live, free, nb_live, cleanup_required, prev_rpos;
 
+        if (hw->poll_mode) {
+            /* the host asked for data: have the cards write theirs now
+               so that it goes out on this run rather than the next one */
+            audio_pcm_hw_fill_out (hw);
+        }
+
         live = audio_pcm_hw_get_live_out (hw, &nb_live);
         if (!nb_live) {
             live = 0;
@@ -1510,13 +1687,8 @@ static void audio_run_out (AudioState *s)
         }
 
         if (!live) {
-            for (sw = hw->sw_head.lh_first; sw; sw = sw->entries.le_next) {
-                if (sw->active) {
-                    free = audio_get_free (sw);
-                    if (free > 0) {
-                        sw->callback.fn (sw->callback.opaque, free);
-                    }
-                }
+            if (!hw->poll_mode) {
+                audio_pcm_hw_fill_out (hw);
             }
             continue;
         }
@@ -1565,6 +1737,8 @@ static void audio_run_out (AudioState *s)
             }
         }
 
+        audio_update_latency (s, hw);
+
         if (cleanup_required) {
             SWVoiceOut *sw1;
 
@@ -1663,6 +1837,7 @@ void audio_run (const char *msg)
 {
     AudioState *s = &glob_audio_state;
 
+    s->stats.runs++;
     audio_run_out (s);
     audio_run_in (s);
     audio_run_capture (s);
@@ -1722,6 +1897,19 @@ static struct audio_option audio_options[] = {
         .valp  = &conf.try_poll_out,
         .descr = "Attempt using poll mode for DAC"
     },
+    {
+        .name  = "DAC_TIMER_POLL",
+        .tag   = AUD_OPT_BOOL,
+        .valp  = &conf.timer_poll_out,
+        .descr = "Use poll mode for the none and wav DACs (the sound card "
+                 "must call AUD_wakeup_out)"
+    },
+    {
+        .name  = "DAC_WATERMARK",
+        .tag   = AUD_OPT_INT,
+        .valp  = &conf.watermark,
+        .descr = "Milliseconds left to play when a polled DAC asks for more"
+    },
     /* ADC */
     {
         .name  = "ADC_FIXED_SETTINGS",
@@ -1778,6 +1966,13 @@ static struct audio_option audio_options[] = {
         .valp  = &conf.log_to_monitor,
         .descr = "Print logging messages to monitor instead of stderr"
     },
+    {
+        .name  = "RESAMPLE_QUALITY",
+        .tag   = AUD_OPT_INT,
+        .valp  = &conf.resample_quality,
+        .descr = "Sample rate conversion quality "
+                 "(0 = linear, 1 = low, 2 = medium, 3 = high)"
+    },
     { /* End of list */ }
 };
 
@@ -1969,6 +2164,9 @@ static void audio_init (void)
         dolog ("Could not create audio timer\n");
         return;
     }
+#ifndef _WIN32
+    audio_notify_init (s);
+#endif
 
     audio_process_options ("AUDIO", audio_options);
 
@@ -2027,6 +2225,19 @@ static void audio_init (void)
         }
     }
 
+    if (conf.resample_quality < RATE_QUALITY_LINEAR ||
+        conf.resample_quality >= RATE_QUALITY_COUNT) {
+        dolog ("warning: Invalid resample quality %d, using %d\n",
+               conf.resample_quality, RATE_QUALITY_MEDIUM);
+        conf.resample_quality = RATE_QUALITY_MEDIUM;
+    }
+
+    if (conf.watermark <= 0) {
+        dolog ("warning: Invalid DAC watermark %d ms, using 10\n",
+               conf.watermark);
+        conf.watermark = 10;
+    }
+
     if (conf.period.hertz <= 0) {
         if (conf.period.hertz < 0) {
             dolog ("warning: Timer period is negative - %d "
@@ -2211,3 +2422,25 @@ void AUD_set_volume_in (SWVoiceIn *sw, int mute, uint8_t lvol, uint8_t rvol)
         sw->vol.r = nominal_volume.r * rvol / 255;
     }
 }
+
+void AUD_get_stats (AudioStats *stats)
+{
+    AudioState *s = &glob_audio_state;
+    HWVoiceOut *hw = NULL;
+
+    *stats = s->stats;
+    stats->driver = s->drv ? s->drv->name : NULL;
+    stats->polled_voices = 0;
+    stats->timed_voices = 0;
+    while ((hw = audio_pcm_hw_find_any_enabled_out (hw))) {
+        if (hw->poll_mode) {
+            stats->polled_voices++;
+        }
+        else {
+            stats->timed_voices++;
+        }
+    }
+
+    s->stats.latency_min_ns = 0;
+    s->stats.latency_max_ns = 0;
+}
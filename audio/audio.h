@@ -142,9 +142,31 @@ int  AUD_is_active_in (SWVoiceIn *sw);
 void     AUD_init_time_stamp_in (SWVoiceIn *sw, QEMUAudioTimeStamp *ts);
 uint64_t AUD_get_elapsed_usec_in (SWVoiceIn *sw, QEMUAudioTimeStamp *ts);
 
+/* Tell the audio layer that the card behind @sw has new data to play.
+ * Voices mixed by the audio timer pick it up on the next tick anyway,
+ * but a host voice in poll mode that is running dry only asks for more
+ * once it has data, so this restarts it. */
+void AUD_wakeup_out (SWVoiceOut *sw);
+
+typedef struct AudioStats {
+    const char *driver;        /* host driver name */
+    uint64_t    runs;          /* mixer runs */
+    uint64_t    timer_runs;    /* ... of which from the periodic timer */
+    int         polled_voices; /* enabled host voices asking for data */
+    int         timed_voices;  /* enabled host voices run by the timer */
+    /* time between mixing a sample and the host playing it, measured
+     * on each run that has something to play */
+    uint64_t    latency_count;
+    int64_t     latency_sum_ns;
+    int64_t     latency_min_ns; /* min and max since the previous call */
+    int64_t     latency_max_ns;
+} AudioStats;
+
+void AUD_get_stats (AudioStats *stats);
+
 static inline void *advance (void *p, int incr)
 {
-    uint8_t *d = p;
+    uint8_t *d = (uint8_t *) p;
     return (d + incr);
 }
 
@@ -82,6 +82,11 @@ typedef struct HWVoiceOut {
     struct st_sample *mix_buf;
 
     int samples;
+    /* in poll mode, samples left to play when the driver asks for more,
+       zero if the driver has its own threshold */
+    int watermark;
+    /* samples taken from mix_buf but not played yet, if the driver knows */
+    int delay;
     QLIST_HEAD (sw_out_listhead, SWVoiceOut) sw_head;
     QLIST_HEAD (sw_cap_listhead, SWVoiceCap) cap_head;
     struct audio_pcm_ops *pcm_ops;
@@ -199,6 +204,11 @@ struct AudioState {
     int nb_hw_voices_out;
     int nb_hw_voices_in;
     int vm_running;
+#ifndef _WIN32
+    int notify_fds[2];
+    int notify_pending;
+#endif
+    AudioStats stats;
 };
 
 extern struct audio_driver no_audio_driver;
@@ -230,6 +240,14 @@ int audio_bug (const char *funcname, int cond);
 void *audio_calloc (const char *funcname, int nmemb, size_t size);
 
 void audio_run (const char *msg);
+void audio_run_at (int64_t when);
+#ifndef _WIN32
+void audio_notify (void);
+#endif
+
+void audio_pcm_hw_set_poll_out (HWVoiceOut *hw, int poll_mode);
+void audio_pcm_hw_set_timer_poll_out (HWVoiceOut *hw, int poll_mode);
+void audio_pcm_hw_schedule_out (HWVoiceOut *hw, int live);
 
 #define VOICE_ENABLE 1
 #define VOICE_DISABLE 2
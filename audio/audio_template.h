@@ -122,9 +122,11 @@ static int glue (audio_pcm_sw_alloc_resources_, TYPE) (SW *sw)
     }
 
 #ifdef DAC
-    sw->rate = st_rate_start (sw->info.freq, sw->hw->info.freq);
+    sw->rate = st_rate_start (sw->info.freq, sw->hw->info.freq,
+                              conf.resample_quality);
 #else
-    sw->rate = st_rate_start (sw->hw->info.freq, sw->info.freq);
+    sw->rate = st_rate_start (sw->hw->info.freq, sw->info.freq,
+                              conf.resample_quality);
 #endif
     if (!sw->rate) {
         g_free (sw->buf);
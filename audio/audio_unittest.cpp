@@ -0,0 +1,281 @@
+// Copyright 2014 The Android Open Source Project
+//
+// This software is licensed under the terms of the GNU General Public
+// License version 2, as published by the Free Software Foundation, and
+// may be copied, distributed, and modified under those terms.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+#include <gtest/gtest.h>
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/time.h>
+
+#include <vector>
+
+// The QEMU headers include C library headers, which must not end up in
+// the extern "C" block when first seen.
+
+extern "C" {
+#include "audio/testing/audio_test_driver.h"
+#include "audio_int.h"
+}
+
+// These tests feed voices through audio_pcm_sw_write() and
+// audio_run_out(), which mix them into the memory driver of
+// audio/testing/audio_test_driver.c.
+
+namespace {
+
+// A card's voice that plays |pcm| in a loop, |chunk| frames at a time
+// at most, whenever the mixer asks for data.
+class TestVoice {
+public:
+    TestVoice(int freq, int channels, const std::vector<int16_t>& pcm,
+              int chunk)
+            : mPcm(pcm), mChannels(channels), mChunk(chunk), mPos(0),
+              mWritten(0), mVoice(NULL) {
+        memset(&mCard, 0, sizeof(mCard));
+        mCard.name = const_cast<char*>("test");
+        struct audsettings as;
+        as.freq = freq;
+        as.nchannels = channels;
+        as.fmt = AUD_FMT_S16;
+        as.endianness = AUDIO_HOST_ENDIANNESS;
+        mVoice = AUD_open_out(&mCard, NULL, "test", this, callback, &as);
+        if (mVoice) {
+            AUD_set_active_out(mVoice, 1);
+        }
+    }
+
+    ~TestVoice() {
+        if (mVoice) {
+            AUD_close_out(&mCard, mVoice);
+        }
+    }
+
+    bool ok() const { return mVoice != NULL; }
+    int64_t written() const { return mWritten; }
+
+    // Write as much as the voice accepts.
+    void fill() { callback(this, 1 << 20); }
+
+private:
+    static void callback(void* opaque, int avail) {
+        TestVoice* voice = static_cast<TestVoice*>(opaque);
+        const int frameSize = 2 * voice->mChannels;
+        const int frames = static_cast<int>(voice->mPcm.size()) /
+                           voice->mChannels;
+        int wanted = avail / frameSize;
+        while (wanted > 0) {
+            int n = frames - voice->mPos;
+            if (n > voice->mChunk) {
+                n = voice->mChunk;
+            }
+            if (n > wanted) {
+                n = wanted;
+            }
+            int written = AUD_write(
+                    voice->mVoice,
+                    const_cast<int16_t*>(&voice->mPcm[voice->mPos *
+                                                      voice->mChannels]),
+                    n * frameSize) / frameSize;
+            voice->mWritten += written;
+            voice->mPos = (voice->mPos + written) % frames;
+            wanted -= written;
+            if (written < n) {
+                break;
+            }
+        }
+    }
+
+    std::vector<int16_t> mPcm;
+    int mChannels;
+    int mChunk;
+    int mPos;
+    int64_t mWritten;
+    QEMUSoundCard mCard;
+    SWVoiceOut* mVoice;
+};
+
+std::vector<int16_t> sine(double freq, int rate, int channels, int frames) {
+    std::vector<int16_t> pcm(frames * channels);
+    for (int n = 0; n < frames; ++n) {
+        int16_t v = static_cast<int16_t>(12000 * sin(2 * M_PI * freq * n /
+                                                     rate));
+        pcm[n * channels] = v;
+        if (channels == 2) {
+            pcm[n * channels + 1] = -v;
+        }
+    }
+    return pcm;
+}
+
+void captureNotify(void* opaque, audcnotification_e cmd) {}
+
+void captureDestroy(void* opaque) {}
+
+void captureData(void* opaque, void* buf, int size) {
+    *static_cast<int64_t*>(opaque) += size;
+}
+
+double nowSeconds() {
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+}  // namespace
+
+TEST(audio, PlaysVoiceUnchanged) {
+    audio_test_init(RATE_QUALITY_MEDIUM);
+
+    // A voice at the rate of the hardware is not resampled. The integer
+    // engine clips from 0x7f000000, i.e. 32512 in S16.
+    std::vector<int16_t> pcm(AUDIO_TEST_FREQ * 2);
+    for (size_t n = 0; n < pcm.size(); ++n) {
+        pcm[n] = static_cast<int16_t>((n * 7919) % 64000 - 32000);
+    }
+    std::vector<int16_t> out(AUDIO_TEST_FREQ * 2);
+    audio_test_record(&out[0], AUDIO_TEST_FREQ);
+
+    TestVoice voice(AUDIO_TEST_FREQ, 2, pcm, 1000);
+    ASSERT_TRUE(voice.ok());
+    voice.fill();
+    for (int n = 0; n < 1000 && audio_test_recorded() < AUDIO_TEST_FREQ;
+         ++n) {
+        audio_test_run();
+    }
+    ASSERT_EQ(AUDIO_TEST_FREQ, audio_test_recorded());
+    EXPECT_TRUE(out == pcm);
+}
+
+TEST(audio, ResamplesVoices) {
+    const struct {
+        int freq;
+        int channels;
+    } kVoices[] = {
+        { 8000, 1 },
+        { 22050, 1 },
+        { 48000, 2 },
+    };
+    for (size_t v = 0; v < sizeof(kVoices) / sizeof(kVoices[0]); ++v) {
+        audio_test_init(RATE_QUALITY_MEDIUM);
+        std::vector<int16_t> out(AUDIO_TEST_FREQ * 2);
+        audio_test_record(&out[0], AUDIO_TEST_FREQ);
+
+        // A whole number of periods, as the voice loops over it.
+        TestVoice voice(kVoices[v].freq, kVoices[v].channels,
+                        sine(1000, kVoices[v].freq, kVoices[v].channels,
+                             kVoices[v].freq),
+                        4096);
+        ASSERT_TRUE(voice.ok());
+        voice.fill();
+        for (int n = 0; n < 1000 && audio_test_recorded() < AUDIO_TEST_FREQ;
+             ++n) {
+            audio_test_run();
+        }
+        ASSERT_EQ(AUDIO_TEST_FREQ, audio_test_recorded());
+
+        // The voice is consumed at its own rate.
+        const double ratio = static_cast<double>(voice.written()) /
+                             audio_test_played();
+        EXPECT_NEAR(static_cast<double>(kVoices[v].freq) / AUDIO_TEST_FREQ,
+                    ratio, 0.05) << kVoices[v].freq << " Hz";
+
+        // And comes out as a 1 kHz tone of the same level on the left
+        // channel, past the start of the filters.
+        double sum = 0;
+        for (int n = 1000; n < AUDIO_TEST_FREQ; ++n) {
+            sum += static_cast<double>(out[2 * n]) * out[2 * n];
+        }
+        const double rms = sqrt(sum / (AUDIO_TEST_FREQ - 1000));
+        EXPECT_NEAR(12000 / sqrt(2.), rms, 12000 * 0.01)
+                << kVoices[v].freq << " Hz";
+    }
+}
+
+// Not a pass/fail test: measures the mixer's cost per hardware frame for
+// typical sets of guest voices, with and without a capture.
+TEST(audio, Benchmark) {
+    const struct {
+        int voices;
+        bool capture;
+        int quality;
+    } kRuns[] = {
+        { 1, false, RATE_QUALITY_MEDIUM },
+        { 1, true, RATE_QUALITY_MEDIUM },
+        { 4, true, RATE_QUALITY_LINEAR },
+        { 4, true, RATE_QUALITY_MEDIUM },
+        { 4, true, RATE_QUALITY_HIGH },
+    };
+    const struct {
+        int freq;
+        int channels;
+    } kVoices[] = {
+        { 44100, 2 },
+        { 48000, 2 },
+        { 22050, 1 },
+        { 8000, 1 },
+    };
+    const int kIterations = 5000;
+
+    for (size_t r = 0; r < sizeof(kRuns) / sizeof(kRuns[0]); ++r) {
+        audio_test_init(kRuns[r].quality);
+
+        int64_t captured = 0;
+        CaptureVoiceOut* cap = NULL;
+        if (kRuns[r].capture) {
+            struct audsettings as;
+            as.freq = AUDIO_TEST_FREQ;
+            as.nchannels = 2;
+            as.fmt = AUD_FMT_S16;
+            as.endianness = AUDIO_HOST_ENDIANNESS;
+            struct audio_capture_ops ops;
+            ops.notify = captureNotify;
+            ops.capture = captureData;
+            ops.destroy = captureDestroy;
+            cap = AUD_add_capture(&as, &ops, &captured);
+            ASSERT_TRUE(cap != NULL);
+        }
+
+        std::vector<TestVoice*> voices;
+        for (int v = 0; v < kRuns[r].voices; ++v) {
+            voices.push_back(new TestVoice(
+                    kVoices[v].freq, kVoices[v].channels,
+                    sine(997, kVoices[v].freq, kVoices[v].channels, 8192),
+                    4096));
+            ASSERT_TRUE(voices.back()->ok());
+            voices.back()->fill();
+        }
+
+        const double start = nowSeconds();
+        for (int n = 0; n < kIterations; ++n) {
+            audio_test_run();
+        }
+        const double elapsed = nowSeconds() - start;
+        const int64_t played = audio_test_played();
+        ASSERT_GT(played, 0);
+        if (kRuns[r].capture) {
+            EXPECT_GT(captured, 0);
+        }
+
+        printf("%d voice(s)%s, quality %d: %.1f ns per frame, "
+               "%.3f%% of a core\n",
+               kRuns[r].voices, kRuns[r].capture ? " + capture" : "",
+               kRuns[r].quality, elapsed * 1e9 / played,
+               100. * elapsed * AUDIO_TEST_FREQ / played);
+
+        for (size_t v = 0; v < voices.size(); ++v) {
+            delete voices[v];
+        }
+        if (cap) {
+            AUD_del_capture(cap, &captured);
+        }
+    }
+}
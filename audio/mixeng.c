@@ -25,6 +25,11 @@
 #include "qemu-common.h"
 #include "audio.h"
 
+#include <math.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
 #define AUDIO_CAP "mixeng"
 #include "audio_int.h"
 
@@ -143,6 +148,259 @@
 #undef IN_T
 #undef SHIFT
 
+/*
+ * Vectorized versions of the host endian signed 16 bit conversions, which
+ * is what nearly every guest device and host backend uses.  They produce
+ * the exact same samples as the generic ones above and fall back to them
+ * for the last few samples of a buffer.
+ */
+#if defined(__SSE2__) && !defined(CONFIG_MIXEMU)
+
+#ifdef FLOAT_MIXENG
+
+static void conv_s16_to_stereo_sse2 (struct st_sample *dst, const void *src,
+                                     int samples, struct mixeng_volume *vol)
+{
+    const int16_t *in = src;
+    float *out = (float *) dst;
+    const __m128 scale = _mm_set1_ps ((mixeng_real) SHRT_MAX -
+                                      (mixeng_real) SHRT_MIN);
+    int i, n = samples & ~3;
+
+    for (i = 0; i < n; i += 4) {
+        __m128i v = _mm_loadu_si128 ((const __m128i *) (in + i * 2));
+        __m128i lo = _mm_srai_epi32 (_mm_unpacklo_epi16 (v, v), 16);
+        __m128i hi = _mm_srai_epi32 (_mm_unpackhi_epi16 (v, v), 16);
+
+        _mm_storeu_ps (out + i * 2, _mm_div_ps (_mm_cvtepi32_ps (lo), scale));
+        _mm_storeu_ps (out + i * 2 + 4,
+                       _mm_div_ps (_mm_cvtepi32_ps (hi), scale));
+    }
+    conv_natural_int16_t_to_stereo (dst + n, in + n * 2, samples - n, vol);
+}
+
+static void conv_s16_to_mono_sse2 (struct st_sample *dst, const void *src,
+                                   int samples, struct mixeng_volume *vol)
+{
+    const int16_t *in = src;
+    float *out = (float *) dst;
+    const __m128 scale = _mm_set1_ps ((mixeng_real) SHRT_MAX -
+                                      (mixeng_real) SHRT_MIN);
+    int i, n = samples & ~3;
+
+    for (i = 0; i < n; i += 4) {
+        __m128i v = _mm_loadl_epi64 ((const __m128i *) (in + i));
+        __m128 f = _mm_div_ps (
+            _mm_cvtepi32_ps (_mm_srai_epi32 (_mm_unpacklo_epi16 (v, v), 16)),
+            scale);
+
+        _mm_storeu_ps (out + i * 2, _mm_unpacklo_ps (f, f));
+        _mm_storeu_ps (out + i * 2 + 4, _mm_unpackhi_ps (f, f));
+    }
+    conv_natural_int16_t_to_mono (dst + n, in + n, samples - n, vol);
+}
+
+/* Clip 8 samples to [-0.5, 0.5) and convert them, see clip_natural_int16_t */
+static inline __m128i clip_s16x8_sse2 (__m128 a, __m128 b)
+{
+    const __m128 scale = _mm_set1_ps (SHRT_MAX - SHRT_MIN);
+    const __m128 max = _mm_set1_ps (0.5f);
+    const __m128 min = _mm_set1_ps (-0.5f);
+    __m128i va = _mm_cvttps_epi32 (_mm_mul_ps (a, scale));
+    __m128i vb = _mm_cvttps_epi32 (_mm_mul_ps (b, scale));
+    __m128i v = _mm_packs_epi32 (va, vb);
+    __m128i hi = _mm_packs_epi32 (_mm_castps_si128 (_mm_cmpge_ps (a, max)),
+                                  _mm_castps_si128 (_mm_cmpge_ps (b, max)));
+    __m128i lo = _mm_packs_epi32 (_mm_castps_si128 (_mm_cmplt_ps (a, min)),
+                                  _mm_castps_si128 (_mm_cmplt_ps (b, min)));
+
+    v = _mm_or_si128 (_mm_andnot_si128 (hi, v),
+                      _mm_and_si128 (hi, _mm_set1_epi16 (SHRT_MAX)));
+    return _mm_or_si128 (_mm_andnot_si128 (lo, v),
+                         _mm_and_si128 (lo, _mm_set1_epi16 (SHRT_MIN)));
+}
+
+static void clip_s16_from_stereo_sse2 (void *dst, const struct st_sample *src,
+                                       int samples)
+{
+    const float *in = (const float *) src;
+    int16_t *out = dst;
+    int i, n = samples & ~3;
+
+    for (i = 0; i < n; i += 4) {
+        __m128i v = clip_s16x8_sse2 (_mm_loadu_ps (in + i * 2),
+                                     _mm_loadu_ps (in + i * 2 + 4));
+        _mm_storeu_si128 ((__m128i *) (out + i * 2), v);
+    }
+    clip_natural_int16_t_from_stereo (out + n * 2, src + n, samples - n);
+}
+
+static void clip_s16_from_mono_sse2 (void *dst, const struct st_sample *src,
+                                     int samples)
+{
+    const float *in = (const float *) src;
+    int16_t *out = dst;
+    int i, n = samples & ~7;
+
+    for (i = 0; i < n; i += 8) {
+        __m128 s[4], l, r;
+        int k;
+
+        for (k = 0; k < 4; k++) {
+            s[k] = _mm_loadu_ps (in + i * 2 + k * 4);
+        }
+        l = _mm_shuffle_ps (s[0], s[1], _MM_SHUFFLE (2, 0, 2, 0));
+        r = _mm_shuffle_ps (s[0], s[1], _MM_SHUFFLE (3, 1, 3, 1));
+        s[0] = _mm_add_ps (l, r);
+        l = _mm_shuffle_ps (s[2], s[3], _MM_SHUFFLE (2, 0, 2, 0));
+        r = _mm_shuffle_ps (s[2], s[3], _MM_SHUFFLE (3, 1, 3, 1));
+        s[1] = _mm_add_ps (l, r);
+        _mm_storeu_si128 ((__m128i *) (out + i), clip_s16x8_sse2 (s[0], s[1]));
+    }
+    clip_natural_int16_t_from_mono (out + n, src + n, samples - n);
+}
+
+#else  /* !FLOAT_MIXENG */
+
+/* Sign extend the 32 bit values of v to 64 bit, 2 by 2 */
+static inline void sext_s32x4_sse2 (__m128i v, __m128i *lo, __m128i *hi)
+{
+    __m128i sign = _mm_srai_epi32 (v, 31);
+
+    *lo = _mm_unpacklo_epi32 (v, sign);
+    *hi = _mm_unpackhi_epi32 (v, sign);
+}
+
+static void conv_s16_to_stereo_sse2 (struct st_sample *dst, const void *src,
+                                     int samples, struct mixeng_volume *vol)
+{
+    const int16_t *in = src;
+    __m128i *out = (__m128i *) dst;
+    const __m128i zero = _mm_setzero_si128 ();
+    int i, n = samples & ~3;
+
+    for (i = 0; i < n; i += 4) {
+        __m128i v = _mm_loadu_si128 ((const __m128i *) (in + i * 2));
+        __m128i a, b;
+
+        /* interleaving with zeroes gives the 16 bit samples << 16 */
+        sext_s32x4_sse2 (_mm_unpacklo_epi16 (zero, v), &a, &b);
+        _mm_storeu_si128 (out++, a);
+        _mm_storeu_si128 (out++, b);
+        sext_s32x4_sse2 (_mm_unpackhi_epi16 (zero, v), &a, &b);
+        _mm_storeu_si128 (out++, a);
+        _mm_storeu_si128 (out++, b);
+    }
+    conv_natural_int16_t_to_stereo (dst + n, in + n * 2, samples - n, vol);
+}
+
+static void conv_s16_to_mono_sse2 (struct st_sample *dst, const void *src,
+                                   int samples, struct mixeng_volume *vol)
+{
+    const int16_t *in = src;
+    __m128i *out = (__m128i *) dst;
+    const __m128i zero = _mm_setzero_si128 ();
+    int i, n = samples & ~3;
+
+    for (i = 0; i < n; i += 4) {
+        __m128i v = _mm_loadl_epi64 ((const __m128i *) (in + i));
+        __m128i a, b;
+
+        sext_s32x4_sse2 (_mm_unpacklo_epi16 (zero, v), &a, &b);
+        _mm_storeu_si128 (out++, _mm_unpacklo_epi64 (a, a));
+        _mm_storeu_si128 (out++, _mm_unpackhi_epi64 (a, a));
+        _mm_storeu_si128 (out++, _mm_unpacklo_epi64 (b, b));
+        _mm_storeu_si128 (out++, _mm_unpackhi_epi64 (b, b));
+    }
+    conv_natural_int16_t_to_mono (dst + n, in + n, samples - n, vol);
+}
+
+/*
+ * Clip 4 64 bit samples like clip_natural_int16_t does and return them as
+ * 32 bit values, ready to be shifted and packed.  SSE2 has no 64 bit
+ * comparisons, so values are checked for fitting in 32 bits by comparing
+ * their high half with the sign of their low half.
+ */
+static inline __m128i clip_s64x4_sse2 (__m128i v0, __m128i v1)
+{
+    __m128i a = _mm_shuffle_epi32 (v0, _MM_SHUFFLE (3, 1, 2, 0));
+    __m128i b = _mm_shuffle_epi32 (v1, _MM_SHUFFLE (3, 1, 2, 0));
+    __m128i lo = _mm_unpacklo_epi64 (a, b);
+    __m128i hi = _mm_unpackhi_epi64 (a, b);
+    __m128i fits = _mm_cmpeq_epi32 (hi, _mm_srai_epi32 (lo, 31));
+    __m128i sat = _mm_xor_si128 (_mm_srai_epi32 (hi, 31),
+                                 _mm_set1_epi32 (INT32_MAX));
+    __m128i v = _mm_or_si128 (_mm_and_si128 (fits, lo),
+                              _mm_andnot_si128 (fits, sat));
+    __m128i big = _mm_cmpgt_epi32 (v, _mm_set1_epi32 (0x7f000000 - 1));
+
+    return _mm_or_si128 (v, _mm_srli_epi32 (big, 1));
+}
+
+static inline __m128i clip_s16x8_sse2 (const __m128i *v)
+{
+    return _mm_packs_epi32 (_mm_srai_epi32 (clip_s64x4_sse2 (v[0], v[1]), 16),
+                            _mm_srai_epi32 (clip_s64x4_sse2 (v[2], v[3]), 16));
+}
+
+static void clip_s16_from_stereo_sse2 (void *dst, const struct st_sample *src,
+                                       int samples)
+{
+    const __m128i *in = (const __m128i *) src;
+    int16_t *out = dst;
+    int i, n = samples & ~3;
+
+    for (i = 0; i < n; i += 4) {
+        __m128i v[4];
+        int k;
+
+        for (k = 0; k < 4; k++) {
+            v[k] = _mm_loadu_si128 (in++);
+        }
+        _mm_storeu_si128 ((__m128i *) (out + i * 2), clip_s16x8_sse2 (v));
+    }
+    clip_natural_int16_t_from_stereo (out + n * 2, src + n, samples - n);
+}
+
+static void clip_s16_from_mono_sse2 (void *dst, const struct st_sample *src,
+                                     int samples)
+{
+    const __m128i *in = (const __m128i *) src;
+    int16_t *out = dst;
+    int i, n = samples & ~7;
+
+    for (i = 0; i < n; i += 8) {
+        __m128i v[4];
+        int k;
+
+        /* l + r of two consecutive samples in each register */
+        for (k = 0; k < 4; k++) {
+            __m128i s0 = _mm_loadu_si128 (in++);
+            __m128i s1 = _mm_loadu_si128 (in++);
+            v[k] = _mm_add_epi64 (_mm_unpacklo_epi64 (s0, s1),
+                                  _mm_unpackhi_epi64 (s0, s1));
+        }
+        _mm_storeu_si128 ((__m128i *) (out + i), clip_s16x8_sse2 (v));
+    }
+    clip_natural_int16_t_from_mono (out + n, src + n, samples - n);
+}
+
+#endif  /* !FLOAT_MIXENG */
+
+#define CONV_S16_TO_MONO    conv_s16_to_mono_sse2
+#define CONV_S16_TO_STEREO  conv_s16_to_stereo_sse2
+#define CLIP_S16_FROM_MONO  clip_s16_from_mono_sse2
+#define CLIP_S16_FROM_STEREO clip_s16_from_stereo_sse2
+
+#else  /* !__SSE2__ || CONFIG_MIXEMU */
+
+#define CONV_S16_TO_MONO    conv_natural_int16_t_to_mono
+#define CONV_S16_TO_STEREO  conv_natural_int16_t_to_stereo
+#define CLIP_S16_FROM_MONO  clip_natural_int16_t_from_mono
+#define CLIP_S16_FROM_STEREO clip_natural_int16_t_from_stereo
+
+#endif
+
 t_sample *mixeng_conv[2][2][2][3] = {
     {
         {
@@ -160,7 +418,7 @@ t_sample *mixeng_conv[2][2][2][3] = {
         {
             {
                 conv_natural_int8_t_to_mono,
-                conv_natural_int16_t_to_mono,
+                CONV_S16_TO_MONO,
                 conv_natural_int32_t_to_mono
             },
             {
@@ -186,7 +444,7 @@ t_sample *mixeng_conv[2][2][2][3] = {
         {
             {
                 conv_natural_int8_t_to_stereo,
-                conv_natural_int16_t_to_stereo,
+                CONV_S16_TO_STEREO,
                 conv_natural_int32_t_to_stereo
             },
             {
@@ -215,7 +473,7 @@ f_sample *mixeng_clip[2][2][2][3] = {
         {
             {
                 clip_natural_int8_t_from_mono,
-                clip_natural_int16_t_from_mono,
+                CLIP_S16_FROM_MONO,
                 clip_natural_int32_t_from_mono
             },
             {
@@ -241,7 +499,7 @@ f_sample *mixeng_clip[2][2][2][3] = {
         {
             {
                 clip_natural_int8_t_from_stereo,
-                clip_natural_int16_t_from_stereo,
+                CLIP_S16_FROM_STEREO,
                 clip_natural_int32_t_from_stereo
             },
             {
@@ -285,18 +543,298 @@ f_sample *mixeng_clip[2][2][2][3] = {
  * an (unsigned long) cast to make it safe.  MarkMLl 2/1/99
  */
 
+/*
+ * Polyphase windowed-sinc interpolation.
+ *
+ * The ratio between the two rates is reduced to phases/step, i.e. every
+ * output sample advances by step/phases input samples, and there are only
+ * `phases' distinct fractional positions.  The (Kaiser windowed) sinc
+ * filter is precomputed for each of them, so that each output sample is
+ * a plain dot product between one filter phase and the last `taps' input
+ * samples.  Tables are shared between resamplers with the same ratio.
+ *
+ * Input samples are converted to floats in a history buffer, which is
+ * compacted every RATE_CHUNK samples or so.
+ */
+#define RATE_MAX_PHASES 1024
+#define RATE_CHUNK      256
+
+static const struct {
+    int taps;           /* filter length at unity ratio, multiple of 8 */
+    double beta;        /* Kaiser window shape */
+    double cutoff;      /* passband edge, relative to the lowest Nyquist */
+} rate_quality[RATE_QUALITY_COUNT] = {
+    [RATE_QUALITY_LOW]    = { 16, 6.0, 0.76 },
+    [RATE_QUALITY_MEDIUM] = { 32, 8.0, 0.84 },
+    [RATE_QUALITY_HIGH]   = { 64, 10.0, 0.90 },
+};
+
+struct rate_filter {
+    int phases;
+    int step;
+    int quality;
+    int taps;
+    int refcount;
+    /* phases * taps coefficients, each one stored twice in a row so that
+       both channels of interleaved frames are filtered at once */
+    float *coefs;
+    struct rate_filter *next;
+};
+
+struct rate_frame {
+    float l;
+    float r;
+};
+
+static struct rate_filter *rate_filters;
+
 /* Private data */
 struct rate {
     uint64_t opos;
     uint64_t opos_inc;
     uint32_t ipos;              /* position in the input stream (integer) */
     struct st_sample ilast;          /* last sample in the input stream */
+
+    struct rate_filter *filter; /* NULL for linear interpolation */
+    int phase;                  /* fractional position, in 1/phases */
+    int pos;                    /* first frame of the filter in hist */
+    int count;                  /* number of frames in hist */
+    float *hist;                /* taps + RATE_CHUNK interleaved frames */
 };
 
+#ifdef FLOAT_MIXENG
+#define RATE_TO_FLOAT(v) (v)
+#define RATE_FROM_FLOAT(v) (v)
+#else
+#define RATE_TO_FLOAT(v) ((float) (v))
+#define RATE_FROM_FLOAT(v) ((int64_t) (v))
+#endif
+
+static int rate_gcd (int a, int b)
+{
+    while (b) {
+        int t = a % b;
+        a = b;
+        b = t;
+    }
+    return a;
+}
+
+/* Zeroth order modified Bessel function of the first kind */
+static double rate_bessel_i0 (double x)
+{
+    double sum = 1.0, term = 1.0;
+    int k;
+
+    for (k = 1; k < 64 && term > sum * 1e-12; k++) {
+        double t = x / (2 * k);
+        term *= t * t;
+        sum += term;
+    }
+    return sum;
+}
+
+static int rate_filter_fill (struct rate_filter *f)
+{
+    double beta = rate_quality[f->quality].beta;
+    double cutoff = rate_quality[f->quality].cutoff;
+    double half = f->taps / 2;
+    double i0_beta = rate_bessel_i0 (beta);
+    double *h;
+    int p, k;
+
+    /* lower the cutoff below the output Nyquist when downsampling */
+    if (f->step > f->phases) {
+        cutoff = cutoff * f->phases / f->step;
+    }
+
+    h = audio_calloc (AUDIO_FUNC, f->taps, sizeof (*h));
+    if (!h) {
+        return -1;
+    }
+
+    for (p = 0; p < f->phases; p++) {
+        float *c = f->coefs + p * f->taps * 2;
+        double sum = 0;
+
+        for (k = 0; k < f->taps; k++) {
+            /* distance between input sample k and the output sample */
+            double d = k - (half - 1) - (double) p / f->phases;
+            double x = d / half;
+            double w = rate_bessel_i0 (beta * sqrt (1 - x * x)) / i0_beta;
+            double t = M_PI * cutoff * d;
+
+            h[k] = w * (t == 0 ? 1.0 : sin (t) / t);
+            sum += h[k];
+        }
+
+        /* unity gain at DC for every phase */
+        for (k = 0; k < f->taps; k++) {
+            c[k * 2] = c[k * 2 + 1] = h[k] / sum;
+        }
+    }
+
+    g_free (h);
+    return 0;
+}
+
+static struct rate_filter *rate_filter_get (int phases, int step, int quality)
+{
+    struct rate_filter *f;
+
+    for (f = rate_filters; f; f = f->next) {
+        if (f->phases == phases && f->step == step && f->quality == quality) {
+            f->refcount++;
+            return f;
+        }
+    }
+
+    f = audio_calloc (AUDIO_FUNC, 1, sizeof (*f));
+    if (!f) {
+        return NULL;
+    }
+    f->phases = phases;
+    f->step = step;
+    f->quality = quality;
+    /* keep the transition band width when downsampling */
+    f->taps = rate_quality[quality].taps;
+    if (step > phases) {
+        f->taps = ((int64_t) f->taps * step / phases + 7) & ~7;
+    }
+    f->refcount = 1;
+    f->coefs = audio_calloc (AUDIO_FUNC, phases * f->taps * 2,
+                             sizeof (*f->coefs));
+    if (!f->coefs || rate_filter_fill (f)) {
+        g_free (f->coefs);
+        g_free (f);
+        return NULL;
+    }
+
+    f->next = rate_filters;
+    rate_filters = f;
+    return f;
+}
+
+static void rate_filter_put (struct rate_filter *f)
+{
+    struct rate_filter **pf;
+
+    if (--f->refcount) {
+        return;
+    }
+    for (pf = &rate_filters; *pf; pf = &(*pf)->next) {
+        if (*pf == f) {
+            *pf = f->next;
+            break;
+        }
+    }
+    g_free (f->coefs);
+    g_free (f);
+}
+
+/*
+ * Append up to n input frames to the history, dropping the ones already
+ * used, and return how many were appended.
+ */
+static inline int rate_push (struct rate *rate, const struct st_sample *in,
+                             int n)
+{
+    int size = rate->filter->taps + RATE_CHUNK;
+    float *hist;
+    int i;
+
+    if (rate->count + n > size) {
+        int drop = audio_MIN (rate->pos, rate->count);
+
+        memmove (rate->hist, rate->hist + drop * 2,
+                 (rate->count - drop) * 2 * sizeof (float));
+        rate->count -= drop;
+        rate->pos -= drop;
+        n = audio_MIN (n, size - rate->count);
+    }
+
+    hist = rate->hist + rate->count * 2;
+    for (i = 0; i < n; i++) {
+        hist[i * 2] = RATE_TO_FLOAT (in[i].l);
+        hist[i * 2 + 1] = RATE_TO_FLOAT (in[i].r);
+    }
+    rate->count += n;
+    return n;
+}
+
+static inline void rate_dot (const float *coefs, const float *hist, int taps,
+                             struct rate_frame *out)
+{
+#ifdef __SSE2__
+    __m128 acc0 = _mm_setzero_ps ();
+    __m128 acc1 = _mm_setzero_ps ();
+    __m128 acc2 = _mm_setzero_ps ();
+    __m128 acc3 = _mm_setzero_ps ();
+    int k;
+
+    /* 8 taps of both channels per iteration, with independent sums */
+    for (k = 0; k < taps * 2; k += 16) {
+        acc0 = _mm_add_ps (acc0, _mm_mul_ps (_mm_loadu_ps (coefs + k),
+                                             _mm_loadu_ps (hist + k)));
+        acc1 = _mm_add_ps (acc1, _mm_mul_ps (_mm_loadu_ps (coefs + k + 4),
+                                             _mm_loadu_ps (hist + k + 4)));
+        acc2 = _mm_add_ps (acc2, _mm_mul_ps (_mm_loadu_ps (coefs + k + 8),
+                                             _mm_loadu_ps (hist + k + 8)));
+        acc3 = _mm_add_ps (acc3, _mm_mul_ps (_mm_loadu_ps (coefs + k + 12),
+                                             _mm_loadu_ps (hist + k + 12)));
+    }
+    /* lanes are l, r, l, r */
+    acc0 = _mm_add_ps (_mm_add_ps (acc0, acc1), _mm_add_ps (acc2, acc3));
+    acc0 = _mm_add_ps (acc0, _mm_movehl_ps (acc0, acc0));
+    out->l = _mm_cvtss_f32 (acc0);
+    out->r = _mm_cvtss_f32 (_mm_shuffle_ps (acc0, acc0, 1));
+#else
+    float l = 0, r = 0;
+    int k;
+
+    for (k = 0; k < taps * 2; k += 2) {
+        l += coefs[k] * hist[k];
+        r += coefs[k + 1] * hist[k + 1];
+    }
+    out->l = l;
+    out->r = r;
+#endif
+}
+
+/* dst += src, for n samples */
+static void mixeng_mix (struct st_sample *dst, const struct st_sample *src,
+                        int n)
+{
+    int i = 0;
+
+#ifdef __SSE2__
+    for (; i + 2 <= n; i += 2) {
+#ifdef FLOAT_MIXENG
+        float *d = (float *) (dst + i);
+        const float *s = (const float *) (src + i);
+
+        _mm_storeu_ps (d, _mm_add_ps (_mm_loadu_ps (d), _mm_loadu_ps (s)));
+#else
+        __m128i *d = (__m128i *) (dst + i);
+        const __m128i *s = (const __m128i *) (src + i);
+
+        _mm_storeu_si128 (d, _mm_add_epi64 (_mm_loadu_si128 (d),
+                                            _mm_loadu_si128 (s)));
+        _mm_storeu_si128 (d + 1, _mm_add_epi64 (_mm_loadu_si128 (d + 1),
+                                                _mm_loadu_si128 (s + 1)));
+#endif
+    }
+#endif
+    for (; i < n; i++) {
+        dst[i].l += src[i].l;
+        dst[i].r += src[i].r;
+    }
+}
+
 /*
  * Prepare processing.
  */
-void *st_rate_start (int inrate, int outrate)
+void *st_rate_start (int inrate, int outrate, int quality)
 {
     struct rate *rate = audio_calloc (AUDIO_FUNC, 1, sizeof (*rate));
 
@@ -313,20 +851,59 @@ void *st_rate_start (int inrate, int outrate)
     rate->ipos = 0;
     rate->ilast.l = 0;
     rate->ilast.r = 0;
+
+    if (inrate != outrate && quality > RATE_QUALITY_LINEAR &&
+        quality < RATE_QUALITY_COUNT) {
+        int gcd = rate_gcd (inrate, outrate);
+        int phases = outrate / gcd;
+
+        if (phases > RATE_MAX_PHASES) {
+            dolog ("Using linear interpolation for %d -> %d Hz\n",
+                   inrate, outrate);
+            return rate;
+        }
+
+        rate->filter = rate_filter_get (phases, inrate / gcd, quality);
+        if (!rate->filter) {
+            dolog ("Could not allocate resampler filter\n");
+            g_free (rate);
+            return NULL;
+        }
+
+        rate->hist = audio_calloc (AUDIO_FUNC,
+                                   (rate->filter->taps + RATE_CHUNK) * 2,
+                                   sizeof (float));
+        if (!rate->hist) {
+            rate_filter_put (rate->filter);
+            g_free (rate);
+            return NULL;
+        }
+
+        /* center the filter on the first input sample */
+        rate->count = rate->filter->taps / 2 - 1;
+    }
     return rate;
 }
 
 #define NAME st_rate_flow_mix
 #define OP(a, b) a += b
+#define OP_BLOCK(dst, src, n) mixeng_mix (dst, src, n)
 #include "rate_template.h"
 
 #define NAME st_rate_flow
 #define OP(a, b) a = b
+#define OP_BLOCK(dst, src, n) memcpy (dst, src, (n) * sizeof (struct st_sample))
 #include "rate_template.h"
 
 void st_rate_stop (void *opaque)
 {
-    g_free (opaque);
+    struct rate *rate = opaque;
+
+    if (rate->filter) {
+        rate_filter_put (rate->filter);
+        g_free (rate->hist);
+    }
+    g_free (rate);
 }
 
 void mixeng_clear (struct st_sample *buf, int len)
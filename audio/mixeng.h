@@ -40,7 +40,16 @@ typedef void (f_sample) (void *dst, const struct st_sample *src, int samples);
 extern t_sample *mixeng_conv[2][2][2][3];
 extern f_sample *mixeng_clip[2][2][2][3];
 
-void *st_rate_start (int inrate, int outrate);
+/* Resampler quality, from the cheapest to the most accurate. */
+enum {
+    RATE_QUALITY_LINEAR,        /* linear interpolation */
+    RATE_QUALITY_LOW,           /* windowed-sinc, short filters */
+    RATE_QUALITY_MEDIUM,
+    RATE_QUALITY_HIGH,
+    RATE_QUALITY_COUNT
+};
+
+void *st_rate_start (int inrate, int outrate, int quality);
 void st_rate_flow (void *opaque, struct st_sample *ibuf, struct st_sample *obuf,
                    int *isamp, int *osamp);
 void st_rate_flow_mix (void *opaque, struct st_sample *ibuf, struct st_sample *obuf,
@@ -66,10 +66,10 @@ static mixeng_real inline glue (conv_, ET) (IN_T v)
 static IN_T inline glue (clip_, ET) (mixeng_real v)
 {
     if (v >= 0.5) {
-        return IN_MAX;
+        return ENDIAN_CONVERT (IN_MAX);
     }
     else if (v < -0.5) {
-        return IN_MIN;
+        return ENDIAN_CONVERT (IN_MIN);
     }
 
 #ifdef SIGNED
@@ -94,10 +94,10 @@ static inline int64_t glue (conv_, ET) (IN_T v)
 static inline IN_T glue (clip_, ET) (int64_t v)
 {
     if (v >= 0x7f000000) {
-        return IN_MAX;
+        return ENDIAN_CONVERT (IN_MAX);
     }
     else if (v < -2147483648LL) {
-        return IN_MIN;
+        return ENDIAN_CONVERT (IN_MIN);
     }
 
 #ifdef SIGNED
@@ -0,0 +1,280 @@
+// Copyright 2014 The Android Open Source Project
+//
+// This software is licensed under the terms of the GNU General Public
+// License version 2, as published by the Free Software Foundation, and
+// may be copied, distributed, and modified under those terms.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+#include <gtest/gtest.h>
+
+#include <math.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <vector>
+
+// The QEMU headers include C library headers, which must not end up in
+// the extern "C" block when first seen.
+
+extern "C" {
+#include "audio_int.h"
+}
+
+namespace {
+
+// Index of signed 16-bit samples in mixeng_conv and mixeng_clip.
+const int kS16 = 1;
+
+uint64_t sRandom = 88172645463325252ULL;
+
+uint64_t nextRandom() {
+    sRandom ^= sRandom << 13;
+    sRandom ^= sRandom >> 7;
+    sRandom ^= sRandom << 17;
+    return sRandom;
+}
+
+uint16_t swap16(uint16_t v) {
+    return static_cast<uint16_t>((v << 8) | (v >> 8));
+}
+
+#ifdef FLOAT_MIXENG
+typedef mixeng_real SampleValue;
+#else
+typedef int64_t SampleValue;
+#endif
+
+// A value for st_sample that covers the clipping limits of the engine.
+SampleValue randomSample() {
+#ifdef FLOAT_MIXENG
+    float v = static_cast<int32_t>(nextRandom()) / 2147483648.0f;
+    switch (nextRandom() % 3) {
+    case 0:
+        return v * 4;
+    case 1:
+        return (static_cast<int>(nextRandom() % 9) - 4) * 0.25f;
+    default:
+        return v;
+    }
+#else
+    switch (nextRandom() % 5) {
+    case 0:
+        return static_cast<int64_t>(nextRandom());
+    case 1:
+        return static_cast<int32_t>(nextRandom());
+    case 2:
+        return static_cast<int64_t>(static_cast<int32_t>(nextRandom())) * 3;
+    case 3:
+        return 0x7f000000LL +
+               static_cast<int64_t>(nextRandom() % 0x2000000) - 0x1000000;
+    default:
+        return -2147483648LL + static_cast<int64_t>(nextRandom() % 5) - 2;
+    }
+#endif
+}
+
+// The host endian S16 entries of mixeng_conv and mixeng_clip may use
+// vectorized code, while the opposite endian ones are always the generic
+// template code. They must produce the same samples on swapped data.
+void checkConvS16(int stereo) {
+    const int kMax = 67;
+    for (int iter = 0; iter < 5000; ++iter) {
+        const int samples = nextRandom() % kMax;
+        const int count = samples << stereo;
+        int16_t in[kMax * 2];
+        int16_t swapped[kMax * 2];
+        for (int n = 0; n < count; ++n) {
+            in[n] = static_cast<int16_t>(nextRandom());
+            swapped[n] = static_cast<int16_t>(swap16(in[n]));
+        }
+
+        st_sample out[kMax + 1];
+        st_sample expected[kMax + 1];
+        memset(out, 0x55, sizeof(out));
+        memset(expected, 0x55, sizeof(expected));
+        mixeng_conv[stereo][1][0][kS16](out, in, samples, &nominal_volume);
+        mixeng_conv[stereo][1][1][kS16](expected, swapped, samples,
+                                       &nominal_volume);
+        ASSERT_EQ(0, memcmp(expected, out, sizeof(out)))
+                << "samples=" << samples;
+    }
+}
+
+void checkClipS16(int stereo) {
+    const int kMax = 67;
+    for (int iter = 0; iter < 5000; ++iter) {
+        const int samples = nextRandom() % kMax;
+        st_sample in[kMax];
+        for (int n = 0; n < samples; ++n) {
+            in[n].l = randomSample();
+            in[n].r = randomSample();
+        }
+
+        int16_t out[kMax * 2 + 1];
+        int16_t expected[kMax * 2 + 1];
+        memset(out, 0x55, sizeof(out));
+        memset(expected, 0x55, sizeof(expected));
+        mixeng_clip[stereo][1][0][kS16](out, in, samples);
+        mixeng_clip[stereo][1][1][kS16](expected, in, samples);
+        for (int n = 0; n < (samples << stereo); ++n) {
+            expected[n] = static_cast<int16_t>(swap16(expected[n]));
+        }
+        ASSERT_EQ(0, memcmp(expected, out, sizeof(out)))
+                << "samples=" << samples;
+    }
+}
+
+// Resample |in| from |inRate| to |outRate| Hz with st_rate_flow(), in
+// chunks of |chunk| frames like audio_pcm_sw_write() does.
+std::vector<st_sample> resample(const std::vector<st_sample>& in,
+                                int inRate, int outRate, int quality,
+                                int chunk) {
+    void* rate = st_rate_start(inRate, outRate, quality);
+    std::vector<st_sample> out;
+    std::vector<st_sample> buf(chunk * 8 + 64);
+    std::vector<st_sample> input(in);
+    size_t pos = 0;
+    while (pos < input.size()) {
+        int isamp = static_cast<int>(input.size() - pos);
+        if (isamp > chunk) {
+            isamp = chunk;
+        }
+        int osamp = static_cast<int>(buf.size());
+        st_rate_flow(rate, &input[pos], &buf[0], &isamp, &osamp);
+        out.insert(out.end(), buf.begin(), buf.begin() + osamp);
+        pos += isamp;
+        if (isamp == 0 && osamp == 0) {
+            break;
+        }
+    }
+    st_rate_stop(rate);
+    return out;
+}
+
+// A tone of |freq| Hz, converted from S16 samples of amplitude 16000.
+std::vector<st_sample> tone(double freq, int rate, int frames) {
+    std::vector<int16_t> pcm(frames * 2);
+    for (int n = 0; n < frames; ++n) {
+        pcm[2 * n] = pcm[2 * n + 1] = static_cast<int16_t>(
+                16000 * (freq ? sin(2 * M_PI * freq * n / rate) : 1.));
+    }
+    std::vector<st_sample> out(frames);
+    mixeng_conv[1][1][0][kS16](&out[0], &pcm[0], frames, &nominal_volume);
+    return out;
+}
+
+// RMS of the left channel as S16 samples, skipping the first and last
+// |margin| frames where the filters have not settled.
+double rmsS16(const std::vector<st_sample>& in, size_t margin) {
+    if (in.size() <= 2 * margin) {
+        return 0;
+    }
+    const size_t frames = in.size() - 2 * margin;
+    std::vector<int16_t> pcm(frames * 2);
+    mixeng_clip[1][1][0][kS16](&pcm[0], &in[margin], frames);
+    double sum = 0;
+    for (size_t n = 0; n < frames; ++n) {
+        sum += static_cast<double>(pcm[2 * n]) * pcm[2 * n];
+    }
+    return sqrt(sum / frames);
+}
+
+struct RatePair {
+    int in;
+    int out;
+};
+
+const RatePair kRates[] = {
+    { 48000, 44100 },
+    { 44100, 48000 },
+    { 22050, 44100 },
+    { 8000, 44100 },
+    { 44100, 8000 },
+    { 44100, 44100 },
+};
+
+}  // namespace
+
+TEST(mixeng, ConvS16MonoMatchesGeneric) {
+    checkConvS16(0);
+}
+
+TEST(mixeng, ConvS16StereoMatchesGeneric) {
+    checkConvS16(1);
+}
+
+TEST(mixeng, ClipS16MonoMatchesGeneric) {
+    checkClipS16(0);
+}
+
+TEST(mixeng, ClipS16StereoMatchesGeneric) {
+    checkClipS16(1);
+}
+
+TEST(mixeng, ResampleDcGain) {
+    for (int quality = 0; quality < RATE_QUALITY_COUNT; ++quality) {
+        for (size_t n = 0; n < sizeof(kRates) / sizeof(kRates[0]); ++n) {
+            std::vector<st_sample> out = resample(
+                    tone(0, kRates[n].in, kRates[n].in / 4),
+                    kRates[n].in, kRates[n].out, quality, 512);
+            // 16000 within 0.1 dB.
+            EXPECT_NEAR(16000, rmsS16(out, 200), 16000 * 0.012)
+                    << kRates[n].in << " -> " << kRates[n].out
+                    << " Hz, quality " << quality;
+        }
+    }
+}
+
+TEST(mixeng, ResampleOutputCount) {
+    for (int quality = 0; quality < RATE_QUALITY_COUNT; ++quality) {
+        for (size_t n = 0; n < sizeof(kRates) / sizeof(kRates[0]); ++n) {
+            const int frames = kRates[n].in;
+            std::vector<st_sample> out = resample(
+                    tone(1000, kRates[n].in, frames),
+                    kRates[n].in, kRates[n].out, quality, 333);
+            // One second in, one second out, but for the frames that are
+            // still in the filter: at most 64 taps at the lower rate.
+            const double held = 64. * kRates[n].out /
+                                (kRates[n].in < kRates[n].out ?
+                                 kRates[n].in : kRates[n].out);
+            EXPECT_NEAR(kRates[n].out, static_cast<int>(out.size()), held)
+                    << kRates[n].in << " -> " << kRates[n].out
+                    << " Hz, quality " << quality;
+        }
+    }
+}
+
+TEST(mixeng, ResampleChunkSizeDoesNotMatter) {
+    std::vector<st_sample> in = tone(997, 48000, 48000 / 4);
+    for (int quality = 0; quality < RATE_QUALITY_COUNT; ++quality) {
+        std::vector<st_sample> a = resample(in, 48000, 44100, quality, 4096);
+        std::vector<st_sample> b = resample(in, 48000, 44100, quality, 7);
+        ASSERT_EQ(a.size(), b.size()) << "quality " << quality;
+        EXPECT_EQ(0, memcmp(&a[0], &b[0], a.size() * sizeof(a[0])))
+                << "quality " << quality;
+    }
+}
+
+TEST(mixeng, ResampleDownsampling) {
+    // Down to 8 kHz, a 1 kHz tone goes through, and a 6 kHz one, which
+    // would alias to 2 kHz, is filtered out by the sinc resamplers.
+    for (int quality = RATE_QUALITY_LOW; quality < RATE_QUALITY_COUNT;
+         ++quality) {
+        std::vector<st_sample> pass = resample(tone(1000, 44100, 44100),
+                                               44100, 8000, quality, 512);
+        std::vector<st_sample> stop = resample(tone(6000, 44100, 44100),
+                                               44100, 8000, quality, 512);
+        const double passDb = 20 * log10(rmsS16(pass, 200) /
+                                         (16000 / sqrt(2.)));
+        const double stopDb = 20 * log10((rmsS16(stop, 200) + 1e-3) /
+                                         (16000 / sqrt(2.)));
+        printf("44100 -> 8000 Hz, quality %d: 1 kHz %.2f dB, 6 kHz %.1f dB\n",
+               quality, passDb, stopDb);
+        EXPECT_NEAR(0, passDb, 0.1) << "quality " << quality;
+        EXPECT_GT(-60, stopDb) << "quality " << quality;
+    }
+}
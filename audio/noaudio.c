@@ -55,6 +55,7 @@ static int no_run_out (HWVoiceOut *hw, int live)
     no->old_ticks = now;
     decr = audio_MIN (live, samples);
     hw->rpos = (hw->rpos + decr) % hw->samples;
+    audio_pcm_hw_schedule_out (hw, live);
     return decr;
 }
 
@@ -77,8 +78,27 @@ static void no_fini_out (HWVoiceOut *hw)
 
 static int no_ctl_out (HWVoiceOut *hw, int cmd, ...)
 {
-    (void) hw;
-    (void) cmd;
+    NoVoiceOut *no = (NoVoiceOut *) hw;
+
+    switch (cmd) {
+    case VOICE_ENABLE:
+        {
+            va_list ap;
+            int poll_mode;
+
+            va_start (ap, cmd);
+            poll_mode = va_arg (ap, int);
+            va_end (ap);
+
+            no->old_ticks = qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL);
+            audio_pcm_hw_set_timer_poll_out (hw, poll_mode);
+        }
+        break;
+
+    case VOICE_DISABLE:
+        audio_pcm_hw_set_poll_out (hw, 0);
+        break;
+    }
     return 0;
 }
 
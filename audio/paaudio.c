@@ -254,6 +254,11 @@ static void *qpa_thread_out (void *arg)
         pa->rpos = rpos;
         pa->live -= decr;
         pa->decr += decr;
+
+        /* ask for more before running dry rather than wait for the timer */
+        if (hw->poll_mode && pa->live < hw->watermark) {
+            audio_notify ();
+        }
     }
 
  exit:
@@ -576,6 +581,8 @@ static int qpa_init_out (HWVoiceOut *hw, struct audsettings *as)
 
     audio_pcm_init_info (&hw->info, &obt_as);
     hw->samples = glob_paaudio.samples;
+    /* the server keeps about tlength bytes queued once they are written */
+    hw->delay = ba.tlength >> hw->info.shift;
     pa->pcm_buf = audio_calloc (AUDIO_FUNC, hw->samples, 1 << hw->info.shift);
     pa->rpos = hw->rpos;
     if (!pa->pcm_buf) {
@@ -711,6 +718,27 @@ static int qpa_ctl_out (HWVoiceOut *hw, int cmd, ...)
 #endif
 
     switch (cmd) {
+    case VOICE_ENABLE:
+        {
+            va_list ap;
+            int poll_mode;
+
+            va_start (ap, cmd);
+            poll_mode = va_arg (ap, int);
+            va_end (ap);
+
+            audio_pt_lock (&pa->pt, AUDIO_FUNC);
+            audio_pcm_hw_set_poll_out (hw, poll_mode);
+            audio_pt_unlock (&pa->pt, AUDIO_FUNC);
+        }
+        break;
+
+    case VOICE_DISABLE:
+        audio_pt_lock (&pa->pt, AUDIO_FUNC);
+        audio_pcm_hw_set_poll_out (hw, 0);
+        audio_pt_unlock (&pa->pt, AUDIO_FUNC);
+        break;
+
     case VOICE_VOLUME:
         {
             SWVoiceOut *sw;
@@ -23,6 +23,74 @@
  * THE SOFTWARE.
  */
 
+/*
+ * Polyphase filtering, see struct rate_filter in mixeng.c.
+ */
+static void glue (NAME, _sinc) (struct rate *rate,
+                                struct st_sample *ibuf, struct st_sample *obuf,
+                                int *isamp, int *osamp)
+{
+    struct rate_filter *f = rate->filter;
+    struct st_sample *istart, *iend;
+    struct st_sample *ostart, *oend;
+    struct rate_frame out;
+    int step_int = f->step / f->phases;
+    int step_frac = f->step % f->phases;
+
+    istart = ibuf;
+    iend = ibuf + *isamp;
+
+    ostart = obuf;
+    oend = obuf + *osamp;
+
+    while (obuf < oend) {
+        int need = rate->pos + f->taps - rate->count;
+
+        if (need > 0) {
+            int avail = iend - ibuf;
+            int64_t want;
+            int n;
+
+            /* input frames that end before the filter window are not
+               needed at all, this happens when downsampling */
+            if (rate->pos > rate->count) {
+                int skip = audio_MIN (rate->pos - rate->count, avail);
+                ibuf += skip;
+                avail -= skip;
+                need -= skip;
+                rate->pos -= skip;
+            }
+
+            /* convert what the remaining output samples need in one go */
+            want = need + ((int64_t) (oend - obuf - 1) * f->step +
+                           rate->phase) / f->phases;
+            n = rate_push (rate, ibuf, audio_MIN (want, avail));
+            ibuf += n;
+            if (n < need) {
+                break;
+            }
+        }
+
+        rate_dot (f->coefs + rate->phase * f->taps * 2,
+                  rate->hist + rate->pos * 2, f->taps, &out);
+
+        /* output sample & increment position */
+        OP (obuf->l, RATE_FROM_FLOAT (out.l));
+        OP (obuf->r, RATE_FROM_FLOAT (out.r));
+        obuf += 1;
+
+        rate->pos += step_int;
+        rate->phase += step_frac;
+        if (rate->phase >= f->phases) {
+            rate->phase -= f->phases;
+            rate->pos++;
+        }
+    }
+
+    *isamp = ibuf - istart;
+    *osamp = obuf - ostart;
+}
+
 /*
  * Processed signed long samples from ibuf to obuf.
  * Return number of samples processed.
@@ -49,16 +117,18 @@ void NAME (void *opaque, struct st_sample *ibuf, struct st_sample *obuf,
     oend = obuf + *osamp;
 
     if (rate->opos_inc == (1ULL + UINT_MAX)) {
-        int i, n = *isamp > *osamp ? *osamp : *isamp;
-        for (i = 0; i < n; i++) {
-            OP (obuf[i].l, ibuf[i].l);
-            OP (obuf[i].r, ibuf[i].r);
-        }
+        int n = *isamp > *osamp ? *osamp : *isamp;
+        OP_BLOCK (obuf, ibuf, n);
         *isamp = n;
         *osamp = n;
         return;
     }
 
+    if (rate->filter) {
+        glue (NAME, _sinc) (rate, ibuf, obuf, isamp, osamp);
+        return;
+    }
+
     while (obuf < oend) {
 
         /* Safety catch to make sure we have input samples.  */
@@ -109,3 +179,4 @@ the_end:
 
 #undef NAME
 #undef OP
+#undef OP_BLOCK
@@ -0,0 +1,86 @@
+/* Copyright (C) 2014 The Android Open Source Project
+**
+** This software is licensed under the terms of the GNU General Public
+** License version 2, as published by the Free Software Foundation, and
+** may be copied, distributed, and modified under those terms.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+*/
+
+/* Stand-ins for the parts of QEMU that audio.c references but that its
+ * unit tests do not need: snapshots, the monitor, timers and the main
+ * loop. audio_test_run() replaces the audio timer. */
+
+#include "qemu-common.h"
+#include "migration/vmstate.h"
+#include "monitor/monitor.h"
+#include "qemu/timer.h"
+#include "sysemu/char.h"
+#include "sysemu/sysemu.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+Monitor* cur_mon;
+
+QEMUTimerListGroup main_loop_tlg;
+
+void monitor_printf(Monitor* mon, const char* fmt, ...) {}
+
+void monitor_vprintf(Monitor* mon, const char* fmt, va_list ap) {}
+
+void hw_error(const char* fmt, ...) {
+    va_list ap;
+    va_start(ap, fmt);
+    vfprintf(stderr, fmt, ap);
+    va_end(ap);
+    abort();
+}
+
+int register_savevm(DeviceState* dev,
+                    const char* idstr,
+                    int instance_id,
+                    int version_id,
+                    SaveStateHandler* save_state,
+                    LoadStateHandler* load_state,
+                    void* opaque) {
+    return 0;
+}
+
+VMChangeStateEntry* qemu_add_vm_change_state_handler(
+        VMChangeStateHandler* cb, void* opaque) {
+    return NULL;
+}
+
+int qemu_pipe(int pipefd[2]) {
+    return -1;
+}
+
+int qemu_set_fd_handler(int fd,
+                        IOHandler* fd_read,
+                        IOHandler* fd_write,
+                        void* opaque) {
+    return 0;
+}
+
+int64_t qemu_clock_get_ns(QEMUClockType type) {
+    return 0;
+}
+
+void timer_init(QEMUTimer* ts, QEMUTimerList* timer_list, int scale,
+                QEMUTimerCB* cb, void* opaque) {}
+
+void timer_mod(QEMUTimer* ts, int64_t expire_time) {}
+
+void timer_del(QEMUTimer* ts) {}
+
+bool timer_pending(QEMUTimer* ts) {
+    return false;
+}
+
+uint64_t timer_expire_time_ns(QEMUTimer* ts) {
+    return (uint64_t) -1;
+}
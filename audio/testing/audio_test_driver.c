@@ -0,0 +1,140 @@
+/* Copyright (C) 2014 The Android Open Source Project
+**
+** This software is licensed under the terms of the GNU General Public
+** License version 2, as published by the Free Software Foundation, and
+** may be copied, distributed, and modified under those terms.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+*/
+
+/* audio.c is included here to reach its global state and its static
+ * run functions, so that the tests go through the same code as the
+ * audio timer, without a host backend.
+ */
+#include "audio.c"
+
+#include "audio/testing/audio_test_driver.h"
+
+static int16_t*  test_record_buf;
+static int       test_record_max;
+static int       test_record_len;
+
+static int test_run_out (HWVoiceOut *hw, int live)
+{
+    int16_t sink[AUDIO_TEST_SAMPLES * 2];
+    int left = live, rpos = hw->rpos;
+
+    while (left) {
+        int n = audio_MIN (left, hw->samples - rpos);
+        int rec = audio_MIN (n, test_record_max - test_record_len);
+
+        hw->clip (sink, hw->mix_buf + rpos, n);
+        if (rec > 0) {
+            memcpy (test_record_buf + test_record_len * 2, sink,
+                    rec * 2 * sizeof (int16_t));
+            test_record_len += rec;
+        }
+        rpos = (rpos + n) % hw->samples;
+        left -= n;
+    }
+    hw->rpos = rpos;
+    return live;
+}
+
+static int test_write (SWVoiceOut *sw, void *buf, int len)
+{
+    return audio_pcm_sw_write (sw, buf, len);
+}
+
+static int test_init_out (HWVoiceOut *hw, struct audsettings *as)
+{
+    audio_pcm_init_info (&hw->info, as);
+    hw->samples = AUDIO_TEST_SAMPLES;
+    return 0;
+}
+
+static void test_fini_out (HWVoiceOut *hw)
+{
+    (void) hw;
+}
+
+static int test_ctl_out (HWVoiceOut *hw, int cmd, ...)
+{
+    (void) hw;
+    (void) cmd;
+    return 0;
+}
+
+static struct audio_pcm_ops test_pcm_ops = {
+    .init_out = test_init_out,
+    .fini_out = test_fini_out,
+    .run_out  = test_run_out,
+    .write    = test_write,
+    .ctl_out  = test_ctl_out,
+};
+
+static struct audio_driver test_audio_driver = {
+    .name           = "test",
+    .descr          = "offline test driver",
+    .pcm_ops        = &test_pcm_ops,
+    .max_voices_out = 1,
+    .max_voices_in  = 0,
+    .voice_size_out = sizeof (HWVoiceOut),
+    .voice_size_in  = 0
+};
+
+void audio_test_init (int resample_quality)
+{
+    AudioState *s = &glob_audio_state;
+
+    memset (s, 0, sizeof (*s));
+    QLIST_INIT (&s->hw_head_out);
+    QLIST_INIT (&s->hw_head_in);
+    QLIST_INIT (&s->cap_head);
+    QLIST_INIT (&s->card_head);
+    s->drv = &test_audio_driver;
+    s->nb_hw_voices_out = 1;
+    s->vm_running = 1;
+#ifndef _WIN32
+    s->notify_fds[0] = s->notify_fds[1] = -1;
+#endif
+
+    conf.fixed_out.settings.freq = AUDIO_TEST_FREQ;
+    conf.fixed_out.settings.nchannels = 2;
+    conf.fixed_out.settings.fmt = AUD_FMT_S16;
+    conf.resample_quality = resample_quality;
+
+    test_record_buf = NULL;
+    test_record_max = 0;
+    test_record_len = 0;
+}
+
+void audio_test_record (int16_t *buf, int frames)
+{
+    test_record_buf = buf;
+    test_record_max = frames;
+    test_record_len = 0;
+}
+
+int audio_test_recorded (void)
+{
+    return test_record_len;
+}
+
+void audio_test_run (void)
+{
+    AudioState *s = &glob_audio_state;
+
+    audio_run_out (s);
+    audio_run_capture (s);
+}
+
+int64_t audio_test_played (void)
+{
+    HWVoiceOut *hw = glob_audio_state.hw_head_out.lh_first;
+
+    return hw ? (int64_t) hw->ts_helper : 0;
+}
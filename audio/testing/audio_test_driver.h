@@ -0,0 +1,48 @@
+/* Copyright (C) 2014 The Android Open Source Project
+**
+** This software is licensed under the terms of the GNU General Public
+** License version 2, as published by the Free Software Foundation, and
+** may be copied, distributed, and modified under those terms.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+*/
+#ifndef AUDIO_TESTING_AUDIO_TEST_DRIVER_H
+#define AUDIO_TESTING_AUDIO_TEST_DRIVER_H
+
+#include <stdint.h>
+
+/* Runs the audio mixer offline, for tests and benchmarks. A single
+ * 44.1 kHz stereo S16 hardware voice of 1024 frames is played by a
+ * driver that clips it into memory. Cards open their voices with
+ * AUD_open_out() and AUD_add_capture() as usual, but nothing runs
+ * until audio_test_run() is called.
+ */
+
+/* reset the audio state, and select the resampler quality of the
+ * voices opened from now on (RATE_QUALITY_XXX) */
+extern void     audio_test_init( int  resample_quality );
+
+/* have the driver copy the first 'frames' frames that it plays to
+ * 'buf', which must hold 'frames' * 2 samples */
+extern void     audio_test_record( int16_t*  buf, int  frames );
+
+/* number of frames recorded so far */
+extern int      audio_test_recorded( void );
+
+/* run the mixer once, like the audio timer does: play everything that
+ * was mixed, then ask the voices for more and run the captures */
+extern void     audio_test_run( void );
+
+/* number of frames played since audio_test_init() */
+extern int64_t  audio_test_played( void );
+
+/* sample rate of the hardware voice */
+#define  AUDIO_TEST_FREQ     44100
+
+/* size of the hardware voice buffer, in frames */
+#define  AUDIO_TEST_SAMPLES  1024
+
+#endif /* AUDIO_TESTING_AUDIO_TEST_DRIVER_H */
@@ -95,6 +95,7 @@ static int wav_out_run (HWVoiceOut *hw, int live)
     }
 
     hw->rpos = rpos;
+    audio_pcm_hw_schedule_out (hw, live);
     return decr;
 }
 
@@ -210,8 +211,27 @@ static void wav_out_fini (HWVoiceOut *hw)
 
 static int wav_out_ctl (HWVoiceOut *hw, int cmd, ...)
 {
-    (void) hw;
-    (void) cmd;
+    WAVVoiceOut *wav = (WAVVoiceOut *) hw;
+
+    switch (cmd) {
+    case VOICE_ENABLE:
+        {
+            va_list ap;
+            int poll_mode;
+
+            va_start (ap, cmd);
+            poll_mode = va_arg (ap, int);
+            va_end (ap);
+
+            wav->old_ticks = qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL);
+            audio_pcm_hw_set_timer_poll_out (hw, poll_mode);
+        }
+        break;
+
+    case VOICE_DISABLE:
+        audio_pcm_hw_set_poll_out (hw, 0);
+        break;
+    }
     return 0;
 }
 
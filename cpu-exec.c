@@ -24,6 +24,8 @@
 #include "exec/hax.h"
 #include "qemu/atomic.h"
 
+#include "helper.h"
+
 #if !defined(CONFIG_SOFTMMU)
 #undef EAX
 #undef ECX
@@ -43,6 +45,10 @@
 //#define CONFIG_DEBUG_EXEC
 //#define DEBUG_SIGNAL
 
+int64_t tb_exec_count;
+int64_t tb_lookup_ptr_hit_count;
+int64_t tb_lookup_ptr_miss_count;
+
 bool qemu_cpu_has_work(CPUState *cpu)
 {
     return cpu_has_work(cpu);
@@ -187,6 +193,33 @@ static inline TranslationBlock *tb_find_fast(CPUArchState *env)
     return tb;
 }
 
+/* Called by translated code that ends in an indirect branch, once the
+   new PC is in env.  Returns the host code of the next TB when it is
+   in tb_jmp_cache, so that the caller can jump straight to it with
+   goto_ptr, or the epilogue, which returns to cpu_exec with next_tb 0.
+   Pending interrupts and exit requests are still caught by the
+   tcg_exit_req check at the start of the next TB.
+   Only the targets that emit goto_ptr declare this helper.  */
+#if defined(TARGET_ARM) || defined(TARGET_I386)
+void *HELPER(lookup_tb_ptr)(CPUArchState *env)
+{
+    TranslationBlock *tb;
+    target_ulong cs_base, pc;
+    int flags;
+
+    cpu_get_tb_cpu_state(env, &pc, &cs_base, &flags);
+    tb = env->tb_jmp_cache[tb_jmp_cache_hash_func(pc)];
+    if (unlikely(!tb || tb->pc != pc || tb->cs_base != cs_base ||
+                 tb->flags != flags)) {
+        tb_lookup_ptr_miss_count++;
+        return tcg_ctx.code_gen_epilogue;
+    }
+    tb_lookup_ptr_hit_count++;
+    env->current_tb = tb;
+    return tb->tc_ptr;
+}
+#endif
+
 static CPUDebugExcpHandler *debug_excp_handler;
 
 void cpu_set_debug_excp_handler(CPUDebugExcpHandler *handler)
@@ -592,6 +625,7 @@ int cpu_exec(CPUOldState *env)
                     tc_ptr = tb->tc_ptr;
                 /* execute the generated code */
                     next_tb = tcg_qemu_tb_exec(env, tc_ptr);
+                    tb_exec_count++;
                     switch (next_tb & TB_EXIT_MASK) {
                     case TB_EXIT_REQUESTED:
                         /* Something asked us to stop executing
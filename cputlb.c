@@ -23,8 +23,19 @@
 #include "exec/cputlb.h"
 #include "exec/ram_addr.h"
 
+/* A mostly empty TLB is only shrunk after that many consecutive flushes,
+   so that short idle phases do not throw away a well sized table.  */
+#define CPU_TLB_SHRINK_FLUSHES 64
+
 /* statistics */
 int tlb_flush_count;
+int tlb_resize_count;
+uint64_t tlb_miss_count[NB_MMU_MODES];
+uint64_t tlb_victim_hit_count[NB_MMU_MODES];
+int tlb_asid_switch_count;
+int tlb_asid_flush_count;
+uint64_t tlb_asid_kept_count;
+uint64_t tlb_asid_dropped_count;
 
 static const CPUTLBEntry s_cputlb_empty_entry = {
     .addr_read  = -1,
@@ -38,16 +49,61 @@ static const CPUTLBEntry s_cputlb_empty_entry = {
  * If flush_global is false, flush (at least) all tlb entries not
  * marked global.
  *
- * Since QEMU doesn't currently implement a global/not-global flag
- * for tlb entries, at the moment tlb_flush() will also flush all
- * tlb entries in the flush_global == false case. This is OK because
- * CPU architectures generally permit an implementation to drop
- * entries from the TLB at any time, so flushing more entries than
- * required is only an efficiency issue, not a correctness issue.
+ * tlb_flush() always flushes all tlb entries, also in the
+ * flush_global == false case. This is OK because CPU architectures
+ * generally permit an implementation to drop entries from the TLB at
+ * any time, so flushing more entries than required is only an
+ * efficiency issue, not a correctness issue. Targets that tag entries
+ * with an ASID use tlb_switch_asid() and tlb_flush_asid() instead to
+ * keep global entries across address space switches.
+ */
+/* Adjust the size of the TLB of 'mmu_idx' before it gets flushed.
+ *
+ * The TLB is doubled when more than half of its entries were used and
+ * it missed more often than it has entries since the previous flush,
+ * i.e. when the guest working set does not fit in it. It is halved when
+ * it stayed mostly empty for CPU_TLB_SHRINK_FLUSHES flushes in a row,
+ * which makes flushes cheaper for guests that flush very often.
  */
+static void tlb_mmu_resize(CPUArchState *env, int mmu_idx)
+{
+    CPUTLBDesc *desc = &env->tlb_desc[mmu_idx];
+    unsigned int size = tlb_n_entries(env, mmu_idx);
+    unsigned int new_size = size;
+
+    if (env->tlb_mask[mmu_idx] == 0) {
+        /* first flush since the CPU was reset */
+        new_size = CPU_TLB_SIZE;
+        desc->n_idle_flushes = 0;
+    } else if (desc->n_used * 2 > size && desc->n_misses > size) {
+        if (size < CPU_TLB_MAX_SIZE) {
+            new_size = size * 2;
+        }
+        desc->n_idle_flushes = 0;
+    } else if (desc->n_used * 8 < size) {
+        if (++desc->n_idle_flushes >= CPU_TLB_SHRINK_FLUSHES &&
+            size > (1 << CPU_TLB_MIN_BITS)) {
+            new_size = size / 2;
+            desc->n_idle_flushes = 0;
+        }
+    } else {
+        desc->n_idle_flushes = 0;
+    }
+
+    if (new_size != size) {
+        if (env->tlb_mask[mmu_idx] != 0) {
+            tlb_resize_count++;
+        }
+        env->tlb_mask[mmu_idx] =
+            (uintptr_t)(new_size - 1) << CPU_TLB_ENTRY_BITS;
+    }
+    desc->n_used = 0;
+    desc->n_misses = 0;
+}
+
 void tlb_flush(CPUArchState *env, int flush_global)
 {
-    int i;
+    int mmu_idx;
 
 #if defined(DEBUG_TLB)
     printf("tlb_flush:\n");
@@ -56,12 +112,17 @@ void tlb_flush(CPUArchState *env, int flush_global)
        links while we are modifying them */
     env->current_tb = NULL;
 
-    for (i = 0; i < CPU_TLB_SIZE; i++) {
-        int mmu_idx;
+    for (mmu_idx = 0; mmu_idx < NB_MMU_MODES; mmu_idx++) {
+        unsigned int i, n;
 
-        for (mmu_idx = 0; mmu_idx < NB_MMU_MODES; mmu_idx++) {
+        tlb_mmu_resize(env, mmu_idx);
+        n = tlb_n_entries(env, mmu_idx);
+        for (i = 0; i < n; i++) {
             env->tlb_table[mmu_idx][i] = s_cputlb_empty_entry;
         }
+        for (i = 0; i < CPU_VTLB_SIZE; i++) {
+            env->tlb_v_table[mmu_idx][i] = s_cputlb_empty_entry;
+        }
     }
 
     memset(env->tb_jmp_cache, 0, TB_JMP_CACHE_SIZE * sizeof (void *));
@@ -71,14 +132,27 @@ void tlb_flush(CPUArchState *env, int flush_global)
     tlb_flush_count++;
 }
 
+static inline bool tlb_entry_is_page(CPUTLBEntry *tlb_entry,
+                                     target_ulong addr)
+{
+    return addr == (tlb_entry->addr_read &
+                    (TARGET_PAGE_MASK | TLB_INVALID_MASK)) ||
+           addr == (tlb_entry->addr_write &
+                    (TARGET_PAGE_MASK | TLB_INVALID_MASK)) ||
+           addr == (tlb_entry->addr_code &
+                    (TARGET_PAGE_MASK | TLB_INVALID_MASK));
+}
+
+static inline bool tlb_entry_is_empty(CPUTLBEntry *tlb_entry)
+{
+    return tlb_entry->addr_read == -1 &&
+           tlb_entry->addr_write == -1 &&
+           tlb_entry->addr_code == -1;
+}
+
 static inline void tlb_flush_entry(CPUTLBEntry *tlb_entry, target_ulong addr)
 {
-    if (addr == (tlb_entry->addr_read &
-                 (TARGET_PAGE_MASK | TLB_INVALID_MASK)) ||
-        addr == (tlb_entry->addr_write &
-                 (TARGET_PAGE_MASK | TLB_INVALID_MASK)) ||
-        addr == (tlb_entry->addr_code &
-                 (TARGET_PAGE_MASK | TLB_INVALID_MASK))) {
+    if (tlb_entry_is_page(tlb_entry, addr)) {
         *tlb_entry = s_cputlb_empty_entry;
     }
 }
@@ -106,9 +180,12 @@ void tlb_flush_page(CPUArchState *env, target_ulong addr)
     env->current_tb = NULL;
 
     addr &= TARGET_PAGE_MASK;
-    i = (addr >> TARGET_PAGE_BITS) & (CPU_TLB_SIZE - 1);
     for (mmu_idx = 0; mmu_idx < NB_MMU_MODES; mmu_idx++) {
-        tlb_flush_entry(&env->tlb_table[mmu_idx][i], addr);
+        tlb_flush_entry(&env->tlb_table[mmu_idx][tlb_index(env, mmu_idx, addr)],
+                        addr);
+        for (i = 0; i < CPU_VTLB_SIZE; i++) {
+            tlb_flush_entry(&env->tlb_v_table[mmu_idx][i], addr);
+        }
     }
 
     tb_flush_jmp_cache(env, addr);
@@ -159,12 +236,16 @@ void cpu_tlb_reset_dirty_all(ram_addr_t start1, ram_addr_t length)
 
         env = cpu->env_ptr;
         for (mmu_idx = 0; mmu_idx < NB_MMU_MODES; mmu_idx++) {
-            unsigned int i;
+            unsigned int i, n = tlb_n_entries(env, mmu_idx);
 
-            for (i = 0; i < CPU_TLB_SIZE; i++) {
+            for (i = 0; i < n; i++) {
                 tlb_reset_dirty_range(&env->tlb_table[mmu_idx][i],
                                       start1, length);
             }
+            for (i = 0; i < CPU_VTLB_SIZE; i++) {
+                tlb_reset_dirty_range(&env->tlb_v_table[mmu_idx][i],
+                                      start1, length);
+            }
         }
     }
 }
@@ -184,9 +265,12 @@ void tlb_set_dirty(CPUArchState *env, target_ulong vaddr)
     int mmu_idx;
 
     vaddr &= TARGET_PAGE_MASK;
-    i = (vaddr >> TARGET_PAGE_BITS) & (CPU_TLB_SIZE - 1);
     for (mmu_idx = 0; mmu_idx < NB_MMU_MODES; mmu_idx++) {
-        tlb_set_dirty1(&env->tlb_table[mmu_idx][i], vaddr);
+        tlb_set_dirty1(&env->tlb_table[mmu_idx][tlb_index(env, mmu_idx, vaddr)],
+                       vaddr);
+        for (i = 0; i < CPU_VTLB_SIZE; i++) {
+            tlb_set_dirty1(&env->tlb_v_table[mmu_idx][i], vaddr);
+        }
     }
 }
 
@@ -213,6 +297,13 @@ static void tlb_add_large_page(CPUArchState *env, target_ulong vaddr,
     env->tlb_flush_mask = mask;
 }
 
+/* A victim TLB entry tagged with 'tag' can be used by the current
+   address space.  */
+static inline bool tlb_asid_match(CPUArchState *env, uint16_t tag)
+{
+    return tag == 0 || tag == env->tlb_asid_tag;
+}
+
 /* Add a new TLB entry. At most one entry for a given virtual address
    is permitted. Only a single TARGET_PAGE_SIZE region is mapped, the
    supplied size is only used by tlb_flush_page.  */
@@ -220,7 +311,17 @@ void tlb_set_page(CPUArchState *env, target_ulong vaddr,
                   hwaddr paddr, int prot,
                   int mmu_idx, target_ulong size)
 {
-    PhysPageDesc *p;
+    tlb_set_page_asid(env, vaddr, paddr, prot, mmu_idx, size,
+                      TLB_ASID_GLOBAL);
+}
+
+/* Same as tlb_set_page(), for a translation that is only valid in the
+   address space 'asid', or in all of them if 'asid' is TLB_ASID_GLOBAL.  */
+void tlb_set_page_asid(CPUArchState *env, target_ulong vaddr,
+                       hwaddr paddr, int prot,
+                       int mmu_idx, target_ulong size, int asid)
+{
+    PhysPageDesc p;
     unsigned long pd;
     unsigned int index;
     target_ulong address;
@@ -229,17 +330,19 @@ void tlb_set_page(CPUArchState *env, target_ulong vaddr,
     CPUTLBEntry *te;
     CPUWatchpoint *wp;
     hwaddr iotlb;
+    unsigned int vidx;
+    uint16_t tag = asid + 1;
 
     assert(size >= TARGET_PAGE_SIZE);
+    if (tag != 0 && tag != env->tlb_asid_tag) {
+        /* The ASID changed behind our back, e.g. on reset or loadvm.  */
+        tlb_switch_asid(env, asid);
+    }
     if (size != TARGET_PAGE_SIZE) {
         tlb_add_large_page(env, vaddr, size);
     }
-    p = phys_page_find(paddr >> TARGET_PAGE_BITS);
-    if (!p) {
-        pd = IO_MEM_UNASSIGNED;
-    } else {
-        pd = p->phys_offset;
-    }
+    phys_page_lookup(paddr >> TARGET_PAGE_BITS, &p);
+    pd = p.phys_offset;
 #if defined(DEBUG_TLB)
     printf("tlb_set_page: vaddr=" TARGET_FMT_lx " paddr=0x" TARGET_FMT_plx
            " prot=%x idx=%d pd=0x%08lx\n",
@@ -267,11 +370,7 @@ void tlb_set_page(CPUArchState *env, target_ulong vaddr,
            We can't use the high bits of pd for this because
            IO_MEM_ROMD uses these as a ram address.  */
         iotlb = (pd & ~TARGET_PAGE_MASK);
-        if (p) {
-            iotlb += p->region_offset;
-        } else {
-            iotlb += paddr;
-        }
+        iotlb += p.region_offset;
     }
 
     code_address = address;
@@ -286,9 +385,32 @@ void tlb_set_page(CPUArchState *env, target_ulong vaddr,
         }
     }
 
-    index = (vaddr >> TARGET_PAGE_BITS) & (CPU_TLB_SIZE - 1);
-    env->iotlb[mmu_idx][index] = iotlb - vaddr;
+    index = tlb_index(env, mmu_idx, vaddr);
     te = &env->tlb_table[mmu_idx][index];
+
+    /* Keep the translation being replaced in the victim TLB, unless it is
+       for the same page. Any stale victim entry for this page is dropped,
+       so that there is still at most one entry per virtual address in the
+       current address space. Entries of other address spaces are kept,
+       unless the new one is global.  */
+    for (vidx = 0; vidx < CPU_VTLB_SIZE; vidx++) {
+        if (tag == 0 || tlb_asid_match(env, env->tlb_v_asid[mmu_idx][vidx])) {
+            tlb_flush_entry(&env->tlb_v_table[mmu_idx][vidx], vaddr);
+        }
+    }
+    if (tlb_entry_is_empty(te)) {
+        env->tlb_desc[mmu_idx].n_used++;
+    } else if (!tlb_entry_is_page(te, vaddr)) {
+        vidx = env->vtlb_index++ % CPU_VTLB_SIZE;
+        env->tlb_v_table[mmu_idx][vidx] = *te;
+        env->iotlb_v[mmu_idx][vidx] = env->iotlb[mmu_idx][index];
+        env->tlb_v_asid[mmu_idx][vidx] = env->tlb_asid[mmu_idx][index];
+    }
+    env->tlb_asid[mmu_idx][index] = tag;
+    env->tlb_desc[mmu_idx].n_misses++;
+    tlb_miss_count[mmu_idx]++;
+
+    env->iotlb[mmu_idx][index] = iotlb - vaddr;
     te->addend = addend - vaddr;
     if (prot & PAGE_READ) {
         te->addr_read = address;
@@ -317,6 +439,114 @@ void tlb_set_page(CPUArchState *env, target_ulong vaddr,
     }
 }
 
+/* Look up 'addr' in the victim TLB of 'mmu_idx', and on a hit swap the
+   matching entry with the one at 'index' in the main TLB. 'elt_ofs' is the
+   offset in CPUTLBEntry of the address field for the access type. Used by
+   the softmmu slow path before resorting to tlb_fill().  */
+bool tlb_victim_lookup(CPUArchState *env, int mmu_idx, unsigned int index,
+                       target_ulong addr, size_t elt_ofs)
+{
+    unsigned int vidx;
+
+    addr &= TARGET_PAGE_MASK;
+    for (vidx = 0; vidx < CPU_VTLB_SIZE; vidx++) {
+        CPUTLBEntry *ve = &env->tlb_v_table[mmu_idx][vidx];
+        target_ulong cmp = *(target_ulong *)((uintptr_t)ve + elt_ofs);
+
+        if ((cmp & (TARGET_PAGE_MASK | TLB_INVALID_MASK)) == addr &&
+            tlb_asid_match(env, env->tlb_v_asid[mmu_idx][vidx])) {
+            CPUTLBEntry tmptlb = env->tlb_table[mmu_idx][index];
+            hwaddr tmpiotlb = env->iotlb[mmu_idx][index];
+            uint16_t tmptag = env->tlb_asid[mmu_idx][index];
+
+            env->tlb_table[mmu_idx][index] = *ve;
+            env->iotlb[mmu_idx][index] = env->iotlb_v[mmu_idx][vidx];
+            env->tlb_asid[mmu_idx][index] = env->tlb_v_asid[mmu_idx][vidx];
+            *ve = tmptlb;
+            env->iotlb_v[mmu_idx][vidx] = tmpiotlb;
+            env->tlb_v_asid[mmu_idx][vidx] = tmptag;
+            tlb_victim_hit_count[mmu_idx]++;
+            return true;
+        }
+    }
+    return false;
+}
+
+/* Make 'asid' the current address space.
+ *
+ * The softmmu fast path does not compare ASIDs, so the non-global entries
+ * of the previous address space are dropped from the main TLB, while the
+ * global ones (typically the kernel mappings) are kept. Entries in the
+ * victim TLB are kept as well: they are only used again once their
+ * address space is current. This makes a context switch much cheaper
+ * than a full tlb_flush().
+ */
+void tlb_switch_asid(CPUArchState *env, int asid)
+{
+    uint16_t tag = asid + 1;
+    int mmu_idx;
+
+    if (tag == env->tlb_asid_tag) {
+        return;
+    }
+    /* must reset current TB so that interrupts cannot modify the
+       links while we are modifying them */
+    env->current_tb = NULL;
+
+    for (mmu_idx = 0; mmu_idx < NB_MMU_MODES; mmu_idx++) {
+        unsigned int i, n = tlb_n_entries(env, mmu_idx);
+
+        for (i = 0; i < n; i++) {
+            CPUTLBEntry *te = &env->tlb_table[mmu_idx][i];
+
+            if (tlb_entry_is_empty(te)) {
+                continue;
+            }
+            if (env->tlb_asid[mmu_idx][i] == 0) {
+                tlb_asid_kept_count++;
+            } else {
+                *te = s_cputlb_empty_entry;
+                tlb_asid_dropped_count++;
+            }
+        }
+    }
+
+    /* The jump cache is indexed by virtual address only.  */
+    memset(env->tb_jmp_cache, 0, TB_JMP_CACHE_SIZE * sizeof (void *));
+
+    env->tlb_asid_tag = tag;
+    tlb_asid_switch_count++;
+}
+
+/* Flush all the non-global entries of address space 'asid'.  */
+void tlb_flush_asid(CPUArchState *env, int asid)
+{
+    uint16_t tag = asid + 1;
+    int mmu_idx;
+
+    env->current_tb = NULL;
+
+    for (mmu_idx = 0; mmu_idx < NB_MMU_MODES; mmu_idx++) {
+        unsigned int i, n = tlb_n_entries(env, mmu_idx);
+
+        for (i = 0; i < n; i++) {
+            if (env->tlb_asid[mmu_idx][i] == tag) {
+                env->tlb_table[mmu_idx][i] = s_cputlb_empty_entry;
+            }
+        }
+        for (i = 0; i < CPU_VTLB_SIZE; i++) {
+            if (env->tlb_v_asid[mmu_idx][i] == tag) {
+                env->tlb_v_table[mmu_idx][i] = s_cputlb_empty_entry;
+            }
+        }
+    }
+
+    if (tag == env->tlb_asid_tag) {
+        memset(env->tb_jmp_cache, 0, TB_JMP_CACHE_SIZE * sizeof (void *));
+    }
+    tlb_asid_flush_count++;
+}
+
 /* NOTE: this function can trigger an exception */
 /* NOTE2: the returned address is not exactly the physical address: it
    is the offset relative to phys_ram_base */
@@ -325,8 +555,8 @@ tb_page_addr_t get_page_addr_code(CPUArchState *env1, target_ulong addr)
     int mmu_idx, page_index, pd;
     void *p;
 
-    page_index = (addr >> TARGET_PAGE_BITS) & (CPU_TLB_SIZE - 1);
     mmu_idx = cpu_mmu_index(env1);
+    page_index = tlb_index(env1, mmu_idx, addr);
     if (unlikely(env1->tlb_table[mmu_idx][page_index].addr_code !=
                  (addr & TARGET_PAGE_MASK))) {
         cpu_ldub_code(env1, addr);
@@ -40,6 +40,9 @@ these four paragraphs for those parts of this code that are retained.
  */
 #include "config.h"
 
+#include <float.h>
+#include <math.h>
+
 #include "fpu/softfloat.h"
 
 /*----------------------------------------------------------------------------
@@ -74,6 +77,74 @@ void set_floatx80_rounding_precision(int val STATUS_PARAM)
     STATUS(floatx80_rounding_precision) = val;
 }
 
+/*----------------------------------------------------------------------------
+| Host FPU fast path for the basic single and double precision operations.
+|
+| The host FPU gives the same result as the code below when the rounding mode
+| is round-to-nearest-even, the operands are zero or normal and the result is
+| a normal number or an infinity.  The only flag the host cannot report for us
+| is inexact, so the fast path is only taken once inexact is already set in
+| `status' (it is sticky, and guests very rarely clear it).  Overflow is
+| detected from an infinite result; everything else, including results that
+| may be tiny, is recomputed with softfloat so that underflow, flush-to-zero
+| and NaN handling stay exactly as before.
+|
+| This requires a host that evaluates float and double arithmetic in their own
+| precision (not the x87 stack) and runs with its default rounding mode and no
+| denormal flushing, which is the case on every host we build for except
+| 32-bit x86 without SSE2 math.
+*----------------------------------------------------------------------------*/
+#if defined(FLT_EVAL_METHOD) && FLT_EVAL_METHOD == 0
+#define USE_HOST_FPU 1
+#else
+#define USE_HOST_FPU 0
+#endif
+
+typedef union {
+    float32 s;
+    float h;
+} host_float32;
+
+typedef union {
+    float64 s;
+    double h;
+} host_float64;
+
+static flag host_fpu_enabled = USE_HOST_FPU;
+
+void set_float_host_fpu(flag val)
+{
+    host_fpu_enabled = USE_HOST_FPU && val;
+}
+
+static inline flag host_fpu_usable(float_status *status)
+{
+    return host_fpu_enabled
+        && (STATUS(float_exception_flags) & float_flag_inexact)
+        && STATUS(float_rounding_mode) == float_round_nearest_even;
+}
+
+/* Returns 1 if the host result `r' can be returned as is, raising overflow
+ * if needed, or 0 if the operation must be redone in software.
+ */
+static inline flag host_float32_result_ok(float r STATUS_PARAM)
+{
+    if (unlikely(isinf(r))) {
+        float_raise(float_flag_overflow STATUS_VAR);
+        return 1;
+    }
+    return fabsf(r) > FLT_MIN;
+}
+
+static inline flag host_float64_result_ok(double r STATUS_PARAM)
+{
+    if (unlikely(isinf(r))) {
+        float_raise(float_flag_overflow STATUS_VAR);
+        return 1;
+    }
+    return fabs(r) > DBL_MIN;
+}
+
 /*----------------------------------------------------------------------------
 | Returns the fraction bits of the half-precision floating-point value `a'.
 *----------------------------------------------------------------------------*/
@@ -1867,6 +1938,19 @@ static float32 subFloat32Sigs( float32 a, float32 b, flag zSign STATUS_PARAM)
 float32 float32_add( float32 a, float32 b STATUS_PARAM )
 {
     flag aSign, bSign;
+
+    if (host_fpu_usable(status)
+        && float32_is_zero_or_normal(a) && float32_is_zero_or_normal(b)) {
+        host_float32 ua, ub, ur;
+
+        ua.s = a;
+        ub.s = b;
+        ur.h = ua.h + ub.h;
+        if (host_float32_result_ok(ur.h STATUS_VAR)) {
+            return ur.s;
+        }
+    }
+
     a = float32_squash_input_denormal(a STATUS_VAR);
     b = float32_squash_input_denormal(b STATUS_VAR);
 
@@ -1890,6 +1974,19 @@ float32 float32_add( float32 a, float32 b STATUS_PARAM )
 float32 float32_sub( float32 a, float32 b STATUS_PARAM )
 {
     flag aSign, bSign;
+
+    if (host_fpu_usable(status)
+        && float32_is_zero_or_normal(a) && float32_is_zero_or_normal(b)) {
+        host_float32 ua, ub, ur;
+
+        ua.s = a;
+        ub.s = b;
+        ur.h = ua.h - ub.h;
+        if (host_float32_result_ok(ur.h STATUS_VAR)) {
+            return ur.s;
+        }
+    }
+
     a = float32_squash_input_denormal(a STATUS_VAR);
     b = float32_squash_input_denormal(b STATUS_VAR);
 
@@ -1918,6 +2015,18 @@ float32 float32_mul( float32 a, float32 b STATUS_PARAM )
     uint64_t zSig64;
     uint32_t zSig;
 
+    if (host_fpu_usable(status)
+        && float32_is_zero_or_normal(a) && float32_is_zero_or_normal(b)) {
+        host_float32 ua, ub, ur;
+
+        ua.s = a;
+        ub.s = b;
+        ur.h = ua.h * ub.h;
+        if (host_float32_result_ok(ur.h STATUS_VAR)) {
+            return ur.s;
+        }
+    }
+
     a = float32_squash_input_denormal(a STATUS_VAR);
     b = float32_squash_input_denormal(b STATUS_VAR);
 
@@ -1978,6 +2087,20 @@ float32 float32_div( float32 a, float32 b STATUS_PARAM )
     flag aSign, bSign, zSign;
     int_fast16_t aExp, bExp, zExp;
     uint32_t aSig, bSig, zSig;
+
+    if (host_fpu_usable(status)
+        && float32_is_zero_or_normal(a)
+        && float32_is_zero_or_normal(b) && !float32_is_zero(b)) {
+        host_float32 ua, ub, ur;
+
+        ua.s = a;
+        ub.s = b;
+        ur.h = ua.h / ub.h;
+        if (host_float32_result_ok(ur.h STATUS_VAR)) {
+            return ur.s;
+        }
+    }
+
     a = float32_squash_input_denormal(a STATUS_VAR);
     b = float32_squash_input_denormal(b STATUS_VAR);
 
@@ -2351,6 +2474,18 @@ float32 float32_sqrt( float32 a STATUS_PARAM )
     int_fast16_t aExp, zExp;
     uint32_t aSig, zSig;
     uint64_t rem, term;
+
+    if (host_fpu_usable(status)
+        && float32_is_zero_or_normal(a) && !float32_is_neg(a)) {
+        host_float32 ua, ur;
+
+        ua.s = a;
+        ur.h = sqrtf(ua.h);
+        if (host_float32_result_ok(ur.h STATUS_VAR)) {
+            return ur.s;
+        }
+    }
+
     a = float32_squash_input_denormal(a STATUS_VAR);
 
     aSig = extractFloat32Frac( a );
@@ -3430,6 +3565,19 @@ static float64 subFloat64Sigs( float64 a, float64 b, flag zSign STATUS_PARAM )
 float64 float64_add( float64 a, float64 b STATUS_PARAM )
 {
     flag aSign, bSign;
+
+    if (host_fpu_usable(status)
+        && float64_is_zero_or_normal(a) && float64_is_zero_or_normal(b)) {
+        host_float64 ua, ub, ur;
+
+        ua.s = a;
+        ub.s = b;
+        ur.h = ua.h + ub.h;
+        if (host_float64_result_ok(ur.h STATUS_VAR)) {
+            return ur.s;
+        }
+    }
+
     a = float64_squash_input_denormal(a STATUS_VAR);
     b = float64_squash_input_denormal(b STATUS_VAR);
 
@@ -3453,6 +3601,19 @@ float64 float64_add( float64 a, float64 b STATUS_PARAM )
 float64 float64_sub( float64 a, float64 b STATUS_PARAM )
 {
     flag aSign, bSign;
+
+    if (host_fpu_usable(status)
+        && float64_is_zero_or_normal(a) && float64_is_zero_or_normal(b)) {
+        host_float64 ua, ub, ur;
+
+        ua.s = a;
+        ub.s = b;
+        ur.h = ua.h - ub.h;
+        if (host_float64_result_ok(ur.h STATUS_VAR)) {
+            return ur.s;
+        }
+    }
+
     a = float64_squash_input_denormal(a STATUS_VAR);
     b = float64_squash_input_denormal(b STATUS_VAR);
 
@@ -3479,6 +3640,18 @@ float64 float64_mul( float64 a, float64 b STATUS_PARAM )
     int_fast16_t aExp, bExp, zExp;
     uint64_t aSig, bSig, zSig0, zSig1;
 
+    if (host_fpu_usable(status)
+        && float64_is_zero_or_normal(a) && float64_is_zero_or_normal(b)) {
+        host_float64 ua, ub, ur;
+
+        ua.s = a;
+        ub.s = b;
+        ur.h = ua.h * ub.h;
+        if (host_float64_result_ok(ur.h STATUS_VAR)) {
+            return ur.s;
+        }
+    }
+
     a = float64_squash_input_denormal(a STATUS_VAR);
     b = float64_squash_input_denormal(b STATUS_VAR);
 
@@ -3541,6 +3714,20 @@ float64 float64_div( float64 a, float64 b STATUS_PARAM )
     uint64_t aSig, bSig, zSig;
     uint64_t rem0, rem1;
     uint64_t term0, term1;
+
+    if (host_fpu_usable(status)
+        && float64_is_zero_or_normal(a)
+        && float64_is_zero_or_normal(b) && !float64_is_zero(b)) {
+        host_float64 ua, ub, ur;
+
+        ua.s = a;
+        ub.s = b;
+        ur.h = ua.h / ub.h;
+        if (host_float64_result_ok(ur.h STATUS_VAR)) {
+            return ur.s;
+        }
+    }
+
     a = float64_squash_input_denormal(a STATUS_VAR);
     b = float64_squash_input_denormal(b STATUS_VAR);
 
@@ -3924,6 +4111,18 @@ float64 float64_sqrt( float64 a STATUS_PARAM )
     int_fast16_t aExp, zExp;
     uint64_t aSig, zSig, doubleZSig;
     uint64_t rem0, rem1, term0, term1;
+
+    if (host_fpu_usable(status)
+        && float64_is_zero_or_normal(a) && !float64_is_neg(a)) {
+        host_float64 ua, ur;
+
+        ua.s = a;
+        ur.h = sqrt(ua.h);
+        if (host_float64_result_ok(ur.h STATUS_VAR)) {
+            return ur.s;
+        }
+    }
+
     a = float64_squash_input_denormal(a STATUS_VAR);
 
     aSig = extractFloat64Frac( a );
@@ -0,0 +1,354 @@
+/* Copyright (C) 2014 The Android Open Source Project
+**
+** This software is licensed under the terms of the GNU General Public
+** License version 2, as published by the Free Software Foundation, and
+** may be copied, distributed, and modified under those terms.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+*/
+extern "C" {
+#include "fpu/softfloat.h"
+}
+
+#include <gtest/gtest.h>
+
+#include <stdint.h>
+
+// These tests check that the host FPU fast path of the basic float32 and
+// float64 operations returns exactly the same results and exception flags
+// as the pure software implementation, for random operands and random
+// floating-point status.
+
+namespace {
+
+const int kIterations = 100000;
+
+// Simple deterministic pseudo-random generator (xorshift64*).
+class Random {
+public:
+    explicit Random(uint64_t seed) : mState(seed) {}
+
+    uint64_t next() {
+        mState ^= mState >> 12;
+        mState ^= mState << 25;
+        mState ^= mState >> 27;
+        return mState * 2685821657736338717ULL;
+    }
+
+    // Return a random number in [0..limit).
+    unsigned below(unsigned limit) {
+        return static_cast<unsigned>((next() >> 32) % limit);
+    }
+
+private:
+    uint64_t mState;
+};
+
+// Classes of operands to pick from. Normal numbers are more frequent so
+// that the fast path is taken often enough.
+enum OperandClass {
+    kZero,
+    kDenormal,
+    kInfinity,
+    kNaN,
+    kNearOverflow,
+    kNearUnderflow,
+    kRandomBits,
+    kNormal,
+};
+
+OperandClass randomClass(Random* random) {
+    unsigned n = random->below(16);
+    return n <= kRandomBits ? static_cast<OperandClass>(n) : kNormal;
+}
+
+// Build a float32 from its fields. |frac| is masked to 23 bits.
+uint32_t makeFloat32Bits(uint32_t sign, uint32_t exp, uint32_t frac) {
+    return (sign << 31) | (exp << 23) | (frac & 0x7fffff);
+}
+
+float32 randomFloat32(Random* random) {
+    uint64_t bits = random->next();
+    uint32_t sign = bits & 1;
+    uint32_t frac = static_cast<uint32_t>(bits >> 8);
+    uint32_t result;
+
+    switch (randomClass(random)) {
+    case kZero:
+        result = makeFloat32Bits(sign, 0, 0);
+        break;
+    case kDenormal:
+        result = makeFloat32Bits(sign, 0, frac | 1);
+        break;
+    case kInfinity:
+        result = makeFloat32Bits(sign, 0xff, 0);
+        break;
+    case kNaN:
+        // Both quiet and signaling NaNs.
+        result = makeFloat32Bits(sign, 0xff, frac | 1);
+        break;
+    case kNearOverflow:
+        result = makeFloat32Bits(sign, 0xfe - random->below(2), frac);
+        break;
+    case kNearUnderflow:
+        result = makeFloat32Bits(sign, 1 + random->below(24), frac);
+        break;
+    case kRandomBits:
+        result = static_cast<uint32_t>(bits >> 32);
+        break;
+    case kNormal:
+    default:
+        // Keep the exponent close to 1.0 so that sums and products
+        // mostly stay normal.
+        result = makeFloat32Bits(sign, 127 - 20 + random->below(40), frac);
+        break;
+    }
+    return make_float32(result);
+}
+
+uint64_t makeFloat64Bits(uint64_t sign, uint64_t exp, uint64_t frac) {
+    return (sign << 63) | (exp << 52) | (frac & 0xfffffffffffffULL);
+}
+
+float64 randomFloat64(Random* random) {
+    uint64_t bits = random->next();
+    uint64_t sign = bits >> 63;
+    uint64_t frac = random->next();
+    uint64_t result;
+
+    switch (randomClass(random)) {
+    case kZero:
+        result = makeFloat64Bits(sign, 0, 0);
+        break;
+    case kDenormal:
+        result = makeFloat64Bits(sign, 0, frac | 1);
+        break;
+    case kInfinity:
+        result = makeFloat64Bits(sign, 0x7ff, 0);
+        break;
+    case kNaN:
+        result = makeFloat64Bits(sign, 0x7ff, frac | 1);
+        break;
+    case kNearOverflow:
+        result = makeFloat64Bits(sign, 0x7fe - random->below(2), frac);
+        break;
+    case kNearUnderflow:
+        result = makeFloat64Bits(sign, 1 + random->below(53), frac);
+        break;
+    case kRandomBits:
+        result = bits;
+        break;
+    case kNormal:
+    default:
+        result = makeFloat64Bits(sign, 1023 - 40 + random->below(80), frac);
+        break;
+    }
+    return make_float64(result);
+}
+
+// Return a random status. Half of the time the rounding mode is the
+// default one and the inexact flag is set, which is when the fast path
+// can be used.
+float_status randomStatus(Random* random) {
+    float_status status = {};
+    bool fast = random->below(2) == 0;
+
+    set_float_rounding_mode(fast ? float_round_nearest_even
+                                 : static_cast<int>(random->below(4)),
+                            &status);
+    int flags = static_cast<int>(random->below(256));
+    if (fast) {
+        flags |= float_flag_inexact;
+    }
+    set_float_exception_flags(flags, &status);
+    set_float_detect_tininess(random->below(2) ? float_tininess_before_rounding
+                                               : float_tininess_after_rounding,
+                              &status);
+    set_flush_to_zero(random->below(4) == 0, &status);
+    set_flush_inputs_to_zero(random->below(4) == 0, &status);
+    set_default_nan_mode(random->below(4) == 0, &status);
+    return status;
+}
+
+typedef float32 (*Float32BinaryOp)(float32, float32, float_status*);
+typedef float64 (*Float64BinaryOp)(float64, float64, float_status*);
+
+void checkFloat32BinaryOp(Float32BinaryOp op, const char* name, uint64_t seed) {
+    Random random(seed);
+    for (int n = 0; n < kIterations; ++n) {
+        float32 a = randomFloat32(&random);
+        float32 b = randomFloat32(&random);
+        if (random.below(8) == 0) {
+            // Nearly equal operands, to exercise cancellation.
+            b = make_float32(float32_val(a) ^ random.below(16));
+        }
+        const float_status status = randomStatus(&random);
+        float_status hostStatus = status;
+        float_status softStatus = status;
+
+        set_float_host_fpu(1);
+        float32 hostResult = op(a, b, &hostStatus);
+        set_float_host_fpu(0);
+        float32 softResult = op(a, b, &softStatus);
+
+        EXPECT_EQ(float32_val(softResult), float32_val(hostResult))
+                << name << "(0x" << std::hex << float32_val(a) << ", 0x"
+                << float32_val(b) << ") rounding "
+                << static_cast<int>(status.float_rounding_mode);
+        EXPECT_EQ(softStatus.float_exception_flags,
+                  hostStatus.float_exception_flags)
+                << name << "(0x" << std::hex << float32_val(a) << ", 0x"
+                << float32_val(b) << ") flags 0x"
+                << static_cast<int>(status.float_exception_flags & 0xff);
+    }
+    set_float_host_fpu(1);
+}
+
+void checkFloat64BinaryOp(Float64BinaryOp op, const char* name, uint64_t seed) {
+    Random random(seed);
+    for (int n = 0; n < kIterations; ++n) {
+        float64 a = randomFloat64(&random);
+        float64 b = randomFloat64(&random);
+        if (random.below(8) == 0) {
+            b = make_float64(float64_val(a) ^ random.below(16));
+        }
+        const float_status status = randomStatus(&random);
+        float_status hostStatus = status;
+        float_status softStatus = status;
+
+        set_float_host_fpu(1);
+        float64 hostResult = op(a, b, &hostStatus);
+        set_float_host_fpu(0);
+        float64 softResult = op(a, b, &softStatus);
+
+        EXPECT_EQ(float64_val(softResult), float64_val(hostResult))
+                << name << "(0x" << std::hex << float64_val(a) << ", 0x"
+                << float64_val(b) << ") rounding "
+                << static_cast<int>(status.float_rounding_mode);
+        EXPECT_EQ(softStatus.float_exception_flags,
+                  hostStatus.float_exception_flags)
+                << name << "(0x" << std::hex << float64_val(a) << ", 0x"
+                << float64_val(b) << ") flags 0x"
+                << static_cast<int>(status.float_exception_flags & 0xff);
+    }
+    set_float_host_fpu(1);
+}
+
+}  // namespace
+
+TEST(softfloat, float32_add) {
+    checkFloat32BinaryOp(float32_add, "float32_add", 1);
+}
+
+TEST(softfloat, float32_sub) {
+    checkFloat32BinaryOp(float32_sub, "float32_sub", 2);
+}
+
+TEST(softfloat, float32_mul) {
+    checkFloat32BinaryOp(float32_mul, "float32_mul", 3);
+}
+
+TEST(softfloat, float32_div) {
+    checkFloat32BinaryOp(float32_div, "float32_div", 4);
+}
+
+TEST(softfloat, float32_sqrt) {
+    Random random(5);
+    for (int n = 0; n < kIterations; ++n) {
+        float32 a = randomFloat32(&random);
+        if (random.below(2)) {
+            // Mostly non-negative operands, which the fast path handles.
+            a = float32_abs(a);
+        }
+        const float_status status = randomStatus(&random);
+        float_status hostStatus = status;
+        float_status softStatus = status;
+
+        set_float_host_fpu(1);
+        float32 hostResult = float32_sqrt(a, &hostStatus);
+        set_float_host_fpu(0);
+        float32 softResult = float32_sqrt(a, &softStatus);
+
+        EXPECT_EQ(float32_val(softResult), float32_val(hostResult))
+                << "float32_sqrt(0x" << std::hex << float32_val(a) << ")";
+        EXPECT_EQ(softStatus.float_exception_flags,
+                  hostStatus.float_exception_flags)
+                << "float32_sqrt(0x" << std::hex << float32_val(a) << ")";
+    }
+    set_float_host_fpu(1);
+}
+
+TEST(softfloat, float64_add) {
+    checkFloat64BinaryOp(float64_add, "float64_add", 6);
+}
+
+TEST(softfloat, float64_sub) {
+    checkFloat64BinaryOp(float64_sub, "float64_sub", 7);
+}
+
+TEST(softfloat, float64_mul) {
+    checkFloat64BinaryOp(float64_mul, "float64_mul", 8);
+}
+
+TEST(softfloat, float64_div) {
+    checkFloat64BinaryOp(float64_div, "float64_div", 9);
+}
+
+TEST(softfloat, float64_sqrt) {
+    Random random(10);
+    for (int n = 0; n < kIterations; ++n) {
+        float64 a = randomFloat64(&random);
+        if (random.below(2)) {
+            a = float64_abs(a);
+        }
+        const float_status status = randomStatus(&random);
+        float_status hostStatus = status;
+        float_status softStatus = status;
+
+        set_float_host_fpu(1);
+        float64 hostResult = float64_sqrt(a, &hostStatus);
+        set_float_host_fpu(0);
+        float64 softResult = float64_sqrt(a, &softStatus);
+
+        EXPECT_EQ(float64_val(softResult), float64_val(hostResult))
+                << "float64_sqrt(0x" << std::hex << float64_val(a) << ")";
+        EXPECT_EQ(softStatus.float_exception_flags,
+                  hostStatus.float_exception_flags)
+                << "float64_sqrt(0x" << std::hex << float64_val(a) << ")";
+    }
+    set_float_host_fpu(1);
+}
+
+// Check that a float-heavy loop with the usual guest status (default
+// rounding, inexact already raised) gives the same bits on both paths.
+TEST(softfloat, float64_dot_product) {
+    Random random(11);
+    float_status hostStatus = {};
+    float_status softStatus = {};
+    float64 hostSum = float64_zero;
+    float64 softSum = float64_zero;
+
+    set_float_exception_flags(float_flag_inexact, &hostStatus);
+    set_float_exception_flags(float_flag_inexact, &softStatus);
+    for (int n = 0; n < kIterations; ++n) {
+        float64 a = make_float64(makeFloat64Bits(random.below(2),
+                                                 1023 - 4 + random.below(8),
+                                                 random.next()));
+        float64 b = make_float64(makeFloat64Bits(random.below(2),
+                                                 1023 - 4 + random.below(8),
+                                                 random.next()));
+        set_float_host_fpu(1);
+        hostSum = float64_add(hostSum, float64_mul(a, b, &hostStatus),
+                              &hostStatus);
+        set_float_host_fpu(0);
+        softSum = float64_add(softSum, float64_mul(a, b, &softStatus),
+                              &softStatus);
+    }
+    set_float_host_fpu(1);
+    EXPECT_EQ(float64_val(softSum), float64_val(hostSum));
+    EXPECT_EQ(softStatus.float_exception_flags,
+              hostStatus.float_exception_flags);
+}
@@ -466,6 +466,7 @@ static void goldfish_audio_write(void *opaque, hwaddr offset, uint32_t val)
             goldfish_audio_buff_set_length( s->out_buff1, val );
             goldfish_audio_buff_read( s->out_buff1 );
             s->int_status &= ~AUDIO_INT_WRITE_BUFFER_1_EMPTY;
+            AUD_wakeup_out(s->voice);
             break;
         case AUDIO_WRITE_BUFFER_2:
             /* record that data in buffer 2 is ready to write */
@@ -474,6 +475,7 @@ static void goldfish_audio_write(void *opaque, hwaddr offset, uint32_t val)
             goldfish_audio_buff_set_length( s->out_buff2, val );
             goldfish_audio_buff_read( s->out_buff2 );
             s->int_status &= ~AUDIO_INT_WRITE_BUFFER_2_EMPTY;
+            AUD_wakeup_out(s->voice);
             break;
 
         case AUDIO_SET_READ_BUFFER:
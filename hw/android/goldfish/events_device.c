@@ -16,6 +16,7 @@
 #include "android/multitouch-screen.h"
 #include "android/skin/charmap.h"
 #include "android/user-events.h"
+#include "android/utils/debug.h"
 #include "exec/cpu-common.h"
 #include "exec/hwaddr.h"
 #include "hw/hw.h"
@@ -23,7 +24,16 @@
 #include "migration/qemu-file.h"
 #include "ui/console.h"
 
-#define MAX_EVENTS 256*4
+/* Default, minimum and maximum sizes of the event queue. The default is
+ * used when hw.events.queueSize is not set, other values are rounded up
+ * to a power of 2 and clamped to [MIN_QUEUE_SIZE..MAX_QUEUE_SIZE].
+ */
+#define DEFAULT_QUEUE_SIZE  1024
+#define MIN_QUEUE_SIZE      64
+#define MAX_QUEUE_SIZE      65536
+
+/* Maximum number of events copied to the guest per stack buffer. */
+#define BATCH_CHUNK         64
 
 enum {
     REG_READ        = 0x00,
@@ -31,6 +41,19 @@ enum {
     REG_LEN         = 0x04,
     REG_DATA        = 0x08,
 
+    /* Batch mode registers. These live above the largest page that
+     * can be read through REG_DATA, so older drivers never hit them.
+     * The guest writes the guest-physical address and capacity (in
+     * events) of a buffer, then reads REG_BATCH_READ: the device
+     * copies as many pending events as fit, as little-endian
+     * (type, code, value) 32-bit triples, and returns their count.
+     */
+    REG_BATCH_ADDR      = 0x800,
+    REG_BATCH_ADDR_HIGH = 0x804,
+    REG_BATCH_SIZE      = 0x808,
+    REG_BATCH_READ      = 0x80c,
+    REG_FEATURES        = 0x810,
+
     PAGE_NAME       = 0x00000,
     PAGE_EVBITS     = 0x10000,
     PAGE_ABSDATA    = 0x20000 | EV_ABS,
@@ -47,10 +70,22 @@ enum {
     STATE_LIVE       /* Events can be sent directly to the kernel */
 };
 
+/* Bits returned by REG_FEATURES. Older devices return 0 there. */
+enum {
+    FEATURE_BATCH   = 1 << 0,
+};
+
 /* NOTE: The ev_bits arrays are used to indicate to the kernel
  *       which events can be sent by the emulated hardware.
  */
 
+typedef struct
+{
+    uint32_t type;
+    uint32_t code;
+    uint32_t value;
+} events_entry;
+
 typedef struct
 {
     uint32_t base;
@@ -58,11 +93,20 @@ typedef struct
     int pending;
     int page;
 
-    unsigned events[MAX_EVENTS];
+    /* Ring of pending events, 'size' is a power of 2. REG_READ returns
+     * one field of events[first] at a time, 'field' is the next one.
+     */
+    events_entry *events;
+    unsigned size;
     unsigned first;
     unsigned last;
+    unsigned field;
     unsigned state;
 
+    uint64_t batch_addr;
+    uint32_t batch_size;
+    uint32_t dropped;
+
     const char *name;
 
     struct {
@@ -89,48 +133,78 @@ typedef struct ABSEntry {
 /* modify this each time you change the events_device structure. you
  * will also need to upadte events_state_load and events_state_save
  */
-#define  EVENTS_STATE_SAVE_VERSION  2
+#define  EVENTS_STATE_SAVE_VERSION  3
 
-#undef  QFIELD_STRUCT
-#define QFIELD_STRUCT  events_state
-
-QFIELD_BEGIN(events_state_fields)
-    QFIELD_INT32(pending),
-    QFIELD_INT32(page),
-    QFIELD_BUFFER(events),
-    QFIELD_INT32(first),
-    QFIELD_INT32(last),
-    QFIELD_INT32(state),
-QFIELD_END
+static unsigned events_count(events_state *s)
+{
+    return (s->last - s->first) & (s->size - 1);
+}
 
 static void  events_state_save(QEMUFile*  f, void*  opaque)
 {
     events_state*  s = opaque;
+    unsigned n;
 
-    qemu_put_struct(f, events_state_fields, s);
+    qemu_put_be32(f, s->pending);
+    qemu_put_be32(f, s->page);
+    qemu_put_be32(f, s->state);
+    qemu_put_be32(f, s->field);
+    qemu_put_be64(f, s->batch_addr);
+    qemu_put_be32(f, s->batch_size);
+
+    qemu_put_be32(f, events_count(s));
+    for (n = s->first; n != s->last; n = (n + 1) & (s->size - 1)) {
+        qemu_put_be32(f, s->events[n].type);
+        qemu_put_be32(f, s->events[n].code);
+        qemu_put_be32(f, s->events[n].value);
+    }
 }
 
 static int  events_state_load(QEMUFile*  f, void* opaque, int  version_id)
 {
     events_state*  s = opaque;
+    unsigned count, n;
 
     if (version_id != EVENTS_STATE_SAVE_VERSION)
         return -1;
 
-    return qemu_get_struct(f, events_state_fields, s);
+    s->pending = qemu_get_be32(f);
+    s->page = qemu_get_be32(f);
+    s->state = qemu_get_be32(f);
+    s->field = qemu_get_be32(f);
+    s->batch_addr = qemu_get_be64(f);
+    s->batch_size = qemu_get_be32(f);
+
+    /* The snapshot may come from a session with a larger queue, keep
+     * the oldest events that fit in this one. */
+    count = qemu_get_be32(f);
+    s->first = s->last = 0;
+    for (n = 0; n < count; n++) {
+        events_entry e;
+        e.type = qemu_get_be32(f);
+        e.code = qemu_get_be32(f);
+        e.value = qemu_get_be32(f);
+        if (n < s->size - 1) {
+            s->events[s->last++] = e;
+        }
+    }
+    if (s->field > 2)
+        s->field = 0;
+
+    return 0;
 }
 
 static void enqueue_event(events_state *s, unsigned int type, unsigned int code, int value)
 {
-    int  enqueued = s->last - s->first;
+    events_entry *e;
 
-    if (enqueued < 0)
-        enqueued += MAX_EVENTS;
-
-    if (enqueued + 3 > MAX_EVENTS) {
-        fprintf(stderr, "##KBD: Full queue, lose event\n");
+    if (events_count(s) + 1 >= s->size) {
+        /* Only report the first event lost in a row. */
+        if (s->dropped++ == 0)
+            fprintf(stderr, "##KBD: Full queue, lose event\n");
         return;
     }
+    s->dropped = 0;
 
     if(s->first == s->last) {
 	if (s->state == STATE_LIVE)
@@ -142,26 +216,19 @@ static void enqueue_event(events_state *s, unsigned int type, unsigned int code,
 
     //fprintf(stderr, "##KBD: type=%d code=%d value=%d\n", type, code, value);
 
-    s->events[s->last] = type;
-    s->last = (s->last + 1) & (MAX_EVENTS-1);
-    s->events[s->last] = code;
-    s->last = (s->last + 1) & (MAX_EVENTS-1);
-    s->events[s->last] = value;
-    s->last = (s->last + 1) & (MAX_EVENTS-1);
+    e = &s->events[s->last];
+    e->type = type;
+    e->code = code;
+    e->value = value;
+    s->last = (s->last + 1) & (s->size - 1);
 }
 
-static unsigned dequeue_event(events_state *s)
+/* Called after one or more complete events were removed from the queue.
+ * The IRQ is only updated here, once per event for REG_READ and once per
+ * batch for REG_BATCH_READ.
+ */
+static void events_update_irq(events_state *s)
 {
-    unsigned n;
-
-    if(s->first == s->last) {
-        return 0;
-    }
-
-    n = s->events[s->first];
-
-    s->first = (s->first + 1) & (MAX_EVENTS - 1);
-
     if(s->first == s->last) {
         qemu_irq_lower(s->irq);
     }
@@ -176,15 +243,72 @@ static unsigned dequeue_event(events_state *s)
      * queue, the goldfish event device will re-assert the IRQ so that
      * the driver can be notified to fetch the event again.
      */
-    else if (((s->first + 2) & (MAX_EVENTS - 1)) < s->last ||
-               (s->first & (MAX_EVENTS - 1)) > s->last) { /* if there still is an event */
+    else {
         qemu_irq_lower(s->irq);
         qemu_irq_raise(s->irq);
     }
 #endif
+}
+
+static unsigned dequeue_event(events_state *s)
+{
+    const events_entry *e;
+    unsigned n;
+
+    if(s->first == s->last) {
+        return 0;
+    }
+
+    e = &s->events[s->first];
+    switch (s->field) {
+    case 0:  n = e->type; break;
+    case 1:  n = e->code; break;
+    default: n = e->value; break;
+    }
+
+    if (++s->field < 3)
+        return n;
+
+    s->field = 0;
+    s->first = (s->first + 1) & (s->size - 1);
+    events_update_irq(s);
     return n;
 }
 
+/* Copy up to batch_size pending events to the guest buffer at
+ * batch_addr, and return how many were copied. */
+static uint32_t dequeue_batch(events_state *s)
+{
+    uint32_t buf[BATCH_CHUNK * 3];
+    uint32_t total = 0;
+
+    if (s->batch_addr == 0 || s->first == s->last)
+        return 0;
+
+    /* A partially read event is sent again in full. */
+    s->field = 0;
+
+    while (total < s->batch_size && s->first != s->last) {
+        uint32_t n = 0;
+
+        while (n < BATCH_CHUNK && total + n < s->batch_size &&
+               s->first != s->last) {
+            const events_entry *e = &s->events[s->first];
+            buf[n * 3 + 0] = cpu_to_le32(e->type);
+            buf[n * 3 + 1] = cpu_to_le32(e->code);
+            buf[n * 3 + 2] = cpu_to_le32(e->value);
+            s->first = (s->first + 1) & (s->size - 1);
+            n++;
+        }
+        cpu_physical_memory_write(s->batch_addr + total * sizeof(buf[0]) * 3,
+                                  (const uint8_t *)buf, n * sizeof(buf[0]) * 3);
+        total += n;
+    }
+
+    events_update_irq(s);
+    return total;
+}
+
 static int get_page_len(events_state *s)
 {
     int page = s->page;
@@ -236,6 +360,10 @@ static uint32_t events_read(void *x, hwaddr off)
         return dequeue_event(s);
     else if (offset == REG_LEN)
         return get_page_len(s);
+    else if (offset == REG_BATCH_READ)
+        return dequeue_batch(s);
+    else if (offset == REG_FEATURES)
+        return FEATURE_BATCH;
     else if (offset >= REG_DATA)
         return get_page_data(s, offset - REG_DATA);
     return 0; // this shouldn't happen, if the driver does the right thing
@@ -247,6 +375,12 @@ static void events_write(void *x, hwaddr off, uint32_t val)
     int offset = off; // - s->base;
     if (offset == REG_SET_PAGE)
         s->page = val;
+    else if (offset == REG_BATCH_ADDR)
+        uint64_set_low(&s->batch_addr, val);
+    else if (offset == REG_BATCH_ADDR_HIGH)
+        uint64_set_high(&s->batch_addr, val);
+    else if (offset == REG_BATCH_SIZE)
+        s->batch_size = val;
 }
 
 static CPUReadMemoryFunc *events_readfn[] = {
@@ -528,8 +662,23 @@ void events_dev_init(uint32_t base, qemu_irq irq)
     s->base = base;
     s->irq = irq;
 
+    /* One slot is always left empty to tell a full ring from an empty one. */
+    s->size = DEFAULT_QUEUE_SIZE;
+    if (config->hw_events_queueSize > 0) {
+        if (config->hw_events_queueSize > MAX_QUEUE_SIZE) {
+            dwarning("hw.events.queueSize %d is too large, using %d",
+                     config->hw_events_queueSize, MAX_QUEUE_SIZE);
+            s->size = MAX_QUEUE_SIZE;
+        } else {
+            s->size = MIN_QUEUE_SIZE;
+            while (s->size < config->hw_events_queueSize)
+                s->size <<= 1;
+        }
+    }
+    s->events = g_new0(events_entry, s->size);
     s->first = 0;
     s->last = 0;
+    s->field = 0;
     s->state = STATE_INIT;
     s->name = g_strdup(config->hw_keyboard_charmap);
 
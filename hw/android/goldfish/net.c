@@ -0,0 +1,533 @@
+/* Copyright (C) 2014 The Android Open Source Project
+**
+** This software is licensed under the terms of the GNU General Public
+** License version 2, as published by the Free Software Foundation, and
+** may be copied, distributed, and modified under those terms.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+*/
+
+/* A paravirtual network device for the goldfish platform.
+ *
+ * Instead of moving frames through I/O registers like the smc91c111
+ * or ne2000, the guest places descriptors for its buffers in two rings
+ * in guest memory, one for transmission and one for reception, and
+ * only touches a register to publish new descriptors. A single TX
+ * doorbell can thus send a whole batch of frames, and interrupts are
+ * coalesced by frame count and delay.
+ *
+ * See docs/GOLDFISH-VIRTUAL-HARDWARE.TXT for the guest interface.
+ */
+
+#include "cpu.h"
+#include "migration/qemu-file.h"
+#include "hw/android/goldfish/device.h"
+#include "hw/hw.h"
+#include "net/net.h"
+#include "qemu/timer.h"
+
+#define  DEBUG  0
+
+#if DEBUG
+#  define  D(...)  fprintf(stderr, __VA_ARGS__), fprintf(stderr, "\n")
+#else
+#  define  D(...)  ((void)0)
+#endif
+
+enum {
+    /* pending interrupt bits, reading acknowledges them */
+    NET_INT_STATUS      = 0x00,
+    /* mask of interrupt bits that raise the IRQ */
+    NET_INT_ENABLE      = 0x04,
+    NET_MAC_LOW         = 0x08,
+    NET_MAC_HIGH        = 0x0c,
+    /* number of descriptors in each ring, power of 2 */
+    NET_RING_SIZE       = 0x10,
+    NET_TX_RING_LOW     = 0x14,
+    NET_TX_RING_HIGH    = 0x18,
+    NET_RX_RING_LOW     = 0x1c,
+    NET_RX_RING_HIGH    = 0x20,
+    /* guest-owned producer indices, writing TX_HEAD is the doorbell */
+    NET_TX_HEAD         = 0x24,
+    NET_RX_HEAD         = 0x2c,
+    /* device-owned consumer indices */
+    NET_TX_TAIL         = 0x28,
+    NET_RX_TAIL         = 0x30,
+    NET_COALESCE_USECS  = 0x34,
+    NET_COALESCE_FRAMES = 0x38,
+    NET_CONTROL         = 0x3c,
+    NET_LINK_STATUS     = 0x40,
+
+    NET_INT_TX          = 1U << 0,
+    NET_INT_RX          = 1U << 1,
+    NET_INT_LINK        = 1U << 2,
+    NET_INT_MASK        = NET_INT_TX | NET_INT_RX | NET_INT_LINK,
+
+    NET_CONTROL_ENABLE  = 1U << 0,
+
+    /* descriptor flags, written back by the device */
+    NET_DESC_DONE       = 1U << 31,
+    NET_DESC_ERROR      = 1U << 30,
+};
+
+/* A ring descriptor, as laid out (little-endian) in guest memory:
+ *
+ *    0  uint64  buffer physical address
+ *    8  uint32  buffer length (RX: updated to the frame length)
+ *   12  uint32  flags
+ */
+#define  NET_DESC_SIZE        16
+#define  NET_MAX_RING_SIZE    1024
+#define  NET_MAX_FRAME        2048
+
+#define  NET_DEFAULT_COALESCE_USECS   100
+#define  NET_DEFAULT_COALESCE_FRAMES  32
+
+struct goldfish_net_state {
+    struct goldfish_device dev;
+    // IRQs
+    uint32_t int_status;
+    // irq enable mask for int_status
+    uint32_t int_enable;
+    // interrupt bits and frame count waiting for the coalescing timer
+    uint32_t int_pending;
+    uint32_t frames_pending;
+    uint32_t coalesce_usecs;
+    uint32_t coalesce_frames;
+    uint32_t control;
+    uint32_t ring_size;
+    uint64_t tx_ring;
+    uint64_t rx_ring;
+    // free-running ring indices, the slot is index & (ring_size - 1)
+    uint32_t tx_head;
+    uint32_t tx_tail;
+    uint32_t rx_head;
+    uint32_t rx_tail;
+    // the fields below are not saved to / restored from snapshots.
+    // vc and timer are NULL once the VLAN client has been deleted.
+    VLANClientState *vc;
+    QEMUTimer *timer;
+    uint8_t macaddr[6];
+    // set while the VLAN queues one of our frames
+    int tx_busy;
+    uint8_t tx_buf[NET_MAX_FRAME];
+};
+
+/* update this each time you update the goldfish_net_state struct */
+#define  NET_STATE_SAVE_VERSION  1
+
+#define  QFIELD_STRUCT  struct goldfish_net_state
+QFIELD_BEGIN(goldfish_net_fields)
+    QFIELD_INT32(int_status),
+    QFIELD_INT32(int_enable),
+    QFIELD_INT32(int_pending),
+    QFIELD_INT32(frames_pending),
+    QFIELD_INT32(coalesce_usecs),
+    QFIELD_INT32(coalesce_frames),
+    QFIELD_INT32(control),
+    QFIELD_INT32(ring_size),
+    QFIELD_INT64(tx_ring),
+    QFIELD_INT64(rx_ring),
+    QFIELD_INT32(tx_head),
+    QFIELD_INT32(tx_tail),
+    QFIELD_INT32(rx_head),
+    QFIELD_INT32(rx_tail),
+QFIELD_END
+
+static void goldfish_net_update_irq(struct goldfish_net_state *s)
+{
+    goldfish_device_set_irq(&s->dev, 0, (s->int_status & s->int_enable) != 0);
+}
+
+/* Deliver the interrupt bits accumulated since the last one. */
+static void goldfish_net_flush_irq(struct goldfish_net_state *s)
+{
+    if (s->timer)
+        timer_del(s->timer);
+    if (s->int_pending) {
+        s->int_status |= s->int_pending;
+        s->int_pending = 0;
+        s->frames_pending = 0;
+        goldfish_net_update_irq(s);
+    }
+}
+
+static void goldfish_net_timer_cb(void *opaque)
+{
+    goldfish_net_flush_irq(opaque);
+}
+
+/* Record that 'frames' frames completed with interrupt bits 'bits'.
+ * The interrupt is raised once coalesce_frames frames are pending, or
+ * coalesce_usecs after the first of them, whichever comes first.
+ */
+static void goldfish_net_event(struct goldfish_net_state *s,
+                               uint32_t bits, int frames)
+{
+    s->int_pending    |= bits;
+    s->frames_pending += frames;
+
+    if (s->frames_pending >= s->coalesce_frames || s->coalesce_usecs == 0 ||
+        s->timer == NULL) {
+        goldfish_net_flush_irq(s);
+    } else if (!timer_pending(s->timer)) {
+        timer_mod(s->timer, qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL) +
+                            (int64_t)s->coalesce_usecs * 1000);
+    }
+}
+
+static hwaddr goldfish_net_desc_addr(struct goldfish_net_state *s,
+                                     uint64_t ring, uint32_t index)
+{
+    return ring + (hwaddr)(index & (s->ring_size - 1)) * NET_DESC_SIZE;
+}
+
+static void goldfish_net_desc_read(hwaddr addr, uint64_t *buffer,
+                                   uint32_t *length)
+{
+    uint8_t desc[NET_DESC_SIZE];
+
+    cpu_physical_memory_read(addr, desc, sizeof desc);
+    *buffer = ldq_le_p(desc);
+    *length = ldl_le_p(desc + 8);
+}
+
+static void goldfish_net_desc_complete(hwaddr addr, uint32_t length,
+                                       uint32_t flags)
+{
+    uint8_t tail[8];
+
+    stl_le_p(tail, length);
+    stl_le_p(tail + 4, flags | NET_DESC_DONE);
+    cpu_physical_memory_write(addr + 8, tail, sizeof tail);
+}
+
+/* ring sizes the guest may program: powers of 2, 0 meaning no ring */
+static int goldfish_net_valid_ring_size(uint32_t size)
+{
+    return size <= NET_MAX_RING_SIZE && (size & (size - 1)) == 0;
+}
+
+static int goldfish_net_enabled(struct goldfish_net_state *s)
+{
+    return (s->control & NET_CONTROL_ENABLE) && s->ring_size != 0;
+}
+
+static void goldfish_net_tx(struct goldfish_net_state *s);
+
+static void goldfish_net_tx_sent(VLANClientState *vc)
+{
+    struct goldfish_net_state *s = vc->opaque;
+
+    s->tx_busy = 0;
+    goldfish_net_tx(s);
+}
+
+/* Send every frame published by the guest since the last doorbell, and
+ * signal their completion with a single (coalesced) interrupt. Stops
+ * early when the VLAN has to queue a frame, goldfish_net_tx_sent()
+ * resumes once it has been delivered. Frames are completed with an
+ * error, and dropped, once the VLAN client is gone.
+ */
+static void goldfish_net_tx(struct goldfish_net_state *s)
+{
+    int frames = 0;
+
+    if (!goldfish_net_enabled(s))
+        return;
+
+    while (!s->tx_busy && s->tx_tail != s->tx_head) {
+        hwaddr   desc = goldfish_net_desc_addr(s, s->tx_ring, s->tx_tail);
+        uint64_t buffer;
+        uint32_t length, flags = 0;
+
+        goldfish_net_desc_read(desc, &buffer, &length);
+        if (length > NET_MAX_FRAME || s->vc == NULL) {
+            flags = NET_DESC_ERROR;
+        } else {
+            cpu_physical_memory_read(buffer, s->tx_buf, length);
+            if (qemu_send_packet_async(s->vc, s->tx_buf, length,
+                                       goldfish_net_tx_sent) == 0) {
+                s->tx_busy = 1;
+            }
+        }
+        goldfish_net_desc_complete(desc, length, flags);
+        s->tx_tail++;
+        frames++;
+    }
+
+    if (frames > 0)
+        goldfish_net_event(s, NET_INT_TX, frames);
+}
+
+static int goldfish_net_can_receive(VLANClientState *vc)
+{
+    struct goldfish_net_state *s = vc->opaque;
+
+    return goldfish_net_enabled(s) && s->rx_tail != s->rx_head;
+}
+
+static ssize_t goldfish_net_receive(VLANClientState *vc,
+                                    const uint8_t *buf, size_t size)
+{
+    struct goldfish_net_state *s = vc->opaque;
+    hwaddr   desc;
+    uint64_t buffer;
+    uint32_t length, flags = 0;
+
+    if (!goldfish_net_can_receive(vc))
+        return 0;
+
+    desc = goldfish_net_desc_addr(s, s->rx_ring, s->rx_tail);
+    goldfish_net_desc_read(desc, &buffer, &length);
+    if (size > length) {
+        D("%s: %d bytes frame truncated to %d", __FUNCTION__,
+          (int)size, length);
+        flags = NET_DESC_ERROR;
+    } else {
+        length = size;
+    }
+    cpu_physical_memory_write(buffer, buf, length);
+    goldfish_net_desc_complete(desc, length, flags);
+    s->rx_tail++;
+
+    goldfish_net_event(s, NET_INT_RX, 1);
+    return size;
+}
+
+static void goldfish_net_link_status_changed(VLANClientState *vc)
+{
+    struct goldfish_net_state *s = vc->opaque;
+
+    s->int_status |= NET_INT_LINK;
+    goldfish_net_update_irq(s);
+}
+
+static void goldfish_net_reset(struct goldfish_net_state *s)
+{
+    if (s->timer)
+        timer_del(s->timer);
+    s->int_status = 0;
+    s->int_pending = 0;
+    s->frames_pending = 0;
+    s->control = 0;
+    s->tx_head = s->tx_tail = 0;
+    s->rx_head = s->rx_tail = 0;
+    s->tx_busy = 0;
+    goldfish_net_update_irq(s);
+}
+
+static uint32_t goldfish_net_read(void *opaque, hwaddr offset)
+{
+    struct goldfish_net_state *s = opaque;
+    uint32_t ret;
+
+    switch(offset) {
+        case NET_INT_STATUS:
+            ret = s->int_status & s->int_enable;
+            if (ret) {
+                s->int_status &= ~ret;
+                goldfish_net_update_irq(s);
+            }
+            return ret;
+        case NET_INT_ENABLE:
+            return s->int_enable;
+        case NET_MAC_LOW:
+            return s->macaddr[0] | (s->macaddr[1] << 8) |
+                   (s->macaddr[2] << 16) | ((uint32_t)s->macaddr[3] << 24);
+        case NET_MAC_HIGH:
+            return s->macaddr[4] | (s->macaddr[5] << 8);
+        case NET_RING_SIZE:
+            return s->ring_size;
+        case NET_TX_RING_LOW:
+            return (uint32_t)s->tx_ring;
+        case NET_TX_RING_HIGH:
+            return (uint32_t)(s->tx_ring >> 32);
+        case NET_RX_RING_LOW:
+            return (uint32_t)s->rx_ring;
+        case NET_RX_RING_HIGH:
+            return (uint32_t)(s->rx_ring >> 32);
+        case NET_TX_HEAD:
+            return s->tx_head;
+        case NET_TX_TAIL:
+            return s->tx_tail;
+        case NET_RX_HEAD:
+            return s->rx_head;
+        case NET_RX_TAIL:
+            return s->rx_tail;
+        case NET_COALESCE_USECS:
+            return s->coalesce_usecs;
+        case NET_COALESCE_FRAMES:
+            return s->coalesce_frames;
+        case NET_CONTROL:
+            return s->control;
+        case NET_LINK_STATUS:
+            return s->vc != NULL && !s->vc->link_down;
+        default:
+            cpu_abort(cpu_single_env,
+                      "goldfish_net_read: Bad offset %" HWADDR_PRIx "\n",
+                      offset);
+            return 0;
+    }
+}
+
+static void goldfish_net_write(void *opaque, hwaddr offset, uint32_t val)
+{
+    struct goldfish_net_state *s = opaque;
+
+    switch(offset) {
+        case NET_INT_ENABLE:
+            s->int_enable = val & NET_INT_MASK;
+            goldfish_net_update_irq(s);
+            break;
+        case NET_RING_SIZE:
+            /* only while disabled, and only powers of 2 */
+            if (!(s->control & NET_CONTROL_ENABLE) &&
+                goldfish_net_valid_ring_size(val)) {
+                s->ring_size = val;
+            }
+            break;
+        case NET_TX_RING_LOW:
+            uint64_set_low(&s->tx_ring, val);
+            break;
+        case NET_TX_RING_HIGH:
+            uint64_set_high(&s->tx_ring, val);
+            break;
+        case NET_RX_RING_LOW:
+            uint64_set_low(&s->rx_ring, val);
+            break;
+        case NET_RX_RING_HIGH:
+            uint64_set_high(&s->rx_ring, val);
+            break;
+        case NET_TX_HEAD:
+            /* ignore indices that would overrun the ring */
+            if (val - s->tx_tail <= s->ring_size) {
+                s->tx_head = val;
+                goldfish_net_tx(s);
+            }
+            break;
+        case NET_RX_HEAD:
+            if (val - s->rx_tail <= s->ring_size) {
+                s->rx_head = val;
+                /* new buffers, retry frames the VLAN had to hold back */
+                if (s->vc && goldfish_net_can_receive(s->vc))
+                    qemu_flush_queued_packets(s->vc);
+            }
+            break;
+        case NET_COALESCE_USECS:
+            s->coalesce_usecs = val;
+            break;
+        case NET_COALESCE_FRAMES:
+            s->coalesce_frames = val;
+            break;
+        case NET_CONTROL:
+            if (val & NET_CONTROL_ENABLE) {
+                s->control = val;
+            } else {
+                goldfish_net_reset(s);
+            }
+            break;
+        default:
+            cpu_abort(cpu_single_env,
+                      "goldfish_net_write: Bad offset %" HWADDR_PRIx "\n",
+                      offset);
+    }
+}
+
+static CPUReadMemoryFunc *goldfish_net_readfn[] = {
+    goldfish_net_read,
+    goldfish_net_read,
+    goldfish_net_read
+};
+
+static CPUWriteMemoryFunc *goldfish_net_writefn[] = {
+    goldfish_net_write,
+    goldfish_net_write,
+    goldfish_net_write
+};
+
+static void goldfish_net_save(QEMUFile *f, void *opaque)
+{
+    struct goldfish_net_state *s = opaque;
+
+    qemu_put_struct(f, goldfish_net_fields, s);
+}
+
+static int goldfish_net_load(QEMUFile *f, void *opaque, int version_id)
+{
+    struct goldfish_net_state *s = opaque;
+    int ret;
+
+    if (version_id != NET_STATE_SAVE_VERSION)
+        return -1;
+
+    ret = qemu_get_struct(f, goldfish_net_fields, s);
+    if (ret == 0) {
+        /* the same checks as the register writes, and an enabled device
+         * must have rings: the indices are masked with ring_size - 1 */
+        if (!goldfish_net_valid_ring_size(s->ring_size) ||
+            ((s->control & NET_CONTROL_ENABLE) && s->ring_size == 0) ||
+            s->tx_head - s->tx_tail > s->ring_size ||
+            s->rx_head - s->rx_tail > s->ring_size) {
+            s->control &= ~NET_CONTROL_ENABLE;
+            s->ring_size = 0;
+            return -EINVAL;
+        }
+        s->tx_busy = 0;
+        if (s->int_pending && s->timer)
+            timer_mod(s->timer, qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL));
+        goldfish_net_update_irq(s);
+    }
+    return ret;
+}
+
+static void goldfish_net_cleanup(VLANClientState *vc)
+{
+    struct goldfish_net_state *s = vc->opaque;
+
+    timer_del(s->timer);
+    timer_free(s->timer);
+    s->timer = NULL;
+    s->vc = NULL;
+    /* the link is down from now on, tell the guest along with what
+     * was waiting for the coalescing timer */
+    s->int_pending |= NET_INT_LINK;
+    goldfish_net_flush_irq(s);
+}
+
+void goldfish_net_init(NICInfo *nd, int id)
+{
+    struct goldfish_net_state *s;
+
+    s = (struct goldfish_net_state *)g_malloc0(sizeof(*s));
+    s->dev.name = "goldfish_net";
+    s->dev.id = id;
+    s->dev.base = 0;    // will be allocated dynamically
+    s->dev.size = 0x1000;
+    s->dev.irq_count = 1;
+
+    s->coalesce_usecs = NET_DEFAULT_COALESCE_USECS;
+    s->coalesce_frames = NET_DEFAULT_COALESCE_FRAMES;
+    memcpy(s->macaddr, nd->macaddr, sizeof(s->macaddr));
+    s->timer = timer_new(QEMU_CLOCK_VIRTUAL, SCALE_NS, goldfish_net_timer_cb, s);
+
+    goldfish_device_add(&s->dev, goldfish_net_readfn, goldfish_net_writefn, s);
+
+    s->vc = qemu_new_vlan_client(nd->vlan, nd->model, nd->name,
+                                 goldfish_net_can_receive,
+                                 goldfish_net_receive, NULL,
+                                 goldfish_net_cleanup, s);
+    s->vc->link_status_changed = goldfish_net_link_status_changed;
+    qemu_format_nic_info_str(s->vc, s->macaddr);
+
+    register_savevm(NULL,
+                    "goldfish_net",
+                    id,
+                    NET_STATE_SAVE_VERSION,
+                    goldfish_net_save,
+                    goldfish_net_load,
+                    s);
+}
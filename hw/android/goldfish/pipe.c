@@ -16,6 +16,14 @@
 #include "hw/android/goldfish/vmem.h"
 #include "exec/ram_addr.h"
 #include "qemu/timer.h"
+#include "sysemu/char.h"
+#include "sysemu/kvm.h"
+
+#include <errno.h>
+#include <unistd.h>
+#ifdef CONFIG_KVM
+#include <sys/eventfd.h>
+#endif
 
 #define  DEBUG 0
 
@@ -54,7 +62,10 @@
 /* Maximum length of pipe service name, in characters (excluding final 0) */
 #define MAX_PIPE_SERVICE_NAME_SIZE  255
 
-#define GOLDFISH_PIPE_SAVE_VERSION  3
+#define GOLDFISH_PIPE_SAVE_VERSION  4
+
+// Up to the introduction of the command doorbell.
+#define GOLDFISH_PIPE_SAVE_VERSION_NO_DOORBELL  3
 
 // Up to Tools r22.6, the emulator saved with this version number.
 #define GOLDFISH_PIPE_SAVE_VERSION_LEGACY  2
@@ -66,7 +77,7 @@
  *****
  *****/
 
-#define MAX_PIPE_SERVICES  8
+#define MAX_PIPE_SERVICES  16
 typedef struct {
     const char*        name;
     void*              opaque;
@@ -967,14 +978,78 @@ struct PipeDevice {
     uint64_t  channel;
     uint32_t  wakes;
     uint64_t  params_addr;
+
+    /* command doorbell state, see PIPE_REG_DOORBELL */
+    uint32_t  ring_head;
+    uint32_t  ring_completed;
+    int       doorbell_fd;
 };
 
+/* Translate the current buffer address of |dev| into a host pointer.
+ * |physical| is true if the address is a guest physical one, false if it
+ * is a virtual address in the current guest address space. |is_write| is
+ * true if the host is going to write into the buffer.
+ *
+ * Physical addresses come straight from the guest's doorbell ring, so
+ * the whole buffer must map to a single, contiguous range of guest RAM.
+ * Return 0 on success, or PIPE_ERROR_INVAL otherwise. A successful call
+ * must be followed by pipeDevice_putBuffer(). */
+static int
+pipeDevice_getBuffer( PipeDevice* dev, GoldfishPipeBuffer* buffer,
+                      bool physical, bool is_write )
+{
+    target_ulong  address = dev->address;
+    target_ulong  page    = address & TARGET_PAGE_MASK;
+    hwaddr  phys;
+
+    if (physical) {
+        hwaddr  len = dev->size;
+        void*   data;
+
+        if (len == 0) {
+            buffer->data = NULL;
+            buffer->size = 0;
+            return 0;
+        }
+        data = cpu_physical_memory_map(dev->address, &len, is_write);
+        if (data == NULL || len < dev->size) {
+            if (data != NULL)
+                cpu_physical_memory_unmap(data, len, is_write, 0);
+            D("%s: invalid buffer address=0x%llx size=%d", __FUNCTION__,
+              (unsigned long long)dev->address, dev->size);
+            return PIPE_ERROR_INVAL;
+        }
+        buffer->data = data;
+        buffer->size = dev->size;
+        return 0;
+    }
+
+    phys = safe_get_phys_page_debug(ENV_GET_CPU(cpu_single_env), page);
+#ifdef TARGET_X86_64
+    phys = phys & TARGET_PTE_MASK;
+#endif
+    buffer->data = qemu_get_ram_ptr(phys) + (address - page);
+    buffer->size = dev->size;
+    return 0;
+}
+
+/* Release a buffer obtained from pipeDevice_getBuffer(). |transferred| is
+ * the number of bytes the pipe actually read or wrote. */
+static void
+pipeDevice_putBuffer( GoldfishPipeBuffer* buffer, bool physical,
+                      bool is_write, int transferred )
+{
+    if (physical && buffer->data != NULL) {
+        cpu_physical_memory_unmap(buffer->data, buffer->size, is_write,
+                                  transferred > 0 ? transferred : 0);
+    }
+}
+
 static void
-pipeDevice_doCommand( PipeDevice* dev, uint32_t command )
+pipeDevice_doCommand( PipeDevice* dev, uint32_t command, bool physical )
 {
     Pipe** lookup = pipe_list_findp_channel(&dev->pipes, dev->channel);
     Pipe*  pipe   = *lookup;
-    CPUOldState* env = cpu_single_env;
 
     /* Check that we're referring a known pipe channel */
     if (command != PIPE_CMD_OPEN && pipe == NULL) {
@@ -1016,18 +1091,13 @@ pipeDevice_doCommand( PipeDevice* dev, uint32_t command )
         break;
 
     case PIPE_CMD_READ_BUFFER: {
-        /* Translate virtual address into physical one, into emulator memory. */
         GoldfishPipeBuffer  buffer;
-        target_ulong        address = dev->address;
-        target_ulong        page    = address & TARGET_PAGE_MASK;
-        hwaddr  phys;
-        phys = safe_get_phys_page_debug(ENV_GET_CPU(env), page);
-#ifdef TARGET_X86_64
-        phys = phys & TARGET_PTE_MASK;
-#endif
-        buffer.data = qemu_get_ram_ptr(phys) + (address - page);
-        buffer.size = dev->size;
+        if (pipeDevice_getBuffer(dev, &buffer, physical, true) != 0) {
+            dev->status = PIPE_ERROR_INVAL;
+            break;
+        }
         dev->status = pipe->funcs->recvBuffers(pipe->opaque, &buffer, 1);
+        pipeDevice_putBuffer(&buffer, physical, true, dev->status);
         DD("%s: CMD_READ_BUFFER channel=0x%llx address=0x%16llx size=%d > status=%d",
            __FUNCTION__, (unsigned long long)dev->channel, (unsigned long long)dev->address,
            dev->size, dev->status);
@@ -1035,18 +1105,13 @@ pipeDevice_doCommand( PipeDevice* dev, uint32_t command )
     }
 
     case PIPE_CMD_WRITE_BUFFER: {
-        /* Translate virtual address into physical one, into emulator memory. */
         GoldfishPipeBuffer  buffer;
-        target_ulong        address = dev->address;
-        target_ulong        page    = address & TARGET_PAGE_MASK;
-        hwaddr  phys;
-        phys = safe_get_phys_page_debug(ENV_GET_CPU(env), page);
-#ifdef TARGET_X86_64
-        phys = phys & TARGET_PTE_MASK;
-#endif
-        buffer.data = qemu_get_ram_ptr(phys) + (address - page);
-        buffer.size = dev->size;
+        if (pipeDevice_getBuffer(dev, &buffer, physical, false) != 0) {
+            dev->status = PIPE_ERROR_INVAL;
+            break;
+        }
         dev->status = pipe->funcs->sendBuffers(pipe->opaque, &buffer, 1);
+        pipeDevice_putBuffer(&buffer, physical, false, dev->status);
         DD("%s: CMD_WRITE_BUFFER channel=0x%llx address=0x%16llx size=%d > status=%d",
            __FUNCTION__, (unsigned long long)dev->channel, (unsigned long long)dev->address,
            dev->size, dev->status);
@@ -1076,6 +1141,123 @@ pipeDevice_doCommand( PipeDevice* dev, uint32_t command )
     }
 }
 
+/* Run all pending commands queued in the doorbell ring, in order. */
+static void
+pipeDevice_runDoorbell( PipeDevice* dev )
+{
+    const bool is64 = goldfish_guest_is_64bit();
+    const size_t entrySize = is64 ? sizeof(struct access_params_64)
+                                  : sizeof(struct access_params);
+    uint64_t  saved_address = dev->address;
+    uint32_t  saved_size    = dev->size;
+    uint32_t  saved_status  = dev->status;
+    uint64_t  saved_channel = dev->channel;
+    int       count;
+
+    if (dev->params_addr == 0)
+        return;
+
+    for (count = 0; count < PIPE_DOORBELL_RING_SIZE; count++) {
+        hwaddr entry = dev->params_addr + dev->ring_head * entrySize;
+        struct access_params aps;
+        struct access_params_64 aps64;
+        uint32_t cmd, flags;
+
+        if (is64) {
+            cpu_physical_memory_read(entry, (void*)&aps64, sizeof(aps64));
+            flags = aps64.flags;
+            dev->channel = aps64.channel;
+            dev->size = aps64.size;
+            dev->address = aps64.address;
+            cmd = aps64.cmd;
+        } else {
+            cpu_physical_memory_read(entry, (void*)&aps, sizeof(aps));
+            flags = aps.flags;
+            dev->channel = aps.channel;
+            dev->size = aps.size;
+            dev->address = aps.address;
+            cmd = aps.cmd;
+        }
+        if ((flags & PIPE_PARAMS_FLAG_PENDING) == 0)
+            break;
+
+        DD("%s: ring[%d] cmd=%d channel=0x%llx", __FUNCTION__, dev->ring_head,
+           cmd, (unsigned long long)dev->channel);
+        pipeDevice_doCommand(dev, cmd, true);
+
+        flags = (flags & ~PIPE_PARAMS_FLAG_PENDING) | PIPE_PARAMS_FLAG_DONE;
+        if (is64) {
+            aps64.result = dev->status;
+            aps64.flags = flags;
+            cpu_physical_memory_write(entry, (void*)&aps64, sizeof(aps64));
+        } else {
+            aps.result = dev->status;
+            aps.flags = flags;
+            cpu_physical_memory_write(entry, (void*)&aps, sizeof(aps));
+        }
+        dev->ring_head = (dev->ring_head + 1) % PIPE_DOORBELL_RING_SIZE;
+        dev->ring_completed++;
+    }
+
+    /* The doorbell may be drained asynchronously (see below) while the
+     * guest is in the middle of a register-based command sequence, so
+     * leave its register state untouched. */
+    dev->address = saved_address;
+    dev->size    = saved_size;
+    dev->status  = saved_status;
+    dev->channel = saved_channel;
+
+    if (count > 0) {
+        goldfish_device_set_irq(&dev->dev, 0, 1);
+        DD("%s: raising IRQ", __FUNCTION__);
+    }
+}
+
+#ifdef CONFIG_KVM
+/* Called from the main loop when the guest rang the doorbell through
+ * the KVM ioeventfd. */
+static void
+pipeDevice_doorbellEvent( void* opaque )
+{
+    PipeDevice* dev = opaque;
+    uint64_t    value;
+
+    while (read(dev->doorbell_fd, &value, sizeof(value)) < 0 && errno == EINTR) {
+    }
+    pipeDevice_runDoorbell(dev);
+}
+
+/* Try to bind the doorbell register to an ioeventfd. On failure, guest
+ * writes to it keep trapping to pipe_dev_write(). */
+static void
+pipeDevice_initDoorbellEventFd( PipeDevice* dev )
+{
+    int fd;
+    int ret;
+
+    if (!kvm_enabled() || !kvm_has_ioeventfd())
+        return;
+
+    /* KVM needs a real eventfd here, not the pipe that qemu_eventfd()
+     * may fall back to. */
+    fd = eventfd(0, 0);
+    if (fd < 0)
+        return;
+    qemu_set_cloexec(fd);
+
+    ret = kvm_set_ioeventfd_mmio(fd, dev->dev.base + PIPE_REG_DOORBELL, 4, 1);
+    if (ret < 0) {
+        D("%s: could not bind doorbell ioeventfd: %s", __FUNCTION__,
+          strerror(-ret));
+        close(fd);
+        return;
+    }
+    dev->doorbell_fd = fd;
+    qemu_set_fd_handler(dev->doorbell_fd, pipeDevice_doorbellEvent, NULL, dev);
+    D("%s: doorbell bound to ioeventfd %d", __FUNCTION__, dev->doorbell_fd);
+}
+#endif  /* CONFIG_KVM */
+
 static void pipe_dev_write(void *opaque, hwaddr offset, uint32_t value)
 {
     PipeDevice *s = (PipeDevice *)opaque;
@@ -1083,7 +1265,7 @@ static void pipe_dev_write(void *opaque, hwaddr offset, uint32_t value)
     switch (offset) {
     case PIPE_REG_COMMAND:
         DR("%s: command=%d (0x%x)", __FUNCTION__, value, value);
-        pipeDevice_doCommand(s, value);
+        pipeDevice_doCommand(s, value, false);
         break;
 
     case PIPE_REG_SIZE:
@@ -1111,13 +1293,17 @@ static void pipe_dev_write(void *opaque, hwaddr offset, uint32_t value)
         uint64_set_high(&s->channel, value);
         break;
 
+    /* A driver that (re)programs the params block starts producing doorbell
+     * commands at slot 0 of the ring, so consume from there as well. */
     case PIPE_REG_PARAMS_ADDR_HIGH:
         s->params_addr = (s->params_addr & ~(0xFFFFFFFFULL << 32) ) |
                           ((uint64_t)value << 32);
+        s->ring_head = 0;
         break;
 
     case PIPE_REG_PARAMS_ADDR_LOW:
         s->params_addr = (s->params_addr & ~(0xFFFFFFFFULL) ) | value;
+        s->ring_head = 0;
         break;
 
     case PIPE_REG_ACCESS_PARAMS:
@@ -1152,7 +1338,7 @@ static void pipe_dev_write(void *opaque, hwaddr offset, uint32_t value)
         if ((cmd != PIPE_CMD_READ_BUFFER) && (cmd != PIPE_CMD_WRITE_BUFFER))
             break;
 
-        pipeDevice_doCommand(s, cmd);
+        pipeDevice_doCommand(s, cmd, false);
         if (goldfish_guest_is_64bit()) {
             aps64.result = s->status;
             cpu_physical_memory_write(s->params_addr, (void*)&aps64,
@@ -1165,6 +1351,11 @@ static void pipe_dev_write(void *opaque, hwaddr offset, uint32_t value)
     }
     break;
 
+    case PIPE_REG_DOORBELL:
+        DR("%s: doorbell", __FUNCTION__);
+        pipeDevice_runDoorbell(s);
+        break;
+
     default:
         D("%s: offset=%d (0x%x) value=%d (0x%x)\n", __FUNCTION__, offset,
             offset, value, value);
@@ -1191,7 +1382,7 @@ static uint32_t pipe_dev_read(void *opaque, hwaddr offset)
             pipe->wanted = 0;
             dev->signaled_pipes = pipe->next_waked;
             pipe->next_waked = NULL;
-            if (dev->signaled_pipes == NULL) {
+            if (dev->signaled_pipes == NULL && dev->ring_completed == 0) {
                 goldfish_device_set_irq(&dev->dev, 0, 0);
                 DD("%s: lowering IRQ", __FUNCTION__);
             }
@@ -1220,6 +1411,19 @@ static uint32_t pipe_dev_read(void *opaque, hwaddr offset)
     case PIPE_REG_PARAMS_ADDR_LOW:
         return (uint32_t)(dev->params_addr & 0xFFFFFFFFUL);
 
+    case PIPE_REG_DOORBELL: {
+        uint32_t completed = dev->ring_completed;
+        DR("%s: doorbell completed=%d", __FUNCTION__, completed);
+        dev->ring_completed = 0;
+        if (dev->signaled_pipes == NULL) {
+            goldfish_device_set_irq(&dev->dev, 0, 0);
+        }
+        return completed;
+    }
+
+    case PIPE_REG_FEATURES:
+        return PIPE_FEATURE_DOORBELL;
+
     default:
         D("%s: offset=%d (0x%x)\n", __FUNCTION__, offset, offset);
     }
@@ -1250,6 +1454,8 @@ goldfish_pipe_save( QEMUFile* file, void* opaque )
     qemu_put_be64(file, dev->channel);
     qemu_put_be32(file, dev->wakes);
     qemu_put_be64(file, dev->params_addr);
+    qemu_put_be32(file, dev->ring_head);
+    qemu_put_be32(file, dev->ring_completed);
 
     /* Count the number of pipe connections */
     int count = 0;
@@ -1271,6 +1477,7 @@ goldfish_pipe_load( QEMUFile* file, void* opaque, int version_id )
     Pipe*       pipe;
 
     if ((version_id != GOLDFISH_PIPE_SAVE_VERSION) &&
+        (version_id != GOLDFISH_PIPE_SAVE_VERSION_NO_DOORBELL) &&
         (version_id != GOLDFISH_PIPE_SAVE_VERSION_LEGACY)) {
         return -EINVAL;
     }
@@ -1288,6 +1495,13 @@ goldfish_pipe_load( QEMUFile* file, void* opaque, int version_id )
     }
     dev->wakes   = qemu_get_be32(file);
     dev->params_addr   = qemu_get_be64(file);
+    if (version_id >= GOLDFISH_PIPE_SAVE_VERSION) {
+        dev->ring_head      = qemu_get_be32(file) % PIPE_DOORBELL_RING_SIZE;
+        dev->ring_completed = qemu_get_be32(file);
+    } else {
+        dev->ring_head      = 0;
+        dev->ring_completed = 0;
+    }
 
     /* Count the number of pipe connections */
     int count = qemu_get_sbe32(file);
@@ -1325,8 +1539,12 @@ void pipe_dev_init(bool newDeviceNaming)
     s->dev.size = 0x2000;
     s->dev.irq = 0;
     s->dev.irq_count = 1;
+    s->doorbell_fd = -1;
 
     goldfish_device_add(&s->dev, pipe_dev_readfn, pipe_dev_writefn, s);
+#ifdef CONFIG_KVM
+    pipeDevice_initDoorbellEventFd(s);
+#endif
 
     register_savevm(NULL,
                     "goldfish_pipe",
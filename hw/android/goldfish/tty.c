@@ -39,10 +39,16 @@ struct tty_state {
     uint64_t ptr;
     uint32_t ptr_len;
     uint32_t ready;
+    /* receive ring, data_count bytes starting at data_start */
     uint8_t data[128];
+    uint32_t data_start;
     uint32_t data_count;
 };
 
+/* Maximum number of guest buffer fragments handed to the char driver
+ * in one qemu_chr_writev() call. */
+#define  TTY_IOV_MAX  16
+
 #define  TTY_DEVICE_VERSION 0
 #define  GOLDFISH_TTY_SAVE_VERSION  2
 
@@ -67,7 +73,14 @@ static void  goldfish_tty_save(QEMUFile*  f, void*  opaque)
     qemu_put_be32( f, s->ptr_len );
     qemu_put_byte( f, s->ready );
     qemu_put_byte( f, s->data_count );
-    qemu_put_buffer( f, s->data, s->data_count );
+    /* saved in order, as the linear buffer used to be */
+    if (s->data_start + s->data_count > sizeof(s->data)) {
+        uint32_t  head = sizeof(s->data) - s->data_start;
+        qemu_put_buffer( f, s->data + s->data_start, head );
+        qemu_put_buffer( f, s->data, s->data_count - head );
+    } else {
+        qemu_put_buffer( f, s->data + s->data_start, s->data_count );
+    }
 }
 
 static int  goldfish_tty_load(QEMUFile*  f, void*  opaque, int  version_id)
@@ -85,7 +98,10 @@ static int  goldfish_tty_load(QEMUFile*  f, void*  opaque, int  version_id)
     }
     s->ptr_len    = qemu_get_be32(f);
     s->ready      = qemu_get_byte(f);
+    s->data_start = 0;
     s->data_count = qemu_get_byte(f);
+    if (s->data_count > sizeof(s->data))
+        return -1;
     qemu_get_buffer(f, s->data, s->data_count);
 
     return 0;
@@ -108,6 +124,98 @@ static uint32_t goldfish_tty_read(void *opaque, hwaddr offset)
     }
 }
 
+/* Send the guest buffer at s->ptr to the char driver. Each guest page
+ * backed by RAM is mapped directly and the fragments are passed in one
+ * vectored write, anything else is copied through a small buffer. */
+static void goldfish_tty_write_buffer(struct tty_state *s)
+{
+    struct iovec  iov[TTY_IOV_MAX];
+    target_ulong  buf = s->ptr;
+    uint32_t      len = s->ptr_len;
+    int           n, i;
+
+    while (len) {
+        n = 0;
+        while (len) {
+            target_ulong  page = buf & TARGET_PAGE_MASK;
+            hwaddr        phys = safe_get_phys_page_debug(current_cpu, page);
+            hwaddr        plen = TARGET_PAGE_SIZE - (buf - page);
+            hwaddr        want;
+            uint8_t*      host;
+
+            if (phys == -1)
+                break;
+            if (plen > len)
+                plen = len;
+            want = plen;
+            host = cpu_physical_memory_map(phys + (buf - page), &plen, 0);
+            if (host == NULL)
+                break;
+            if (plen < want) {
+                cpu_physical_memory_unmap(host, plen, 0, 0);
+                break;
+            }
+            if (n > 0 &&
+                (uint8_t*)iov[n-1].iov_base + iov[n-1].iov_len == host) {
+                /* physically contiguous guest pages */
+                iov[n-1].iov_len += plen;
+            } else if (n < TTY_IOV_MAX) {
+                iov[n].iov_base = host;
+                iov[n].iov_len  = plen;
+                n++;
+            } else {
+                cpu_physical_memory_unmap(host, plen, 0, 0);
+                break;
+            }
+            buf += plen;
+            len -= plen;
+        }
+
+        if (n > 0) {
+            qemu_chr_writev(s->cs, iov, n);
+            for (i = 0; i < n; i++) {
+                cpu_physical_memory_unmap(iov[i].iov_base, iov[i].iov_len,
+                                          0, iov[i].iov_len);
+            }
+        } else {
+            /* unmapped or not RAM, copy up to the end of the page */
+            uint8_t   temp[64];
+            uint32_t  to_write = TARGET_PAGE_SIZE - (buf & ~TARGET_PAGE_MASK);
+            if (to_write > sizeof(temp))
+                to_write = sizeof(temp);
+            if (to_write > len)
+                to_write = len;
+
+            safe_memory_rw_debug(current_cpu, buf, temp, to_write, 0);
+            qemu_chr_write(s->cs, temp, to_write);
+            buf += to_write;
+            len -= to_write;
+        }
+    }
+}
+
+/* Copy s->ptr_len bytes from the receive ring to the guest buffer. */
+static void goldfish_tty_read_buffer(struct tty_state *s)
+{
+    uint32_t  len = s->ptr_len;
+    uint32_t  head;
+
+    if (len > s->data_count)
+        len = s->data_count;
+
+    head = sizeof(s->data) - s->data_start;
+    if (head > len)
+        head = len;
+    safe_memory_rw_debug(current_cpu, s->ptr, s->data + s->data_start, head, 1);
+    if (len > head)
+        safe_memory_rw_debug(current_cpu, s->ptr + head, s->data, len - head, 1);
+
+    s->data_start = (s->data_start + len) % sizeof(s->data);
+    s->data_count -= len;
+    if (s->data_count == 0)
+        s->data_start = 0;
+}
+
 static void goldfish_tty_write(void *opaque, hwaddr offset, uint32_t value)
 {
     struct tty_state *s = (struct tty_state *)opaque;
@@ -141,23 +249,7 @@ static void goldfish_tty_write(void *opaque, hwaddr offset, uint32_t value)
 
                 case TTY_CMD_WRITE_BUFFER:
                     if(s->cs) {
-                        int len;
-                        target_ulong  buf;
-
-                        buf = s->ptr;
-                        len = s->ptr_len;
-
-                        while (len) {
-                            char   temp[64];
-                            int    to_write = sizeof(temp);
-                            if (to_write > len)
-                                to_write = len;
-
-                            safe_memory_rw_debug(current_cpu, buf, (uint8_t*)temp, to_write, 0);
-                            qemu_chr_write(s->cs, (const uint8_t*)temp, to_write);
-                            buf += to_write;
-                            len -= to_write;
-                        }
+                        goldfish_tty_write_buffer(s);
                         D("goldfish_tty_write: got %d bytes from %llx\n", s->ptr_len, (unsigned long long)s->ptr);
                     }
                     break;
@@ -165,11 +257,8 @@ static void goldfish_tty_write(void *opaque, hwaddr offset, uint32_t value)
                 case TTY_CMD_READ_BUFFER:
                     if(s->ptr_len > s->data_count)
                         E("goldfish_tty_write: reading more data than available %d %d\n", s->ptr_len, s->data_count);
-                    safe_memory_rw_debug(current_cpu, s->ptr, s->data, s->ptr_len,1);
+                    goldfish_tty_read_buffer(s);
                     D("goldfish_tty_write: read %d bytes to %llx\n", s->ptr_len, (unsigned long long)s->ptr);
-                    if(s->data_count > s->ptr_len)
-                        memmove(s->data, s->data + s->ptr_len, s->data_count - s->ptr_len);
-                    s->data_count -= s->ptr_len;
                     if(s->data_count == 0 && s->ready)
                         goldfish_device_set_irq(&s->dev, 0, 0);
                     break;
@@ -206,8 +295,13 @@ static int tty_can_receive(void *opaque)
 static void tty_receive(void *opaque, const uint8_t *buf, int size)
 {
     struct tty_state *s = opaque;
+    uint32_t tail = (s->data_start + s->data_count) % sizeof(s->data);
+    uint32_t head = sizeof(s->data) - tail;
 
-    memcpy(s->data + s->data_count, buf, size);
+    if (head > (uint32_t)size)
+        head = size;
+    memcpy(s->data + tail, buf, head);
+    memcpy(s->data, buf + head, size - head);
     s->data_count += size;
     if(s->data_count > 0 && s->ready)
         goldfish_device_set_irq(&s->dev, 0, 1);
@@ -27,7 +27,9 @@ extern int  qemu_chr_open_charpipe( CharDriverState* *pfirst, CharDriverState* *
  */
 extern CharDriverState*  qemu_chr_open_buffer( CharDriverState*  endpoint );
 
-/* must be called from the main event loop to poll all charpipes */
+/* must be called from the main event loop to retry delivery of data buffered
+ * by charpipes and charbuffers whose receiver was not ready. This only visits
+ * objects that actually have pending data. */
 extern void charpipe_poll( void );
 
 #endif /* _CHARPIPE_H */
@@ -13,9 +13,13 @@
 #define _SLIRP_SHAPER_H_
 
 #include <stddef.h>
+#include <stdint.h>
 
 /* a NetShaper object is used to limit the throughput of data packets
- * at a fixed rate expressed in bits/seconds
+ * at a fixed rate expressed in bits/seconds, with a token bucket.
+ * packets that must wait are copied to a preallocated ring, unless
+ * 'do_copy' is 0, in which case their data must stay valid until
+ * they are sent.
  */
 typedef struct NetShaperRec_*  NetShaper;
 typedef void (*NetShaperSendFunc)( void*  data, size_t  size, void*  opaque);
@@ -31,6 +35,32 @@ void        netshaper_send_aux( NetShaper  shaper, void* data, size_t  size, voi
 
 int         netshaper_can_send( NetShaper  shaper );
 
+/* an optional model applied to the packets going through a shaper,
+ * to simulate packet loss and jitter. both callbacks are optional.
+ */
+typedef struct {
+    /* return 1 if the packet must be dropped */
+    int      (*drop)  ( void*  opaque, size_t  size );
+    /* return a delay in nanoseconds to add to the packet */
+    int64_t  (*jitter)( void*  opaque, size_t  size );
+} NetShaperModel;
+
+/* set or clear (with NULL) the model of a shaper */
+void        netshaper_set_model( NetShaper              shaper,
+                                 const NetShaperModel*  model,
+                                 void*                  opaque );
+
+/* a model dropping packets with probability 'loss', and delaying
+ * them by a random amount between 0 and 'jitter_ns'. pass a
+ * NetShaperRandomModel as the opaque argument of netshaper_set_model()
+ */
+typedef struct {
+    double   loss;
+    int64_t  jitter_ns;
+} NetShaperRandomModel;
+
+extern const NetShaperModel  netshaper_random_model;
+
 void        netshaper_destroy (NetShaper   shaper);
 
 /* a NetDelay object is used to simulate network connection latencies */
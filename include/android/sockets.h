@@ -357,6 +357,11 @@ int  socket_set_ipv6only(int  fd);
 /* retrieve last socket error code */
 int  socket_get_error(int  fd);
 
+/* retrieve the size of the kernel receive/send buffers of a socket,
+ * or -1 on error */
+int  socket_get_rcvbuf(int  fd);
+int  socket_get_sndbuf(int  fd);
+
 /* close an opened socket. Note that this is unlike the Unix 'close' because:
  * - it will properly shutdown the socket in the background
  * - it does not modify errno
@@ -17,20 +17,36 @@
 /* global flag, set to 1 when packet captupe is active */
 extern int  qemu_tcpdump_active;
 
+/* maximum and default number of bytes captured per packet */
+#define  QEMU_TCPDUMP_SNAPLEN  65535
+
+/* packet directions, as seen from the emulated device */
+#define  QEMU_TCPDUMP_IN   0
+#define  QEMU_TCPDUMP_OUT  1
+
+/* set the snaplen of the next captures, <= 0 selects the default */
+extern void qemu_tcpdump_set_snaplen( int  snaplen );
+
 /* start a new packet capture, close the current one if any.
+ * the file uses the pcapng format if its name ends with '.pcapng',
+ * and the libpcap format otherwise.
  * returns 0 on success, and -1 on failure (see errno then) */
 extern int  qemu_tcpdump_start( const char*  filepath );
 
 /* stop the current packet capture, if any */
 extern void qemu_tcpdump_stop( void );
 
-/* send an ethernet packet to the packet capture file, if any */
-extern void qemu_tcpdump_packet( const void*  base, int  len );
+/* send an ethernet packet to the packet capture file, if any.
+ * the packet is only queued, it is written later by a separate thread,
+ * or dropped if too many packets are already waiting. */
+extern void qemu_tcpdump_packet( const void*  base, int  len, int  direction );
 
 /* returns interesting stats, like the number of packets captures,
- * and the total size of these packets. Note: the file will be larger
+ * the total size of these packets, and the number of packets dropped
+ * because the writer could not keep up. Note: the file will be larger
  * due to global and packet headers.
  */
-extern void  qemu_tcpdump_stats( uint64_t  *pcount, uint64_t*  psize );
+extern void  qemu_tcpdump_stats( uint64_t  *pcount, uint64_t*  psize,
+                                 uint64_t*  pdropped );
 
 #endif /* _QEMU_TCPDUMP_H */
@@ -74,8 +74,21 @@ typedef uint64_t target_ulong;
 #define TB_JMP_PAGE_MASK (TB_JMP_CACHE_SIZE - TB_JMP_PAGE_SIZE)
 
 #if !defined(CONFIG_USER_ONLY)
+/* Each MMU mode has a direct-mapped TLB, whose number of entries is
+   adjusted between 1 << CPU_TLB_MIN_BITS and 1 << CPU_TLB_MAX_BITS on
+   full flushes (see tlb_mmu_resize() in cputlb.c). It starts with
+   CPU_TLB_SIZE entries. The current size is kept in tlb_mask, which is
+   also what the generated code uses to index the table.  */
 #define CPU_TLB_BITS 8
 #define CPU_TLB_SIZE (1 << CPU_TLB_BITS)
+#define CPU_TLB_MIN_BITS 6
+#define CPU_TLB_MAX_BITS 10
+#define CPU_TLB_MAX_SIZE (1 << CPU_TLB_MAX_BITS)
+
+/* Each MMU mode also has a small, fully associative victim TLB holding
+   the last entries evicted from the main one. It is looked up by the
+   softmmu slow path before walking the guest page tables.  */
+#define CPU_VTLB_SIZE 8
 
 #if HOST_LONG_BITS == 32 && TARGET_LONG_BITS == 32
 #define CPU_TLB_ENTRY_BITS 4
@@ -105,10 +118,27 @@ typedef struct CPUTLBEntry {
 
 QEMU_BUILD_BUG_ON(sizeof(CPUTLBEntry) != (1 << CPU_TLB_ENTRY_BITS));
 
+/* Per MMU mode TLB usage since the last full flush.  */
+typedef struct CPUTLBDesc {
+    uint32_t n_used;          /* entries filled while empty */
+    uint32_t n_misses;        /* entries filled */
+    uint32_t n_idle_flushes;  /* consecutive flushes of a mostly empty TLB */
+} CPUTLBDesc;
+
 #define CPU_COMMON_TLB \
     /* The meaning of the MMU modes is defined in the target code. */   \
-    CPUTLBEntry tlb_table[NB_MMU_MODES][CPU_TLB_SIZE];                  \
-    hwaddr iotlb[NB_MMU_MODES][CPU_TLB_SIZE];                           \
+    CPUTLBEntry tlb_table[NB_MMU_MODES][CPU_TLB_MAX_SIZE];              \
+    CPUTLBEntry tlb_v_table[NB_MMU_MODES][CPU_VTLB_SIZE];               \
+    hwaddr iotlb[NB_MMU_MODES][CPU_TLB_MAX_SIZE];                       \
+    hwaddr iotlb_v[NB_MMU_MODES][CPU_VTLB_SIZE];                        \
+    /* (number of entries - 1) << CPU_TLB_ENTRY_BITS */                 \
+    uintptr_t tlb_mask[NB_MMU_MODES];                                   \
+    CPUTLBDesc tlb_desc[NB_MMU_MODES];                                  \
+    unsigned int vtlb_index;                                            \
+    /* ASID + 1 of each entry, 0 for global ones, see tlb_switch_asid() */ \
+    uint16_t tlb_asid[NB_MMU_MODES][CPU_TLB_MAX_SIZE];                  \
+    uint16_t tlb_v_asid[NB_MMU_MODES][CPU_VTLB_SIZE];                   \
+    uint16_t tlb_asid_tag;  /* current ASID + 1, 0 if unused */         \
     target_ulong tlb_flush_addr;                                        \
     target_ulong tlb_flush_mask;
 
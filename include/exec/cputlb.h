@@ -29,6 +29,13 @@ void tlb_reset_dirty_range(CPUTLBEntry *tlb_entry, uintptr_t start,
 void cpu_tlb_reset_dirty_all(ram_addr_t start1, ram_addr_t length);
 void tlb_set_dirty(CPUArchState *env, target_ulong vaddr);
 extern int tlb_flush_count;
+extern int tlb_resize_count;
+extern uint64_t tlb_miss_count[NB_MMU_MODES];
+extern uint64_t tlb_victim_hit_count[NB_MMU_MODES];
+extern int tlb_asid_switch_count;
+extern int tlb_asid_flush_count;
+extern uint64_t tlb_asid_kept_count;
+extern uint64_t tlb_asid_dropped_count;
 
 /* exec.c */
 void tb_flush_jmp_cache(CPUArchState *env, target_ulong addr);
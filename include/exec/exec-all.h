@@ -105,7 +105,31 @@ void tlb_flush(CPUArchState *env, int flush_global);
 void tlb_set_page(CPUArchState *env, target_ulong vaddr,
                   hwaddr paddr, int prot,
                   int mmu_idx, target_ulong size);
+/* ASID to pass to tlb_set_page_asid() for translations shared by all
+   address spaces.  */
+#define TLB_ASID_GLOBAL (-1)
+void tlb_set_page_asid(CPUArchState *env, target_ulong vaddr,
+                       hwaddr paddr, int prot,
+                       int mmu_idx, target_ulong size, int asid);
+void tlb_switch_asid(CPUArchState *env, int asid);
+void tlb_flush_asid(CPUArchState *env, int asid);
+bool tlb_victim_lookup(CPUArchState *env, int mmu_idx, unsigned int index,
+                       target_ulong addr, size_t elt_ofs);
 void tb_invalidate_phys_addr(hwaddr addr);
+
+/* Number of entries currently used by the TLB of 'mmu_idx'.  */
+static inline unsigned int tlb_n_entries(CPUArchState *env, int mmu_idx)
+{
+    return (env->tlb_mask[mmu_idx] >> CPU_TLB_ENTRY_BITS) + 1;
+}
+
+/* Index of the entry for 'addr' in the TLB of 'mmu_idx'.  */
+static inline unsigned int tlb_index(CPUArchState *env, int mmu_idx,
+                                     target_ulong addr)
+{
+    return (addr >> TARGET_PAGE_BITS) &
+           (env->tlb_mask[mmu_idx] >> CPU_TLB_ENTRY_BITS);
+}
 #else
 static inline void tlb_flush_page(CPUArchState *env, target_ulong addr)
 {
@@ -122,10 +146,22 @@ typedef struct PhysPageDesc {
     ram_addr_t region_offset;
 } PhysPageDesc;
 
-PhysPageDesc *phys_page_find(hwaddr index);
+/* Only for cpu_register_physical_memory_log(), which must then call
+   phys_dispatch_invalidate().  */
 PhysPageDesc *phys_page_find_alloc(hwaddr index, int alloc);
-
-int io_mem_watch;
+/* Call 'fn' for every page of the registration radix tree, in increasing
+   page index order.  Pages that were never registered may be skipped.  */
+typedef void PhysPageFunc(hwaddr index, const PhysPageDesc *pd);
+void phys_page_for_each(PhysPageFunc *fn);
+void phys_dispatch_invalidate(void);
+/* Fill *pd with the mapping of physical page 'index'.  Pages that were
+   never registered are IO_MEM_UNASSIGNED with their own address as
+   region_offset.  */
+void phys_page_lookup(hwaddr index, PhysPageDesc *pd);
+int phys_dispatch_nb_sections(void);
+extern int phys_dispatch_rebuild_count;
+
+extern int io_mem_watch;
 
 #define CODE_GEN_ALIGN           16 /* must be >= of the size of a icache line */
 
@@ -232,6 +268,13 @@ void tb_invalidate_phys_page_fast0(hwaddr start, int len);
 extern uint8_t *code_gen_ptr;
 extern int code_gen_max_blocks;
 
+/* cpu-exec.c statistics: entries into translated code from cpu_exec,
+   and indirect branches resolved by helper_lookup_tb_ptr without
+   going back to it.  */
+extern int64_t tb_exec_count;
+extern int64_t tb_lookup_ptr_hit_count;
+extern int64_t tb_lookup_ptr_miss_count;
+
 #if defined(USE_DIRECT_JUMP)
 
 #if defined(CONFIG_TCG_INTERPRETER)
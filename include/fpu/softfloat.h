@@ -204,6 +204,13 @@ INLINE int get_float_exception_flags(float_status *status)
 }
 void set_floatx80_rounding_precision(int val STATUS_PARAM);
 
+/*----------------------------------------------------------------------------
+| Enables or disables the host FPU fast path of the basic float32/float64
+| operations (on by default where the host supports it).  Results and flags
+| are the same either way; this is used to test that they are.
+*----------------------------------------------------------------------------*/
+void set_float_host_fpu(flag val);
+
 /*----------------------------------------------------------------------------
 | Routine to raise any or all of the software IEC/IEEE floating-point
 | exception flags.
@@ -350,6 +357,12 @@ INLINE int float32_is_zero_or_denormal(float32 a)
     return (float32_val(a) & 0x7f800000) == 0;
 }
 
+INLINE int float32_is_zero_or_normal(float32 a)
+{
+    uint32_t exp = float32_val(a) & 0x7f800000;
+    return exp == 0 ? float32_is_zero(a) : exp != 0x7f800000;
+}
+
 INLINE float32 float32_set_sign(float32 a, int sign)
 {
     return make_float32((float32_val(a) & 0x7fffffff) | (sign << 31));
@@ -458,6 +471,12 @@ INLINE int float64_is_zero_or_denormal(float64 a)
     return (float64_val(a) & 0x7ff0000000000000LL) == 0;
 }
 
+INLINE int float64_is_zero_or_normal(float64 a)
+{
+    uint64_t exp = float64_val(a) & 0x7ff0000000000000LL;
+    return exp == 0 ? float64_is_zero(a) : exp != 0x7ff0000000000000LL;
+}
+
 INLINE float64 float64_set_sign(float64 a, int sign)
 {
     return make_float64((float64_val(a) & 0x7fffffffffffffffULL)
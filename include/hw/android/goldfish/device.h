@@ -50,6 +50,7 @@ void goldfish_battery_init(int has_battery);
 void goldfish_battery_set_prop(int ac, int property, int value);
 void goldfish_battery_display(void (* callback)(void *data, const char* string), void *data);
 void goldfish_mmc_init(uint32_t base, int id, BlockDriverState* bs);
+void goldfish_net_init(NICInfo *nd, int id);
 int goldfish_guest_is_64bit();
 
 // these do not add a device
@@ -161,6 +161,34 @@ extern void goldfish_pipe_wake( void* hwpipe, unsigned flags );
 #define PIPE_REG_ACCESS_PARAMS       0x20
 #define PIPE_REG_CHANNEL_HIGH        0x30 /* read/write: high 32 bit channel id */
 #define PIPE_REG_ADDRESS_HIGH        0x34 /* write: high 32 bit physical address */
+#define PIPE_REG_DOORBELL            0x38 /* write: run queued commands, read: completed count */
+#define PIPE_REG_FEATURES            0x3c /* read: PIPE_FEATURE_XXX bit-flags */
+
+/* Bit-flags returned by PIPE_REG_FEATURES */
+#define PIPE_FEATURE_DOORBELL  (1 << 0)
+
+/* Command doorbell. A guest that sees PIPE_FEATURE_DOORBELL can queue
+ * commands as an array of PIPE_DOORBELL_RING_SIZE access_params (or
+ * access_params_64) entries located at PIPE_REG_PARAMS_ADDR, instead of
+ * doing one register round-trip per command:
+ *
+ *   - fill the next entry, using a guest *physical* buffer address, and
+ *     set PIPE_PARAMS_FLAG_PENDING in its 'flags' field.
+ *   - write any value to PIPE_REG_DOORBELL.
+ *
+ * The emulator runs pending entries in ring order, stores the command
+ * status in 'result', replaces PIPE_PARAMS_FLAG_PENDING with
+ * PIPE_PARAMS_FLAG_DONE, then raises the device IRQ. Reading
+ * PIPE_REG_DOORBELL returns the number of entries completed since the
+ * last read. Writing PIPE_REG_PARAMS_ADDR restarts the ring at entry 0.
+ *
+ * Under KVM, the doorbell register is bound to an ioeventfd when the host
+ * kernel supports it, so ringing it does not cause a VCPU exit; the ring
+ * is then drained from the main loop.
+ */
+#define PIPE_DOORBELL_RING_SIZE     64
+#define PIPE_PARAMS_FLAG_PENDING   (1 << 0)
+#define PIPE_PARAMS_FLAG_DONE      (1 << 1)
 
 /* list of commands for PIPE_REG_COMMAND */
 #define PIPE_CMD_OPEN               1  /* open new channel */
@@ -56,10 +56,12 @@ typedef void QEMUTimerListNotifyCB(void *opaque);
 
 struct QEMUTimer {
     int64_t expire_time;        /* in nanoseconds */
+    int64_t slack;              /* in nanoseconds, see timer_set_slack_ns */
     QEMUTimerList *timer_list;
     QEMUTimerCB *cb;
     void *opaque;
-    QEMUTimer *next;
+    uint64_t seq;               /* keeps timers with equal deadlines FIFO */
+    int heap_index;             /* 1-based position in the heap, 0 if idle */
     int scale;
 };
 
@@ -583,6 +585,19 @@ void timer_mod(QEMUTimer *ts, int64_t expire_timer);
  */
 void timer_mod_anticipate(QEMUTimer *ts, int64_t expire_time);
 
+/**
+ * timer_set_slack_ns:
+ * @ts: the timer
+ * @slack: the slack in nanoseconds
+ *
+ * Allow the timer to fire up to @slack nanoseconds after its expiry
+ * time, so that it can run together with other timers whose deadlines
+ * fall within that window instead of waking up the host on its own.
+ * The timer never fires before its expiry time. The new slack applies
+ * from the next timer_mod call on.
+ */
+void timer_set_slack_ns(QEMUTimer *ts, int64_t slack);
+
 /**
  * timer_pending:
  * @ts: the timer
@@ -61,6 +61,26 @@ void kvm_setup_guest_memory(void *start, size_t size);
 int kvm_coalesce_mmio_region(hwaddr start, ram_addr_t size);
 int kvm_uncoalesce_mmio_region(hwaddr start, ram_addr_t size);
 
+/* Returns 1 if the host kernel can signal an eventfd on guest MMIO writes
+ * (KVM_CAP_IOEVENTFD), 0 otherwise. */
+int kvm_has_ioeventfd(void);
+
+/* Bind (|assign| != 0) or unbind the eventfd |fd| to guest writes of |len|
+ * bytes at physical address |addr|. Such writes no longer cause a
+ * KVM_EXIT_MMIO; the kernel increments the eventfd counter instead.
+ * Returns 0 on success, or a negative errno value. */
+int kvm_set_ioeventfd_mmio(int fd, hwaddr addr, uint32_t len, int assign);
+
+/* Cumulative counters of the VCPU exits handled by kvm_cpu_exec(). */
+typedef struct KVMExitStats {
+    uint64_t total;
+    uint64_t io;
+    uint64_t mmio;
+    uint64_t coalesced_mmio;
+} KVMExitStats;
+
+void kvm_get_exit_stats(KVMExitStats *stats);
+
 int kvm_insert_breakpoint(CPUState *current_env, target_ulong addr,
                           target_ulong len, int type);
 int kvm_remove_breakpoint(CPUState *current_env, target_ulong addr,
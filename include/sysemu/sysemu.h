@@ -52,6 +52,17 @@ int init_timer_alarm(void);
 int qemu_timer_alarm_pending(void);
 void quit_timers(void);
 
+/* Host wakeups of the main loop, i.e. blocking waits that returned. */
+typedef struct MainLoopWakeupStats {
+    uint64_t wakeups;        /* all blocking waits that returned */
+    uint64_t timer_wakeups;  /* ... because a timer deadline passed */
+    uint64_t io_wakeups;     /* ... because a file descriptor was ready */
+    int64_t  elapsed_ns;     /* host time since the main loop started */
+} MainLoopWakeupStats;
+
+void main_loop_get_wakeup_stats(MainLoopWakeupStats *stats);
+const char *qemu_alarm_timer_name(void);
+
 int64_t qemu_icount;
 int64_t qemu_icount_bias;
 int icount_time_shift;
@@ -61,6 +61,7 @@ struct KVMState
     int fd;
     int vmfd;
     int coalesced_mmio;
+    int ioeventfd;
     int broken_set_mem_region;
     int migration_log;
 #ifdef KVM_CAP_SET_GUEST_DEBUG
@@ -70,6 +71,8 @@ struct KVMState
 
 static KVMState *kvm_state;
 
+static KVMExitStats kvm_exit_stats;
+
 static KVMSlot *kvm_alloc_slot(KVMState *s)
 {
     int i;
@@ -397,6 +400,42 @@ int kvm_uncoalesce_mmio_region(hwaddr start, ram_addr_t size)
     return ret;
 }
 
+int kvm_has_ioeventfd(void)
+{
+    KVMState *s = kvm_state;
+
+    return s != NULL && s->ioeventfd;
+}
+
+int kvm_set_ioeventfd_mmio(int fd, hwaddr addr, uint32_t len, int assign)
+{
+    int ret = -ENOSYS;
+#ifdef KVM_CAP_IOEVENTFD
+    KVMState *s = kvm_state;
+
+    if (s != NULL && s->ioeventfd) {
+        struct kvm_ioeventfd iofd;
+
+        memset(&iofd, 0, sizeof(iofd));
+        iofd.addr = addr;
+        iofd.len = len;
+        iofd.fd = fd;
+        if (!assign) {
+            iofd.flags |= KVM_IOEVENTFD_FLAG_DEASSIGN;
+        }
+
+        ret = kvm_vm_ioctl(s, KVM_IOEVENTFD, &iofd);
+    }
+#endif
+
+    return ret;
+}
+
+void kvm_get_exit_stats(KVMExitStats *stats)
+{
+    *stats = kvm_exit_stats;
+}
+
 int kvm_check_extension(KVMState *s, unsigned int extension)
 {
     int ret;
@@ -503,6 +542,12 @@ int kvm_init(int smp_cpus)
     s->coalesced_mmio = 0;
 #endif
 
+#ifdef KVM_CAP_IOEVENTFD
+    s->ioeventfd = kvm_check_extension(s, KVM_CAP_IOEVENTFD);
+#else
+    s->ioeventfd = 0;
+#endif
+
     s->broken_set_mem_region = 1;
 #ifdef KVM_CAP_JOIN_MEMORY_REGIONS_WORKS
     ret = kvm_ioctl(s, KVM_CHECK_EXTENSION, KVM_CAP_JOIN_MEMORY_REGIONS_WORKS);
@@ -584,6 +629,7 @@ static void kvm_run_coalesced_mmio(CPUState *cpu, struct kvm_run *run)
             struct kvm_coalesced_mmio *ent;
 
             ent = &ring->coalesced_mmio[ring->first];
+            kvm_exit_stats.coalesced_mmio++;
 
             cpu_physical_memory_write(ent->phys_addr, ent->data, ent->len);
             /* FIXME smp_wmb() */
@@ -625,10 +671,12 @@ int kvm_cpu_exec(CPUState *cpu)
 
         kvm_run_coalesced_mmio(cpu, run);
 
+        kvm_exit_stats.total++;
         ret = 0; /* exit loop */
         switch (run->exit_reason) {
         case KVM_EXIT_IO:
             dprintf("handle_io\n");
+            kvm_exit_stats.io++;
             ret = kvm_handle_io(cpu, run->io.port,
                                 (uint8_t *)run + run->io.data_offset,
                                 run->io.direction,
@@ -637,6 +685,7 @@ int kvm_cpu_exec(CPUState *cpu)
             break;
         case KVM_EXIT_MMIO:
             dprintf("handle_mmio\n");
+            kvm_exit_stats.mmio++;
             cpu_physical_memory_rw(run->mmio.phys_addr,
                                    run->mmio.data,
                                    run->mmio.len,
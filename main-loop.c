@@ -39,6 +39,7 @@
 
 #ifdef __linux__
 #include <sys/ioctl.h>
+#include <sys/timerfd.h>
 #endif
 
 #ifdef _WIN32
@@ -258,20 +259,32 @@ void os_host_main_loop_wait(int *timeout)
 #endif  // _WIN32
 
 static void qemu_run_alarm_timer(void);  // forward
+static void qemu_prepare_alarm_timer(void);  // forward
 
+static MainLoopWakeupStats wakeup_stats;
+static int64_t main_loop_start_ns;
+static uint64_t alarm_timer_fired;
+
+void main_loop_get_wakeup_stats(MainLoopWakeupStats *stats)
+{
+    *stats = wakeup_stats;
+    stats->elapsed_ns = main_loop_start_ns ?
+                        get_clock() - main_loop_start_ns : 0;
+}
+
+/* Wait for I/O, timers or bottom-halves for up to 'timeout' ms, or
+ * until something happens if 'timeout' is negative, then run them. */
 void main_loop_wait(int timeout)
 {
     fd_set rfds, wfds, xfds;
     int ret, nfds;
     struct timeval tv;
+    uint64_t fired = alarm_timer_fired;
 
     qemu_bh_update_timeout(&timeout);
 
     os_host_main_loop_wait(&timeout);
 
-    tv.tv_sec = timeout / 1000;
-    tv.tv_usec = (timeout % 1000) * 1000;
-
     /* poll any events */
 
     /* XXX: separate device handlers from system ones */
@@ -282,10 +295,17 @@ void main_loop_wait(int timeout)
     qemu_iohandler_fill(&nfds, &rfds, &wfds, &xfds);
     if (slirp_is_inited()) {
         slirp_select_fill(&nfds, &rfds, &wfds, &xfds);
+        slirp_update_timeout(&timeout);
     }
 
+    tv.tv_sec = timeout / 1000;
+    tv.tv_usec = (timeout % 1000) * 1000;
+
+    /* the deadlines may have moved since the last wait */
+    qemu_prepare_alarm_timer();
+
     qemu_mutex_unlock_iothread();
-    ret = select(nfds + 1, &rfds, &wfds, &xfds, &tv);
+    ret = select(nfds + 1, &rfds, &wfds, &xfds, timeout < 0 ? NULL : &tv);
     qemu_mutex_lock_iothread();
     qemu_iohandler_poll(&rfds, &wfds, &xfds, ret);
     if (slirp_is_inited()) {
@@ -298,6 +318,15 @@ void main_loop_wait(int timeout)
     }
     charpipe_poll();
 
+    if (timeout != 0) {
+        wakeup_stats.wakeups++;
+        if (alarm_timer_fired != fired || ret == 0) {
+            wakeup_stats.timer_wakeups++;
+        } else if (ret > 0) {
+            wakeup_stats.io_wakeups++;
+        }
+    }
+
     qemu_clock_run_all_timers();
 
     qemu_run_alarm_timer();
@@ -306,6 +335,8 @@ void main_loop_wait(int timeout)
        them.  */
     qemu_bh_poll();
 
+    /* the guest may have work now, arm the alarm for its next slice */
+    qemu_prepare_alarm_timer();
 }
 
 void main_loop(void)
@@ -453,9 +484,14 @@ struct qemu_alarm_timer {
     int (*start)(struct qemu_alarm_timer *t);
     void (*stop)(struct qemu_alarm_timer *t);
     void (*rearm)(struct qemu_alarm_timer *t);
+    /* Rearmed before every main loop wait rather than only on expiry,
+     * the main loop then blocks until the next deadline. */
+    char deadline_driven;
 #if defined(__linux__)
     int fd;
     timer_t timer;
+    int64_t fd_deadline;        /* absolute CLOCK_MONOTONIC ns, 0 if none */
+    int64_t signal_deadline;
 #elif defined(_WIN32)
     HANDLE timer;
 #endif
@@ -484,6 +520,18 @@ static void qemu_run_alarm_timer(void) {
     }
 }
 
+static void qemu_prepare_alarm_timer(void)
+{
+    if (alarm_timer && alarm_timer->deadline_driven) {
+        qemu_rearm_alarm_timer(alarm_timer);
+    }
+}
+
+const char *qemu_alarm_timer_name(void)
+{
+    return alarm_timer ? alarm_timer->name : "none";
+}
+
 /* TODO: MIN_TIMER_REARM_NS should be optimized */
 #define MIN_TIMER_REARM_NS 250000
 
@@ -508,6 +556,10 @@ static int dynticks_start_timer(struct qemu_alarm_timer *t);
 static void dynticks_stop_timer(struct qemu_alarm_timer *t);
 static void dynticks_rearm_timer(struct qemu_alarm_timer *t);
 
+static int timerfd_start_timer(struct qemu_alarm_timer *t);
+static void timerfd_stop_timer(struct qemu_alarm_timer *t);
+static void timerfd_rearm_timer(struct qemu_alarm_timer *t);
+
 #endif /* __linux__ */
 
 #endif /* _WIN32 */
@@ -519,6 +571,10 @@ int64_t qemu_icount_round(int64_t count)
 
 static struct qemu_alarm_timer alarm_timers[] = {
 #ifndef _WIN32
+#ifdef __linux__
+    {"timerfd", timerfd_start_timer,
+     timerfd_stop_timer, timerfd_rearm_timer, 1},
+#endif
     {"unix", unix_start_timer, unix_stop_timer, NULL},
 #ifdef __linux__
     /* on Linux, the 'dynticks' clock sometimes doesn't work
@@ -614,25 +670,29 @@ int qemu_timer_alarm_pending(void)
 }
 
 #if defined(__linux__) || defined(_WIN32)
-// Compute the next alarm deadline, return a timeout in nanoseconds.
+// Compute the soonest deadline of all clocks, return a timeout in
+// nanoseconds, or -1 if no timer is pending.
 // NOTE: This function cannot be called from a signal handler since
 // it calls qemu-timer.c functions that acquire/release global mutexes.
-static int64_t qemu_next_alarm_deadline(void)
+static int64_t qemu_soonest_alarm_deadline(void)
 {
-    int64_t delta = INT32_MAX;
+    int64_t delta = -1;
     if (!use_icount) {
         delta = qemu_clock_deadline_ns_all(QEMU_CLOCK_VIRTUAL);
     }
-    int64_t hdelta = qemu_clock_deadline_ns_all(QEMU_CLOCK_HOST);
-    if (hdelta < delta) {
-        delta = hdelta;
-    }
-    int64_t rtdelta = qemu_clock_deadline_ns_all(QEMU_CLOCK_REALTIME);
-    if (rtdelta < delta) {
-        delta = rtdelta;
-    }
+    delta = qemu_soonest_timeout(delta,
+                                 qemu_clock_deadline_ns_all(QEMU_CLOCK_HOST));
+    delta = qemu_soonest_timeout(delta,
+                                 qemu_clock_deadline_ns_all(QEMU_CLOCK_REALTIME));
     return delta;
 }
+
+// Same as above, but return INT32_MAX if no timer is pending.
+static int64_t qemu_next_alarm_deadline(void)
+{
+    int64_t delta = qemu_soonest_alarm_deadline();
+    return delta < 0 ? INT32_MAX : delta;
+}
 #endif  // __linux__ || _WIN32
 
 #ifdef _WIN32
@@ -741,6 +801,130 @@ static void dynticks_rearm_timer(struct qemu_alarm_timer *t)
     }
 }
 
+/* The 'timerfd' alarm is fully deadline-driven: nothing ticks unless a
+ * timer is due. While the guest is idle, the main loop blocks in select()
+ * on a timerfd armed to the soonest deadline. Since TCG runs on the main
+ * thread, a one-shot signal timer armed to the same deadline is still
+ * needed to kick the CPU out of translated code while the guest has work,
+ * and at least every TIMERFD_IO_KICK_NS so that I/O is not starved, but
+ * it is left disarmed otherwise. Both are only reprogrammed when the
+ * deadline moves. */
+
+/* Longest time translated code may run without the main loop polling
+ * file descriptors. */
+#define TIMERFD_IO_KICK_NS  (4 * 1000000)
+
+static int64_t monotonic_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static void timerfd_alarm_read(void *opaque)
+{
+    struct qemu_alarm_timer *t = opaque;
+    uint64_t expirations;
+    ssize_t len;
+
+    do {
+        len = read(t->fd, &expirations, sizeof(expirations));
+    } while (len < 0 && errno == EINTR);
+
+    t->fd_deadline = 0;
+    t->expired = 1;
+    timer_alarm_pending = 1;
+    alarm_timer_fired++;
+}
+
+static int timerfd_start_timer(struct qemu_alarm_timer *t)
+{
+    t->fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (t->fd < 0) {
+        perror("timerfd_create");
+        return -1;
+    }
+    if (dynticks_start_timer(t)) {
+        close(t->fd);
+        t->fd = -1;
+        return -1;
+    }
+    t->fd_deadline = 0;
+    t->signal_deadline = 0;
+    qemu_set_fd_handler(t->fd, timerfd_alarm_read, NULL, t);
+    return 0;
+}
+
+static void timerfd_stop_timer(struct qemu_alarm_timer *t)
+{
+    qemu_set_fd_handler(t->fd, NULL, NULL, NULL);
+    close(t->fd);
+    t->fd = -1;
+    dynticks_stop_timer(t);
+}
+
+/* Returns true if a timer armed for 'armed' must be reprogrammed to fire
+ * at 'deadline' (both absolute, 0 meaning disarmed). Firing a little
+ * early is cheaper than a syscall on every main loop iteration. */
+static bool timerfd_needs_rearm(int64_t armed, int64_t deadline, int64_t now)
+{
+    if (armed <= now) {
+        return deadline != 0;
+    }
+    if (deadline == 0) {
+        return true;
+    }
+    return armed > deadline || deadline - armed >= MIN_TIMER_REARM_NS;
+}
+
+static void timerfd_rearm_timer(struct qemu_alarm_timer *t)
+{
+    struct itimerspec its;
+    int64_t now = monotonic_ns();
+    int64_t delta = qemu_soonest_alarm_deadline();
+    int64_t deadline = delta < 0 ? 0 : now + delta;
+    int64_t signal_deadline = 0;
+
+    memset(&its, 0, sizeof(its));
+
+    if (timerfd_needs_rearm(t->fd_deadline, deadline, now)) {
+        /* an absolute time in the past fires at once, 0 disarms */
+        its.it_value.tv_sec = deadline / 1000000000LL;
+        its.it_value.tv_nsec = deadline % 1000000000LL;
+        if (timerfd_settime(t->fd, TFD_TIMER_ABSTIME, &its, NULL)) {
+            perror("timerfd_settime");
+            fprintf(stderr, "Internal timer error: aborting\n");
+            exit(1);
+        }
+        t->fd_deadline = deadline;
+    }
+
+    if (vm_running && tcg_has_work()) {
+        /* Also kick the CPU when no timer is due soon, so that file
+         * descriptors are still polled while the guest keeps running.
+         * A kick that is already pending is not pushed back. */
+        int64_t kick = now + TIMERFD_IO_KICK_NS;
+
+        if (t->signal_deadline > now && t->signal_deadline < kick) {
+            kick = t->signal_deadline;
+        }
+        signal_deadline = deadline ? MIN(deadline, kick) : kick;
+        signal_deadline = MAX(signal_deadline, now + MIN_TIMER_REARM_NS);
+    }
+    if (timerfd_needs_rearm(t->signal_deadline, signal_deadline, now)) {
+        int64_t rel = signal_deadline ? signal_deadline - now : 0;
+        its.it_value.tv_sec = rel / 1000000000LL;
+        its.it_value.tv_nsec = rel % 1000000000LL;
+        if (timer_settime(t->timer, 0 /* RELATIVE */, &its, NULL)) {
+            perror("settime");
+            fprintf(stderr, "Internal timer error: aborting\n");
+            exit(1);
+        }
+        t->signal_deadline = signal_deadline;
+    }
+}
+
 #endif /* defined(__linux__) */
 
 #if !defined(_WIN32)
@@ -970,6 +1154,7 @@ int init_timer_alarm(void)
 
     /* first event is at time 0 */
     alarm_timer = t;
+    main_loop_start_ns = get_clock();
     timer_alarm_pending = 1;
     qemu_add_vm_change_state_handler(alarm_timer_on_change_state_rearm, t);
 
@@ -994,7 +1179,10 @@ int qemu_calculate_timeout(void)
         timeout = 5000;
     else if (tcg_has_work())
         timeout = 0;
-    else {
+    else if (alarm_timer && alarm_timer->deadline_driven) {
+        /* the alarm wakes up select() when the next timer is due */
+        timeout = -1;
+    } else {
 #ifdef WIN32
         /* This corresponds to the case where the emulated system is
          * totally idle and waiting for i/o. The problem is that on
@@ -770,7 +770,7 @@ void slirp_output(const uint8_t *pkt, int pkt_len)
     hex_dump(stdout, pkt, pkt_len);
 #endif
     if (qemu_tcpdump_active)
-        qemu_tcpdump_packet(pkt, pkt_len);
+        qemu_tcpdump_packet(pkt, pkt_len, QEMU_TCPDUMP_IN);
 
     if (!slirp_vc)
         return;
@@ -794,7 +794,7 @@ static ssize_t slirp_receive(VLANClientState *vc, const uint8_t *buf, size_t siz
     hex_dump(stdout, buf, size);
 #endif
     if (qemu_tcpdump_active)
-        qemu_tcpdump_packet(buf, size);
+        qemu_tcpdump_packet(buf, size, QEMU_TCPDUMP_OUT);
 
 #ifdef CONFIG_ANDROID
     netshaper_send(slirp_shaper_in, (char*)buf, size);
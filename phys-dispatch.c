@@ -0,0 +1,302 @@
+/* Copyright (C) 2014 The Android Open Source Project
+**
+** This software is licensed under the terms of the GNU General Public
+** License version 2, as published by the Free Software Foundation, and
+** may be copied, distributed, and modified under those terms.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+*/
+#include "config.h"
+
+#include "qemu-common.h"
+#define NO_CPU_IO_DEFS
+#include "cpu.h"
+#include "exec/exec-all.h"
+#include "translate-all.h"
+
+/* Physical memory map.
+
+   cpu_register_physical_memory_log() records the PhysPageDesc of each
+   page in the l1_phys_map radix tree, which is only used when registering
+   memory.  Lookups go through a sorted array of sections, each a run of
+   pages whose phys_offset and region_offset are either constant or
+   advance by one page per page (RAM, ROM and ROMD advance, I/O and
+   subpages do not).  A direct-indexed bucket table gives the small range
+   of sections to binary search.  I/O pages are split into many small
+   sections, so a small direct-mapped cache of recently used I/O pages
+   answers MMIO lookups with one probe; RAM is found faster by the search
+   itself.  The array and the cache are rebuilt from the radix tree on the
+   first lookup after phys_dispatch_invalidate(), which
+   cpu_register_physical_memory_log() calls once it changed the mapping.  */
+
+static void *l1_phys_map[V_L1_SIZE];
+
+PhysPageDesc *phys_page_find_alloc(hwaddr index, int alloc)
+{
+    void **lp;
+    PhysPageDesc *pd;
+    int i;
+
+    /* Level 1. Always allocated. */
+    lp = l1_phys_map + ((index >> V_L1_SHIFT) & (V_L1_SIZE - 1));
+
+    /* Level 2..N-1 */
+    for (i = V_L1_SHIFT / L2_BITS - 1; i > 0; i--) {
+        void **p = *lp;
+
+        if (p == NULL) {
+            if (!alloc) {
+                return NULL;
+            }
+            p = g_malloc0(sizeof(void *) * L2_SIZE);
+            *lp = p;
+        }
+
+        lp = p + ((index >> (i * L2_BITS)) & (L2_SIZE - 1));
+    }
+
+    pd = *lp;
+    if (pd == NULL) {
+        if (!alloc) {
+            return NULL;
+        }
+        pd = g_malloc(sizeof(PhysPageDesc) * L2_SIZE);
+        *lp = pd;
+        for (i = 0; i < L2_SIZE; i++) {
+            pd[i].phys_offset = IO_MEM_UNASSIGNED;
+            pd[i].region_offset = (index + i) << TARGET_PAGE_BITS;
+        }
+    }
+    return ((PhysPageDesc *)pd) + (index & (L2_SIZE - 1));
+}
+
+static void phys_page_walk(void **lp, int level, hwaddr base,
+                           PhysPageFunc *fn)
+{
+    int i;
+
+    if (*lp == NULL) {
+        return;
+    }
+    if (level == 0) {
+        PhysPageDesc *pd = *lp;
+
+        for (i = 0; i < L2_SIZE; i++) {
+            fn(base + i, &pd[i]);
+        }
+    } else {
+        void **p = *lp;
+
+        for (i = 0; i < L2_SIZE; i++) {
+            phys_page_walk(p + i, level - 1,
+                           base + ((hwaddr)i << (level * L2_BITS)), fn);
+        }
+    }
+}
+
+void phys_page_for_each(PhysPageFunc *fn)
+{
+    int i;
+
+    for (i = 0; i < V_L1_SIZE; i++) {
+        phys_page_walk(l1_phys_map + i, V_L1_SHIFT / L2_BITS - 1,
+                       (hwaddr)i << V_L1_SHIFT, fn);
+    }
+}
+
+/* Flat physical memory dispatch.  */
+
+#define PHYS_INDEX_BITS         (L1_MAP_ADDR_SPACE_BITS - TARGET_PAGE_BITS)
+#define PHYS_BUCKET_BITS        12
+#if PHYS_INDEX_BITS > PHYS_BUCKET_BITS
+# define PHYS_BUCKET_SHIFT      (PHYS_INDEX_BITS - PHYS_BUCKET_BITS)
+#else
+# define PHYS_BUCKET_SHIFT      0
+#endif
+#define PHYS_NB_BUCKETS         (1 << PHYS_BUCKET_BITS)
+
+#define PHYS_SECTION_STEP_PHYS      1
+#define PHYS_SECTION_STEP_REGION    2
+
+typedef struct PhysSection {
+    hwaddr start;               /* first page index */
+    hwaddr nb_pages;
+    ram_addr_t phys_offset;     /* of the first page */
+    ram_addr_t region_offset;   /* of the first page */
+    int flags;
+} PhysSection;
+
+static PhysSection *phys_sections;
+static int phys_nb_sections;
+static int phys_sections_size;
+/* phys_bucket[b] is the first section that ends after the start of
+   bucket b; the last section to look at is phys_bucket[b + 1].  */
+static int phys_bucket[PHYS_NB_BUCKETS + 1];
+static bool phys_dispatch_dirty = true;
+
+#define PHYS_CACHE_BITS         8
+#define PHYS_CACHE_SIZE         (1 << PHYS_CACHE_BITS)
+
+static struct {
+    hwaddr index;
+    PhysPageDesc desc;
+} phys_cache[PHYS_CACHE_SIZE];
+
+int phys_dispatch_rebuild_count;
+
+void phys_dispatch_invalidate(void)
+{
+    phys_dispatch_dirty = true;
+}
+
+static void phys_dispatch_add(hwaddr index, const PhysPageDesc *pd)
+{
+    PhysSection *s;
+
+    if (pd->phys_offset == IO_MEM_UNASSIGNED &&
+        pd->region_offset == index << TARGET_PAGE_BITS) {
+        /* same as a page that was never registered */
+        return;
+    }
+    if (phys_nb_sections > 0) {
+        ram_addr_t delta;
+
+        s = &phys_sections[phys_nb_sections - 1];
+        delta = (ram_addr_t)s->nb_pages << TARGET_PAGE_BITS;
+        if (s->start + s->nb_pages == index) {
+            if (s->nb_pages == 1) {
+                int flags = 0;
+
+                if (pd->phys_offset == s->phys_offset + delta) {
+                    flags |= PHYS_SECTION_STEP_PHYS;
+                } else if (pd->phys_offset != s->phys_offset) {
+                    goto new_section;
+                }
+                if (pd->region_offset == s->region_offset + delta) {
+                    flags |= PHYS_SECTION_STEP_REGION;
+                } else if (pd->region_offset != s->region_offset) {
+                    goto new_section;
+                }
+                s->flags = flags;
+                s->nb_pages++;
+                return;
+            }
+            if (pd->phys_offset == s->phys_offset +
+                    (s->flags & PHYS_SECTION_STEP_PHYS ? delta : 0) &&
+                pd->region_offset == s->region_offset +
+                    (s->flags & PHYS_SECTION_STEP_REGION ? delta : 0)) {
+                s->nb_pages++;
+                return;
+            }
+        }
+    }
+new_section:
+    if (phys_nb_sections == phys_sections_size) {
+        phys_sections_size = phys_sections_size ? phys_sections_size * 2 : 64;
+        phys_sections = g_renew(PhysSection, phys_sections,
+                                phys_sections_size);
+    }
+    s = &phys_sections[phys_nb_sections++];
+    s->start = index;
+    s->nb_pages = 1;
+    s->phys_offset = pd->phys_offset;
+    s->region_offset = pd->region_offset;
+    s->flags = 0;
+}
+
+static void phys_dispatch_rebuild(void)
+{
+    int i, b;
+
+    phys_nb_sections = 0;
+    phys_page_for_each(phys_dispatch_add);
+
+    i = 0;
+    for (b = 0; b < PHYS_NB_BUCKETS; b++) {
+        hwaddr start = (hwaddr)b << PHYS_BUCKET_SHIFT;
+
+        while (i < phys_nb_sections &&
+               phys_sections[i].start + phys_sections[i].nb_pages <= start) {
+            i++;
+        }
+        phys_bucket[b] = i;
+    }
+    phys_bucket[PHYS_NB_BUCKETS] = phys_nb_sections;
+
+    for (i = 0; i < PHYS_CACHE_SIZE; i++) {
+        phys_cache[i].index = (hwaddr)-1;
+    }
+    phys_dispatch_dirty = false;
+    phys_dispatch_rebuild_count++;
+}
+
+static const PhysSection *phys_section_find(hwaddr index)
+{
+    int b = index >> PHYS_BUCKET_SHIFT;
+    int lo = phys_bucket[b];
+    int hi = phys_bucket[b + 1];
+
+    /* The section at phys_bucket[b + 1] may start in bucket b.  */
+    if (hi == phys_nb_sections) {
+        hi--;
+    }
+    while (lo <= hi) {
+        int mid = (lo + hi) / 2;
+        const PhysSection *s = &phys_sections[mid];
+
+        if (index < s->start) {
+            hi = mid - 1;
+        } else if (index - s->start >= s->nb_pages) {
+            lo = mid + 1;
+        } else {
+            return s;
+        }
+    }
+    return NULL;
+}
+
+void phys_page_lookup(hwaddr index, PhysPageDesc *pd)
+{
+    hwaddr masked = index & (((hwaddr)1 << PHYS_INDEX_BITS) - 1);
+    unsigned int h = masked & (PHYS_CACHE_SIZE - 1);
+    const PhysSection *s;
+    ram_addr_t delta;
+
+    if (unlikely(phys_dispatch_dirty)) {
+        phys_dispatch_rebuild();
+    }
+    if (likely(phys_cache[h].index == masked)) {
+        *pd = phys_cache[h].desc;
+        return;
+    }
+    s = phys_section_find(masked);
+    if (!s) {
+        pd->phys_offset = IO_MEM_UNASSIGNED;
+        pd->region_offset = index << TARGET_PAGE_BITS;
+        return;
+    }
+    delta = (ram_addr_t)(masked - s->start) << TARGET_PAGE_BITS;
+    pd->phys_offset = s->phys_offset;
+    if (s->flags & PHYS_SECTION_STEP_PHYS) {
+        pd->phys_offset += delta;
+    }
+    pd->region_offset = s->region_offset;
+    if (s->flags & PHYS_SECTION_STEP_REGION) {
+        pd->region_offset += delta;
+    }
+    if ((pd->phys_offset & ~TARGET_PAGE_MASK) > IO_MEM_ROM) {
+        phys_cache[h].index = masked;
+        phys_cache[h].desc = *pd;
+    }
+}
+
+int phys_dispatch_nb_sections(void)
+{
+    if (phys_dispatch_dirty) {
+        phys_dispatch_rebuild();
+    }
+    return phys_nb_sections;
+}
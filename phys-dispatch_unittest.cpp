@@ -0,0 +1,258 @@
+/* Copyright (C) 2014 The Android Open Source Project
+**
+** This software is licensed under the terms of the GNU General Public
+** License version 2, as published by the Free Software Foundation, and
+** may be copied, distributed, and modified under those terms.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+*/
+#include <gtest/gtest.h>
+
+#include <stdio.h>
+#include <time.h>
+
+#include <vector>
+
+// The QEMU headers include C library headers, which must not end up in
+// the extern "C" block when first seen.
+
+extern "C" {
+#include "config.h"
+#include "qemu-common.h"
+#define NO_CPU_IO_DEFS
+#include "cpu.h"
+#include "exec/exec-all.h"
+#include "translate-all.h"
+}
+
+// These tests register the physical memory map of the ARM goldfish board
+// in the radix tree of phys-dispatch.c, the way
+// cpu_register_physical_memory_log() does, then check that the flat
+// dispatch table gives the same answers, including after a remap.
+
+namespace {
+
+// The lookup that the flat table replaced.
+void radixLookup(hwaddr index, PhysPageDesc* pd) {
+    PhysPageDesc* p = phys_page_find_alloc(index, 0);
+    if (p) {
+        *pd = *p;
+    } else {
+        pd->phys_offset = IO_MEM_UNASSIGNED;
+        pd->region_offset = index << TARGET_PAGE_BITS;
+    }
+}
+
+// Same as cpu_register_physical_memory_log() without subpages.
+void registerMemory(hwaddr start, hwaddr size, ram_addr_t phys_offset,
+                    ram_addr_t region_offset = 0) {
+    if (phys_offset == IO_MEM_UNASSIGNED) {
+        region_offset = start;
+    }
+    for (hwaddr addr = start; addr < start + size;
+         addr += TARGET_PAGE_SIZE) {
+        PhysPageDesc* p = phys_page_find_alloc(addr >> TARGET_PAGE_BITS, 1);
+        p->phys_offset = phys_offset;
+        p->region_offset = region_offset;
+        if ((phys_offset & ~TARGET_PAGE_MASK) <= IO_MEM_ROM) {
+            phys_offset += TARGET_PAGE_SIZE;
+        }
+        region_offset += TARGET_PAGE_SIZE;
+    }
+    phys_dispatch_invalidate();
+}
+
+void expectMapping(hwaddr addr, ram_addr_t phys_offset,
+                   ram_addr_t region_offset) {
+    PhysPageDesc pd;
+    phys_page_lookup(addr >> TARGET_PAGE_BITS, &pd);
+    EXPECT_EQ(phys_offset, pd.phys_offset) << "at 0x" << std::hex << addr;
+    EXPECT_EQ(region_offset, pd.region_offset) << "at 0x" << std::hex << addr;
+}
+
+const hwaddr kRamSize = 512 << 20;
+const hwaddr kTimerBase = 0xff003000;
+const hwaddr kPipeBase = 0xff016000;
+
+ram_addr_t ioIndex(int n) {
+    return (ram_addr_t)(n + 5) << IO_MEM_SHIFT;
+}
+
+// Register the memory map of hw/android/android_arm.c: RAM at 0, the
+// fixed goldfish devices from 0xff000000, and the dynamically placed
+// ones (framebuffer, ttys, events, nand, battery, pipe...) from
+// 0xff010000.
+void setupGoldfishMap() {
+    static bool done;
+    if (done) {
+        return;
+    }
+    done = true;
+    registerMemory(0, kRamSize, IO_MEM_RAM);
+    int n = 0;
+    for (hwaddr base = 0xff000000; base < 0xff006000; base += 0x1000) {
+        registerMemory(base, 0x1000, ioIndex(n++));
+    }
+    for (hwaddr base = 0xff010000; base < 0xff018000; base += 0x1000) {
+        registerMemory(base, 0x1000, ioIndex(n++));
+    }
+}
+
+std::vector<hwaddr> mmioStorm(size_t count) {
+    // Mostly goldfish timer and pipe register accesses, as done by a guest
+    // that polls the clock and talks to the pipe, with some RAM accesses
+    // for the buffers the pipe reads and writes.
+    std::vector<hwaddr> result;
+    uint32_t state = 1;
+    for (size_t n = 0; n < count; ++n) {
+        state = state * 1103515245U + 12345U;
+        unsigned r = state >> 16;
+        hwaddr addr;
+        switch (r % 4) {
+        case 0:
+        case 1:
+            addr = kTimerBase + (r & 0xc);
+            break;
+        case 2:
+            addr = kPipeBase + (r & 0x7c);
+            break;
+        default:
+            addr = (static_cast<hwaddr>(state) * 4096) % kRamSize;
+            break;
+        }
+        result.push_back(addr >> TARGET_PAGE_BITS);
+    }
+    return result;
+}
+
+}  // namespace
+
+TEST(phys_dispatch, matches_radix_tree) {
+    setupGoldfishMap();
+
+    const hwaddr kMaxIndex = (hwaddr)1 << (32 - TARGET_PAGE_BITS);
+    const hwaddr kStep = 7;
+    for (hwaddr index = 0; index < kMaxIndex; index += kStep) {
+        PhysPageDesc expected, actual;
+        radixLookup(index, &expected);
+        phys_page_lookup(index, &actual);
+        ASSERT_EQ(expected.phys_offset, actual.phys_offset)
+                << "page 0x" << std::hex << index;
+        ASSERT_EQ(expected.region_offset, actual.region_offset)
+                << "page 0x" << std::hex << index;
+    }
+    for (hwaddr index = 0xff000000 >> TARGET_PAGE_BITS;
+         index < kMaxIndex; index++) {
+        PhysPageDesc expected, actual;
+        radixLookup(index, &expected);
+        phys_page_lookup(index, &actual);
+        ASSERT_EQ(expected.phys_offset, actual.phys_offset)
+                << "page 0x" << std::hex << index;
+        ASSERT_EQ(expected.region_offset, actual.region_offset)
+                << "page 0x" << std::hex << index;
+    }
+    EXPECT_GT(phys_dispatch_nb_sections(), 0);
+}
+
+TEST(phys_dispatch, remap) {
+    setupGoldfishMap();
+
+    // An unused page above the goldfish devices.
+    const hwaddr kBase = 0xff100000;
+    const ram_addr_t kRomOffset = kRamSize;
+
+    registerMemory(kBase, 2 * TARGET_PAGE_SIZE, ioIndex(40));
+    expectMapping(kBase, ioIndex(40), 0);
+    expectMapping(kBase + TARGET_PAGE_SIZE, ioIndex(40), TARGET_PAGE_SIZE);
+    // The I/O pages are now in the cache of the flat table.
+    expectMapping(kBase, ioIndex(40), 0);
+
+    // Another device.
+    registerMemory(kBase, TARGET_PAGE_SIZE, ioIndex(41), 0x100);
+    expectMapping(kBase, ioIndex(41), 0x100);
+    expectMapping(kBase + TARGET_PAGE_SIZE, ioIndex(40), TARGET_PAGE_SIZE);
+
+    // ROM pages, which advance by one page per page.
+    registerMemory(kBase, 2 * TARGET_PAGE_SIZE, kRomOffset | IO_MEM_ROM);
+    expectMapping(kBase, kRomOffset | IO_MEM_ROM, 0);
+    expectMapping(kBase + TARGET_PAGE_SIZE,
+                  (kRomOffset + TARGET_PAGE_SIZE) | IO_MEM_ROM,
+                  TARGET_PAGE_SIZE);
+
+    // And back to unassigned, as if never registered.
+    registerMemory(kBase, 2 * TARGET_PAGE_SIZE, IO_MEM_UNASSIGNED);
+    expectMapping(kBase, IO_MEM_UNASSIGNED, kBase);
+    expectMapping(kBase + TARGET_PAGE_SIZE, IO_MEM_UNASSIGNED,
+                  kBase + TARGET_PAGE_SIZE);
+
+    // The rest of the map is unchanged.
+    expectMapping(kTimerBase, ioIndex(3), 0);
+    expectMapping(kRamSize - TARGET_PAGE_SIZE,
+                  (kRamSize - TARGET_PAGE_SIZE) | IO_MEM_RAM,
+                  kRamSize - TARGET_PAGE_SIZE);
+}
+
+TEST(phys_dispatch, rebuilds_once_per_change) {
+    setupGoldfishMap();
+
+    PhysPageDesc pd;
+    phys_page_lookup(0, &pd);
+    const int count = phys_dispatch_rebuild_count;
+    phys_page_lookup(kTimerBase >> TARGET_PAGE_BITS, &pd);
+    phys_page_lookup(kPipeBase >> TARGET_PAGE_BITS, &pd);
+    EXPECT_EQ(count, phys_dispatch_rebuild_count);
+
+    registerMemory(kPipeBase, TARGET_PAGE_SIZE, ioIndex(42));
+    EXPECT_EQ(count, phys_dispatch_rebuild_count);
+    expectMapping(kPipeBase, ioIndex(42), 0);
+    expectMapping(kTimerBase, ioIndex(3), 0);
+    EXPECT_EQ(count + 1, phys_dispatch_rebuild_count);
+
+    // Restore the pipe for the other tests.
+    registerMemory(kPipeBase, TARGET_PAGE_SIZE, ioIndex(12));
+    expectMapping(kPipeBase, ioIndex(12), 0);
+}
+
+// Not a pass/fail test: reports the cost of both lookups for an MMIO
+// storm against the goldfish timer and pipe registers. Run it with
+// --gtest_also_run_disabled_tests.
+TEST(phys_dispatch, DISABLED_mmio_storm_benchmark) {
+    setupGoldfishMap();
+
+    const std::vector<hwaddr> pages = mmioStorm(1 << 20);
+    const int kRounds = 8;
+    ram_addr_t radixSum = 0, flatSum = 0;
+    PhysPageDesc pd;
+
+    phys_page_lookup(0, &pd);  // rebuild the table outside of the timing
+
+    clock_t start = clock();
+    for (int round = 0; round < kRounds; ++round) {
+        for (size_t n = 0; n < pages.size(); ++n) {
+            radixLookup(pages[n], &pd);
+            radixSum += pd.phys_offset + pd.region_offset;
+        }
+    }
+    clock_t radixTime = clock() - start;
+
+    start = clock();
+    for (int round = 0; round < kRounds; ++round) {
+        for (size_t n = 0; n < pages.size(); ++n) {
+            phys_page_lookup(pages[n], &pd);
+            flatSum += pd.phys_offset + pd.region_offset;
+        }
+    }
+    clock_t flatTime = clock() - start;
+
+    EXPECT_EQ(radixSum, flatSum);
+
+    const double lookups = static_cast<double>(pages.size()) * kRounds;
+    printf("MMIO storm, %.0f lookups: radix tree %.2f ns/lookup, "
+           "flat table %.2f ns/lookup\n",
+           lookups,
+           radixTime * 1e9 / CLOCKS_PER_SEC / lookups,
+           flatTime * 1e9 / CLOCKS_PER_SEC / lookups);
+}
@@ -18,6 +18,7 @@
 #include "android/utils/misc.h"
 #include "android/utils/system.h"
 #include "android/iolooper.h"
+#include <stddef.h>
 #include <stdlib.h>
 
 int  proxy_log = 0;
@@ -74,6 +75,10 @@ proxy_connection_init( ProxyConnection*           conn,
     conn->conn_select = conn_select;
     conn->conn_poll   = conn_poll;
 
+    conn->sel->count       = 0;
+    conn->sel->ready_fd    = -1;
+    conn->sel->ready_flags = 0;
+
     socket_set_nonblock(socket);
 
     {
@@ -92,9 +97,12 @@ proxy_connection_init( ProxyConnection*           conn,
     conn->str_pos = 0;
 }
 
+static void  proxy_select_done( ProxySelect*  sel );
+
 void
 proxy_connection_done( ProxyConnection*  conn )
 {
+    proxy_select_done( conn->sel );
     stralloc_reset( conn->str );
     if (conn->socket >= 0) {
         socket_close(conn->socket);
@@ -227,6 +235,164 @@ proxy_connection_receive_line( ProxyConnection*  conn, int  fd )
     }
 }
 
+void
+proxy_input_init( ProxyInput*  in )
+{
+    in->buf->s = NULL;
+    in->buf->n = 0;
+    in->buf->a = 0;
+    in->pos    = 0;
+}
+
+void
+proxy_input_done( ProxyInput*  in )
+{
+    stralloc_reset(in->buf);
+    in->pos = 0;
+}
+
+/* size of each socket read performed through a ProxyInput */
+#define  PROXY_INPUT_CHUNK     4096
+
+/* maximum length of a single line, to avoid buffering garbage forever */
+#define  PROXY_INPUT_MAX_LINE  65536
+
+/* read more data into 'in', returns DATA_COMPLETED if something was read */
+static DataStatus
+proxy_input_fill( ProxyConnection*  conn, ProxyInput*  in, int  fd )
+{
+    stralloc_t*  buf = in->buf;
+    int          n;
+
+    /* move the unconsumed bytes to the start of the buffer */
+    if (in->pos > 0) {
+        memmove(buf->s, buf->s + in->pos, buf->n - in->pos);
+        buf->n -= in->pos;
+        in->pos = 0;
+    }
+
+    stralloc_readyplus(buf, PROXY_INPUT_CHUNK);
+    n = socket_recv(fd, buf->s + buf->n, PROXY_INPUT_CHUNK);
+    if (n == 0) {
+        PROXY_LOG("%s: disconnected from peer", conn->name);
+        return DATA_ERROR;
+    }
+    if (n < 0) {
+        if (errno == EWOULDBLOCK || errno == EAGAIN)
+            return DATA_NEED_MORE;
+
+        PROXY_LOG("%s: error: %s", conn->name, errno_str);
+        return DATA_ERROR;
+    }
+
+    if (proxy_log) {
+        PROXY_LOG("%s: buffered %d bytes:", conn->name, n );
+        hex_dump( buf->s + buf->n, n, "<< " );
+    }
+    buf->n += n;
+    return DATA_COMPLETED;
+}
+
+DataStatus
+proxy_connection_receive_line_buffered( ProxyConnection*  conn,
+                                        ProxyInput*       in,
+                                        int               fd )
+{
+    stralloc_t*  str = conn->str;
+    stralloc_t*  buf = in->buf;
+
+    for (;;) {
+        int    avail = buf->n - in->pos;
+        char*  start = buf->s + in->pos;
+        char*  eol   = avail > 0 ? memchr(start, '\n', avail) : NULL;
+
+        if (eol != NULL) {
+            int  len = eol - start;
+
+            in->pos += len + 1;
+            if (len > 0 && start[len-1] == '\r')
+                len -= 1;
+
+            stralloc_add_bytes(str, start, len);
+            stralloc_cstr(str);
+
+            PROXY_LOG("%s: received '%s'", conn->name,
+                      quote_bytes(str->s, str->n));
+            return DATA_COMPLETED;
+        }
+
+        if (avail >= PROXY_INPUT_MAX_LINE) {
+            PROXY_LOG("%s: line too long", conn->name);
+            return DATA_ERROR;
+        }
+
+        {
+            DataStatus  ret = proxy_input_fill(conn, in, fd);
+            if (ret != DATA_COMPLETED)
+                return ret;
+        }
+    }
+}
+
+DataStatus
+proxy_connection_receive_buffered( ProxyConnection*  conn,
+                                   ProxyInput*       in,
+                                   int               fd,
+                                   int               wanted )
+{
+    int  avail = in->buf->n - in->pos;
+
+    if (avail > 0) {
+        stralloc_t*  str = conn->str;
+
+        if (avail > wanted)
+            avail = wanted;
+
+        stralloc_add_bytes(str, in->buf->s + in->pos, avail);
+        in->pos += avail;
+        if (in->pos == in->buf->n)
+            in->buf->n = in->pos = 0;
+
+        conn->str_recv = avail;
+        if (avail == wanted)
+            return DATA_COMPLETED;
+
+        /* the buffer is empty now, read the rest directly */
+        {
+            DataStatus  ret = proxy_connection_receive(conn, fd, wanted - avail);
+            conn->str_recv += avail;
+            return ret;
+        }
+    }
+    return proxy_connection_receive(conn, fd, wanted);
+}
+
+int
+proxy_header_has_token( const char*  value, const char*  token )
+{
+    int  token_len = strlen(token);
+
+    while (*value) {
+        const char*  end;
+        int          len;
+
+        value += strspn(value, " \t,");
+        end    = strchr(value, ',');
+        if (end == NULL)
+            end = value + strlen(value);
+
+        len = end - value;
+        while (len > 0 && (value[len-1] == ' ' || value[len-1] == '\t'))
+            len--;
+
+        if (len == token_len && !strncasecmp(value, token, len))
+            return 1;
+
+        value = end;
+    }
+    return 0;
+}
+
 static void
 proxy_connection_insert( ProxyConnection*  conn, ProxyConnection*  after )
 {
@@ -236,9 +402,15 @@ proxy_connection_insert( ProxyConnection*  conn, ProxyConnection*  after )
     conn->prev        = after;
 }
 
+/* the connection whose conn_poll method is currently running, if any */
+static ProxyConnection*  s_polled;
+
 static void
 proxy_connection_remove( ProxyConnection*  conn )
 {
+    if (conn == s_polled)
+        s_polled = NULL;
+
     conn->prev->next = conn->next;
     conn->next->prev = conn->prev;
 
@@ -253,8 +425,10 @@ proxy_connection_remove( ProxyConnection*  conn )
 static  ProxyService*  s_services[ MAX_SERVICES ];
 static  int            s_num_services;
 static  int            s_init;
+static  Looper*        s_looper;
 
 static void  proxy_manager_atexit( void );
+static void  proxy_connection_select( ProxyConnection*  conn );
 
 static void
 proxy_manager_init(void)
@@ -266,6 +440,18 @@ proxy_manager_init(void)
 }
 
 
+/* all proxified connections are driven by the core event loop,
+ * the looper is only created on first use */
+Looper*
+proxy_get_looper( void )
+{
+    if (!s_looper)
+        s_looper = looper_newCore();
+
+    return s_looper;
+}
+
+
 extern int
 proxy_manager_add_service( ProxyService*  service )
 {
@@ -314,6 +500,9 @@ proxy_connection_free( ProxyConnection*  conn,
 
         proxy_connection_remove(conn);
 
+        /* stop watching the socket before it is handed to slirp */
+        proxy_select_done(conn->sel);
+
         if (event != PROXY_EVENT_NONE)
             conn->ev_func( conn->ev_opaque, fd, event );
 
@@ -346,6 +535,7 @@ proxy_manager_add( SockAddress*    address,
             conn->ev_func   = ev_func;
             conn->ev_opaque = ev_opaque;
             proxy_connection_insert(conn, s_connections->prev);
+            proxy_connection_select(conn);
             return 0;
         }
     }
@@ -370,90 +560,119 @@ proxy_manager_del( void*  ev_opaque )
     }
 }
 
+static void
+proxy_select_io_func( void*  opaque, int  fd, unsigned  events )
+{
+    ProxySelectIo*    sio  = opaque;
+    ProxyConnection*  conn = sio->conn;
+    ProxySelect*      sel  = conn->sel;
+    unsigned          flags = 0;
+
+    if (events & LOOP_IO_READ)
+        flags |= PROXY_SELECT_READ;
+    if (events & LOOP_IO_WRITE)
+        flags |= PROXY_SELECT_WRITE;
+
+    sel->ready_fd    = fd;
+    sel->ready_flags = flags;
+
+    /* conn_poll() may free the connection, in which case
+     * proxy_connection_remove() clears s_polled */
+    s_polled = conn;
+    conn->conn_poll(conn, sel);
+
+    if (s_polled == conn) {
+        sel->ready_fd    = -1;
+        sel->ready_flags = 0;
+        proxy_connection_select(conn);
+    }
+    s_polled = NULL;
+}
+
+static void
+proxy_select_done( ProxySelect*  sel )
+{
+    int  n;
+
+    for (n = 0; n < sel->count; n++)
+        loopIo_done(sel->ios[n].io);
+
+    sel->count = 0;
+}
+
 void
 proxy_select_set( ProxySelect*  sel,
                   int           fd,
                   unsigned      flags )
 {
+    ProxySelectIo*  sio;
+    int             n;
+
     if (fd < 0 || !flags)
         return;
 
-    if (*sel->pcount < fd+1)
-        *sel->pcount = fd+1;
-
-    if (flags & PROXY_SELECT_READ) {
-        FD_SET( fd, sel->reads );
-    } else {
-        FD_CLR( fd, sel->reads );
-    }
-    if (flags & PROXY_SELECT_WRITE) {
-        FD_SET( fd, sel->writes );
-    } else {
-        FD_CLR( fd, sel->writes );
+    for (n = 0; n < sel->count; n++) {
+        sio = &sel->ios[n];
+        if (sio->fd == fd) {
+            sio->wanted |= flags;
+            return;
+        }
     }
-    if (flags & PROXY_SELECT_ERROR) {
-        FD_SET( fd, sel->errors );
-    } else {
-        FD_CLR( fd, sel->errors );
+
+    if (sel->count >= PROXY_SELECT_MAX_IOS) {
+        PROXY_LOG("%s: too many descriptors, ignoring %d", __FUNCTION__, fd);
+        return;
     }
+
+    /* sel is always embedded in its ProxyConnection */
+    sio = &sel->ios[sel->count++];
+    sio->conn   = (ProxyConnection*)((char*)sel - offsetof(ProxyConnection, sel));
+    sio->fd     = fd;
+    sio->wanted = flags;
+    sio->armed  = 0;
+    loopIo_init(sio->io, proxy_get_looper(), fd, proxy_select_io_func, sio);
 }
 
 unsigned
 proxy_select_poll( ProxySelect*  sel, int  fd )
 {
-    unsigned  flags = 0;
+    if (fd < 0 || fd != sel->ready_fd)
+        return 0;
 
-    if (fd >= 0) {
-        if ( FD_ISSET(fd, sel->reads) )
-            flags |= PROXY_SELECT_READ;
-        if ( FD_ISSET(fd, sel->writes) )
-            flags |= PROXY_SELECT_WRITE;
-        if ( FD_ISSET(fd, sel->errors) )
-            flags |= PROXY_SELECT_ERROR;
-    }
-    return flags;
+    return sel->ready_flags;
 }
 
-/* this function is called to update the select file descriptor sets
- * with those of the proxified connection sockets that are currently managed */
-void
-proxy_manager_select_fill( int  *pcount, fd_set*  read_fds, fd_set*  write_fds, fd_set*  err_fds)
+/* ask the connection which events it wants, and update its looper
+ * watchers accordingly */
+static void
+proxy_connection_select( ProxyConnection*  conn )
 {
-    ProxyConnection*  conn;
-    ProxySelect       sel[1];
+    ProxySelect*  sel = conn->sel;
+    int           n;
 
-    if (!s_init)
-        proxy_manager_init();
+    for (n = 0; n < sel->count; n++)
+        sel->ios[n].wanted = 0;
 
-    sel->pcount = pcount;
-    sel->reads  = read_fds;
-    sel->writes = write_fds;
-    sel->errors = err_fds;
+    conn->conn_select(conn, sel);
 
-    conn = s_connections->next;
-    while (conn != s_connections) {
-        ProxyConnection*  next = conn->next;
-        conn->conn_select(conn, sel);
-        conn = next;
-    }
-}
-
-/* this function is called to act on proxified connection sockets when network events arrive */
-void
-proxy_manager_poll( fd_set*  read_fds, fd_set*  write_fds, fd_set*  err_fds )
-{
-    ProxyConnection*  conn = s_connections->next;
-    ProxySelect       sel[1];
+    for (n = 0; n < sel->count; n++) {
+        ProxySelectIo*  sio     = &sel->ios[n];
+        unsigned        changed = sio->wanted ^ sio->armed;
 
-    sel->pcount = NULL;
-    sel->reads  = read_fds;
-    sel->writes = write_fds;
-    sel->errors = err_fds;
-
-    while (conn != s_connections) {
-        ProxyConnection*  next  = conn->next;
-        conn->conn_poll( conn, sel );
-        conn = next;
+        if (changed & PROXY_SELECT_READ) {
+            if (sio->wanted & PROXY_SELECT_READ)
+                loopIo_wantRead(sio->io);
+            else
+                loopIo_dontWantRead(sio->io);
+        }
+        /* errors are reported by the looper as write events */
+        if (changed & (PROXY_SELECT_WRITE|PROXY_SELECT_ERROR)) {
+            if (sio->wanted & (PROXY_SELECT_WRITE|PROXY_SELECT_ERROR))
+                loopIo_wantWrite(sio->io);
+            else
+                loopIo_dontWantWrite(sio->io);
+        }
+        sio->armed = sio->wanted;
     }
 }
 
@@ -22,12 +22,86 @@ static void
 http_service_free( HttpService*  service )
 {
     PROXY_LOG("%s", __FUNCTION__);
+    while (service->pool_count > 0)
+        socket_close(service->pool[--service->pool_count].socket);
+
     if (service->footer != service->footer0)
         g_free(service->footer);
     g_free(service);
 }
 
 
+/* drop the first 'count' entries of the pool, i.e. the oldest ones */
+static void
+http_service_drop_sockets( HttpService*  service, int  count )
+{
+    int  n;
+
+    for (n = 0; n < count; n++)
+        socket_close(service->pool[n].socket);
+
+    service->pool_count -= count;
+    memmove(service->pool, service->pool + count,
+            service->pool_count * sizeof(service->pool[0]));
+}
+
+/* close the pooled sockets that have been idle for too long */
+static void
+http_service_expire_sockets( HttpService*  service, Duration  now )
+{
+    int  n = 0;
+
+    while (n < service->pool_count &&
+           now - service->pool[n].idle_since >= HTTP_POOL_IDLE_TIMEOUT)
+        n++;
+
+    if (n > 0) {
+        PROXY_LOG("%s: closing %d expired connection(s)", __FUNCTION__, n);
+        http_service_drop_sockets(service, n);
+    }
+}
+
+int
+http_service_get_socket( HttpService*  service )
+{
+    http_service_expire_sockets(service, looper_now(proxy_get_looper()));
+
+    /* the most recently used socket is the most likely to be alive */
+    while (service->pool_count > 0) {
+        int   fd = service->pool[--service->pool_count].socket;
+        char  c;
+
+        /* an idle connection has nothing to read, anything else means
+         * the proxy closed it, or sent an error (e.g. a 408) */
+        if (socket_recv(fd, &c, 1) < 0 &&
+            (errno == EWOULDBLOCK || errno == EAGAIN))
+        {
+            PROXY_LOG("%s: reusing connection %d", __FUNCTION__, fd);
+            return fd;
+        }
+        PROXY_LOG("%s: connection %d was closed by proxy", __FUNCTION__, fd);
+        socket_close(fd);
+    }
+    return -1;
+}
+
+void
+http_service_put_socket( HttpService*  service, int  socket )
+{
+    Duration  now = looper_now(proxy_get_looper());
+
+    http_service_expire_sockets(service, now);
+
+    if (service->pool_count == HTTP_POOL_MAX_SOCKETS)
+        http_service_drop_sockets(service, 1);
+
+    PROXY_LOG("%s: keeping connection %d", __FUNCTION__, socket);
+    service->pool[service->pool_count].socket     = socket;
+    service->pool[service->pool_count].idle_since = now;
+    service->pool_count++;
+}
+
+
 static ProxyConnection*
 http_service_connect( HttpService*  service,
                       SocketType    sock_type,
@@ -49,7 +123,7 @@ http_service_connect( HttpService*  service,
         PROXY_LOG("%s: using HTTP rewriter", __FUNCTION__);
         return http_rewriter_connect(service, address);
     } else {
-        PROXY_LOG("%s: using HTTP rewriter", __FUNCTION__);
+        PROXY_LOG("%s: using HTTP connector", __FUNCTION__);
         return http_connector_connect(service, address);
     }
 }
@@ -32,6 +32,7 @@ typedef enum {
 typedef struct Connection {
     ProxyConnection  root[1];
     ConnectorState   state;
+    char             pooled;  /* socket comes from the service's pool */
 } Connection;
 
 
@@ -59,7 +60,12 @@ connection_init( Connection*  conn )
 
     stralloc_add_bytes(str, service->footer, service->footer_len);
 
-    if (!socket_connect( root->socket, &service->server_addr )) {
+    if (conn->pooled) {
+        /* an idle keep-alive connection accepts a CONNECT as well */
+        conn->state = STATE_SEND_HEADER;
+        PROXY_LOG("%s: reusing connection to proxy", root->name);
+    }
+    else if (!socket_connect( root->socket, &service->server_addr )) {
         /* immediate connection ?? */
         conn->state = STATE_SEND_HEADER;
         PROXY_LOG("%s: immediate connection", root->name);
@@ -183,16 +189,22 @@ http_connector_connect( HttpService*  service,
 {
     Connection*  conn;
     int          s;
-
-    s = socket_create_inet( SOCKET_STREAM );
-    if (s < 0)
-        return NULL;
+    int          pooled = 1;
+
+    s = http_service_get_socket( service );
+    if (s < 0) {
+        s = socket_create_inet( SOCKET_STREAM );
+        if (s < 0)
+            return NULL;
+        pooled = 0;
+    }
 
     conn = g_malloc0(sizeof(*conn));
     if (conn == NULL) {
         socket_close(s);
         return NULL;
     }
+    conn->pooled = pooled;
 
     proxy_connection_init( conn->root, s, address, service->root,
                            connection_free,
@@ -15,6 +15,18 @@
 #include "proxy_http.h"
 #include "proxy_int.h"
 
+/* maximum number of idle keep-alive connections to the proxy server */
+#define  HTTP_POOL_MAX_SOCKETS    8
+
+/* idle connections older than this are closed instead of being reused,
+ * most proxies drop them after a similar delay anyway */
+#define  HTTP_POOL_IDLE_TIMEOUT   30000  /* in milliseconds */
+
+typedef struct {
+    int        socket;
+    Duration   idle_since;
+} HttpPoolEntry;
+
 /* the HttpService object */
 typedef struct HttpService {
     ProxyService        root[1];
@@ -22,8 +34,18 @@ typedef struct HttpService {
     char*               footer;      /* the footer contains the static parts of the */
     int                 footer_len;  /* connection header, we generate it only once */
     char                footer0[512];
+    HttpPoolEntry       pool[HTTP_POOL_MAX_SOCKETS];  /* oldest first */
+    int                 pool_count;
 } HttpService;
 
+/* return an idle socket connected to the proxy server, that was
+ * released by a previous connection, or -1 if there is none */
+extern int   http_service_get_socket( HttpService*  service );
+
+/* give back a socket connected to the proxy server once a complete
+ * reply was received on it. the socket is closed if the pool is full */
+extern void  http_service_put_socket( HttpService*  service, int  socket );
+
 /* create a CONNECT connection (for port != 80) */
 extern ProxyConnection*  http_connector_connect(
                                 HttpService*   service,
@@ -41,6 +41,15 @@
  * this sounds all easy, but the rules for computing the
  * sizes of HTTP Message Bodies makes the implementation
  * a *bit* funky.
+ *
+ * both sides are read through a ProxyInput buffer, so that the
+ * bytes following the current message (e.g. a request pipelined
+ * by the client) are kept for the next one.
+ *
+ * when the client closes its connection between two requests,
+ * and the proxy server indicated that it would keep the connection
+ * alive, the socket to the server is given back to the HttpService
+ * pool, to be reused by the next connection.
  */
 
 /* define D_ACTIVE to 1 to dump additionnal debugging
@@ -348,6 +357,11 @@ typedef struct {
     ProxyConnection   root[1];
     int               slirp_fd;
     ConnectionState   state;
+    ProxyInput        slirp_in[1];  /* buffered input from slirp_fd */
+    ProxyInput        proxy_in[1];  /* buffered input from root->socket */
+    char              pooled;       /* root->socket comes from the pool */
+    char              keep_alive;   /* proxy keeps root->socket opened */
+    char              request_keep_alive;
     HttpRequest*      request;
     BodyMode          body_mode;
     int64_t           body_length;
@@ -369,15 +383,33 @@ rewrite_connection_free( ProxyConnection*  root )
 {
     RewriteConnection*  conn = (RewriteConnection*)root;
 
+    /* if the client disconnected between two requests, the connection
+     * to the proxy server is idle and can be reused by someone else */
+    if (root->socket >= 0 && conn->keep_alive &&
+        conn->state == STATE_REQUEST_FIRST_LINE &&
+        PROXY_INPUT_AVAIL(conn->proxy_in) == 0)
+    {
+        http_service_put_socket((HttpService*)root->service, root->socket);
+        root->socket = -1;
+    }
+    proxy_connection_done(root);
+
     if (conn->slirp_fd >= 0) {
         socket_close(conn->slirp_fd);
         conn->slirp_fd = -1;
     }
     http_request_free(conn->request);
-    proxy_connection_done(root);
+    proxy_input_done(conn->slirp_in);
+    proxy_input_done(conn->proxy_in);
     g_free(conn);
 }
 
+static ProxyInput*
+rewrite_connection_input( RewriteConnection*  conn, int  fd )
+{
+    return (fd == conn->slirp_fd) ? conn->slirp_in : conn->proxy_in;
+}
+
 
 static int
 rewrite_connection_init( RewriteConnection*   conn )
@@ -385,10 +417,17 @@ rewrite_connection_init( RewriteConnection*   conn )
     HttpService*      service = (HttpService*) conn->root->service;
     ProxyConnection*  root    = conn->root;
 
-    conn->slirp_fd = -1;
-    conn->state    = STATE_CONNECTING;
+    conn->slirp_fd   = -1;
+    conn->state      = STATE_CONNECTING;
+    conn->keep_alive = 1;
+    proxy_input_init(conn->slirp_in);
+    proxy_input_init(conn->proxy_in);
 
-    if (socket_connect( root->socket, &service->server_addr ) < 0) {
+    if (conn->pooled) {
+        PROXY_LOG("%s: reusing connection to proxy", root->name);
+        conn->state = STATE_CREATE_SOCKET_PAIR;
+    }
+    else if (socket_connect( root->socket, &service->server_addr ) < 0) {
         if (errno == EINPROGRESS || errno == EWOULDBLOCK || errno == EAGAIN) {
             PROXY_LOG("%s: connecting", conn->root->name);
         }
@@ -431,7 +470,16 @@ rewrite_connection_read_request( RewriteConnection*  conn )
     ProxyConnection*  root = conn->root;
     DataStatus        ret;
 
-    ret = proxy_connection_receive_line(root, conn->slirp_fd);
+    for (;;) {
+        ret = proxy_connection_receive_line_buffered(root, conn->slirp_in,
+                                                     conn->slirp_fd);
+        if (ret != DATA_COMPLETED || root->str->n > 0)
+            break;
+
+        /* clients may send an extra CRLF after a request body,
+         * it must be ignored before the next request line */
+        proxy_connection_rewind(root);
+    }
     if (ret == DATA_COMPLETED) {
         /* now parse the first line to see if we can handle it */
         char*  line   = root->str->s;
@@ -477,7 +525,8 @@ rewrite_connection_read_reply( RewriteConnection*  conn )
     ProxyConnection*  root = conn->root;
     DataStatus        ret;
 
-    ret = proxy_connection_receive_line( root, root->socket );
+    ret = proxy_connection_receive_line_buffered( root, conn->proxy_in,
+                                                  root->socket );
     if (ret == DATA_COMPLETED) {
         HttpRequest*  request = conn->request;
 
@@ -516,12 +565,13 @@ rewrite_connection_read_headers( RewriteConnection*   conn,
 {
     int               ret;
     ProxyConnection*  root = conn->root;
+    ProxyInput*       in   = rewrite_connection_input(conn, fd);
 
     for (;;) {
         char*        line;
         stralloc_t*  str = root->str;
 
-        ret = proxy_connection_receive_line(root, fd);
+        ret = proxy_connection_receive_line_buffered(root, in, fd);
         if (ret != DATA_COMPLETED)
             break;
 
@@ -559,6 +609,27 @@ rewrite_connection_read_headers( RewriteConnection*   conn,
     return ret;
 }
 
+/* returns 1 if the sender of the message that was just parsed into
+ * 'r' wants the connection to persist after it */
+static int
+http_request_keeps_alive( HttpRequest*  r, const char*  version )
+{
+    char*  connection = http_request_find_header(r, "Proxy-Connection");
+
+    if (!connection)
+        connection = http_request_find_header(r, "Connection");
+
+    /* the header is a list of tokens, e.g. "keep-alive, Upgrade" */
+    if (connection) {
+        if (proxy_header_has_token(connection, "close"))
+            return 0;
+        if (proxy_header_has_token(connection, "keep-alive"))
+            return 1;
+    }
+    /* persistent connections are the default since HTTP/1.1 */
+    return version != NULL && !strcmp(version, "HTTP/1.1");
+}
+
 static int
 rewrite_connection_rewrite_request( RewriteConnection*  conn )
 {
@@ -677,7 +748,7 @@ rewrite_connection_get_body_length( RewriteConnection*  conn,
         if (!connection)
             connection = http_request_find_header(r, "Connection");
 
-        if (!connection || strcasecmp(connection, "Close")) {
+        if (!connection || !proxy_header_has_token(connection, "close")) {
             /* hum, we can't support this at all */
             PROXY_LOG("%s: can't determine content length, and client wants"
                         " to keep connection opened",
@@ -687,7 +758,8 @@ rewrite_connection_get_body_length( RewriteConnection*  conn,
         /* a negative value means that the data ends when the client
          * disconnects the connection.
          */
-        conn->body_mode = BODY_UNTIL_CLOSE;
+        conn->body_mode  = BODY_UNTIL_CLOSE;
+        conn->keep_alive = 0;
     }
     D("%s: body_length=%lld body_mode=%s",
       root->name, conn->body_length,
@@ -704,6 +776,7 @@ rewrite_connection_read_body( RewriteConnection*  conn, int  fd )
 {
     ProxyConnection*  root   = conn->root;
     stralloc_t*       str    = root->str;
+    ProxyInput*       in     = rewrite_connection_input(conn, fd);
     int               wanted = 0, current, avail;
     DataStatus        ret;
 
@@ -736,7 +809,7 @@ rewrite_connection_read_body( RewriteConnection*  conn, int  fd )
     case BODY_CHUNKED:
         if (conn->chunk_state == CHUNK_DATA_END) {
             /* We're waiting for the CR LF after the chunk data */
-            ret = proxy_connection_receive_line(root, fd);
+            ret = proxy_connection_receive_line_buffered(root, in, fd);
             if (ret != DATA_COMPLETED)
                 return ret;
 
@@ -766,7 +839,7 @@ rewrite_connection_read_body( RewriteConnection*  conn, int  fd )
                 D("%s: waiting chunk header", root->name);
                 conn->parse_chunk_header = 1;
             }
-            ret = proxy_connection_receive_line(root, fd);
+            ret = proxy_connection_receive_line_buffered(root, in, fd);
             if (ret != DATA_COMPLETED) {
                 return ret;
             }
@@ -840,7 +913,7 @@ rewrite_connection_read_body( RewriteConnection*  conn, int  fd )
     if (wanted > avail)
         wanted = avail;
 
-    ret = proxy_connection_receive(root, fd, wanted);
+    ret = proxy_connection_receive_buffered(root, in, fd, wanted);
     conn->body_has_data = (str->n > 0);
     conn->body_is_full  = (str->n == MAX_BODY_BUFFER);
 
@@ -989,17 +1062,17 @@ rewrite_connection_select( ProxyConnection*  root,
     };
 }
 
-static void
-rewrite_connection_poll( ProxyConnection*  root,
-                         ProxySelect*      sel )
+/* run the state machine once, 'has_slirp' and 'has_proxy' tell
+ * whether an event was reported for the corresponding socket */
+static DataStatus
+rewrite_connection_step( RewriteConnection*  conn,
+                         int                 has_slirp,
+                         int                 has_proxy )
 {
-    RewriteConnection*  conn = (RewriteConnection*)root;
-
-    int         slirp     = conn->slirp_fd;
-    int         proxy     = root->socket;
-    int         has_slirp = proxy_select_poll(sel, slirp);
-    int         has_proxy = proxy_select_poll(sel, proxy);
-    DataStatus  ret       = DATA_NEED_MORE;
+    ProxyConnection*  root  = conn->root;
+    int               slirp = conn->slirp_fd;
+    int               proxy = root->socket;
+    DataStatus        ret   = DATA_NEED_MORE;
 
     switch (conn->state) {
         case STATE_CONNECTING:
@@ -1035,6 +1108,9 @@ rewrite_connection_poll( ProxyConnection*  root,
                 ret = rewrite_connection_read_headers(conn, slirp);
                 if (ret == DATA_COMPLETED) {
                     PROXY_LOG("%s: request headers ok", root->name);
+                    conn->request_keep_alive =
+                        http_request_keeps_alive(conn->request,
+                                                 conn->request->req_version);
                     if (rewrite_connection_rewrite_request(conn) < 0)
                         ret = DATA_ERROR;
                     else
@@ -1091,6 +1167,9 @@ rewrite_connection_poll( ProxyConnection*  root,
                 ret = rewrite_connection_read_headers(conn, proxy);
                 if (ret == DATA_COMPLETED) {
                     PROXY_LOG("%s: reply headers ok", root->name);
+                    conn->keep_alive = conn->request_keep_alive &&
+                        http_request_keeps_alive(conn->request,
+                                                 conn->request->rep_version);
                     if (rewrite_connection_rewrite_reply(conn) < 0)
                         ret = DATA_ERROR;
                     else
@@ -1140,10 +1219,41 @@ rewrite_connection_poll( ProxyConnection*  root,
         default:
             ;
     }
-    if (ret == DATA_ERROR)
-        proxy_connection_free(root, 0, PROXY_EVENT_NONE);
+    return ret;
+}
+
+static void
+rewrite_connection_poll( ProxyConnection*  root,
+                         ProxySelect*      sel )
+{
+    RewriteConnection*  conn      = (RewriteConnection*)root;
+    int                 has_slirp = proxy_select_poll(sel, conn->slirp_fd);
+    int                 has_proxy = proxy_select_poll(sel, root->socket);
 
-    return;
+    /* bytes that are already buffered (e.g. a pipelined request) will
+     * not trigger a new looper event, so run the state machine until
+     * it stops making progress */
+    for (;;) {
+        ConnectionState  state    = conn->state;
+        int              str_n    = root->str->n;
+        int              str_pos  = root->str_pos;
+        int              slirp_in = PROXY_INPUT_AVAIL(conn->slirp_in);
+        int              proxy_in = PROXY_INPUT_AVAIL(conn->proxy_in);
+        DataStatus       ret;
+
+        ret = rewrite_connection_step(conn,
+                                      has_slirp || slirp_in > 0,
+                                      has_proxy || proxy_in > 0);
+        if (ret == DATA_ERROR) {
+            proxy_connection_free(root, 0, PROXY_EVENT_NONE);
+            return;
+        }
+        if (conn->state == state &&
+            root->str->n == str_n && root->str_pos == str_pos &&
+            PROXY_INPUT_AVAIL(conn->slirp_in) == slirp_in &&
+            PROXY_INPUT_AVAIL(conn->proxy_in) == proxy_in)
+            break;
+    }
 }
 
 
@@ -1153,16 +1263,22 @@ http_rewriter_connect( HttpService*  service,
 {
     RewriteConnection*  conn;
     int                 s;
-
-    s = socket_create(address->family, SOCKET_STREAM );
-    if (s < 0)
-        return NULL;
+    int                 pooled = 1;
+
+    s = http_service_get_socket( service );
+    if (s < 0) {
+        s = socket_create(address->family, SOCKET_STREAM );
+        if (s < 0)
+            return NULL;
+        pooled = 0;
+    }
 
     conn = g_malloc0(sizeof(*conn));
     if (conn == NULL) {
         socket_close(s);
         return NULL;
     }
+    conn->pooled = pooled;
 
     proxy_connection_init( conn->root, s, address, service->root,
                            rewrite_connection_free,
@@ -0,0 +1,294 @@
+// Copyright 2014 The Android Open Source Project
+//
+// This software is licensed under the terms of the GNU General Public
+// License version 2, as published by the Free Software Foundation, and
+// may be copied, distributed, and modified under those terms.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+#include <gtest/gtest.h>
+
+#include <string.h>
+
+#include <string>
+
+// The QEMU headers include C library headers, which must not end up in
+// the extern "C" block when first seen.
+
+extern "C" {
+#include "android/looper.h"
+#include "android/sockets.h"
+#include "proxy_http_int.h"
+#include "proxy_int.h"
+}
+
+// proxy/ normally runs on the core Looper of QEMU, a generic one is
+// enough for the timestamps of the keep-alive pool.
+extern "C" Looper* looper_newCore(void) {
+    return looper_newGeneric();
+}
+
+namespace {
+
+// A connected pair of non-blocking sockets, and a ProxyConnection that
+// reads from the first one through a ProxyInput.
+class ProxyInputTest : public ::testing::Test {
+protected:
+    virtual void SetUp() {
+        ASSERT_EQ(0, socket_pair(&mFd, &mPeer));
+        socket_set_nonblock(mFd);
+        memset(&mConn, 0, sizeof(mConn));
+        strcpy(mConn.name, "test");
+        proxy_input_init(mIn);
+    }
+
+    virtual void TearDown() {
+        proxy_input_done(mIn);
+        stralloc_reset(mConn.str);
+        socket_close(mFd);
+        if (mPeer >= 0) {
+            socket_close(mPeer);
+        }
+    }
+
+    void peerSend(const std::string& data) {
+        ASSERT_EQ(static_cast<int>(data.size()),
+                  socket_send(mPeer, data.data(), data.size()));
+    }
+
+    DataStatus receiveLine(std::string* line) {
+        mConn.str->n = 0;
+        DataStatus ret = proxy_connection_receive_line_buffered(&mConn, mIn,
+                                                                mFd);
+        if (ret == DATA_COMPLETED) {
+            line->assign(mConn.str->s, mConn.str->n);
+        }
+        return ret;
+    }
+
+    DataStatus receive(int wanted, std::string* data) {
+        mConn.str->n = 0;
+        DataStatus ret = proxy_connection_receive_buffered(&mConn, mIn, mFd,
+                                                           wanted);
+        data->assign(mConn.str->s, mConn.str->n);
+        return ret;
+    }
+
+    int mFd;
+    int mPeer;
+    ProxyConnection mConn;
+    ProxyInput mIn[1];
+};
+
+}  // namespace
+
+TEST(ProxyHeader, HasToken) {
+    EXPECT_TRUE(proxy_header_has_token("close", "close"));
+    EXPECT_TRUE(proxy_header_has_token("Keep-Alive", "keep-alive"));
+    EXPECT_TRUE(proxy_header_has_token("keep-alive, Upgrade", "keep-alive"));
+    EXPECT_TRUE(proxy_header_has_token("keep-alive, Upgrade", "upgrade"));
+    EXPECT_TRUE(proxy_header_has_token("close, TE", "close"));
+    EXPECT_TRUE(proxy_header_has_token("TE,close", "close"));
+    EXPECT_TRUE(proxy_header_has_token(" TE ,\tclose\t, ", "close"));
+
+    EXPECT_FALSE(proxy_header_has_token("", "close"));
+    EXPECT_FALSE(proxy_header_has_token(" , ", "close"));
+    EXPECT_FALSE(proxy_header_has_token("closed", "close"));
+    EXPECT_FALSE(proxy_header_has_token("clo", "close"));
+    EXPECT_FALSE(proxy_header_has_token("keep-alive, Upgrade", "close"));
+}
+
+TEST_F(ProxyInputTest, LineAcrossReads) {
+    std::string line;
+    peerSend("GET / HT");
+    EXPECT_EQ(DATA_NEED_MORE, receiveLine(&line));
+    peerSend("TP/1.1\r\nHost: example.com\n");
+    ASSERT_EQ(DATA_COMPLETED, receiveLine(&line));
+    EXPECT_EQ("GET / HTTP/1.1", line);
+    // A bare LF ends a line too.
+    ASSERT_EQ(DATA_COMPLETED, receiveLine(&line));
+    EXPECT_EQ("Host: example.com", line);
+    EXPECT_EQ(DATA_NEED_MORE, receiveLine(&line));
+}
+
+TEST_F(ProxyInputTest, PipelinedRequests) {
+    // Two requests and a body received at once, with a single socket read.
+    peerSend("POST /a HTTP/1.1\r\n"
+             "Content-Length: 5\r\n"
+             "\r\n"
+             "hello"
+             "GET /b HTTP/1.1\r\n"
+             "\r\n");
+
+    std::string line;
+    ASSERT_EQ(DATA_COMPLETED, receiveLine(&line));
+    EXPECT_EQ("POST /a HTTP/1.1", line);
+    ASSERT_EQ(DATA_COMPLETED, receiveLine(&line));
+    EXPECT_EQ("Content-Length: 5", line);
+    ASSERT_EQ(DATA_COMPLETED, receiveLine(&line));
+    EXPECT_EQ("", line);
+
+    std::string body;
+    ASSERT_EQ(DATA_COMPLETED, receive(5, &body));
+    EXPECT_EQ("hello", body);
+    EXPECT_EQ(5, mConn.str_recv);
+
+    // The second request is still buffered, although the socket is empty.
+    EXPECT_EQ(static_cast<int>(strlen("GET /b HTTP/1.1\r\n\r\n")),
+              PROXY_INPUT_AVAIL(mIn));
+    ASSERT_EQ(DATA_COMPLETED, receiveLine(&line));
+    EXPECT_EQ("GET /b HTTP/1.1", line);
+    ASSERT_EQ(DATA_COMPLETED, receiveLine(&line));
+    EXPECT_EQ("", line);
+    EXPECT_EQ(0, PROXY_INPUT_AVAIL(mIn));
+    EXPECT_EQ(DATA_NEED_MORE, receiveLine(&line));
+}
+
+TEST_F(ProxyInputTest, BodyPastBuffer) {
+    // The first read only returns part of the body, the rest must be
+    // read directly from the socket.
+    std::string body(10000, 0);
+    for (size_t n = 0; n < body.size(); ++n) {
+        body[n] = static_cast<char>('a' + n % 26);
+    }
+    peerSend("HTTP/1.1 200 OK\r\n" + body + "HTTP/1.1");
+
+    std::string line;
+    ASSERT_EQ(DATA_COMPLETED, receiveLine(&line));
+    EXPECT_EQ("HTTP/1.1 200 OK", line);
+
+    std::string data;
+    ASSERT_EQ(DATA_COMPLETED, receive(body.size(), &data));
+    EXPECT_EQ(static_cast<int>(body.size()), mConn.str_recv);
+    EXPECT_TRUE(data == body);
+
+    // The start of the next reply is left in the socket.
+    peerSend(" 204 No Content\r\n");
+    ASSERT_EQ(DATA_COMPLETED, receiveLine(&line));
+    EXPECT_EQ("HTTP/1.1 204 No Content", line);
+}
+
+TEST_F(ProxyInputTest, PeerClosed) {
+    std::string line;
+    peerSend("HTTP/1.1 200");
+    socket_close(mPeer);
+    mPeer = -1;
+    EXPECT_EQ(DATA_ERROR, receiveLine(&line));
+}
+
+namespace {
+
+class HttpServicePoolTest : public ::testing::Test {
+protected:
+    virtual void SetUp() {
+        memset(&mService, 0, sizeof(mService));
+    }
+
+    virtual void TearDown() {
+        while (mService.pool_count > 0) {
+            socket_close(mService.pool[--mService.pool_count].socket);
+        }
+    }
+
+    // Return a socket connected to |*peer|, as if it was connected to the
+    // proxy server.
+    int newSocket(int* peer) {
+        int fd = -1;
+        EXPECT_EQ(0, socket_pair(&fd, peer));
+        socket_set_nonblock(fd);
+        return fd;
+    }
+
+    HttpService mService;
+};
+
+}  // namespace
+
+TEST_F(HttpServicePoolTest, ReusesKeepAliveSockets) {
+    EXPECT_EQ(-1, http_service_get_socket(&mService));
+
+    int peer1, peer2;
+    int fd1 = newSocket(&peer1);
+    int fd2 = newSocket(&peer2);
+    http_service_put_socket(&mService, fd1);
+    http_service_put_socket(&mService, fd2);
+
+    // The most recently used socket comes first.
+    EXPECT_EQ(fd2, http_service_get_socket(&mService));
+    EXPECT_EQ(fd1, http_service_get_socket(&mService));
+    EXPECT_EQ(-1, http_service_get_socket(&mService));
+
+    // Back to the pool, once the next reply was received.
+    http_service_put_socket(&mService, fd1);
+    EXPECT_EQ(fd1, http_service_get_socket(&mService));
+
+    socket_close(fd1);
+    socket_close(fd2);
+    socket_close(peer1);
+    socket_close(peer2);
+}
+
+TEST_F(HttpServicePoolTest, DiscardsStaleSockets) {
+    int closedPeer, talkingPeer, idlePeer;
+    int idle = newSocket(&idlePeer);
+    int talking = newSocket(&talkingPeer);
+    int closed = newSocket(&closedPeer);
+    http_service_put_socket(&mService, idle);
+    http_service_put_socket(&mService, talking);
+    http_service_put_socket(&mService, closed);
+
+    // The proxy closed one connection, and timed out on the other one.
+    socket_close(closedPeer);
+    static const char kTimeout[] = "HTTP/1.1 408 Request Timeout\r\n\r\n";
+    socket_send(talkingPeer, kTimeout, sizeof(kTimeout) - 1);
+
+    EXPECT_EQ(idle, http_service_get_socket(&mService));
+    EXPECT_EQ(0, mService.pool_count);
+
+    socket_close(idle);
+    socket_close(idlePeer);
+    socket_close(talkingPeer);
+}
+
+TEST_F(HttpServicePoolTest, ExpiresIdleSockets) {
+    int oldPeer, newPeer;
+    int oldFd = newSocket(&oldPeer);
+    int newFd = newSocket(&newPeer);
+    http_service_put_socket(&mService, oldFd);
+    mService.pool[0].idle_since -= HTTP_POOL_IDLE_TIMEOUT;
+    http_service_put_socket(&mService, newFd);
+
+    // Putting the second socket closed the expired one.
+    ASSERT_EQ(1, mService.pool_count);
+    EXPECT_EQ(newFd, mService.pool[0].socket);
+    EXPECT_EQ(newFd, http_service_get_socket(&mService));
+
+    socket_close(newFd);
+    socket_close(oldPeer);
+    socket_close(newPeer);
+}
+
+TEST_F(HttpServicePoolTest, DropsOldestWhenFull) {
+    int fds[HTTP_POOL_MAX_SOCKETS + 1];
+    int peers[HTTP_POOL_MAX_SOCKETS + 1];
+    for (int n = 0; n <= HTTP_POOL_MAX_SOCKETS; ++n) {
+        fds[n] = newSocket(&peers[n]);
+        http_service_put_socket(&mService, fds[n]);
+    }
+    ASSERT_EQ(HTTP_POOL_MAX_SOCKETS, mService.pool_count);
+    for (int n = HTTP_POOL_MAX_SOCKETS; n > 0; --n) {
+        EXPECT_EQ(fds[n], http_service_get_socket(&mService));
+        socket_close(fds[n]);
+    }
+    EXPECT_EQ(-1, http_service_get_socket(&mService));
+
+    // The oldest socket was closed when the pool was full.
+    char c;
+    EXPECT_EQ(0, socket_recv(peers[0], &c, 1));
+    for (int n = 0; n <= HTTP_POOL_MAX_SOCKETS; ++n) {
+        socket_close(peers[n]);
+    }
+}
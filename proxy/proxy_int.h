@@ -14,6 +14,7 @@
 
 #include "proxy_common.h"
 #include "android/sockets.h"
+#include "android/looper.h"
 #include "android/utils/stralloc.h"
 
 extern int  proxy_log;
@@ -25,7 +26,18 @@ proxy_LOG(const char*  fmt, ...);
     do { if (proxy_log) proxy_LOG(__VA_ARGS__); } while (0)
 
 
-/* ProxySelect is used to handle events */
+/* sockets proxy manager internals */
+
+typedef struct ProxyConnection   ProxyConnection;
+typedef struct ProxyService      ProxyService;
+
+
+/* ProxySelect is used to handle events. Each ProxyConnection owns one,
+ * which maps the file descriptors it cares about to LoopIo watchers of
+ * the core Looper. The connection's conn_select method is called after
+ * each event to tell which events it wants next, then proxy_select_poll()
+ * can be used from conn_poll to know which events were reported.
+ */
 
 enum {
     PROXY_SELECT_READ  = (1 << 0),
@@ -33,11 +45,23 @@ enum {
     PROXY_SELECT_ERROR = (1 << 2)
 };
 
+/* a connection never watches more than two descriptors: the one
+ * connected to the proxy server, and the one connected to slirp */
+#define  PROXY_SELECT_MAX_IOS  2
+
+typedef struct {
+    ProxyConnection*  conn;
+    int               fd;
+    unsigned          wanted;   /* flags requested by the last conn_select */
+    unsigned          armed;    /* flags currently armed in the looper */
+    LoopIo            io[1];
+} ProxySelectIo;
+
 typedef struct {
-    int*     pcount;
-    fd_set*  reads;
-    fd_set*  writes;
-    fd_set*  errors;
+    ProxySelectIo  ios[PROXY_SELECT_MAX_IOS];
+    int            count;
+    int            ready_fd;     /* descriptor reported by the looper */
+    unsigned       ready_flags;  /* and its events, as PROXY_SELECT_XXX */
 } ProxySelect;
 
 extern void     proxy_select_set( ProxySelect*  sel,
@@ -46,11 +70,9 @@ extern void     proxy_select_set( ProxySelect*  sel,
 
 extern unsigned  proxy_select_poll( ProxySelect*  sel, int  fd );
 
+/* returns the Looper used to drive all proxified connections */
+extern Looper*  proxy_get_looper( void );
 
-/* sockets proxy manager internals */
-
-typedef struct ProxyConnection   ProxyConnection;
-typedef struct ProxyService      ProxyService;
 
 /* free a given proxified connection */
 typedef void              (*ProxyConnectionFreeFunc)   ( ProxyConnection*  conn );
@@ -59,7 +81,7 @@ typedef void              (*ProxyConnectionFreeFunc)   ( ProxyConnection*  conn
 typedef void              (*ProxyConnectionSelectFunc) ( ProxyConnection*  conn,
                                                          ProxySelect*      sel );
 
-/* action a proxy connection when select() returns certain events for its socket */
+/* action a proxy connection when the looper reports certain events for its sockets */
 typedef void              (*ProxyConnectionPollFunc)   ( ProxyConnection*  conn,
                                                          ProxySelect*      sel );
 
@@ -73,6 +95,7 @@ struct ProxyConnection {
     ProxyEventFunc      ev_func;
     void*               ev_opaque;
     ProxyService*       service;
+    ProxySelect         sel[1];      /* looper watchers for this connection */
 
     /* the following is useful for all types of services */
     char                name[64];    /* for debugging purposes */
@@ -164,6 +187,45 @@ proxy_connection_receive_line( ProxyConnection*  conn, int  fd );
 extern void
 proxy_connection_rewind( ProxyConnection*  conn );
 
+/* ProxyInput is used to read from a socket in large chunks while still
+ * parsing its content line by line. Bytes received past the end of the
+ * current message (e.g. a pipelined request) stay in the buffer and are
+ * returned by the next receive call.
+ */
+typedef struct {
+    stralloc_t  buf[1];
+    int         pos;
+} ProxyInput;
+
+extern void
+proxy_input_init( ProxyInput*  in );
+
+extern void
+proxy_input_done( ProxyInput*  in );
+
+/* number of buffered bytes that were not consumed yet */
+#define  PROXY_INPUT_AVAIL(in)   ((in)->buf->n - (in)->pos)
+
+/* same as proxy_connection_receive_line(), but reads from the socket
+ * through 'in' instead of one byte at a time */
+extern DataStatus
+proxy_connection_receive_line_buffered( ProxyConnection*  conn,
+                                        ProxyInput*       in,
+                                        int               fd );
+
+/* same as proxy_connection_receive(), but consumes the bytes buffered
+ * in 'in' first */
+extern DataStatus
+proxy_connection_receive_buffered( ProxyConnection*  conn,
+                                   ProxyInput*       in,
+                                   int               fd,
+                                   int               wanted );
+
+/* returns 1 if the comma-separated list of tokens of an HTTP header value
+ * contains 'token', ignoring case and whitespace around each item */
+extern int
+proxy_header_has_token( const char*  value, const char*  token );
+
 /* base64 encode a source string, returns size of encoded result,
  * or -1 if there was not enough room in the destination buffer
  */
@@ -172,6 +172,27 @@ int qemu_chr_write(CharDriverState *s, const uint8_t *buf, int len)
     return s->chr_write(s, buf, len);
 }
 
+/* Write several buffers at once. Backends without a chr_writev
+ * handler get one chr_write call per buffer. Returns the number of
+ * bytes written, or a negative value on error. */
+int qemu_chr_writev(CharDriverState *s, const struct iovec *iov, int iovcnt)
+{
+    int i, ret, total = 0;
+
+    if (s->chr_writev)
+        return s->chr_writev(s, iov, iovcnt);
+
+    for (i = 0; i < iovcnt; i++) {
+        ret = s->chr_write(s, iov[i].iov_base, iov[i].iov_len);
+        if (ret < 0)
+            return total ? total : ret;
+        total += ret;
+        if (ret < (int)iov[i].iov_len)
+            break;
+    }
+    return total;
+}
+
 int qemu_chr_ioctl(CharDriverState *s, int cmd, void *arg)
 {
     if (!s->chr_ioctl)
@@ -609,6 +630,43 @@ static int fd_chr_write(CharDriverState *chr, const uint8_t *buf, int len)
     return send_all(s->fd_out, buf, len);
 }
 
+static int fd_chr_writev(CharDriverState *chr,
+                         const struct iovec *iov, int iovcnt)
+{
+    FDCharDriver *s = chr->opaque;
+    int total = 0;
+
+    while (iovcnt > 0) {
+        ssize_t ret = writev(s->fd_out, iov, MIN(iovcnt, IOV_MAX));
+        if (ret < 0) {
+            if (errno != EINTR && errno != EAGAIN)
+                return total ? total : -1;
+            continue;
+        }
+        if (ret == 0)
+            break;
+        total += ret;
+        /* skip the buffers written in full */
+        while (iovcnt > 0 && (size_t)ret >= iov->iov_len) {
+            ret -= iov->iov_len;
+            iov++;
+            iovcnt--;
+        }
+        /* finish a partially written one before going on */
+        if (ret > 0) {
+            int len = iov->iov_len - ret;
+            int n = send_all(s->fd_out, (const uint8_t *)iov->iov_base + ret, len);
+            if (n > 0)
+                total += n;
+            if (n < len)
+                break;
+            iov++;
+            iovcnt--;
+        }
+    }
+    return total;
+}
+
 static int fd_chr_read_poll(void *opaque)
 {
     CharDriverState *chr = opaque;
@@ -682,6 +740,7 @@ static CharDriverState *qemu_chr_open_fd(int fd_in, int fd_out)
     s->fd_out = fd_out;
     chr->opaque = s;
     chr->chr_write = fd_chr_write;
+    chr->chr_writev = fd_chr_writev;
     chr->chr_update_read_handler = fd_chr_update_read_handler;
     chr->chr_close = fd_chr_close;
 
@@ -64,12 +64,21 @@ QEMUClock qemu_clocks[QEMU_CLOCK_MAX];
  * used by different AioContexts / threads. Each clock also has
  * a list of the QEMUTimerLists associated with it, in order that
  * reenabling the clock can call all the notifiers.
+ *
+ * The active timers are kept in a 4-ary min-heap ordered by their
+ * latest firing time (expire_time + slack), so that arming, re-arming
+ * and deleting a timer are O(log n) and the next deadline is O(1).
  */
 
+#define TIMER_HEAP_ARITY  4
+
 struct QEMUTimerList {
     QEMUClock *clock;
     QemuMutex active_timers_lock;
-    QEMUTimer *active_timers;
+    QEMUTimer **active_timers;
+    int active_count;
+    int active_size;
+    uint64_t seq;
     QLIST_ENTRY(QEMUTimerList) list;
     QEMUTimerListNotifyCB *notify_cb;
     void *notify_opaque;
@@ -96,6 +105,95 @@ static bool timer_expired_ns(QEMUTimer *timer_head, int64_t current_time)
     return timer_head && (timer_head->expire_time <= current_time);
 }
 
+static inline int64_t timer_deadline(const QEMUTimer *ts)
+{
+    return ts->expire_time + ts->slack;
+}
+
+static inline bool timer_before(const QEMUTimer *a, const QEMUTimer *b)
+{
+    int64_t da = timer_deadline(a);
+    int64_t db = timer_deadline(b);
+
+    return da < db || (da == db && a->seq < b->seq);
+}
+
+static inline QEMUTimer *timerlist_head(QEMUTimerList *timer_list)
+{
+    return timer_list->active_count ? timer_list->active_timers[0] : NULL;
+}
+
+static inline void timer_heap_set(QEMUTimerList *timer_list, int i,
+                                  QEMUTimer *ts)
+{
+    timer_list->active_timers[i] = ts;
+    ts->heap_index = i + 1;
+}
+
+static void timer_heap_up(QEMUTimerList *timer_list, int i)
+{
+    QEMUTimer **heap = timer_list->active_timers;
+    QEMUTimer *ts = heap[i];
+
+    while (i > 0) {
+        int parent = (i - 1) / TIMER_HEAP_ARITY;
+        if (!timer_before(ts, heap[parent])) {
+            break;
+        }
+        timer_heap_set(timer_list, i, heap[parent]);
+        i = parent;
+    }
+    timer_heap_set(timer_list, i, ts);
+}
+
+static void timer_heap_down(QEMUTimerList *timer_list, int i)
+{
+    QEMUTimer **heap = timer_list->active_timers;
+    QEMUTimer *ts = heap[i];
+    int count = timer_list->active_count;
+
+    for (;;) {
+        int first = i * TIMER_HEAP_ARITY + 1;
+        int last = MIN(first + TIMER_HEAP_ARITY, count);
+        int best, c;
+
+        if (first >= count) {
+            break;
+        }
+        best = first;
+        for (c = first + 1; c < last; c++) {
+            if (timer_before(heap[c], heap[best])) {
+                best = c;
+            }
+        }
+        if (!timer_before(heap[best], ts)) {
+            break;
+        }
+        timer_heap_set(timer_list, i, heap[best]);
+        i = best;
+    }
+    timer_heap_set(timer_list, i, ts);
+}
+
+static void timer_heap_remove(QEMUTimerList *timer_list, QEMUTimer *ts)
+{
+    int i = ts->heap_index - 1;
+    QEMUTimer *last;
+
+    ts->heap_index = 0;
+    last = timer_list->active_timers[--timer_list->active_count];
+    if (last == ts) {
+        return;
+    }
+    timer_heap_set(timer_list, i, last);
+    if (i > 0 &&
+        timer_before(last, timer_list->active_timers[(i - 1) / TIMER_HEAP_ARITY])) {
+        timer_heap_up(timer_list, i);
+    } else {
+        timer_heap_down(timer_list, i);
+    }
+}
+
 QEMUTimerList *timerlist_new(QEMUClockType type,
                              QEMUTimerListNotifyCB *cb,
                              void *opaque)
@@ -120,6 +218,7 @@ void timerlist_free(QEMUTimerList *timer_list)
         QLIST_REMOVE(timer_list, list);
     }
     qemu_mutex_destroy(&timer_list->active_timers_lock);
+    g_free(timer_list->active_timers);
     g_free(timer_list);
 }
 
@@ -173,7 +272,7 @@ void qemu_clock_enable(QEMUClockType type, bool enabled)
 
 bool timerlist_has_timers(QEMUTimerList *timer_list)
 {
-    return !!timer_list->active_timers;
+    return timer_list->active_count > 0;
 }
 
 bool qemu_clock_has_timers(QEMUClockType type)
@@ -187,11 +286,11 @@ bool timerlist_expired(QEMUTimerList *timer_list)
     int64_t expire_time;
 
     qemu_mutex_lock(&timer_list->active_timers_lock);
-    if (!timer_list->active_timers) {
+    if (!timer_list->active_count) {
         qemu_mutex_unlock(&timer_list->active_timers_lock);
         return false;
     }
-    expire_time = timer_list->active_timers->expire_time;
+    expire_time = timer_list->active_timers[0]->expire_time;
     qemu_mutex_unlock(&timer_list->active_timers_lock);
 
     return expire_time < qemu_clock_get_ns(timer_list->clock->type);
@@ -222,11 +321,13 @@ int64_t timerlist_deadline_ns(QEMUTimerList *timer_list)
      * the caller should notice the change and there is no race condition.
      */
     qemu_mutex_lock(&timer_list->active_timers_lock);
-    if (!timer_list->active_timers) {
+    if (!timer_list->active_count) {
         qemu_mutex_unlock(&timer_list->active_timers_lock);
         return -1;
     }
-    expire_time = timer_list->active_timers->expire_time;
+    /* wake up at the latest time the first timer may fire, so that
+     * other timers due by then run in the same pass */
+    expire_time = timer_deadline(timer_list->active_timers[0]);
     qemu_mutex_unlock(&timer_list->active_timers_lock);
 
     delta = expire_time - qemu_clock_get_ns(timer_list->clock->type);
@@ -331,6 +432,8 @@ void timer_init(QEMUTimer *ts,
     ts->opaque = opaque;
     ts->scale = scale;
     ts->expire_time = -1;
+    ts->slack = 0;
+    ts->heap_index = 0;
 }
 
 void timer_free(QEMUTimer *ts)
@@ -338,43 +441,37 @@ void timer_free(QEMUTimer *ts)
     g_free(ts);
 }
 
-static void timer_del_locked(QEMUTimerList *timer_list, QEMUTimer *ts)
+void timer_set_slack_ns(QEMUTimer *ts, int64_t slack)
 {
-    QEMUTimer **pt, *t;
+    ts->slack = MAX(slack, 0);
+}
 
+static void timer_del_locked(QEMUTimerList *timer_list, QEMUTimer *ts)
+{
     ts->expire_time = -1;
-    pt = &timer_list->active_timers;
-    for(;;) {
-        t = *pt;
-        if (!t)
-            break;
-        if (t == ts) {
-            *pt = t->next;
-            break;
-        }
-        pt = &t->next;
+    if (ts->heap_index) {
+        timer_heap_remove(timer_list, ts);
     }
 }
 
 static bool timer_mod_ns_locked(QEMUTimerList *timer_list,
                                 QEMUTimer *ts, int64_t expire_time)
 {
-    QEMUTimer **pt, *t;
+    int i;
 
-    /* add the timer in the sorted list */
-    pt = &timer_list->active_timers;
-    for (;;) {
-        t = *pt;
-        if (!timer_expired_ns(t, expire_time)) {
-            break;
-        }
-        pt = &t->next;
+    if (timer_list->active_count == timer_list->active_size) {
+        timer_list->active_size = MAX(16, timer_list->active_size * 2);
+        timer_list->active_timers = g_renew(QEMUTimer *,
+                                            timer_list->active_timers,
+                                            timer_list->active_size);
     }
     ts->expire_time = MAX(expire_time, 0);
-    ts->next = *pt;
-    *pt = ts;
+    ts->seq = timer_list->seq++;
+    i = timer_list->active_count++;
+    timer_heap_set(timer_list, i, ts);
+    timer_heap_up(timer_list, i);
 
-    return pt == &timer_list->active_timers;
+    return ts->heap_index == 1;
 }
 
 static void timerlist_rearm(QEMUTimerList *timer_list)
@@ -471,16 +568,14 @@ bool timerlist_run_timers(QEMUTimerList *timer_list)
     current_time = qemu_clock_get_ns(timer_list->clock->type);
     for(;;) {
         qemu_mutex_lock(&timer_list->active_timers_lock);
-        ts = timer_list->active_timers;
+        ts = timerlist_head(timer_list);
         if (!timer_expired_ns(ts, current_time)) {
             qemu_mutex_unlock(&timer_list->active_timers_lock);
             break;
         }
 
         /* remove timer from the list before calling the callback */
-        timer_list->active_timers = ts->next;
-        ts->next = NULL;
-        ts->expire_time = -1;
+        timer_del_locked(timer_list, ts);
         cb = ts->cb;
         opaque = ts->opaque;
         qemu_mutex_unlock(&timer_list->active_timers_lock);
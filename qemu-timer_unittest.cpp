@@ -0,0 +1,345 @@
+/* Copyright (C) 2014 The Android Open Source Project
+**
+** This software is licensed under the terms of the GNU General Public
+** License version 2, as published by the Free Software Foundation, and
+** may be copied, distributed, and modified under those terms.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+*/
+#include <gtest/gtest.h>
+
+#include <stdio.h>
+#include <time.h>
+
+#include <vector>
+
+// The QEMU headers include C library headers, which must not end up in
+// the extern "C" block when first seen.
+
+extern "C" {
+#include "qemu-common.h"
+#include "qemu/timer.h"
+}
+
+// These tests arm, re-arm and delete timers of a QEMUTimerList on a
+// simulated QEMU_CLOCK_VIRTUAL, then run them and check that they fire
+// in the order of the sorted list that the heap of qemu-timer.c
+// replaced: by latest firing time (expire time + slack), and in arming
+// order for equal ones.
+
+// What qemu-timer.c needs from the rest of the emulator, with the
+// virtual clock at sNow.
+
+static int64_t sNow;
+
+int use_icount;
+
+int64_t cpu_get_clock(void) {
+    return sNow;
+}
+
+int64_t cpu_get_icount(void) {
+    return sNow;
+}
+
+void qemu_clock_warp(QEMUClockType type) {
+}
+
+void qemu_notify_event(void) {
+}
+
+namespace {
+
+std::vector<int> sFired;
+
+struct TestTimer {
+    QEMUTimer timer;
+    int id;
+};
+
+void onTimer(void* opaque) {
+    sFired.push_back(static_cast<TestTimer*>(opaque)->id);
+}
+
+// The sorted singly linked list of the previous implementation, indexed
+// by timer id. A timer is inserted after all the timers whose deadline
+// is the same or earlier, so equal deadlines stay in arming order.
+class SortedList {
+public:
+    explicit SortedList(int count)
+        : mNext(count, -1), mDeadline(count, -1), mHead(-1) {}
+
+    void mod(int id, int64_t deadline) {
+        del(id);
+        mDeadline[id] = deadline;
+        int* link = &mHead;
+        while (*link >= 0 && mDeadline[*link] <= deadline) {
+            link = &mNext[*link];
+        }
+        mNext[id] = *link;
+        *link = id;
+    }
+
+    void del(int id) {
+        if (mDeadline[id] < 0) {
+            return;
+        }
+        for (int* link = &mHead; *link >= 0; link = &mNext[*link]) {
+            if (*link == id) {
+                *link = mNext[id];
+                break;
+            }
+        }
+        mDeadline[id] = -1;
+    }
+
+    int64_t headDeadline() const {
+        return mHead >= 0 ? mDeadline[mHead] : -1;
+    }
+
+    std::vector<int> order() const {
+        std::vector<int> result;
+        for (int id = mHead; id >= 0; id = mNext[id]) {
+            result.push_back(id);
+        }
+        return result;
+    }
+
+private:
+    std::vector<int> mNext;
+    std::vector<int64_t> mDeadline;
+    int mHead;
+};
+
+uint32_t sRandom;
+
+uint32_t nextRandom() {
+    sRandom = sRandom * 1103515245U + 12345U;
+    return sRandom >> 8;
+}
+
+class TimerHeapTest : public ::testing::Test {
+protected:
+    virtual void SetUp() {
+        static bool initialized;
+        if (!initialized) {
+            init_clocks();
+            initialized = true;
+        }
+        mList = timerlist_new(QEMU_CLOCK_VIRTUAL, NULL, NULL);
+        sNow = 0;
+        sFired.clear();
+        sRandom = 1;
+    }
+
+    virtual void TearDown() {
+        for (size_t n = 0; n < mTimers.size(); ++n) {
+            timer_del(&mTimers[n].timer);
+        }
+        timerlist_free(mList);
+    }
+
+    void createTimers(int count) {
+        mTimers.resize(count);
+        for (int n = 0; n < count; ++n) {
+            timer_init(&mTimers[n].timer, mList, SCALE_NS, onTimer,
+                       &mTimers[n]);
+            mTimers[n].id = n;
+        }
+    }
+
+    void mod(SortedList* expected, int id, int64_t expire_time,
+             int64_t slack = 0) {
+        timer_set_slack_ns(&mTimers[id].timer, slack);
+        timer_mod_ns(&mTimers[id].timer, expire_time);
+        expected->mod(id, expire_time + slack);
+    }
+
+    void del(SortedList* expected, int id) {
+        timer_del(&mTimers[id].timer);
+        expected->del(id);
+    }
+
+    // With the clock at 0, the deadline is the head's latest firing time.
+    void expectDeadline(const SortedList& expected) {
+        EXPECT_EQ(expected.headDeadline(), timerlist_deadline_ns(mList));
+    }
+
+    // Run every timer, and check the order in which they fired.
+    void expectOrder(const SortedList& expected) {
+        std::vector<int> order = expected.order();
+        sNow = INT64_MAX / 2;
+        timerlist_run_timers(mList);
+        sNow = 0;
+        ASSERT_EQ(order.size(), sFired.size());
+        for (size_t n = 0; n < order.size(); ++n) {
+            ASSERT_EQ(order[n], sFired[n]) << "at position " << n;
+        }
+        EXPECT_FALSE(timerlist_has_timers(mList));
+    }
+
+    QEMUTimerList* mList;
+    std::vector<TestTimer> mTimers;
+};
+
+}  // namespace
+
+TEST_F(TimerHeapTest, insert) {
+    const int kCount = 1000;
+    createTimers(kCount);
+    SortedList expected(kCount);
+
+    // Few distinct expiry times, so that many timers share one.
+    for (int id = 0; id < kCount; ++id) {
+        mod(&expected, id, 1 + nextRandom() % 200);
+        expectDeadline(expected);
+    }
+    expectOrder(expected);
+}
+
+TEST_F(TimerHeapTest, equal_deadlines) {
+    const int kCount = 20;
+    createTimers(kCount);
+    SortedList expected(kCount);
+
+    for (int id = 0; id < kCount; ++id) {
+        mod(&expected, id, 1000);
+    }
+    // Re-arming a timer for the same time puts it after the others.
+    mod(&expected, 5, 1000);
+    // As does re-arming it for an equal deadline through its slack.
+    mod(&expected, 7, 900, 100);
+
+    std::vector<int> order = expected.order();
+    ASSERT_EQ(kCount, (int)order.size());
+    EXPECT_EQ(0, order[0]);
+    EXPECT_EQ(5, order[kCount - 2]);
+    EXPECT_EQ(7, order[kCount - 1]);
+    expectOrder(expected);
+}
+
+TEST_F(TimerHeapTest, remove) {
+    const int kCount = 1000;
+    createTimers(kCount);
+    SortedList expected(kCount);
+
+    for (int id = 0; id < kCount; ++id) {
+        mod(&expected, id, 1 + nextRandom() % 5000);
+    }
+    for (int id = 0; id < kCount; id += 3) {
+        del(&expected, id);
+        EXPECT_FALSE(timer_pending(&mTimers[id].timer));
+        expectDeadline(expected);
+    }
+    // The head, then the new heads, until the list is almost empty.
+    for (int n = 0; n < kCount / 2; ++n) {
+        del(&expected, expected.order()[0]);
+        expectDeadline(expected);
+    }
+    // Deleting an idle timer does nothing.
+    del(&expected, 0);
+    expectDeadline(expected);
+    expectOrder(expected);
+}
+
+TEST_F(TimerHeapTest, modify) {
+    const int kCount = 1000;
+    createTimers(kCount);
+    SortedList expected(kCount);
+
+    for (int id = 0; id < kCount; ++id) {
+        mod(&expected, id, 1 + nextRandom() % 100000);
+    }
+    // Move timers earlier and later, with or without slack, and delete
+    // a few of them along the way.
+    for (int n = 0; n < 20000; ++n) {
+        int id = nextRandom() % kCount;
+        uint32_t r = nextRandom();
+        switch (r % 8) {
+        case 0:
+            del(&expected, id);
+            break;
+        case 1:
+            mod(&expected, id, 1 + (r >> 3) % 100000, (r >> 3) % 1000);
+            break;
+        default:
+            mod(&expected, id, 1 + (r >> 3) % 100000);
+            break;
+        }
+        expectDeadline(expected);
+        if (HasFailure()) {
+            return;
+        }
+    }
+    expectOrder(expected);
+}
+
+TEST_F(TimerHeapTest, slack) {
+    createTimers(2);
+    SortedList expected(2);
+
+    // Timer 0 may fire up to 150, timer 1 must fire at 140: the list
+    // sleeps until 140, and runs both timers then.
+    mod(&expected, 0, 100, 50);
+    mod(&expected, 1, 140);
+    EXPECT_EQ(140, timerlist_deadline_ns(mList));
+
+    sNow = 120;
+    EXPECT_EQ(20, timerlist_deadline_ns(mList));
+    EXPECT_FALSE(timerlist_run_timers(mList));
+    EXPECT_TRUE(sFired.empty());
+
+    sNow = 140;
+    EXPECT_EQ(0, timerlist_deadline_ns(mList));
+    EXPECT_TRUE(timerlist_run_timers(mList));
+    ASSERT_EQ(2U, sFired.size());
+    EXPECT_EQ(1, sFired[0]);
+    EXPECT_EQ(0, sFired[1]);
+    EXPECT_FALSE(timerlist_has_timers(mList));
+}
+
+// Not a pass/fail test: reports the cost of re-arming one timer among
+// N, picked at random, with the heap and with the sorted list it
+// replaced. Run it with --gtest_also_run_disabled_tests.
+TEST_F(TimerHeapTest, DISABLED_rearm_benchmark) {
+    const int kMaxCount = 10000;
+    const int kRearms = 200000;
+    createTimers(kMaxCount);
+
+    for (int count = 10; count <= kMaxCount; count *= 10) {
+        SortedList list(count);
+        std::vector<uint32_t> draws(2 * kRearms);
+        for (size_t n = 0; n < draws.size(); ++n) {
+            draws[n] = nextRandom();
+        }
+        for (int id = 0; id < count; ++id) {
+            timer_mod_ns(&mTimers[id].timer, 1 + nextRandom() % 1000000);
+        }
+
+        clock_t start = clock();
+        for (int n = 0; n < kRearms; ++n) {
+            timer_mod_ns(&mTimers[draws[2 * n] % count].timer,
+                         1 + draws[2 * n + 1] % 1000000);
+        }
+        clock_t heapTime = clock() - start;
+
+        for (int id = 0; id < count; ++id) {
+            timer_del(&mTimers[id].timer);
+            list.mod(id, 1 + nextRandom() % 1000000);
+        }
+
+        start = clock();
+        for (int n = 0; n < kRearms; ++n) {
+            list.mod(draws[2 * n] % count, 1 + draws[2 * n + 1] % 1000000);
+        }
+        clock_t listTime = clock() - start;
+
+        printf("%5d timers: heap %.1f ns/re-arm, sorted list %.1f ns/re-arm\n",
+               count,
+               heapTime * 1e9 / CLOCKS_PER_SEC / kRearms,
+               listTime * 1e9 / CLOCKS_PER_SEC / kRearms);
+    }
+}
@@ -89,7 +89,9 @@
 #include "qemu/sockets.h"
 #include "qemu/timer.h"
 #include "qemu/queue.h"
+#include "qemu/thread.h"
 #include "android/snapshot.h"
+#include "android/utils/debug.h"
 
 
 #define SELF_ANNOUNCE_ROUNDS 5
@@ -585,23 +587,329 @@ static ssize_t block_writev_buffer(void *opaque, struct iovec *iov, int iovcnt,
 }
 #endif
 
+/* The VM state of a snapshot is streamed to/from the image through a small
+ * pipeline. When saving, the QEMUFile buffers are coalesced into chunks of
+ * VMSTATE_CHUNK_SIZE bytes, each chunk is deflated by one of VMSTATE_WORKERS
+ * worker threads, and the results are written to the image in order while
+ * the next chunks are being filled and compressed. When loading, up to
+ * VMSTATE_WORKERS chunks are read ahead and inflated in parallel.
+ *
+ * A compressed stream starts with VMSTATE_ZMAGIC and a be32 format version,
+ * followed by a sequence of chunks, each one made of a be32 stored size, a
+ * be32 raw size, and the deflated data (or the raw data itself when both
+ * sizes are equal). A zero stored size ends the stream. Streams saved by
+ * older emulators start with QEMU_VM_FILE_MAGIC instead, and are read as is,
+ * in VMSTATE_CHUNK_SIZE units. Conversely, older emulators reject compressed
+ * streams because of their magic.
+ *
+ * Note that the block layer itself is only ever used from the main thread,
+ * the worker threads only run zlib.
+ */
+#define VMSTATE_ZMAGIC        0x5145565a   /* "QEVZ" */
+#define VMSTATE_ZVERSION      1
+#define VMSTATE_CHUNK_SIZE    (1024 * 1024)
+#define VMSTATE_CHUNK_HEADER  8
+#define VMSTATE_WORKERS       4
+
+typedef struct VmstateChunk {
+    QemuThread     thread;
+    QemuSemaphore  work;       /* posted by the main thread */
+    QemuSemaphore  done;       /* posted by the worker thread */
+    bool           quit;
+    bool           saving;     /* deflate if true, inflate otherwise */
+    bool           busy;       /* submitted, 'done' not consumed yet */
+    int            error;
+    uint8_t       *raw;        /* VMSTATE_RAW_SIZE bytes */
+    int            raw_size;
+    /* Stored data. When saving, it is preceded by the chunk header. When
+     * loading, it is followed by the header of the next chunk. */
+    uint8_t       *zbuf;
+    int            zsize;
+} VmstateChunk;
+
+typedef struct QEMUFileBdrv {
+    BlockDriverState *bs;
+    int               is_writable;
+    bool              compressed;
+    int64_t           offset;      /* next offset in the vmstate area */
+    int               error;
+    /* chunks are used in round-robin order, which keeps them sorted */
+    VmstateChunk      chunks[VMSTATE_WORKERS];
+    int               head;        /* chunk being filled, or read from */
+    int               tail;        /* reader: next chunk to read ahead */
+    int               read_index;  /* reader: offset in chunks[head].raw */
+    bool              head_ready;  /* reader: chunks[head] is inflated */
+    uint8_t           next_header[VMSTATE_CHUNK_HEADER];
+    bool              eof;
+} QEMUFileBdrv;
+
+#define VMSTATE_ZBUF_SIZE \
+    (VMSTATE_CHUNK_HEADER + compressBound(VMSTATE_CHUNK_SIZE) + VMSTATE_CHUNK_HEADER)
+
+/* stored chunks are loaded in place, followed by the next chunk header */
+#define VMSTATE_RAW_SIZE      (VMSTATE_CHUNK_SIZE + VMSTATE_CHUNK_HEADER)
+
+static void *vmstate_chunk_thread(void *opaque)
+{
+    VmstateChunk *c = opaque;
+
+    for (;;) {
+        qemu_sem_wait(&c->work);
+        if (c->quit) {
+            break;
+        }
+        c->error = 0;
+        if (c->saving) {
+            uint8_t *dst = c->zbuf + VMSTATE_CHUNK_HEADER;
+            uLongf zsize = compressBound(VMSTATE_CHUNK_SIZE);
+
+            if (compress2(dst, &zsize, c->raw, c->raw_size,
+                          Z_BEST_SPEED) != Z_OK) {
+                c->error = -EIO;
+            } else if (zsize >= (uLongf)c->raw_size) {
+                /* incompressible, store it as is */
+                memcpy(dst, c->raw, c->raw_size);
+                zsize = c->raw_size;
+            }
+            c->zsize = zsize;
+        } else if (c->zsize != c->raw_size) {
+            uLongf raw_size = VMSTATE_CHUNK_SIZE;
+
+            if (uncompress(c->raw, &raw_size, c->zbuf, c->zsize) != Z_OK ||
+                raw_size != (uLongf)c->raw_size) {
+                c->error = -EIO;
+            }
+        }
+        qemu_sem_post(&c->done);
+    }
+    return NULL;
+}
+
+static void bdrv_vmstate_start(QEMUFileBdrv *s)
+{
+    int n;
+
+    for (n = 0; n < VMSTATE_WORKERS; n++) {
+        VmstateChunk *c = &s->chunks[n];
+
+        c->saving = s->is_writable;
+        c->raw = g_malloc(VMSTATE_RAW_SIZE);
+        c->zbuf = g_malloc(VMSTATE_ZBUF_SIZE);
+        qemu_sem_init(&c->work, 0);
+        qemu_sem_init(&c->done, 0);
+        qemu_thread_create(&c->thread, vmstate_chunk_thread, c,
+                           QEMU_THREAD_JOINABLE);
+    }
+}
+
+static void bdrv_vmstate_stop(QEMUFileBdrv *s)
+{
+    int n;
+
+    for (n = 0; n < VMSTATE_WORKERS; n++) {
+        VmstateChunk *c = &s->chunks[n];
+
+        if (c->busy && !(n == s->head && s->head_ready)) {
+            qemu_sem_wait(&c->done);
+        }
+        c->quit = true;
+        qemu_sem_post(&c->work);
+        qemu_thread_join(&c->thread);
+        qemu_sem_destroy(&c->work);
+        qemu_sem_destroy(&c->done);
+        g_free(c->zbuf);
+    }
+}
+
+static void bdrv_vmstate_submit(VmstateChunk *c)
+{
+    c->busy = true;
+    qemu_sem_post(&c->work);
+}
+
+/* Waits for the worker to deflate 'c', then writes it to the image. */
+static int bdrv_vmstate_write_chunk(QEMUFileBdrv *s, VmstateChunk *c)
+{
+    int ret, size;
+
+    qemu_sem_wait(&c->done);
+    c->busy = false;
+    if (!s->error && c->error) {
+        s->error = c->error;
+    }
+    if (!s->error) {
+        size = VMSTATE_CHUNK_HEADER + c->zsize;
+        stl_be_p(c->zbuf, c->zsize);
+        stl_be_p(c->zbuf + 4, c->raw_size);
+        ret = bdrv_save_vmstate(s->bs, c->zbuf, s->offset, size);
+        if (ret < 0) {
+            s->error = ret;
+        } else {
+            s->offset += size;
+        }
+    }
+    c->raw_size = 0;
+    return s->error;
+}
+
 static int block_put_buffer(void *opaque, const uint8_t *buf,
                            int64_t pos, int size)
 {
-    bdrv_save_vmstate(opaque, buf, pos, size);
+    QEMUFileBdrv *s = opaque;
+    int done = 0;
+
+    while (done < size) {
+        VmstateChunk *c = &s->chunks[s->head];
+        int ret, l;
+
+        /* the slot may still hold the chunk submitted VMSTATE_WORKERS
+         * chunks ago, which must reach the image first */
+        if (c->busy && (ret = bdrv_vmstate_write_chunk(s, c)) < 0) {
+            return ret;
+        }
+        l = MIN(size - done, VMSTATE_CHUNK_SIZE - c->raw_size);
+        memcpy(c->raw + c->raw_size, buf + done, l);
+        c->raw_size += l;
+        done += l;
+        if (c->raw_size == VMSTATE_CHUNK_SIZE) {
+            bdrv_vmstate_submit(c);
+            s->head = (s->head + 1) % VMSTATE_WORKERS;
+        }
+    }
     return size;
 }
 
+/* Reads the chunk described by s->next_header, along with the header of the
+ * following one, and hands it over to its worker, until all workers are busy
+ * or the end of the stream is reached. */
+static void bdrv_vmstate_read_ahead(QEMUFileBdrv *s)
+{
+    while (!s->eof && !s->error) {
+        VmstateChunk *c = &s->chunks[s->tail];
+        int zsize = ldl_be_p(s->next_header);
+        int raw_size = ldl_be_p(s->next_header + 4);
+        uint8_t *dst;
+        int ret;
+
+        if (c->busy) {
+            break;
+        }
+        if (zsize == 0) {
+            s->eof = true;
+            break;
+        }
+        if (zsize < 0 || zsize > (int)compressBound(VMSTATE_CHUNK_SIZE) ||
+            raw_size <= 0 || raw_size > VMSTATE_CHUNK_SIZE ||
+            zsize > raw_size) {
+            s->error = -EINVAL;
+            break;
+        }
+
+        /* stored chunks are read directly in place */
+        dst = (zsize == raw_size) ? c->raw : c->zbuf;
+        ret = bdrv_load_vmstate(s->bs, dst, s->offset,
+                                zsize + VMSTATE_CHUNK_HEADER);
+        if (ret != zsize + VMSTATE_CHUNK_HEADER) {
+            s->error = ret < 0 ? ret : -EIO;
+            break;
+        }
+        memcpy(s->next_header, dst + zsize, VMSTATE_CHUNK_HEADER);
+        s->offset += zsize + VMSTATE_CHUNK_HEADER;
+
+        c->zsize = zsize;
+        c->raw_size = raw_size;
+        bdrv_vmstate_submit(c);
+        s->tail = (s->tail + 1) % VMSTATE_WORKERS;
+    }
+}
+
 static int block_get_buffer(void *opaque, uint8_t *buf, int64_t pos, int size)
 {
-    return bdrv_load_vmstate(opaque, buf, pos, size);
+    QEMUFileBdrv *s = opaque;
+    VmstateChunk *c = &s->chunks[s->head];
+    int l;
+
+    if (!s->compressed) {
+        /* legacy stream, just read ahead */
+        if (s->read_index == c->raw_size) {
+            int ret = bdrv_load_vmstate(s->bs, c->raw, s->offset,
+                                        VMSTATE_CHUNK_SIZE);
+            if (ret <= 0) {
+                return ret;
+            }
+            c->raw_size = ret;
+            s->offset += ret;
+            s->read_index = 0;
+        }
+    } else {
+        if (s->read_index == c->raw_size && c->busy) {
+            /* current chunk consumed, recycle it */
+            c->busy = false;
+            s->head_ready = false;
+            s->read_index = 0;
+            s->head = (s->head + 1) % VMSTATE_WORKERS;
+            c = &s->chunks[s->head];
+            bdrv_vmstate_read_ahead(s);
+        }
+        if (!c->busy) {
+            /* end of stream */
+            return s->error;
+        }
+        if (!s->head_ready) {
+            qemu_sem_wait(&c->done);
+            s->head_ready = true;
+            if (c->error) {
+                return c->error;
+            }
+        }
+    }
+
+    l = MIN(size, c->raw_size - s->read_index);
+    memcpy(buf, c->raw + s->read_index, l);
+    s->read_index += l;
+    return l;
 }
 
 static int bdrv_fclose(void *opaque)
 {
+    QEMUFileBdrv *s = opaque;
+    int ret = 0;
+    int n;
+
+    if (s->compressed && s->is_writable) {
+        uint8_t trailer[VMSTATE_CHUNK_HEADER] = { 0, };
+
+        /* submit the last, partial chunk and write everything in order */
+        if (s->chunks[s->head].raw_size > 0) {
+            bdrv_vmstate_submit(&s->chunks[s->head]);
+            s->head = (s->head + 1) % VMSTATE_WORKERS;
+        }
+        for (n = 0; n < VMSTATE_WORKERS; n++) {
+            VmstateChunk *c = &s->chunks[(s->head + n) % VMSTATE_WORKERS];
+            if (c->busy) {
+                bdrv_vmstate_write_chunk(s, c);
+            }
+        }
+        if (!s->error) {
+            ret = bdrv_save_vmstate(s->bs, trailer, s->offset, sizeof(trailer));
+            if (ret < 0) {
+                s->error = ret;
+            }
+        }
+    }
+    if (s->compressed) {
+        bdrv_vmstate_stop(s);
+    }
+
     // TODO(digit): bdrv_flush() should return error code.
-    bdrv_flush(opaque);
-    return 0;
+    bdrv_flush(s->bs);
+
+    ret = s->error;
+    for (n = 0; n < VMSTATE_WORKERS; n++) {
+        g_free(s->chunks[n].raw);
+    }
+    g_free(s);
+    return ret;
 }
 
 static const QEMUFileOps bdrv_read_ops = {
@@ -617,9 +925,45 @@ static const QEMUFileOps bdrv_write_ops = {
 
 static QEMUFile *qemu_fopen_bdrv(BlockDriverState *bs, int is_writable)
 {
-    if (is_writable)
-        return qemu_fopen_ops(bs, &bdrv_write_ops);
-    return qemu_fopen_ops(bs, &bdrv_read_ops);
+    QEMUFileBdrv *s = g_malloc0(sizeof(QEMUFileBdrv));
+    uint8_t header[8 + VMSTATE_CHUNK_HEADER];
+
+    s->bs = bs;
+    s->is_writable = is_writable;
+
+    if (is_writable) {
+        s->compressed = true;
+        stl_be_p(header, VMSTATE_ZMAGIC);
+        stl_be_p(header + 4, VMSTATE_ZVERSION);
+        s->error = bdrv_save_vmstate(bs, header, 0, 8);
+        if (s->error < 0) {
+            g_free(s);
+            return NULL;
+        }
+        s->error = 0;
+        s->offset = 8;
+        bdrv_vmstate_start(s);
+        return qemu_fopen_ops(s, &bdrv_write_ops);
+    }
+
+    if (bdrv_load_vmstate(bs, header, 0, sizeof(header)) == sizeof(header) &&
+        ldl_be_p(header) == VMSTATE_ZMAGIC) {
+        int version = ldl_be_p(header + 4);
+
+        if (version != VMSTATE_ZVERSION) {
+            fprintf(stderr, "Snapshot VM state stream version %d is not supported by this emulator, please update your Android SDK Tools.\n", version);
+            g_free(s);
+            return NULL;
+        }
+        s->compressed = true;
+        s->offset = sizeof(header);
+        memcpy(s->next_header, header + 8, VMSTATE_CHUNK_HEADER);
+        bdrv_vmstate_start(s);
+        bdrv_vmstate_read_ahead(s);
+    } else {
+        s->chunks[0].raw = g_malloc(VMSTATE_RAW_SIZE);
+    }
+    return qemu_fopen_ops(s, &bdrv_read_ops);
 }
 
 QEMUFile *qemu_fopen_ops(void *opaque, const QEMUFileOps *ops)
@@ -2480,11 +2824,12 @@ void do_savevm(Monitor *err, const char *name)
 {
     BlockDriverState *bs, *bs1;
     QEMUSnapshotInfo sn1, *sn = &sn1, old_sn1, *old_sn = &old_sn1;
-    int must_delete, ret;
+    int must_delete, ret, ret2;
     BlockDriverInfo bdi1, *bdi = &bdi1;
     QEMUFile *f;
     int saved_vm_running;
     uint32_t vm_state_size;
+    int64_t start_ms = qemu_clock_get_ms(QEMU_CLOCK_REALTIME);
 #ifdef _WIN32
     struct _timeb tb;
 #else
@@ -2545,11 +2890,18 @@ void do_savevm(Monitor *err, const char *name)
     }
     ret = qemu_savevm_state(f);
     vm_state_size = qemu_ftell(f);
-    qemu_fclose(f);
+    /* the last chunks and the trailer are only written on close */
+    ret2 = qemu_fclose(f);
+    if (ret >= 0) {
+        ret = ret2;
+    }
     if (ret < 0) {
         monitor_printf(err, "Error %d while writing VM\n", ret);
         goto the_end;
     }
+    VERBOSE_PRINT(init, "savevm: %u bytes of VM state saved in %lld ms",
+                  vm_state_size,
+                  (long long)(qemu_clock_get_ms(QEMU_CLOCK_REALTIME) - start_ms));
 
     /* create the snapshots */
 
@@ -2587,6 +2939,7 @@ void do_loadvm(Monitor *err, const char *name)
     QEMUFile *f;
     int ret;
     int saved_vm_running;
+    int64_t start_ms = qemu_clock_get_ms(QEMU_CLOCK_REALTIME);
 
     bs = bdrv_snapshots();
     if (!bs) {
@@ -2651,6 +3004,9 @@ void do_loadvm(Monitor *err, const char *name)
     qemu_fclose(f);
     if (ret < 0) {
         monitor_printf(err, "Error %d while loading VM state\n", ret);
+    } else {
+        VERBOSE_PRINT(init, "loadvm: VM state loaded in %lld ms",
+                      (long long)(qemu_clock_get_ms(QEMU_CLOCK_REALTIME) - start_ms));
     }
  the_end:
     if (saved_vm_running)
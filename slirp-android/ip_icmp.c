@@ -132,6 +132,7 @@ icmp_input(struct mbuf *m, int hlen)
       so->so_faddr_port = 7;
       so->so_laddr_ip   = ip_geth(ip->ip_src);
       so->so_laddr_port = 9;
+      sohash(&udb, so);
       so->so_iptos = ip->ip_tos;
       so->so_type = IPPROTO_ICMP;
       so->so_state = SS_ISFCONNECTED;
@@ -241,10 +242,9 @@ icmp_error(struct mbuf *msrc, u_char type, u_char code, int minsize,
   }
 
   /* make a copy */
-  if(!(m=m_get())) goto end_error;               /* get mbuf */
   { int new_m_size;
     new_m_size=sizeof(struct ip )+ICMP_MINLEN+msrc->m_len+ICMP_MAXDATALEN;
-    if(new_m_size>m->m_size) m_inc(m, new_m_size);
+    if(!(m=m_get_size(new_m_size))) goto end_error; /* get mbuf */
   }
   memcpy(m->m_data, msrc->m_data, msrc->m_len);
   m->m_len = msrc->m_len;                        /* copy msrc to m */
@@ -28,6 +28,10 @@ void slirp_init(int restricted, const char *special_ip);
 void slirp_select_fill(int *pnfds,
                        fd_set *readfds, fd_set *writefds, fd_set *xfds);
 
+/* Lower *timeout (in ms, -1 for none) to the next TCP/IP timer of
+ * the stack, as computed by the last slirp_select_fill(). */
+void slirp_update_timeout(int *timeout);
+
 void slirp_select_poll(fd_set *readfds, fd_set *writefds, fd_set *xfds);
 
 void slirp_input(const uint8_t *pkt, int pkt_len);
@@ -114,6 +118,20 @@ extern char slirp_hostname[33];
 extern const char *bootp_filename;
 
 void slirp_stats(void);
+
+/* Usage of one mbuf size class of the stack */
+typedef struct SlirpMbufStats {
+    const char*  name;
+    int          size;      /* usable bytes per buffer */
+    int          inuse;     /* buffers currently allocated */
+    int          hiwat;     /* highest value of 'inuse' so far */
+    int          cached;    /* buffers kept on the free list */
+    unsigned     allocs;    /* total allocations */
+    unsigned     mallocs;   /* ... that had to call malloc() */
+} SlirpMbufStats;
+
+/* Fill up to 'max' entries of 'stats', return the number filled */
+int slirp_get_mbuf_stats(SlirpMbufStats* stats, int max);
 void slirp_socket_recv(int addr_low_byte, int guest_port, const uint8_t *buf,
 		int size);
 size_t slirp_socket_can_recv(int addr_low_byte, int guest_port);
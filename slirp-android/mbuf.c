@@ -7,78 +7,181 @@
 
 /*
  * mbuf's in SLiRP are much simpler than the real mbufs in
- * FreeBSD.  They are fixed size, determined by the MTU,
- * so that one whole packet can fit.  Mbuf's cannot be
- * chained together.  If there's more data than the mbuf
- * could hold, an external malloced buffer is pointed to
+ * FreeBSD.  They are fixed size, so that one whole packet can
+ * fit.  Mbuf's cannot be chained together.  If there's more data
+ * than the mbuf could hold, an external buffer is pointed to
  * by m_ext (and the data pointers) and M_EXT is set in
  * the flags
+ *
+ * Both the mbufs themselves and the M_EXT buffers are carved from
+ * a small set of size classes (see mbuf_classes below), each with
+ * its own free list, so that the common allocate/free cycle never
+ * reaches malloc(), and growing an mbuf is a single copy into a
+ * block of the next class rather than a realloc().
  */
 
 #include <slirp.h>
 
-int mbuf_alloced = 0;
-struct mbuf m_freelist, m_usedlist;
-#define MBUF_THRESH 30
-int mbuf_max = 0;
+struct mbuf m_usedlist;
 
 /*
- * Find a nice value for msize
- * XXX if_maxlinkhdr already in mtu
+ * Size classes.  "small" holds a bare TCP/IP header (pure ACKs,
+ * RSTs), "mtu" one link-level frame, and "large" a fully
+ * reassembled IP datagram.  The size is the usable data area of
+ * an mbuf of that class; an M_EXT buffer taken from the class
+ * gets the same amount.
+ *
+ * Up to max_cached blocks are kept on the free list of a class,
+ * anything above that goes back to malloc() when released, which
+ * replaces the old MBUF_THRESH/M_DOFREE logic.
  */
-#define SLIRP_MSIZE (IF_MTU + IF_MAXLINKHDR + sizeof(struct m_hdr ) + 6)
+#define MBUF_SMALL_SIZE	(IF_MAXLINKHDR + 128)
+#define MBUF_MTU_SIZE	(IF_MTU + IF_MAXLINKHDR + 6)
+#define MBUF_LARGE_SIZE	(IP_MAXPACKET + IF_MAXLINKHDR + 6)
+
+struct mbuf_class {
+	const char *name;
+	int size;		/* Usable bytes in a block */
+	int max_cached;		/* Free blocks kept on the list */
+	struct mbuf freelist;
+	int cached;		/* Blocks currently on the free list */
+	int inuse;		/* Blocks handed out */
+	int hiwat;		/* Highest value of inuse */
+	unsigned allocs;	/* Blocks handed out, total */
+	unsigned mallocs;	/* ... of which came from malloc() */
+};
+
+static struct mbuf_class mbuf_classes[MBUF_NCLASSES] = {
+	{ "small", MBUF_SMALL_SIZE, 64 },
+	{ "mtu",   MBUF_MTU_SIZE,   30 },
+	{ "large", MBUF_LARGE_SIZE,  4 },
+};
 
 void
 m_init(void)
 {
-	m_freelist.m_next = m_freelist.m_prev = &m_freelist;
+	int i;
+
+	for (i = 0; i < MBUF_NCLASSES; i++) {
+		struct mbuf_class *c = &mbuf_classes[i];
+		c->freelist.m_next = c->freelist.m_prev = &c->freelist;
+	}
 	m_usedlist.m_next = m_usedlist.m_prev = &m_usedlist;
 }
 
 /*
- * Get an mbuf from the free list, if there are none
- * malloc one
- *
- * Because fragmentation can occur if we alloc new mbufs and
- * free old mbufs, we mark all mbufs above mbuf_thresh as M_DOFREE,
- * which tells m_free to actually free() it
+ * Return the smallest class whose blocks hold at least size bytes,
+ * or -1 if size is larger than the largest class
  */
-struct mbuf *
-m_get(void)
+static int
+mbuf_class_for(int size)
 {
-	register struct mbuf *m;
-	int flags = 0;
-
-	DEBUG_CALL("m_get");
-
-	if (m_freelist.m_next == &m_freelist) {
-		m = (struct mbuf *)malloc(SLIRP_MSIZE);
-		if (m == NULL) goto end_error;
-		mbuf_alloced++;
-		if (mbuf_alloced > MBUF_THRESH)
-			flags = M_DOFREE;
-		if (mbuf_alloced > mbuf_max)
-			mbuf_max = mbuf_alloced;
+	int i;
+
+	for (i = 0; i < MBUF_NCLASSES; i++)
+		if (mbuf_classes[i].size >= size)
+			return i;
+	return -1;
+}
+
+/*
+ * Take a block from a class free list, malloc a new one if empty.
+ * The block is returned as a struct mbuf, since that is what
+ * it is when not used as an M_EXT buffer
+ */
+static struct mbuf *
+mbuf_block_get(int cls)
+{
+	struct mbuf_class *c = &mbuf_classes[cls];
+	struct mbuf *m;
+
+	if (c->freelist.m_next == &c->freelist) {
+		m = (struct mbuf *)malloc(sizeof(struct m_hdr) + c->size);
+		if (m == NULL)
+			return NULL;
+		c->mallocs++;
 	} else {
-		m = m_freelist.m_next;
+		m = c->freelist.m_next;
 		remque(m);
+		c->cached--;
 	}
+	c->allocs++;
+	if (++c->inuse > c->hiwat)
+		c->hiwat = c->inuse;
+	return m;
+}
+
+static void
+mbuf_block_put(int cls, struct mbuf *m)
+{
+	struct mbuf_class *c = &mbuf_classes[cls];
+
+	c->inuse--;
+	if (c->cached >= c->max_cached) {
+		free(m);
+		return;
+	}
+	insque(m, &c->freelist);
+	m->m_flags = M_FREELIST;
+	c->cached++;
+}
+
+/*
+ * Get an mbuf able to hold at least size bytes of data, from
+ * the free list of the matching class if possible.  Requests larger
+ * than the largest class get an mtu-class mbuf with a malloc()ed
+ * M_EXT buffer
+ */
+struct mbuf *
+m_get_size(int size)
+{
+	register struct mbuf *m;
+	int cls;
+
+	DEBUG_CALL("m_get_size");
+	DEBUG_ARG("size = %d", size);
+
+	cls = mbuf_class_for(size);
+	m = mbuf_block_get(cls < 0 ? MBUF_CLASS_MTU : cls);
+	if (m == NULL) goto end_error;
 
 	/* Insert it in the used list */
 	insque(m,&m_usedlist);
-	m->m_flags = (flags | M_USEDLIST);
+	m->m_flags = M_USEDLIST;
 
 	/* Initialise it */
-	m->m_size = SLIRP_MSIZE - sizeof(struct m_hdr);
+	m->m_class = cls < 0 ? MBUF_CLASS_MTU : cls;
+	m->m_size = mbuf_classes[m->m_class].size;
 	m->m_data = m->m_dat;
 	m->m_len = 0;
         m->m_nextpkt = NULL;
         m->m_prevpkt = NULL;
+
+	if (cls < 0)
+		m_inc(m, size);
 end_error:
 	DEBUG_ARG("m = %lx", (long )m);
 	return m;
 }
 
+/*
+ * Get an mbuf large enough for one whole link-level frame
+ */
+struct mbuf *
+m_get(void)
+{
+	return m_get_size(MBUF_MTU_SIZE);
+}
+
+static void
+m_free_ext(struct mbuf *m)
+{
+	if (m->m_extclass >= 0)
+		mbuf_block_put(m->m_extclass, (struct mbuf *)m->m_ext);
+	else
+		free(m->m_ext);
+}
+
 void
 m_free(struct mbuf *m)
 {
@@ -87,40 +190,40 @@ m_free(struct mbuf *m)
   DEBUG_ARG("m = %lx", (long )m);
 
   if(m) {
+	/* Already released */
+	if (m->m_flags & M_FREELIST)
+	   return;
+
 	/* Remove from m_usedlist */
 	if (m->m_flags & M_USEDLIST)
 	   remque(m);
 
-	/* If it's M_EXT, free() it */
+	/* If it's M_EXT, release it */
 	if (m->m_flags & M_EXT)
-	   free(m->m_ext);
+	   m_free_ext(m);
 
 	/*
-	 * Either free() it or put it on the free list
+	 * Either free() it or put it on its class free list
 	 */
-	if (m->m_flags & M_DOFREE) {
-		free(m);
-		mbuf_alloced--;
-	} else if ((m->m_flags & M_FREELIST) == 0) {
-		insque(m,&m_freelist);
-		m->m_flags = M_FREELIST; /* Clobber other flags */
-	}
+	mbuf_block_put(m->m_class, m);
   } /* if(m) */
 }
 
 /*
  * Copy data from one mbuf to the end of
- * the other.. if result is too big for one mbuf, malloc()
- * an M_EXT data segment
+ * the other.. if result is too big for one mbuf, move it to
+ * an M_EXT data segment of a larger class
  */
 void
 m_cat(struct mbuf *m, struct mbuf *n)
 {
 	/*
-	 * If there's no room, realloc
+	 * If there's no room, grow to exactly what is needed; m_inc
+	 * rounds that up to the next class so further m_cat()s of
+	 * the same datagram fit without another copy
 	 */
 	if (M_FREEROOM(m) < n->m_len)
-		m_inc(m,m->m_size+MINCSIZE);
+		m_inc(m, M_HEADROOM(m) + m->m_len + n->m_len);
 
 	memcpy(m->m_data+m->m_len, n->m_data, n->m_len);
 	m->m_len += n->m_len;
@@ -129,38 +232,61 @@ m_cat(struct mbuf *m, struct mbuf *n)
 }
 
 
-/* make m size bytes large */
+/*
+ * make m size bytes large.  The data, along with everything in
+ * front of it, is copied to an M_EXT buffer of the smallest class
+ * that fits, keeping its offset from the start of the buffer
+ */
 void
 m_inc(struct mbuf *m, int size)
 {
-	int datasize;
+	int cls, headroom;
+	char *dat;
 
-	/* some compiles throw up on gotos.  This one we can fake. */
-        if(m->m_size>size) return;
+        if(m->m_size>=size) return;
 
-        if (m->m_flags & M_EXT) {
-	  datasize = m->m_data - m->m_ext;
-	  m->m_ext = (char *)realloc(m->m_ext,size);
-/*		if (m->m_ext == NULL)
- *			return (struct mbuf *)NULL;
- */
-	  m->m_data = m->m_ext + datasize;
-        } else {
-	  char *dat;
-	  datasize = m->m_data - m->m_dat;
-	  dat = (char *)malloc(size);
-/*		if (dat == NULL)
- *			return (struct mbuf *)NULL;
- */
-	  memcpy(dat, m->m_dat, m->m_size);
+	headroom = M_HEADROOM(m);
+	cls = mbuf_class_for(size);
+	if (cls >= 0) {
+		dat = (char *)mbuf_block_get(cls);
+		size = mbuf_classes[cls].size;
+	} else {
+		dat = (char *)malloc(size);
+	}
+	if (dat == NULL)
+		return;
 
-	  m->m_ext = dat;
-	  m->m_data = m->m_ext + datasize;
-	  m->m_flags |= M_EXT;
-        }
+	memcpy(dat, m->m_data - headroom, headroom + m->m_len);
 
+	if (m->m_flags & M_EXT)
+		m_free_ext(m);
+
+	m->m_ext = dat;
+	m->m_extclass = cls;
+	m->m_data = m->m_ext + headroom;
+	m->m_flags |= M_EXT;
         m->m_size = size;
+}
 
+/*
+ * Report per-class allocator statistics, see libslirp.h
+ */
+int
+slirp_get_mbuf_stats(SlirpMbufStats *stats, int max)
+{
+	int i;
+
+	for (i = 0; i < MBUF_NCLASSES && i < max; i++) {
+		struct mbuf_class *c = &mbuf_classes[i];
+		stats[i].name    = c->name;
+		stats[i].size    = c->size;
+		stats[i].inuse   = c->inuse;
+		stats[i].hiwat   = c->hiwat;
+		stats[i].cached  = c->cached;
+		stats[i].allocs  = c->allocs;
+		stats[i].mallocs = c->mallocs;
+	}
+	return i;
 }
 
 
@@ -38,6 +38,15 @@
 
 #define MINCSIZE 4096	/* Amount to increase mbuf if too small */
 
+/*
+ * Size classes mbufs and their M_EXT buffers are allocated from,
+ * see mbuf.c
+ */
+#define MBUF_CLASS_SMALL	0	/* Headers only, e.g. pure ACKs */
+#define MBUF_CLASS_MTU		1	/* One link-level frame */
+#define MBUF_CLASS_LARGE	2	/* A reassembled IP datagram */
+#define MBUF_NCLASSES		3
+
 /*
  * Macros for type conversion
  * mtod(m,t) -	convert mbuf pointer to data pointer of correct type
@@ -49,9 +58,9 @@
 /* XXX About mbufs for slirp:
  * Only one mbuf is ever used in a chain, for each "cell" of data.
  * m_nextpkt points to the next packet, if fragmented.
- * If the data is too large, the M_EXT is used, and a larger block
- * is alloced.  Therefore, m_free[m] must check for M_EXT and if set
- * free the m_ext.  This is inefficient memory-wise, but who cares.
+ * If the data is too large, the M_EXT is used, and a block of a
+ * larger class is taken.  Therefore, m_free[m] must check for M_EXT
+ * and if set release the m_ext to its class (mh_extclass).
  */
 
 /* XXX should union some of these! */
@@ -62,6 +71,8 @@ struct m_hdr {
 	struct	mbuf *mh_nextpkt;	/* Next packet in queue/record */
 	struct	mbuf *mh_prevpkt; /* Flags aren't used in the output queue */
 	int	mh_flags;	  /* Misc flags */
+	short	mh_class;	/* Size class of the mbuf itself */
+	short	mh_extclass;	/* Size class of m_ext, -1 if malloced */
 
 	int	mh_size;		/* Size of data */
 	struct	socket *mh_so;
@@ -78,6 +89,14 @@ struct m_hdr {
 		   : \
 			(((m)->m_dat + (m)->m_size) - (m)->m_data))
 
+/*
+ * How much room is in front of m_data
+ */
+#define M_HEADROOM(m) ((m->m_flags & M_EXT)? \
+			((m)->m_data - (m)->m_ext) \
+		   : \
+			((m)->m_data - (m)->m_dat))
+
 /*
  * How much free room there is
  */
@@ -103,6 +122,8 @@ struct mbuf {
 #define m_dat		M_dat.m_dat_
 #define m_ext		M_dat.m_ext_
 #define m_so		m_hdr.mh_so
+#define m_class		m_hdr.mh_class
+#define m_extclass	m_hdr.mh_extclass
 
 #define ifq_prev m_prev
 #define ifq_next m_next
@@ -110,11 +131,9 @@ struct mbuf {
 #define ifs_next m_nextpkt
 #define ifq_so m_so
 
-#define M_EXT			0x01	/* m_ext points to more (malloced) data */
+#define M_EXT			0x01	/* m_ext points to more data */
 #define M_FREELIST		0x02	/* mbuf is on free list */
 #define M_USEDLIST		0x04	/* XXX mbuf is on used list (for dtom()) */
-#define M_DOFREE		0x08	/* when m_free is called on the mbuf, free()
-					 * it rather than putting it on the free list */
 
 /*
  * Mbuf statistics. XXX
@@ -126,12 +145,11 @@ struct mbstat {
 };
 
 extern struct	mbstat mbstat;
-extern int mbuf_alloced;
-extern struct mbuf m_freelist, m_usedlist;
-extern int mbuf_max;
+extern struct mbuf m_usedlist;
 
 void m_init _P((void));
 struct mbuf * m_get _P((void));
+struct mbuf * m_get_size _P((int));
 void m_free _P((struct mbuf *));
 void m_cat _P((register struct mbuf *, register struct mbuf *));
 void m_inc _P((struct mbuf *, int));
@@ -39,27 +39,41 @@ sbdrop(struct sbuf *sb, int num)
 
 }
 
+/*
+ * (Re)size a buffer. Data already queued is kept, which allows the
+ * buffer to be resized after the connection has started.
+ */
 void
 sbreserve(struct sbuf *sb, int size)
 {
-	if (sb->sb_data) {
-		/* Already alloced, realloc if necessary */
-		if (sb->sb_datalen != (unsigned)size) {
-			sb->sb_wptr = sb->sb_rptr = sb->sb_data = (char *)realloc(sb->sb_data, size);
+	char *data;
+
+	if (sb->sb_data && sb->sb_datalen == (unsigned)size)
+		return;
+
+	/* Don't shrink below what is queued */
+	if ((unsigned)size < sb->sb_cc)
+		size = (int)sb->sb_cc;
+
+	data = (char *)malloc(size);
+	if (data == NULL) {
+		if (sb->sb_data == NULL) {
+			sb->sb_wptr = sb->sb_rptr = NULL;
 			sb->sb_cc = 0;
-			if (sb->sb_wptr)
-			   sb->sb_datalen = size;
-			else
-			   sb->sb_datalen = 0;
+			sb->sb_datalen = 0;
 		}
-	} else {
-		sb->sb_wptr = sb->sb_rptr = sb->sb_data = (char *)malloc(size);
-		sb->sb_cc = 0;
-		if (sb->sb_wptr)
-		   sb->sb_datalen = size;
-		else
-		   sb->sb_datalen = 0;
+		/* else keep the old buffer */
+		return;
 	}
+	if (sb->sb_cc)
+		sbcopy(sb, 0, sb->sb_cc, data);
+	free(sb->sb_data);
+
+	sb->sb_data = sb->sb_rptr = data;
+	sb->sb_datalen = size;
+	sb->sb_wptr = data + sb->sb_cc;
+	if (sb->sb_wptr >= data + size)
+		sb->sb_wptr = data;
 }
 
 /*
@@ -122,6 +136,16 @@ sbappend(struct socket *so, struct mbuf *m)
 	} /* else */
 	/* Whatever happened, we free the mbuf */
 	m_free(m);
+
+	/*
+	 * The window closes when so_rcv fills, see if the host buffer grew.
+	 * Data usually goes straight to the host socket and so_rcv stays
+	 * empty, so also check once per so_rcv worth of data received.
+	 */
+	if (so->so_tcpcb &&
+	    (sbspace(&so->so_rcv) < so->so_tcpcb->t_maxseg ||
+	     SEQ_GEQ(so->so_tcpcb->rcv_nxt, so->so_tcpcb->rcv_grow)))
+		tcp_sbgrow(so);
 }
 
 /*
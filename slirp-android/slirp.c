@@ -34,6 +34,10 @@
 
 #include "qemu/queue.h"
 
+#ifdef __linux__
+#include <sys/epoll.h>
+#endif
+
 /* proto types */
 static void slirp_net_forward_init(void);
 
@@ -69,13 +73,32 @@ static const uint8_t zero_ethaddr[6] = { 0, 0, 0, 0, 0, 0 };
 const char *slirp_special_ip = CTL_SPECIAL;
 int slirp_restrict;
 static int do_slowtimo;
+static int slirp_timeout_ms = -1;   /* from the last slirp_select_fill() */
 int link_up;
 struct timeval tt;
 FILE *lfd;
 struct ex_list *exec_list;
 
-/* XXX: suppress those select globals */
-fd_set *global_readfds, *global_writefds, *global_xfds;
+/* Socket being handled by slirp_select_poll() and its pending events */
+static struct socket *poll_so;
+static int poll_revents;
+
+#ifdef __linux__
+/*
+ * On Linux, the tcb/udb sockets are registered with an epoll instance
+ * whose fd is the only one slirp adds to the main loop's select() set.
+ * Registrations persist across main loop iterations and are only
+ * updated when a socket's interest changes, and slirp_select_poll()
+ * only visits the sockets that epoll reports ready. This also lifts
+ * the FD_SETSIZE limit on the number of guest connections.
+ */
+#define EPOLL_MAX_EVENTS  256
+
+static int slirp_epoll_fd = -1;
+static struct socket **epoll_sockets;   /* indexed by host fd */
+static int epoll_sockets_size;
+static struct socket *ready_head, *ready_tail;
+#endif
 
 char slirp_hostname[33];
 
@@ -298,6 +321,199 @@ static void updtime(void)
 }
 #endif
 
+#ifdef __linux__
+static void epoll_set_socket(int fd, struct socket *so)
+{
+    if (fd >= epoll_sockets_size) {
+        int size = epoll_sockets_size ? epoll_sockets_size : 256;
+        struct socket **sockets;
+
+        while (size <= fd)
+            size *= 2;
+        sockets = realloc(epoll_sockets, size * sizeof(*sockets));
+        if (sockets == NULL)
+            return;
+        memset(sockets + epoll_sockets_size, 0,
+               (size - epoll_sockets_size) * sizeof(*sockets));
+        epoll_sockets = sockets;
+        epoll_sockets_size = size;
+    }
+    epoll_sockets[fd] = so;
+}
+
+static void epoll_del_socket(struct socket *so)
+{
+    int fd = so->so_pollfd;
+
+    if (fd < 0)
+        return;
+    /* The fd may already be closed, or reused by a newer socket */
+    if (fd < epoll_sockets_size && epoll_sockets[fd] == so) {
+        epoll_ctl(slirp_epoll_fd, EPOLL_CTL_DEL, fd, NULL);
+        epoll_sockets[fd] = NULL;
+    }
+    so->so_pollfd = -1;
+    so->so_events = 0;
+}
+
+/*
+ * Make the epoll registration of a socket match 'events', only
+ * calling into the kernel when something changed.
+ */
+static void epoll_update_socket(struct socket *so, int events)
+{
+    struct epoll_event ev;
+    int op;
+
+    if ((events & ~SO_EV_UDP) == 0 || so->s < 0) {
+        epoll_del_socket(so);
+        return;
+    }
+    if (so->so_pollfd == so->s && so->so_events == events)
+        return;
+
+    if (so->so_pollfd != so->s)
+        epoll_del_socket(so);
+
+    memset(&ev, 0, sizeof(ev));
+    if (events & SO_EV_READ)
+        ev.events |= EPOLLIN;
+    if (events & SO_EV_WRITE)
+        ev.events |= EPOLLOUT;
+    if (events & SO_EV_EXCEPT)
+        ev.events |= EPOLLPRI;
+    ev.data.fd = so->s;
+
+    op = (so->so_pollfd < 0) ? EPOLL_CTL_ADD : EPOLL_CTL_MOD;
+    if (epoll_ctl(slirp_epoll_fd, op, so->s, &ev) < 0) {
+        /* The fd was closed and reopened behind our back */
+        if (op == EPOLL_CTL_MOD && errno == ENOENT)
+            op = EPOLL_CTL_ADD;
+        else if (op == EPOLL_CTL_ADD && errno == EEXIST)
+            op = EPOLL_CTL_MOD;
+        else
+            op = -1;
+        if (op < 0 || epoll_ctl(slirp_epoll_fd, op, so->s, &ev) < 0) {
+            D("%s: epoll_ctl(%d) failed: %s", __FUNCTION__, so->s,
+              errno_str);
+            so->so_pollfd = -1;
+            so->so_events = 0;
+            return;
+        }
+    }
+    so->so_pollfd = so->s;
+    so->so_events = events;
+    epoll_set_socket(so->s, so);
+}
+
+/*
+ * Move the sockets reported ready by epoll to the ready list
+ */
+static void epoll_collect(void)
+{
+    struct epoll_event events[EPOLL_MAX_EVENTS];
+    int n, i;
+
+    do {
+        n = epoll_wait(slirp_epoll_fd, events, EPOLL_MAX_EVENTS, 0);
+        for (i = 0; i < n; i++) {
+            int fd = events[i].data.fd;
+            int revents = 0;
+            struct socket *so = NULL;
+
+            if (fd < epoll_sockets_size)
+                so = epoll_sockets[fd];
+            if (so == NULL || so->so_pollfd != fd) {
+                /* Stale registration */
+                epoll_ctl(slirp_epoll_fd, EPOLL_CTL_DEL, fd, NULL);
+                continue;
+            }
+
+            /* select() reports errors and hangups as readable/writable */
+            if (events[i].events & (EPOLLIN|EPOLLERR|EPOLLHUP))
+                revents |= SO_EV_READ;
+            if (events[i].events & (EPOLLOUT|EPOLLERR|EPOLLHUP))
+                revents |= SO_EV_WRITE;
+            if (events[i].events & EPOLLPRI)
+                revents |= SO_EV_EXCEPT;
+            revents &= so->so_events;
+            if (revents == 0)
+                continue;
+
+            if (so->so_revents == 0) {
+                so->so_ready_next = NULL;
+                if (ready_tail)
+                    ready_tail->so_ready_next = so;
+                else
+                    ready_head = so;
+                ready_tail = so;
+            }
+            so->so_revents |= revents;
+        }
+    } while (n == EPOLL_MAX_EVENTS);
+}
+#endif /* __linux__ */
+
+/*
+ * Register interest in 'events' (SO_EV_*) for a tcb or udb socket
+ */
+static void so_poll_add(struct socket *so, int events, int *pnfds,
+                        fd_set *readfds, fd_set *writefds, fd_set *xfds)
+{
+#ifdef __linux__
+    if (slirp_epoll_fd >= 0) {
+        epoll_update_socket(so, events);
+        return;
+    }
+#endif
+    if (events & SO_EV_READ)
+        FD_SET(so->s, readfds);
+    if (events & SO_EV_WRITE)
+        FD_SET(so->s, writefds);
+    if (events & SO_EV_EXCEPT)
+        FD_SET(so->s, xfds);
+    if ((events & ~SO_EV_UDP) && *pnfds < so->s)
+        *pnfds = so->s;
+}
+
+/*
+ * Called when a socket is freed
+ */
+void so_poll_forget(struct socket *so)
+{
+    if (so == poll_so) {
+        poll_so = NULL;
+        poll_revents = 0;
+    }
+#ifdef __linux__
+    if (so->so_revents) {
+        struct socket **pso, *prev = NULL;
+
+        for (pso = &ready_head; *pso; prev = *pso, pso = &(*pso)->so_ready_next) {
+            if (*pso == so) {
+                *pso = so->so_ready_next;
+                if (ready_tail == so)
+                    ready_tail = prev;
+                break;
+            }
+        }
+        so->so_revents = 0;
+    }
+    if (slirp_epoll_fd >= 0)
+        epoll_del_socket(so);
+#endif
+}
+
+/*
+ * Forget pending events of the socket being polled, e.g. because
+ * it was shut down in that direction while handling another event
+ */
+void so_clear_revents(struct socket *so, int events)
+{
+    if (so == poll_so)
+        poll_revents &= ~events;
+}
+
 void slirp_select_fill(int *pnfds,
                        fd_set *readfds, fd_set *writefds, fd_set *xfds)
 {
@@ -306,12 +522,19 @@ void slirp_select_fill(int *pnfds,
     int nfds;
     int tmp_time;
 
-    /* fail safe */
-    global_readfds = NULL;
-    global_writefds = NULL;
-    global_xfds = NULL;
-
     nfds = *pnfds;
+#ifdef __linux__
+    if (slirp_epoll_fd < 0 && epoll_sockets_size == 0) {
+        slirp_epoll_fd = epoll_create(EPOLL_MAX_EVENTS);
+        if (slirp_epoll_fd < 0) {
+            D("%s: epoll_create failed, using select(): %s", __FUNCTION__,
+              errno_str);
+            epoll_sockets_size = -1;   /* don't retry */
+        } else {
+            fcntl(slirp_epoll_fd, F_SETFD, FD_CLOEXEC);
+        }
+    }
+#endif
 	/*
 	 * First, TCP sockets
 	 */
@@ -325,6 +548,8 @@ void slirp_select_fill(int *pnfds,
                 (&ipq.ip_link != ipq.ip_link.next));
 
 		for (so = tcb.so_next; so != &tcb; so = so_next) {
+			int events = 0;
+
 			so_next = so->so_next;
 
 			/*
@@ -338,60 +563,56 @@ void slirp_select_fill(int *pnfds,
 			 * newly socreated() sockets etc. Don't want to select these.
 	 		 */
 			if (so->so_state & SS_NOFDREF || so->s == -1)
-			   continue;
+			   events = 0;
 
             /*
              * don't register proxified socked connections here
              */
-            if ((so->so_state & SS_PROXIFIED) != 0)
-	            continue;
+            else if ((so->so_state & SS_PROXIFIED) != 0)
+	            events = 0;
 
 			/*
 			 * Set for reading sockets which are accepting
 			 */
-			if (so->so_state & SS_FACCEPTCONN) {
-                                FD_SET(so->s, readfds);
-				UPD_NFDS(so->s);
-				continue;
-			}
+			else if (so->so_state & SS_FACCEPTCONN)
+				events = SO_EV_READ;
 
 			/*
 			 * Set for writing sockets which are connecting
 			 */
-			if (so->so_state & SS_ISFCONNECTING) {
-				FD_SET(so->s, writefds);
-				UPD_NFDS(so->s);
-				continue;
-			}
+			else if (so->so_state & SS_ISFCONNECTING)
+				events = SO_EV_WRITE;
 
-			/*
-			 * Set for writing if we are connected, can send more, and
-			 * we have something to send
-			 */
-			if (CONN_CANFSEND(so) && so->so_rcv.sb_cc) {
-				FD_SET(so->s, writefds);
-				UPD_NFDS(so->s);
-			}
+			else {
+				/*
+				 * Set for writing if we are connected, can send more, and
+				 * we have something to send
+				 */
+				if (CONN_CANFSEND(so) && so->so_rcv.sb_cc)
+					events |= SO_EV_WRITE;
 
-			/*
-			 * Set for reading (and urgent data) if we are connected, can
-			 * receive more, and we have room for it XXX /2 ?
-			 */
-			if (CONN_CANFRCV(so) && (so->so_snd.sb_cc < (so->so_snd.sb_datalen/2))) {
-				FD_SET(so->s, readfds);
-				FD_SET(so->s, xfds);
-				UPD_NFDS(so->s);
+				/*
+				 * Set for reading (and urgent data) if we are connected, can
+				 * receive more, and we have room for it XXX /2 ?
+				 */
+				if (CONN_CANFRCV(so) && (so->so_snd.sb_cc < (so->so_snd.sb_datalen/2)))
+					events |= SO_EV_READ|SO_EV_EXCEPT;
 			}
+			so_poll_add(so, events, &nfds, readfds, writefds, xfds);
 		}
 
 		/*
 		 * UDP sockets
 		 */
 		for (so = udb.so_next; so != &udb; so = so_next) {
+			int events = SO_EV_UDP;
+
 			so_next = so->so_next;
 
-            if ((so->so_state & SS_PROXIFIED) != 0)
+            if ((so->so_state & SS_PROXIFIED) != 0) {
+                so_poll_add(so, events, &nfds, readfds, writefds, xfds);
                 continue;
+            }
 
 			/*
 			 * See if it's timed out
@@ -414,11 +635,18 @@ void slirp_select_fill(int *pnfds,
 			 * if the packets needed to be fragmented
 			 * (XXX <= 4 ?)
 			 */
-			if ((so->so_state & SS_ISFCONNECTED) && so->so_queued <= 4) {
-				FD_SET(so->s, readfds);
-				UPD_NFDS(so->s);
-			}
+			if (so->s != -1 &&
+			    (so->so_state & SS_ISFCONNECTED) && so->so_queued <= 4)
+				events |= SO_EV_READ;
+			so_poll_add(so, events, &nfds, readfds, writefds, xfds);
+		}
+
+#ifdef __linux__
+		if (slirp_epoll_fd >= 0) {
+			FD_SET(slirp_epoll_fd, readfds);
+			UPD_NFDS(slirp_epoll_fd);
 		}
+#endif
 	}
 
 	/*
@@ -454,22 +682,180 @@ void slirp_select_fill(int *pnfds,
 			   timeout.tv_usec = (u_int)tmp_time;
 		}
 	}
-    /*
-     * now, the proxified sockets
-     */
-    proxy_manager_select_fill(&nfds, readfds, writefds, xfds);
+	slirp_timeout_ms = (timeout.tv_usec < 0) ? -1 : (timeout.tv_usec + 999) / 1000;
 
         *pnfds = nfds;
 }
 
+void slirp_update_timeout(int *timeout)
+{
+    if (slirp_timeout_ms >= 0 &&
+        (*timeout < 0 || *timeout > slirp_timeout_ms))
+        *timeout = slirp_timeout_ms;
+}
+
+/*
+ * Handle the poll_revents of a TCP socket
+ */
+static void sopoll_tcp(struct socket *so)
+{
+	int ret;
+
+	/*
+	 * FD_ISSET is meaningless on these sockets
+	 * (and they can crash the program)
+	 */
+	if (so->so_state & SS_NOFDREF || so->s == -1)
+	   return;
+
+	/*
+	 * proxified sockets are polled later in
+	 * slirp_select_poll().
+	 */
+	if ((so->so_state & SS_PROXIFIED) != 0)
+	   return;
+
+	/*
+	 * Check for URG data
+	 * This will soread as well, so no need to
+	 * test for readfds below if this succeeds
+	 */
+	if (poll_revents & SO_EV_EXCEPT)
+	   sorecvoob(so);
+	/*
+	 * Check sockets for reading
+	 */
+	else if (poll_revents & SO_EV_READ) {
+		/*
+		 * Check for incoming connections
+		 */
+		if (so->so_state & SS_FACCEPTCONN) {
+			tcp_connect(so);
+			return;
+		} /* else */
+		ret = soread(so);
+
+		/* Output it if we read something */
+		if (ret > 0)
+		   tcp_output(sototcpcb(so));
+	}
+
+	/*
+	 * The socket was freed while reading, e.g. by tcp_close()
+	 * on a reset: so_poll_forget() cleared poll_so.
+	 */
+	if (poll_so == NULL)
+	   return;
+
+	/*
+	 * Check sockets for writing
+	 */
+	if (poll_revents & SO_EV_WRITE) {
+	  /*
+	   * Check for non-blocking, still-connecting sockets
+	   */
+	  if (so->so_state & SS_ISFCONNECTING) {
+	    /* Connected */
+	    so->so_state &= ~SS_ISFCONNECTING;
+
+	    ret = socket_send(so->s, (const void *)&ret, 0);
+	    if (ret < 0) {
+	      /* XXXXX Must fix, zero bytes is a NOP */
+	      if (errno == EAGAIN || errno == EWOULDBLOCK ||
+		  errno == EINPROGRESS || errno == ENOTCONN)
+		return;
+
+	      /* else failed */
+	      so->so_state = SS_NOFDREF;
+	    }
+	    /* else so->so_state &= ~SS_ISFCONNECTING; */
+
+	    /*
+	     * Continue tcp_input
+	     */
+	    tcp_input((struct mbuf *)NULL, sizeof(struct ip), so);
+	    /* continue; */
+	  } else
+	    ret = sowrite(so);
+	  /*
+	   * XXXXX If we wrote something (a lot), there
+	   * could be a need for a window update.
+	   * In the worst case, the remote will send
+	   * a window probe to get things going again
+	   */
+	  if (poll_so == NULL)
+	    return;
+	}
+
+	/*
+	 * Probe a still-connecting, non-blocking socket
+	 * to check if it's still alive
+ 	 */
+#ifdef PROBE_CONN
+	if (so->so_state & SS_ISFCONNECTING) {
+	  ret = socket_recv(so->s, (char *)&ret, 0);
+
+	  if (ret < 0) {
+	    /* XXX */
+	    if (errno == EAGAIN || errno == EWOULDBLOCK ||
+		errno == EINPROGRESS || errno == ENOTCONN)
+	      return; /* Still connecting, continue */
+
+	    /* else failed */
+	    so->so_state = SS_NOFDREF;
+
+	    /* tcp_input will take care of it */
+	  } else {
+	    ret = socket_send(so->s, &ret, 0);
+	    if (ret < 0) {
+	      /* XXX */
+	      if (errno == EAGAIN || errno == EWOULDBLOCK ||
+		  errno == EINPROGRESS || errno == ENOTCONN)
+		return;
+	      /* else failed */
+	      so->so_state = SS_NOFDREF;
+	    } else
+	      so->so_state &= ~SS_ISFCONNECTING;
+
+	  }
+	  tcp_input((struct mbuf *)NULL, sizeof(struct ip),so);
+	} /* SS_ISFCONNECTING */
+#endif
+}
+
+/*
+ * Handle the poll_revents of a UDP socket.
+ * Incoming packets are sent straight away, they're not buffered.
+ * Incoming UDP data isn't buffered either.
+ */
+static void sopoll_udp(struct socket *so)
+{
+	if ((so->so_state & SS_PROXIFIED) != 0)
+	   return;
+
+	if (so->s != -1 && (poll_revents & SO_EV_READ))
+	    sorecvfrom(so);
+}
+
+static int so_fd_revents(struct socket *so,
+                         fd_set *readfds, fd_set *writefds, fd_set *xfds)
+{
+    int revents = 0;
+
+    if (so->s == -1)
+        return 0;
+    if (FD_ISSET(so->s, readfds))
+        revents |= SO_EV_READ;
+    if (FD_ISSET(so->s, writefds))
+        revents |= SO_EV_WRITE;
+    if (FD_ISSET(so->s, xfds))
+        revents |= SO_EV_EXCEPT;
+    return revents;
+}
+
 void slirp_select_poll(fd_set *readfds, fd_set *writefds, fd_set *xfds)
 {
     struct socket *so, *so_next;
-    int ret;
-
-    global_readfds = readfds;
-    global_writefds = writefds;
-    global_xfds = xfds;
 
 	/* Update time */
 	updtime();
@@ -492,6 +878,33 @@ void slirp_select_poll(fd_set *readfds, fd_set *writefds, fd_set *xfds)
 	/*
 	 * Check sockets
 	 */
+#ifdef __linux__
+	if (link_up && slirp_epoll_fd >= 0) {
+		/*
+		 * Only visit the sockets that epoll reported ready.
+		 * Handlers may free other sockets, so_poll_forget() then
+		 * unlinks them from the ready list.
+		 */
+		if (FD_ISSET(slirp_epoll_fd, readfds))
+			epoll_collect();
+
+		while ((so = ready_head) != NULL) {
+			ready_head = so->so_ready_next;
+			if (ready_head == NULL)
+				ready_tail = NULL;
+			so->so_ready_next = NULL;
+
+			poll_so = so;
+			poll_revents = so->so_revents;
+			so->so_revents = 0;
+			if (so->so_events & SO_EV_UDP)
+				sopoll_udp(so);
+			else
+				sopoll_tcp(so);
+		}
+		poll_so = NULL;
+	} else
+#endif
 	if (link_up) {
 		/*
 		 * Check TCP sockets
@@ -499,155 +912,29 @@ void slirp_select_poll(fd_set *readfds, fd_set *writefds, fd_set *xfds)
 		for (so = tcb.so_next; so != &tcb; so = so_next) {
 			so_next = so->so_next;
 
-			/*
-			 * FD_ISSET is meaningless on these sockets
-			 * (and they can crash the program)
-			 */
-			if (so->so_state & SS_NOFDREF || so->s == -1)
-			   continue;
-
-            /*
-             * proxified sockets are polled later in this
-             * function.
-             */
-            if ((so->so_state & SS_PROXIFIED) != 0)
-                continue;
-
-			/*
-			 * Check for URG data
-			 * This will soread as well, so no need to
-			 * test for readfds below if this succeeds
-			 */
-			if (FD_ISSET(so->s, xfds))
-			   sorecvoob(so);
-			/*
-			 * Check sockets for reading
-			 */
-			else if (FD_ISSET(so->s, readfds)) {
-				/*
-				 * Check for incoming connections
-				 */
-				if (so->so_state & SS_FACCEPTCONN) {
-					tcp_connect(so);
-					continue;
-				} /* else */
-				ret = soread(so);
-
-				/* Output it if we read something */
-				if (ret > 0)
-				   tcp_output(sototcpcb(so));
-			}
-
-			/*
-			 * Check sockets for writing
-			 */
-			if (FD_ISSET(so->s, writefds)) {
-			  /*
-			   * Check for non-blocking, still-connecting sockets
-			   */
-			  if (so->so_state & SS_ISFCONNECTING) {
-			    /* Connected */
-			    so->so_state &= ~SS_ISFCONNECTING;
-
-			    ret = socket_send(so->s, (const void *)&ret, 0);
-			    if (ret < 0) {
-			      /* XXXXX Must fix, zero bytes is a NOP */
-			      if (errno == EAGAIN || errno == EWOULDBLOCK ||
-				  errno == EINPROGRESS || errno == ENOTCONN)
-				continue;
-
-			      /* else failed */
-			      so->so_state = SS_NOFDREF;
-			    }
-			    /* else so->so_state &= ~SS_ISFCONNECTING; */
-
-			    /*
-			     * Continue tcp_input
-			     */
-			    tcp_input((struct mbuf *)NULL, sizeof(struct ip), so);
-			    /* continue; */
-			  } else
-			    ret = sowrite(so);
-			  /*
-			   * XXXXX If we wrote something (a lot), there
-			   * could be a need for a window update.
-			   * In the worst case, the remote will send
-			   * a window probe to get things going again
-			   */
-			}
-
-			/*
-			 * Probe a still-connecting, non-blocking socket
-			 * to check if it's still alive
-	 	 	 */
-#ifdef PROBE_CONN
-			if (so->so_state & SS_ISFCONNECTING) {
-			  ret = socket_recv(so->s, (char *)&ret, 0);
-
-			  if (ret < 0) {
-			    /* XXX */
-			    if (errno == EAGAIN || errno == EWOULDBLOCK ||
-				errno == EINPROGRESS || errno == ENOTCONN)
-			      continue; /* Still connecting, continue */
-
-			    /* else failed */
-			    so->so_state = SS_NOFDREF;
-
-			    /* tcp_input will take care of it */
-			  } else {
-			    ret = socket_send(so->s, &ret, 0);
-			    if (ret < 0) {
-			      /* XXX */
-			      if (errno == EAGAIN || errno == EWOULDBLOCK ||
-				  errno == EINPROGRESS || errno == ENOTCONN)
-				continue;
-			      /* else failed */
-			      so->so_state = SS_NOFDREF;
-			    } else
-			      so->so_state &= ~SS_ISFCONNECTING;
-
-			  }
-			  tcp_input((struct mbuf *)NULL, sizeof(struct ip),so);
-			} /* SS_ISFCONNECTING */
-#endif
+			poll_so = so;
+			poll_revents = so_fd_revents(so, readfds, writefds, xfds);
+			sopoll_tcp(so);
 		}
 
 		/*
 		 * Now UDP sockets.
-		 * Incoming packets are sent straight away, they're not buffered.
-		 * Incoming UDP data isn't buffered either.
 		 */
 		for (so = udb.so_next; so != &udb; so = so_next) {
 			so_next = so->so_next;
 
-            if ((so->so_state & SS_PROXIFIED) != 0)
-                continue;
-
-			if (so->s != -1 && FD_ISSET(so->s, readfds)) {
-                            sorecvfrom(so);
-                        }
+			poll_so = so;
+			poll_revents = so_fd_revents(so, readfds, writefds, xfds);
+			sopoll_udp(so);
 		}
+		poll_so = NULL;
 	}
 
-    /*
-     * Now the proxified sockets
-     */
-    proxy_manager_poll(readfds, writefds, xfds);
-
 	/*
 	 * See if we can start outputting
 	 */
 	if (if_queued && link_up)
 	   if_start();
-
-	/* clear global file descriptor sets.
-	 * these reside on the stack in vl.c
-	 * so they're unusable if we're not in
-	 * slirp_select_fill or slirp_select_poll.
-	 */
-	 global_readfds = NULL;
-	 global_writefds = NULL;
-	 global_xfds = NULL;
 }
 
 #define ETH_ALEN 6
@@ -756,13 +1043,10 @@ void slirp_input(const uint8_t *pkt, int pkt_len)
         arp_input(pkt, pkt_len);
         break;
     case ETH_P_IP:
-        m = m_get();
+        /* Note: we add to align the IP header */
+        m = m_get_size(pkt_len + 2);
         if (!m)
             return;
-        /* Note: we add to align the IP header */
-        if (M_FREEROOM(m) < pkt_len + 2) {
-            m_inc(m, pkt_len + 2);
-        }
         m->m_len = pkt_len + 2;
         memcpy(m->m_data + 2, pkt, pkt_len);
 
@@ -1440,6 +1724,7 @@ static int slirp_socket_load(QEMUFile *f, struct socket *so)
     so->so_laddr_ip = qemu_get_be32(f);
     so->so_faddr_port = qemu_get_be16(f);
     so->so_laddr_port = qemu_get_be16(f);
+    sohash(&tcb, so);
     so->so_iptos = qemu_get_byte(f);
     so->so_emu = qemu_get_byte(f);
     so->so_type = qemu_get_byte(f);
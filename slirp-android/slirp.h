@@ -244,6 +244,7 @@ int ip_output _P((struct socket *, struct mbuf *));
 /* tcp_input.c */
 void tcp_input _P((register struct mbuf *, int, struct socket *));
 int tcp_mss _P((register struct tcpcb *, u_int));
+void tcp_sbgrow _P((struct socket *));
 
 /* tcp_output.c */
 int tcp_output _P((register struct tcpcb *));
@@ -28,12 +28,76 @@ so_init()
 }
 #endif
 
+static struct socket *tcb_hash[SO_HASH_SIZE];
+static struct socket *udb_hash[SO_HASH_SIZE];
+
+static inline u_int
+sohashkey(uint32_t laddr, u_int lport, uint32_t faddr, u_int fport)
+{
+	uint32_t h;
+
+	h = laddr ^ (faddr * 0x9e3779b1u) ^ ((uint32_t)lport << 16 | fport);
+	h ^= h >> 16;
+	h *= 0x85ebca6bu;
+	h ^= h >> 13;
+	return h & (SO_HASH_SIZE - 1);
+}
+
+static void
+sounhash(struct socket *so)
+{
+	if (so->so_hash_pprev == NULL)
+		return;
+	if (so->so_hash_next)
+		so->so_hash_next->so_hash_pprev = so->so_hash_pprev;
+	*so->so_hash_pprev = so->so_hash_next;
+	so->so_hash_next = NULL;
+	so->so_hash_pprev = NULL;
+}
+
+/*
+ * (Re)insert a socket in the lookup hash of its list, must be
+ * called whenever the address fields of a socket in tcb or udb
+ * change. TCP sockets are keyed on the full 4-tuple, UDP sockets
+ * on the local address and port only, see udp_input().
+ */
+void
+sohash(struct socket *head, struct socket *so)
+{
+	struct socket **bucket;
+
+	sounhash(so);
+	if (head == &udb)
+		bucket = &udb_hash[sohashkey(so->so_laddr_ip, so->so_laddr_port, 0, 0)];
+	else
+		bucket = &tcb_hash[sohashkey(so->so_laddr_ip, so->so_laddr_port,
+		                             so->so_faddr_ip, so->so_faddr_port)];
+
+	so->so_hash_next = *bucket;
+	if (*bucket)
+		(*bucket)->so_hash_pprev = &so->so_hash_next;
+	*bucket = so;
+	so->so_hash_pprev = bucket;
+}
+
 struct socket *
 solookup(struct socket *head, uint32_t laddr, u_int lport,
          uint32_t faddr, u_int fport)
 {
 	struct socket *so;
 
+	if (head == &tcb) {
+		so = tcb_hash[sohashkey(laddr, lport, faddr, fport)];
+		for (; so != NULL; so = so->so_hash_next) {
+			if (so->so_laddr_port == lport &&
+			    so->so_laddr_ip   == laddr &&
+			    so->so_faddr_ip   == faddr &&
+			    so->so_faddr_port == fport)
+				return so;
+		}
+		return (struct socket *)NULL;
+	}
+
 	for (so = head->so_next; so != head; so = so->so_next) {
 		if (so->so_laddr_port == lport &&
 		    so->so_laddr_ip   == laddr &&
@@ -48,6 +112,23 @@ solookup(struct socket *head, uint32_t laddr, u_int lport,
 
 }
 
+/*
+ * Find the UDP socket bound to a guest address and port
+ */
+struct socket *
+solookup_udp(uint32_t laddr, u_int lport)
+{
+	struct socket *so;
+
+	so = udb_hash[sohashkey(laddr, lport, 0, 0)];
+	for (; so != NULL; so = so->so_hash_next) {
+		if (so->so_laddr_port == lport &&
+		    so->so_laddr_ip   == laddr)
+			return so;
+	}
+	return (struct socket *)NULL;
+}
+
 /*
  * Create a new socket, initialise the fields
  * It is the responsibility of the caller to
@@ -63,6 +144,7 @@ socreate(void)
     memset(so, 0, sizeof(struct socket));
     so->so_state = SS_NOFDREF;
     so->s = -1;
+    so->so_pollfd = -1;
   }
   return(so);
 }
@@ -87,6 +169,9 @@ sofree(struct socket *so)
 
   m_free(so->so_m);
 
+  sounhash(so);
+  so_poll_forget(so);
+
   if(so->so_next && so->so_prev)
     remque(so);  /* crashes if so is not in a queue */
 
@@ -217,6 +302,10 @@ soread(struct socket *so)
 	sb->sb_wptr += nn;
 	if (sb->sb_wptr >= (sb->sb_data + sb->sb_datalen))
 		sb->sb_wptr -= sb->sb_datalen;
+
+	/* The host may have more for us than fits, see if it grew its buffer */
+	if (sbspace(sb) < so->so_tcpcb->t_maxseg)
+		tcp_sbgrow(so);
 	return nn;
 }
 
@@ -666,6 +755,8 @@ solisten(u_int port, u_int32_t laddr, u_int lport, int flags)
     else
         so->so_faddr_ip = addr_ip;
 
+	sohash(&tcb, so);
+
 	so->s = s;
 	return so;
 }
@@ -748,9 +839,7 @@ sofcantrcvmore(struct socket *so)
 {
 	if ((so->so_state & SS_NOFDREF) == 0) {
 		shutdown(so->s,0);
-		if(global_writefds) {
-		  FD_CLR(so->s,global_writefds);
-		}
+		so_clear_revents(so, SO_EV_WRITE);
 	}
 	so->so_state &= ~(SS_ISFCONNECTING);
 	if (so->so_state & SS_FCANTSENDMORE)
@@ -764,12 +853,7 @@ sofcantsendmore(struct socket *so)
 {
 	if ((so->so_state & SS_NOFDREF) == 0) {
             shutdown(so->s,1);           /* send FIN to fhost */
-            if (global_readfds) {
-                FD_CLR(so->s,global_readfds);
-            }
-            if (global_xfds) {
-                FD_CLR(so->s,global_xfds);
-            }
+            so_clear_revents(so, SO_EV_READ|SO_EV_EXCEPT);
 	}
 	so->so_state &= ~(SS_ISFCONNECTING);
 	if (so->so_state & SS_FCANTRCVMORE)
@@ -52,8 +52,29 @@ struct socket {
   struct sbuf so_rcv;		/* Receive buffer */
   struct sbuf so_snd;		/* Send buffer */
   void * extra;			/* Extra pointer */
+
+  struct socket *so_hash_next;	/* solookup() hash chain */
+  struct socket **so_hash_pprev;	/* NULL if not hashed */
+
+  int	so_events;		/* SO_EV_* interest registered with the poller */
+  int	so_pollfd;		/* fd so_events was registered for, or -1 */
+  int	so_revents;		/* SO_EV_* reported by the poller, not yet handled */
+  struct socket *so_ready_next;	/* Ready list link, valid while so_revents != 0 */
 };
 
+/*
+ * Hash table size for solookup(), must be a power of 2
+ */
+#define SO_HASH_SIZE		1024
+
+/*
+ * Poller event bits for so_events/so_revents
+ */
+#define SO_EV_READ		0x1
+#define SO_EV_WRITE		0x2
+#define SO_EV_EXCEPT		0x4
+#define SO_EV_UDP		0x8	/* Not an event: so is in udb, not tcb */
+
 
 /*
  * Socket state bits. (peer means the host on the Internet,
@@ -78,6 +99,10 @@ extern struct socket tcb;
 
 void so_init _P((void));
 struct socket * solookup _P((struct socket *, uint32_t, u_int, uint32_t, u_int));
+struct socket * solookup_udp _P((uint32_t, u_int));
+void sohash _P((struct socket *, struct socket *));
+void so_clear_revents _P((struct socket *, int));
+void so_poll_forget _P((struct socket *));
 struct socket * socreate _P((void));
 void sofree _P((struct socket *));
 int soread _P((struct socket *));
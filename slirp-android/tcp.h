@@ -46,8 +46,13 @@ typedef	u_int32_t	tcp_seq;
 
 extern struct socket *tcp_last_so;
 
+/*
+ * Initial socket buffer sizes. tcp_sbgrow() grows them to match the
+ * kernel buffers of the host socket, up to TCP_MAXSPACE, when they fill.
+ */
 #define TCP_SNDSPACE 8192
 #define TCP_RCVSPACE 8192
+#define TCP_MAXSPACE (256*1024)
 
 /*
  * TCP header.
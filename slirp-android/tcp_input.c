@@ -109,7 +109,8 @@ tcp_seq tcp_iss;                /* tcp initial send seq # */
 }
 #endif
 static void tcp_dooptions(struct tcpcb *tp, u_char *cp, int cnt,
-                          struct tcpiphdr *ti);
+                          struct tcpiphdr *ti, int *ts_present,
+                          u_int32_t *ts_val, u_int32_t *ts_ecr);
 static void tcp_xmit_timer(register struct tcpcb *tp, int rtt);
 
 static int
@@ -245,7 +246,8 @@ tcp_input(struct mbuf *m, int iphlen, struct socket *inso)
 	int iss = 0;
 	u_long tiwin;
 	int ret;
-/*	int ts_present = 0; */
+	int ts_present = 0;
+	u_int32_t ts_val = 0, ts_ecr = 0;
     struct ex_list *ex_ptr;
 
 	DEBUG_CALL("tcp_input");
@@ -266,6 +268,17 @@ tcp_input(struct mbuf *m, int iphlen, struct socket *inso)
 		tiwin = ti->ti_win;
 		tiflags = ti->ti_flags;
 
+		/*
+		 * The options of the saved SYN still follow its TCP
+		 * header in the mbuf, pick them up again for
+		 * tcp_dooptions().
+		 */
+		off = ti->ti_off << 2;
+		if (off > (int)sizeof (struct tcphdr)) {
+		  optlen = off - sizeof (struct tcphdr);
+		  optp = (caddr_t)ti + sizeof (struct tcpiphdr);
+		}
+
 		goto cont_conn;
 	}
 
@@ -330,17 +343,20 @@ tcp_input(struct mbuf *m, int iphlen, struct socket *inso)
 		 * quickly get the values now and not bother calling
 		 * tcp_dooptions(), etc.
 		 */
-/*		if ((optlen == TCPOLEN_TSTAMP_APPA ||
- *		     (optlen > TCPOLEN_TSTAMP_APPA &&
- *			optp[TCPOLEN_TSTAMP_APPA] == TCPOPT_EOL)) &&
- *		     *(u_int32_t *)optp == htonl(TCPOPT_TSTAMP_HDR) &&
- *		     (ti->ti_flags & TH_SYN) == 0) {
- *			ts_present = 1;
- *			ts_val = ntohl(*(u_int32_t *)(optp + 4));
- *			ts_ecr = ntohl(*(u_int32_t *)(optp + 8));
- *			optp = NULL;   / * we've parsed the options * /
- *		}
- */
+		if ((optlen == TCPOLEN_TSTAMP_APPA ||
+		     (optlen > TCPOLEN_TSTAMP_APPA &&
+			optp[TCPOLEN_TSTAMP_APPA] == TCPOPT_EOL)) &&
+		     optp[0] == TCPOPT_NOP && optp[1] == TCPOPT_NOP &&
+		     optp[2] == TCPOPT_TIMESTAMP &&
+		     optp[3] == TCPOLEN_TIMESTAMP &&
+		     (ti->ti_flags & TH_SYN) == 0) {
+			ts_present = 1;
+			memcpy(&ts_val, optp + 4, sizeof(ts_val));
+			memcpy(&ts_ecr, optp + 8, sizeof(ts_ecr));
+			NTOHL(ts_val);
+			NTOHL(ts_ecr);
+			optp = NULL;	/* we've parsed the options */
+		}
 	}
 	tiflags = ti->ti_flags;
 
@@ -422,6 +438,7 @@ findso:
 	  so->so_laddr_port = port_geth(ti->ti_sport);
 	  so->so_faddr_ip   = ip_geth(ti->ti_dst);
 	  so->so_faddr_port = port_geth(ti->ti_dport);
+	  sohash(&tcb, so);
 
 	  if ((so->so_iptos = tcp_tos(so)) == 0)
 	    so->so_iptos = ((struct ip *)ti)->ip_tos;
@@ -447,10 +464,9 @@ findso:
 		goto drop;
 
 	/* Unscale the window into a 32-bit value. */
-/*	if ((tiflags & TH_SYN) == 0)
- *		tiwin = ti->ti_win << tp->snd_scale;
- *	else
- */
+	if ((tiflags & TH_SYN) == 0)
+		tiwin = (u_long)ti->ti_win << tp->snd_scale;
+	else
 		tiwin = ti->ti_win;
 
 	/*
@@ -468,9 +484,8 @@ findso:
 	 * else do it below (after getting remote address).
 	 */
 	if (optp && tp->t_state != TCPS_LISTEN)
-		tcp_dooptions(tp, (u_char *)optp, optlen, ti);
-/* , */
-/*			&ts_present, &ts_val, &ts_ecr); */
+		tcp_dooptions(tp, (u_char *)optp, optlen, ti,
+			&ts_present, &ts_val, &ts_ecr);
 
 	/*
 	 * Header prediction: check for the two common cases
@@ -492,7 +507,7 @@ findso:
 	 */
 	if (tp->t_state == TCPS_ESTABLISHED &&
 	    (tiflags & (TH_SYN|TH_FIN|TH_RST|TH_URG|TH_ACK)) == TH_ACK &&
-/*	    (!ts_present || TSTMP_GEQ(ts_val, tp->ts_recent)) && */
+	    (!ts_present || TSTMP_GEQ(ts_val, tp->ts_recent)) &&
 	    ti->ti_seq == tp->rcv_nxt &&
 	    tiwin && tiwin == tp->snd_wnd &&
 	    tp->snd_nxt == tp->snd_max) {
@@ -500,12 +515,11 @@ findso:
 		 * If last ACK falls within this segment's sequence numbers,
 		 *  record the timestamp.
 		 */
-/*		if (ts_present && SEQ_LEQ(ti->ti_seq, tp->last_ack_sent) &&
- *		   SEQ_LT(tp->last_ack_sent, ti->ti_seq + ti->ti_len)) {
- *			tp->ts_recent_age = tcp_now;
- *			tp->ts_recent = ts_val;
- *		}
- */
+		if (ts_present && SEQ_LEQ(ti->ti_seq, tp->last_ack_sent) &&
+		   SEQ_LT(tp->last_ack_sent, ti->ti_seq + ti->ti_len)) {
+			tp->ts_recent_age = tcp_now;
+			tp->ts_recent = ts_val;
+		}
 		if (ti->ti_len == 0) {
 			if (SEQ_GT(ti->ti_ack, tp->snd_una) &&
 			    SEQ_LEQ(ti->ti_ack, tp->snd_max) &&
@@ -514,10 +528,9 @@ findso:
 				 * this is a pure ack for outstanding data.
 				 */
 				STAT(tcpstat.tcps_predack++);
-/*				if (ts_present)
- *					tcp_xmit_timer(tp, tcp_now-ts_ecr+1);
- *				else
- */				     if (tp->t_rtt &&
+				if (ts_present && ts_ecr)
+					tcp_xmit_timer(tp, tcp_now-ts_ecr+1);
+				else if (tp->t_rtt &&
 					    SEQ_GT(ti->ti_ack, tp->t_rtseq))
 					tcp_xmit_timer(tp, tp->t_rtt);
 				acked = ti->ti_ack - tp->snd_una;
@@ -721,9 +734,8 @@ findso:
 	  tcp_template(tp);
 
 	  if (optp)
-	    tcp_dooptions(tp, (u_char *)optp, optlen, ti);
-	  /* , */
-	  /*				&ts_present, &ts_val, &ts_ecr); */
+	    tcp_dooptions(tp, (u_char *)optp, optlen, ti,
+			  &ts_present, &ts_val, &ts_ecr);
 
 	  if (iss)
 	    tp->iss = iss;
@@ -782,12 +794,11 @@ findso:
 			tp->t_state = TCPS_ESTABLISHED;
 
 			/* Do window scaling on this connection? */
-/*			if ((tp->t_flags & (TF_RCVD_SCALE|TF_REQ_SCALE)) ==
- *				(TF_RCVD_SCALE|TF_REQ_SCALE)) {
- * 				tp->snd_scale = tp->requested_s_scale;
- *				tp->rcv_scale = tp->request_r_scale;
- *			}
- */
+			if ((tp->t_flags & (TF_RCVD_SCALE|TF_REQ_SCALE)) ==
+				(TF_RCVD_SCALE|TF_REQ_SCALE)) {
+				tp->snd_scale = tp->requested_s_scale;
+				tp->rcv_scale = tp->request_r_scale;
+			}
 			(void) tcp_reass(tp, (struct tcpiphdr *)0,
 				(struct mbuf *)0);
 			/*
@@ -828,31 +839,30 @@ trimthenstep6:
 	 * RFC 1323 PAWS: If we have a timestamp reply on this segment
 	 * and it's less than ts_recent, drop it.
 	 */
-/*	if (ts_present && (tiflags & TH_RST) == 0 && tp->ts_recent &&
- *	    TSTMP_LT(ts_val, tp->ts_recent)) {
- *
- */		/* Check to see if ts_recent is over 24 days old.  */
-/*		if ((int)(tcp_now - tp->ts_recent_age) > TCP_PAWS_IDLE) {
- */			/*
- *			 * Invalidate ts_recent.  If this segment updates
- *			 * ts_recent, the age will be reset later and ts_recent
- *			 * will get a valid value.  If it does not, setting
- *			 * ts_recent to zero will at least satisfy the
- *			 * requirement that zero be placed in the timestamp
- *			 * echo reply when ts_recent isn't valid.  The
- *			 * age isn't reset until we get a valid ts_recent
- *			 * because we don't want out-of-order segments to be
- *			 * dropped when ts_recent is old.
- *			 */
-/*			tp->ts_recent = 0;
- *		} else {
- *			tcpstat.tcps_rcvduppack++;
- *			tcpstat.tcps_rcvdupbyte += ti->ti_len;
- *			tcpstat.tcps_pawsdrop++;
- *			goto dropafterack;
- *		}
- *	}
- */
+	if (ts_present && (tiflags & TH_RST) == 0 && tp->ts_recent &&
+	    TSTMP_LT(ts_val, tp->ts_recent)) {
+
+		/* Check to see if ts_recent is over 24 days old.  */
+		if ((int)(tcp_now - tp->ts_recent_age) > TCP_PAWS_IDLE) {
+			/*
+			 * Invalidate ts_recent.  If this segment updates
+			 * ts_recent, the age will be reset later and ts_recent
+			 * will get a valid value.  If it does not, setting
+			 * ts_recent to zero will at least satisfy the
+			 * requirement that zero be placed in the timestamp
+			 * echo reply when ts_recent isn't valid.  The
+			 * age isn't reset until we get a valid ts_recent
+			 * because we don't want out-of-order segments to be
+			 * dropped when ts_recent is old.
+			 */
+			tp->ts_recent = 0;
+		} else {
+			STAT(tcpstat.tcps_rcvduppack++);
+			STAT(tcpstat.tcps_rcvdupbyte += ti->ti_len);
+			STAT(tcpstat.tcps_pawsdrop++);
+			goto dropafterack;
+		}
+	}
 
 	todrop = tp->rcv_nxt - ti->ti_seq;
 	if (todrop > 0) {
@@ -955,13 +965,12 @@ trimthenstep6:
 	 * If last ACK falls within this segment's sequence numbers,
 	 * record its timestamp.
 	 */
-/*	if (ts_present && SEQ_LEQ(ti->ti_seq, tp->last_ack_sent) &&
- *	    SEQ_LT(tp->last_ack_sent, ti->ti_seq + ti->ti_len +
- *		   ((tiflags & (TH_SYN|TH_FIN)) != 0))) {
- *		tp->ts_recent_age = tcp_now;
- *		tp->ts_recent = ts_val;
- *	}
- */
+	if (ts_present && SEQ_LEQ(ti->ti_seq, tp->last_ack_sent) &&
+	    SEQ_LT(tp->last_ack_sent, ti->ti_seq + ti->ti_len +
+		   ((tiflags & (TH_SYN|TH_FIN)) != 0))) {
+		tp->ts_recent_age = tcp_now;
+		tp->ts_recent = ts_val;
+	}
 
 	/*
 	 * If the RST bit is set examine the state:
@@ -1052,12 +1061,11 @@ trimthenstep6:
 		}
 
 		/* Do window scaling? */
-/*		if ((tp->t_flags & (TF_RCVD_SCALE|TF_REQ_SCALE)) ==
- *			(TF_RCVD_SCALE|TF_REQ_SCALE)) {
- *			tp->snd_scale = tp->requested_s_scale;
- *			tp->rcv_scale = tp->request_r_scale;
- *		}
- */
+		if ((tp->t_flags & (TF_RCVD_SCALE|TF_REQ_SCALE)) ==
+			(TF_RCVD_SCALE|TF_REQ_SCALE)) {
+			tp->snd_scale = tp->requested_s_scale;
+			tp->rcv_scale = tp->request_r_scale;
+		}
 		(void) tcp_reass(tp, (struct tcpiphdr *)0, (struct mbuf *)0);
 		tp->snd_wl1 = ti->ti_seq - 1;
 		/* Avoid ack processing; snd_una==ti_ack  =>  dup ack */
@@ -1166,11 +1174,9 @@ trimthenstep6:
 		 * timer backoff (cf., Phil Karn's retransmit alg.).
 		 * Recompute the initial retransmit timer.
 		 */
-/*		if (ts_present)
- *			tcp_xmit_timer(tp, tcp_now-ts_ecr+1);
- *		else
- */
-		     if (tp->t_rtt && SEQ_GT(ti->ti_ack, tp->t_rtseq))
+		if (ts_present && ts_ecr)
+			tcp_xmit_timer(tp, tcp_now-ts_ecr+1);
+		else if (tp->t_rtt && SEQ_GT(ti->ti_ack, tp->t_rtseq))
 			tcp_xmit_timer(tp,tp->t_rtt);
 
 		/*
@@ -1496,12 +1502,9 @@ drop:
 	return;
 }
 
- /* , ts_present, ts_val, ts_ecr) */
-/*	int *ts_present;
- *	u_int32_t *ts_val, *ts_ecr;
- */
 static void
-tcp_dooptions(struct tcpcb *tp, u_char *cp, int cnt, struct tcpiphdr *ti)
+tcp_dooptions(struct tcpcb *tp, u_char *cp, int cnt, struct tcpiphdr *ti,
+              int *ts_present, u_int32_t *ts_val, u_int32_t *ts_ecr)
 {
 	u_int16_t mss;
 	int opt, optlen;
@@ -1516,8 +1519,10 @@ tcp_dooptions(struct tcpcb *tp, u_char *cp, int cnt, struct tcpiphdr *ti)
 		if (opt == TCPOPT_NOP)
 			optlen = 1;
 		else {
+			if (cnt < 2)
+				break;
 			optlen = cp[1];
-			if (optlen <= 0)
+			if (optlen < 2 || optlen > cnt)
 				break;
 		}
 		switch (opt) {
@@ -1535,34 +1540,34 @@ tcp_dooptions(struct tcpcb *tp, u_char *cp, int cnt, struct tcpiphdr *ti)
 			(void) tcp_mss(tp, mss);	/* sets t_maxseg */
 			break;
 
-/*		case TCPOPT_WINDOW:
- *			if (optlen != TCPOLEN_WINDOW)
- *				continue;
- *			if (!(ti->ti_flags & TH_SYN))
- *				continue;
- *			tp->t_flags |= TF_RCVD_SCALE;
- *			tp->requested_s_scale = min(cp[2], TCP_MAX_WINSHIFT);
- *			break;
- */
-/*		case TCPOPT_TIMESTAMP:
- *			if (optlen != TCPOLEN_TIMESTAMP)
- *				continue;
- *			*ts_present = 1;
- *			memcpy((char *) ts_val, (char *)cp + 2, sizeof(*ts_val));
- *			NTOHL(*ts_val);
- *			memcpy((char *) ts_ecr, (char *)cp + 6, sizeof(*ts_ecr));
- *			NTOHL(*ts_ecr);
- *
- */			/*
- *			 * A timestamp received in a SYN makes
- *			 * it ok to send timestamp requests and replies.
- *			 */
-/*			if (ti->ti_flags & TH_SYN) {
- *				tp->t_flags |= TF_RCVD_TSTMP;
- *				tp->ts_recent = *ts_val;
- *				tp->ts_recent_age = tcp_now;
- *			}
- */			break;
+		case TCPOPT_WINDOW:
+			if (optlen != TCPOLEN_WINDOW)
+				continue;
+			if (!(ti->ti_flags & TH_SYN))
+				continue;
+			tp->t_flags |= TF_RCVD_SCALE;
+			tp->requested_s_scale = min(cp[2], TCP_MAX_WINSHIFT);
+			break;
+
+		case TCPOPT_TIMESTAMP:
+			if (optlen != TCPOLEN_TIMESTAMP)
+				continue;
+			*ts_present = 1;
+			memcpy((char *) ts_val, (char *)cp + 2, sizeof(*ts_val));
+			NTOHL(*ts_val);
+			memcpy((char *) ts_ecr, (char *)cp + 6, sizeof(*ts_ecr));
+			NTOHL(*ts_ecr);
+
+			/*
+			 * A timestamp received in a SYN makes
+			 * it ok to send timestamp requests and replies.
+			 */
+			if (ti->ti_flags & TH_SYN) {
+				tp->t_flags |= TF_RCVD_TSTMP;
+				tp->ts_recent = *ts_val;
+				tp->ts_recent_age = tcp_now;
+			}
+			break;
 		}
 	}
 }
@@ -1699,6 +1704,28 @@ tcp_xmit_timer(register struct tcpcb *tp, int rtt)
  * parameters from pre-set or cached values in the routing entry.
  */
 
+/*
+ * Size of a socket buffer: 'hostsize', the size of the kernel buffer
+ * of the host socket (-1 if unknown), clamped to [min, TCP_MAXSPACE]
+ * and rounded up to a multiple of the mss.
+ * so_snd holds what was read from the host socket, so it follows the
+ * host receive buffer; so_rcv holds what is written to the host socket,
+ * so it follows the host send buffer.
+ * Buffers start at TCP_SNDSPACE/TCP_RCVSPACE and are only grown to
+ * this size by tcp_sbgrow(), once they fill up.
+ */
+static int
+tcp_sbsize(int hostsize, int min, int mss)
+{
+	int size = min;
+
+	if (hostsize > size)
+		size = hostsize < TCP_MAXSPACE ? hostsize : TCP_MAXSPACE;
+	if (size % mss)
+		size += mss - (size % mss);
+	return size;
+}
+
 int
 tcp_mss(struct tcpcb *tp, u_int offer)
 {
@@ -1718,14 +1745,55 @@ tcp_mss(struct tcpcb *tp, u_int offer)
 
 	tp->snd_cwnd = mss;
 
-	sbreserve(&so->so_snd, TCP_SNDSPACE + ((TCP_SNDSPACE % mss) ?
-                                               (mss - (TCP_SNDSPACE % mss)) :
-                                               0));
-	sbreserve(&so->so_rcv, TCP_RCVSPACE + ((TCP_RCVSPACE % mss) ?
-                                               (mss - (TCP_RCVSPACE % mss)) :
-                                               0));
+	sbreserve(&so->so_snd, tcp_sbsize(-1, TCP_SNDSPACE, mss));
+	sbreserve(&so->so_rcv, tcp_sbsize(-1, TCP_RCVSPACE, mss));
+
+	/*
+	 * Request a window scale large enough to advertise the largest
+	 * so_rcv tcp_sbgrow() may give us later. This is only called
+	 * before the connection is established.
+	 */
+	tp->request_r_scale = 0;
+	while (tp->request_r_scale < TCP_MAX_WINSHIFT &&
+	       (TCP_MAXWIN << tp->request_r_scale) < TCP_MAXSPACE)
+		tp->request_r_scale++;
 
 	DEBUG_MISC((dfd, " returning mss = %d\n", mss));
 
 	return mss;
 }
+
+/*
+ * Grow the socket buffers of an established connection up to the size
+ * of the kernel buffers of the host socket (Linux autotunes them).
+ * Called when one of them fills up, and by sbappend() once per so_rcv
+ * worth of data from the guest.
+ */
+void
+tcp_sbgrow(struct socket *so)
+{
+	struct tcpcb *tp = sototcpcb(so);
+	int size;
+
+	if (tp == NULL || so->s < 0)
+		return;
+
+	if (so->so_snd.sb_datalen < TCP_MAXSPACE) {
+		size = tcp_sbsize(socket_get_rcvbuf(so->s),
+		                  so->so_snd.sb_datalen, tp->t_maxseg);
+		if ((unsigned)size > so->so_snd.sb_datalen)
+			sbreserve(&so->so_snd, size);
+	}
+
+	/* Don't grow so_rcv past what the window scale lets us advertise */
+	if (so->so_rcv.sb_datalen < ((u_int)TCP_MAXWIN << tp->rcv_scale) &&
+	    so->so_rcv.sb_datalen < TCP_MAXSPACE) {
+		size = tcp_sbsize(socket_get_sndbuf(so->s),
+		                  so->so_rcv.sb_datalen, tp->t_maxseg);
+		if (size > (TCP_MAXWIN << tp->rcv_scale))
+			size = TCP_MAXWIN << tp->rcv_scale;
+		if ((unsigned)size > so->so_rcv.sb_datalen)
+			sbreserve(&so->so_rcv, size);
+	}
+	tp->rcv_grow = tp->rcv_nxt + so->so_rcv.sb_datalen;
+}
@@ -284,17 +284,14 @@ send:
 			memcpy((caddr_t)(opt + 2), (caddr_t)&mss, sizeof(mss));
 			optlen = 4;
 
-/*			if ((tp->t_flags & TF_REQ_SCALE) &&
- *			    ((flags & TH_ACK) == 0 ||
- *			    (tp->t_flags & TF_RCVD_SCALE))) {
- *				*((u_int32_t *) (opt + optlen)) = htonl(
- *					TCPOPT_NOP << 24 |
- *					TCPOPT_WINDOW << 16 |
- *					TCPOLEN_WINDOW << 8 |
- *					tp->request_r_scale);
- *				optlen += 4;
- *			}
- */
+			if ((tp->t_flags & TF_REQ_SCALE) &&
+			    ((flags & TH_ACK) == 0 ||
+			    (tp->t_flags & TF_RCVD_SCALE))) {
+				opt[optlen++] = TCPOPT_NOP;
+				opt[optlen++] = TCPOPT_WINDOW;
+				opt[optlen++] = TCPOLEN_WINDOW;
+				opt[optlen++] = tp->request_r_scale;
+			}
 		}
  	}
 
@@ -303,19 +300,19 @@ send:
 	 * wants to use timestamps (TF_REQ_TSTMP is set) or both our side
 	 * and our peer have sent timestamps in our SYN's.
  	 */
-/* 	if ((tp->t_flags & (TF_REQ_TSTMP|TF_NOOPT)) == TF_REQ_TSTMP &&
- *	     (flags & TH_RST) == 0 &&
- *	    ((flags & (TH_SYN|TH_ACK)) == TH_SYN ||
- *	     (tp->t_flags & TF_RCVD_TSTMP))) {
- *		u_int32_t *lp = (u_int32_t *)(opt + optlen);
- *
- *		/ * Form timestamp option as shown in appendix A of RFC 1323. *  /
- *		*lp++ = htonl(TCPOPT_TSTAMP_HDR);
- *		*lp++ = htonl(tcp_now);
- *		*lp   = htonl(tp->ts_recent);
- *		optlen += TCPOLEN_TSTAMP_APPA;
- *	}
- */
+ 	if ((tp->t_flags & (TF_REQ_TSTMP|TF_NOOPT)) == TF_REQ_TSTMP &&
+	     (flags & TH_RST) == 0 &&
+	    ((flags & (TH_SYN|TH_ACK)) == TH_SYN ||
+	     (tp->t_flags & TF_RCVD_TSTMP))) {
+		u_int32_t ts[3];
+
+		/* Form timestamp option as shown in appendix A of RFC 1323. */
+		ts[0] = htonl(TCPOPT_TSTAMP_HDR);
+		ts[1] = htonl(tcp_now);
+		ts[2] = htonl(tp->ts_recent);
+		memcpy(opt + optlen, ts, TCPOLEN_TSTAMP_APPA);
+		optlen += TCPOLEN_TSTAMP_APPA;
+	}
  	hdrlen += optlen;
 
 	/*
@@ -385,7 +382,8 @@ send:
 		else
 			STAT(tcpstat.tcps_sndwinup++);
 
-		m = m_get();
+		/* Header only, a small mbuf is enough */
+		m = m_get_size(IF_MAXLINKHDR + hdrlen);
 		if (m == NULL) {
 /*			error = ENOBUFS; */
 			error = 1;
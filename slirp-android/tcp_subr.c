@@ -43,8 +43,8 @@
 #include "proxy_common.h"
 
 /* patchable/settable parameters for tcp */
-/* Don't do rfc1323 performance enhancements */
-#define TCP_DO_RFC1323 0
+/* Do rfc1323 window scaling and timestamps */
+#define TCP_DO_RFC1323 1
 
 /*
  * Tcp initialization
@@ -119,7 +119,7 @@ tcp_respond(struct tcpcb *tp, struct tcpiphdr *ti, struct mbuf *m,
 	if (tp)
 		win = sbspace(&tp->t_socket->so_rcv);
         if (m == NULL) {
-		if ((m = m_get()) == NULL)
+		if ((m = m_get_size(IF_MAXLINKHDR + sizeof(struct tcpiphdr))) == NULL)
 			return;
 #ifdef TCP_COMPAT_42
 		tlen = 1;
@@ -616,8 +616,6 @@ tcp_connect(struct socket *inso)
 		so->so_laddr_port = inso->so_laddr_port;
 	}
 
-	(void) tcp_mss(sototcpcb(so), 0);
-
 	if ((s = socket_accept(inso->s, &addr)) < 0) {
 		tcp_close(sototcpcb(so)); /* This will sofree() as well */
 		return;
@@ -635,6 +633,7 @@ tcp_connect(struct socket *inso)
 	/* Translate connections from localhost to the real hostname */
 	if (addr_ip == 0 || addr_ip == loopback_addr_ip)
 	   so->so_faddr_ip = alias_addr_ip;
+	sohash(&tcb, so);
 
 	/* Close the accept() socket, set right state */
 	if (inso->so_state & SS_FACCEPTONCE) {
@@ -644,6 +643,9 @@ tcp_connect(struct socket *inso)
 	}
 	so->s = s;
 
+	/* Size the buffers after the accepted socket */
+	(void) tcp_mss(sototcpcb(so), 0);
+
 	so->so_iptos = tcp_tos(so);
 	tp = sototcpcb(so);
 
@@ -0,0 +1,114 @@
+/* Copyright (C) 2014 The Android Open Source Project
+**
+** This software is licensed under the terms of the GNU General Public
+** License version 2, as published by the Free Software Foundation, and
+** may be copied, distributed, and modified under those terms.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+*/
+
+// Bulk TCP transfers between a minimal guest TCP peer, driven through
+// slirp_input()/slirp_output(), and a host socket connected through the
+// slirp stack, in both directions and with and without the RFC 1323
+// options. Each test checks what slirp negotiated and that the data
+// arrives intact, and prints the throughput.
+
+#include "slirp-android/testing/TcpTestPeers.h"
+
+#include <gtest/gtest.h>
+
+#include <stdio.h>
+
+#include <deque>
+#include <vector>
+
+extern "C" {
+void slirp_input(const uint8_t* pkt, int pkt_len);
+}
+
+using android::testing::GuestTcp;
+using android::testing::HostTcpPeer;
+using android::testing::kTcpTransferSize;
+
+namespace {
+
+// Packets sent by slirp to the guest, queued until the next iteration of
+// the test loop.
+std::deque<std::vector<uint8_t> > sToGuest;
+
+bool sendToSlirp(void* opaque, const uint8_t* frame, size_t size) {
+    slirp_input(frame, static_cast<int>(size));
+    return true;
+}
+
+// Run slirp for one iteration, then let the guest handle what it sent.
+void pollSlirp(GuestTcp* guest) {
+    android::testing::slirpTestPoll(1);
+    while (!sToGuest.empty()) {
+        guest->receive(&sToGuest.front()[0], sToGuest.front().size());
+        sToGuest.pop_front();
+    }
+    guest->flushAck();
+}
+
+void runTransfer(bool upload, bool windowScale, const char* name) {
+    android::testing::slirpTestInit();
+    sToGuest.clear();
+
+    HostTcpPeer host(upload);
+    ASSERT_TRUE(host.start());
+    GuestTcp guest(host.port(), windowScale, sendToSlirp, NULL);
+
+    double elapsed = android::testing::runTcpTransfer(&guest, &host, upload,
+                                                       pollSlirp);
+    ASSERT_GT(elapsed, 0) << "transfer stalled";
+    EXPECT_EQ(kTcpTransferSize, host.transferred());
+    EXPECT_TRUE(host.dataOk());
+
+    // slirp answers the options offered by the guest, and only those.
+    EXPECT_EQ(windowScale, guest.synAckWindowScale());
+    EXPECT_EQ(windowScale, guest.synAckTimestamp());
+    if (windowScale) {
+        EXPECT_GT(guest.sndShift(), 0);
+        EXPECT_GT(guest.tsEchoed(), 0U);
+        EXPECT_EQ(0U, guest.tsMissing());
+        if (upload) {
+            // The receive buffer of slirp grows past what an unscaled
+            // window can advertise.
+            EXPECT_GT(guest.maxSndWnd(), 65535U);
+        }
+    } else {
+        EXPECT_EQ(0, guest.sndShift());
+        EXPECT_LE(guest.maxSndWnd(), 65535U);
+    }
+    printf("%s: %.1f MB/s\n", name, kTcpTransferSize / elapsed / 1e6);
+}
+
+}  // namespace
+
+extern "C" int slirp_can_output(void) {
+    return 1;
+}
+
+extern "C" void slirp_output(const uint8_t* pkt, int pkt_len) {
+    sToGuest.push_back(std::vector<uint8_t>(pkt, pkt + pkt_len));
+}
+
+TEST(slirp_tcp, download_window_scaling) {
+    runTransfer(false, true, "host to guest, window scaling");
+}
+
+TEST(slirp_tcp, download_no_window_scaling) {
+    runTransfer(false, false, "host to guest, no window scaling");
+}
+
+TEST(slirp_tcp, upload_window_scaling) {
+    runTransfer(true, true, "guest to host, window scaling");
+}
+
+TEST(slirp_tcp, upload_no_window_scaling) {
+    runTransfer(true, false, "guest to host, no window scaling");
+}
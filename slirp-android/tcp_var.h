@@ -130,6 +130,7 @@ struct tcpcb {
 	u_int32_t	ts_recent;		/* timestamp echo data */
 	u_int32_t	ts_recent_age;		/* when last updated */
 	tcp_seq	last_ack_sent;
+	tcp_seq	rcv_grow;		/* check for a larger so_rcv here */
 
 };
 
@@ -219,7 +220,7 @@ struct tcpstat {
 	u_long	tcps_rcvackpack;	/* rcvd ack packets */
 	u_long	tcps_rcvackbyte;	/* bytes acked by rcvd acks */
 	u_long	tcps_rcvwinupd;		/* rcvd window update packets */
-/*	u_long	tcps_pawsdrop;	*/	/* segments dropped due to PAWS */
+	u_long	tcps_pawsdrop;		/* segments dropped due to PAWS */
 	u_long	tcps_predack;		/* times hdr predict ok for acks */
 	u_long	tcps_preddat;		/* times hdr predict ok for data pkts */
 	u_long	tcps_socachemiss;	/* tcp_last_so misses */
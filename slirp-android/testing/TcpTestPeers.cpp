@@ -0,0 +1,481 @@
+// Copyright 2014 The Android Open Source Project
+//
+// This software is licensed under the terms of the GNU General Public
+// License version 2, as published by the Free Software Foundation, and
+// may be copied, distributed, and modified under those terms.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+#include "slirp-android/testing/TcpTestPeers.h"
+
+#include <gtest/gtest.h>
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <string.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include <vector>
+
+extern "C" {
+void slirp_init(int restricted, const char* special_ip);
+void slirp_select_fill(int* pnfds,
+                       fd_set* readfds, fd_set* writefds, fd_set* xfds);
+void slirp_select_poll(fd_set* readfds, fd_set* writefds, fd_set* xfds);
+extern uint8_t client_ethaddr[6];
+}
+
+namespace android {
+namespace testing {
+
+namespace {
+
+const uint32_t kGuestIp = 0x0a00020f;  // 10.0.2.15
+const uint32_t kHostAliasIp = 0x0a000202;  // 10.0.2.2, the host loopback
+const uint16_t kGuestPort = 40000;
+const uint8_t kGuestMac[6] = { 0x52, 0x54, 0x00, 0x12, 0x34, 0x56 };
+const int kGuestMss = 1460;
+const int kGuestWindowShift = 7;
+const uint32_t kGuestBufferSize = 1 << 20;
+const uint32_t kGuestFirstTsVal = 1000;
+
+// TCP option kinds and lengths.
+enum {
+    kOptEnd = 0,
+    kOptNop = 1,
+    kOptMss = 2,
+    kOptWindow = 3,
+    kOptTimestamp = 8,
+    kOptTimestampLen = 10,
+};
+
+// A timestamp option, aligned as in appendix A of RFC 1323.
+const size_t kTimestampOptLen = 12;
+
+enum {
+    kFin = 0x01,
+    kSyn = 0x02,
+    kRst = 0x04,
+    kAck = 0x10,
+};
+
+uint16_t checksum(const uint8_t* data, size_t len, uint32_t sum) {
+    for (size_t n = 0; n + 1 < len; n += 2) {
+        sum += (data[n] << 8) | data[n + 1];
+    }
+    if (len & 1) {
+        sum += data[len - 1] << 8;
+    }
+    while (sum >> 16) {
+        sum = (sum & 0xffff) + (sum >> 16);
+    }
+    return static_cast<uint16_t>(~sum);
+}
+
+void put16(uint8_t* p, uint16_t v) {
+    p[0] = v >> 8;
+    p[1] = static_cast<uint8_t>(v);
+}
+
+void put32(uint8_t* p, uint32_t v) {
+    put16(p, v >> 16);
+    put16(p + 2, static_cast<uint16_t>(v));
+}
+
+uint16_t get16(const uint8_t* p) {
+    return (p[0] << 8) | p[1];
+}
+
+uint32_t get32(const uint8_t* p) {
+    return (get16(p) << 16) | get16(p + 2);
+}
+
+}  // namespace
+
+uint8_t tcpPatternByte(size_t offset) {
+    return static_cast<uint8_t>(offset * 7 + (offset >> 11));
+}
+
+void slirpTestInit() {
+    static bool inited;
+    if (!inited) {
+        slirp_init(0, NULL);
+        memcpy(client_ethaddr, kGuestMac, sizeof(kGuestMac));
+        inited = true;
+    }
+}
+
+void slirpTestPoll(int timeoutMs) {
+    fd_set readfds, writefds, xfds;
+    int nfds = -1;
+    FD_ZERO(&readfds);
+    FD_ZERO(&writefds);
+    FD_ZERO(&xfds);
+    slirp_select_fill(&nfds, &readfds, &writefds, &xfds);
+    struct timeval tv = { 0, timeoutMs * 1000 };
+    if (select(nfds + 1, &readfds, &writefds, &xfds, &tv) < 0) {
+        FD_ZERO(&readfds);
+        FD_ZERO(&writefds);
+        FD_ZERO(&xfds);
+    }
+    slirp_select_poll(&readfds, &writefds, &xfds);
+}
+
+double nowSeconds() {
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+GuestTcp::GuestTcp(uint16_t port, bool rfc1323,
+                   SendFrameFunc sendFrame, void* opaque)
+    : mPort(port),
+      mRfc1323(rfc1323),
+      mSendFrame(sendFrame),
+      mOpaque(opaque),
+      mSndNxt(1000),
+      mSndUna(1000),
+      mSndWnd(0),
+      mMaxSndWnd(0),
+      mSndShift(0),
+      mRcvNxt(0),
+      mReceived(0),
+      mSent(0),
+      mConnected(false),
+      mNeedAck(false),
+      mSynAckWindowScale(false),
+      mTimestamps(false),
+      mTsVal(kGuestFirstTsVal),
+      mTsRecent(0),
+      mTsEchoed(0),
+      mTsMissing(0) {}
+
+void GuestTcp::connect() {
+    uint8_t options[8] = { kOptMss, 4, 0, 0,
+                           kOptNop, kOptWindow, 3, kGuestWindowShift };
+    put16(options + 2, kGuestMss);
+    if (send(kSyn, mSndNxt, NULL, 0, options, mRfc1323 ? 8 : 4)) {
+        mSndNxt++;
+    }
+}
+
+void GuestTcp::receive(const uint8_t* frame, size_t size) {
+    if (size < 14 + 20 + 20 || get16(frame + 12) != 0x0800) {
+        return;
+    }
+    const uint8_t* ip = frame + 14;
+    size_t ipLen = (ip[0] & 0xf) * 4;
+    size_t totalLen = get16(ip + 2);
+    if (ip[9] != IPPROTO_TCP || get16(ip + ipLen + 2) != kGuestPort) {
+        return;
+    }
+    const uint8_t* tcp = ip + ipLen;
+    size_t tcpLen = (tcp[12] >> 4) * 4;
+    uint32_t seq = get32(tcp + 4);
+    uint32_t ack = get32(tcp + 8);
+    uint8_t flags = tcp[13];
+    const uint8_t* data = tcp + tcpLen;
+    size_t dataLen = totalLen - ipLen - tcpLen;
+
+    ASSERT_FALSE(flags & kRst) << "connection reset by slirp";
+    parseOptions(tcp + 20, tcpLen - 20, flags & kSyn);
+    if (flags & kSyn) {
+        mRcvNxt = seq + 1;
+        mConnected = true;
+        mNeedAck = true;
+    }
+    if (flags & kAck) {
+        if (static_cast<int32_t>(ack - mSndUna) > 0) {
+            mSndUna = ack;
+        }
+        // The window of a SYN is never scaled.
+        mSndWnd = get16(tcp + 14) << ((flags & kSyn) ? 0 : mSndShift);
+        if (!(flags & kSyn) && mSndWnd > mMaxSndWnd) {
+            mMaxSndWnd = mSndWnd;
+        }
+    }
+    if (dataLen > 0) {
+        if (seq == mRcvNxt) {
+            for (size_t n = 0; n < dataLen; ++n) {
+                ASSERT_EQ(tcpPatternByte(mReceived + n), data[n])
+                        << "at offset " << mReceived + n;
+            }
+            mReceived += dataLen;
+            mRcvNxt += dataLen;
+        }
+        mNeedAck = true;
+    }
+    if ((flags & kFin) && seq + dataLen == mRcvNxt) {
+        mRcvNxt++;
+        mNeedAck = true;
+    }
+}
+
+void GuestTcp::sendData(size_t total) {
+    while (mSent < total) {
+        uint32_t inFlight = mSndNxt - mSndUna;
+        if (inFlight >= mSndWnd) {
+            break;
+        }
+        size_t len = total - mSent;
+        const size_t maxLen = kGuestMss - (mTimestamps ? kTimestampOptLen : 0);
+        if (len > maxLen) {
+            len = maxLen;
+        }
+        if (len > mSndWnd - inFlight) {
+            len = mSndWnd - inFlight;
+        }
+        uint8_t data[kGuestMss];
+        for (size_t n = 0; n < len; ++n) {
+            data[n] = tcpPatternByte(mSent + n);
+        }
+        if (!send(kAck, mSndNxt, data, len, NULL, 0)) {
+            break;
+        }
+        mSndNxt += len;
+        mSent += len;
+        mNeedAck = false;
+    }
+}
+
+void GuestTcp::flushAck() {
+    if (mNeedAck && send(kAck, mSndNxt, NULL, 0, NULL, 0)) {
+        mNeedAck = false;
+    }
+}
+
+void GuestTcp::parseOptions(const uint8_t* p, size_t len, bool syn) {
+    bool timestamp = false;
+    size_t n = 0;
+    while (n < len && p[n] != kOptEnd) {
+        if (p[n] == kOptNop) {
+            n++;
+            continue;
+        }
+        if (n + 1 >= len || p[n + 1] < 2 || n + p[n + 1] > len) {
+            break;
+        }
+        if (p[n] == kOptWindow && p[n + 1] == 3 && syn) {
+            mSynAckWindowScale = true;
+            if (mRfc1323) {
+                mSndShift = p[n + 2];
+            }
+        } else if (p[n] == kOptTimestamp && p[n + 1] == kOptTimestampLen) {
+            uint32_t tsEcr = get32(p + n + 6);
+            timestamp = true;
+            mTsRecent = get32(p + n + 2);
+            if (!syn && tsEcr >= kGuestFirstTsVal && tsEcr <= mTsVal) {
+                mTsEchoed++;
+            }
+        }
+        n += p[n + 1];
+    }
+    if (syn) {
+        mTimestamps = timestamp;
+    } else if (mTimestamps && !timestamp) {
+        mTsMissing++;
+    }
+}
+
+bool GuestTcp::send(uint8_t flags, uint32_t seq, const uint8_t* data,
+                    size_t dataLen, const uint8_t* options, size_t optLen) {
+    // Once offered in the SYN, timestamps go in every segment.
+    const bool timestamp = (flags & kSyn) ? mRfc1323 : mTimestamps;
+    const size_t tcpLen = 20 + optLen + (timestamp ? kTimestampOptLen : 0);
+    std::vector<uint8_t> frame(14 + 20 + tcpLen + dataLen);
+    uint8_t* eth = &frame[0];
+    uint8_t* ip = eth + 14;
+    uint8_t* tcp = ip + 20;
+
+    memset(eth, 0xff, 6);
+    memcpy(eth + 6, kGuestMac, 6);
+    put16(eth + 12, 0x0800);
+
+    ip[0] = 0x45;
+    put16(ip + 2, static_cast<uint16_t>(20 + tcpLen + dataLen));
+    ip[8] = 64;
+    ip[9] = IPPROTO_TCP;
+    put32(ip + 12, kGuestIp);
+    put32(ip + 16, kHostAliasIp);
+    put16(ip + 10, checksum(ip, 20, 0));
+
+    put16(tcp, kGuestPort);
+    put16(tcp + 2, mPort);
+    put32(tcp + 4, seq);
+    put32(tcp + 8, (flags & kSyn) ? 0 : mRcvNxt);
+    tcp[12] = static_cast<uint8_t>((tcpLen / 4) << 4);
+    tcp[13] = flags;
+    uint32_t window = kGuestBufferSize;
+    if (flags & kSyn) {
+        window = 65535;
+    } else if (mRfc1323 && mSynAckWindowScale) {
+        window >>= kGuestWindowShift;
+    } else if (window > 65535) {
+        window = 65535;
+    }
+    put16(tcp + 14, static_cast<uint16_t>(window));
+    if (optLen) {
+        memcpy(tcp + 20, options, optLen);
+    }
+    if (timestamp) {
+        uint8_t* ts = tcp + 20 + optLen;
+        ts[0] = kOptNop;
+        ts[1] = kOptNop;
+        ts[2] = kOptTimestamp;
+        ts[3] = kOptTimestampLen;
+        put32(ts + 4, ++mTsVal);
+        put32(ts + 8, (flags & kSyn) ? 0 : mTsRecent);
+    }
+    if (dataLen) {
+        memcpy(tcp + tcpLen, data, dataLen);
+    }
+    uint8_t pseudo[12];
+    memcpy(pseudo, ip + 12, 8);
+    pseudo[8] = 0;
+    pseudo[9] = IPPROTO_TCP;
+    put16(pseudo + 10, static_cast<uint16_t>(tcpLen + dataLen));
+    uint32_t sum = 0;
+    for (int n = 0; n < 12; n += 2) {
+        sum += get16(pseudo + n);
+    }
+    put16(tcp + 16, checksum(tcp, tcpLen + dataLen, sum));
+
+    return mSendFrame(mOpaque, &frame[0], frame.size());
+}
+
+HostTcpPeer::HostTcpPeer(bool upload)
+    : mUpload(upload),
+      mListenFd(-1),
+      mPort(0),
+      mThread(),
+      mStarted(false),
+      mTransferred(0),
+      mDataOk(true) {}
+
+HostTcpPeer::~HostTcpPeer() {
+    if (mListenFd >= 0) {
+        // Wakes up the thread if it is still waiting for the connection.
+        shutdown(mListenFd, SHUT_RDWR);
+    }
+    join();
+    if (mListenFd >= 0) {
+        close(mListenFd);
+    }
+}
+
+bool HostTcpPeer::start() {
+    mListenFd = socket(AF_INET, SOCK_STREAM, 0);
+    if (mListenFd < 0) {
+        return false;
+    }
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t addrLen = sizeof(addr);
+    if (bind(mListenFd, reinterpret_cast<sockaddr*>(&addr),
+             sizeof(addr)) < 0 ||
+        getsockname(mListenFd, reinterpret_cast<sockaddr*>(&addr),
+                    &addrLen) < 0 ||
+        listen(mListenFd, 1) < 0) {
+        return false;
+    }
+    mPort = ntohs(addr.sin_port);
+    mStarted = pthread_create(&mThread, NULL, threadMain, this) == 0;
+    return mStarted;
+}
+
+void HostTcpPeer::join() {
+    if (mStarted) {
+        pthread_join(mThread, NULL);
+        mStarted = false;
+    }
+}
+
+void* HostTcpPeer::threadMain(void* opaque) {
+    HostTcpPeer* peer = static_cast<HostTcpPeer*>(opaque);
+    int fd = accept(peer->mListenFd, NULL, NULL);
+    if (fd < 0) {
+        return NULL;
+    }
+    std::vector<uint8_t> buffer(64 * 1024);
+    size_t transferred = 0;
+    while (transferred < kTcpTransferSize) {
+        size_t len = kTcpTransferSize - transferred;
+        if (len > buffer.size()) {
+            len = buffer.size();
+        }
+        ssize_t ret;
+        if (peer->mUpload) {
+            ret = read(fd, &buffer[0], len);
+            for (ssize_t n = 0; n < ret; ++n) {
+                if (buffer[n] != tcpPatternByte(transferred + n)) {
+                    peer->mDataOk = false;
+                }
+            }
+        } else {
+            for (size_t n = 0; n < len; ++n) {
+                buffer[n] = tcpPatternByte(transferred + n);
+            }
+            ret = write(fd, &buffer[0], len);
+        }
+        if (ret < 0 && errno == EINTR) {
+            continue;
+        }
+        if (ret <= 0) {
+            break;
+        }
+        transferred += ret;
+        peer->mTransferred = transferred;
+    }
+    close(fd);
+    return NULL;
+}
+
+double runTcpTransfer(GuestTcp* guest, HostTcpPeer* host, bool upload,
+                      void (*poll)(GuestTcp* guest)) {
+    guest->connect();
+    double start = nowSeconds();
+    while (!guest->connected()) {
+        if (nowSeconds() - start > 5) {
+            return -1;
+        }
+        poll(guest);
+    }
+
+    start = nowSeconds();
+    const double deadline = start + 60;
+    for (;;) {
+        if (upload) {
+            guest->sendData(kTcpTransferSize);
+            if (guest->allAcked() &&
+                host->transferred() == kTcpTransferSize) {
+                break;
+            }
+        } else if (guest->received() == kTcpTransferSize) {
+            break;
+        }
+        if (nowSeconds() > deadline) {
+            return -1;
+        }
+        poll(guest);
+    }
+    double elapsed = nowSeconds() - start;
+    host->join();
+
+    // Let slirp see the host close and tear down the connection.
+    for (int n = 0; n < 10; ++n) {
+        poll(guest);
+    }
+    return elapsed;
+}
+
+}  // namespace testing
+}  // namespace android
@@ -0,0 +1,148 @@
+// Copyright 2014 The Android Open Source Project
+//
+// This software is licensed under the terms of the GNU General Public
+// License version 2, as published by the Free Software Foundation, and
+// may be copied, distributed, and modified under those terms.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+#ifndef SLIRP_ANDROID_TESTING_TCP_TEST_PEERS_H
+#define SLIRP_ANDROID_TESTING_TCP_TEST_PEERS_H
+
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// The two ends of a bulk TCP transfer through slirp: a minimal guest TCP
+// peer that exchanges ethernet frames with slirp, and a host peer on a
+// loopback socket. Tests define slirp_output() and slirp_can_output(),
+// and pass the frames it receives to GuestTcp::receive().
+
+namespace android {
+namespace testing {
+
+// Size of the transfers, and the expected byte at each offset.
+const size_t kTcpTransferSize = 32 << 20;
+uint8_t tcpPatternByte(size_t offset);
+
+// Call slirp_init() on first use, with the MAC address of the guest.
+void slirpTestInit();
+
+// Run one iteration of the slirp loop, waiting up to |timeoutMs| for
+// its sockets.
+void slirpTestPoll(int timeoutMs);
+
+double nowSeconds();
+
+// The guest side of a single TCP connection to 10.0.2.2:|port|, which
+// slirp forwards to 127.0.0.1:|port|. If |rfc1323| is true, the guest
+// offers window scaling and timestamps in its SYN. Frames are sent with
+// |sendFrame|, which returns false when they can't be sent right now.
+class GuestTcp {
+public:
+    typedef bool (*SendFrameFunc)(void* opaque,
+                                  const uint8_t* frame, size_t size);
+
+    GuestTcp(uint16_t port, bool rfc1323,
+             SendFrameFunc sendFrame, void* opaque);
+
+    void connect();
+
+    // Handle an ethernet frame sent by slirp.
+    void receive(const uint8_t* frame, size_t size);
+
+    // Send as much of |total| bytes as the window of slirp allows.
+    void sendData(size_t total);
+
+    // Acknowledge what was received since the last call, like a guest
+    // that handles a batch of packets per interrupt.
+    void flushAck();
+
+    bool connected() const { return mConnected; }
+    bool allAcked() const { return mSndUna == mSndNxt; }
+    size_t received() const { return mReceived; }
+
+    // The options of the SYN-ACK of slirp: whether it had a window scale
+    // and the shift applied to the windows that follow, and whether it
+    // had a timestamp.
+    bool synAckWindowScale() const { return mSynAckWindowScale; }
+    int sndShift() const { return mSndShift; }
+    bool synAckTimestamp() const { return mTimestamps; }
+
+    // Largest window advertised by slirp after the handshake, in bytes.
+    uint32_t maxSndWnd() const { return mMaxSndWnd; }
+
+    // Segments received after the handshake whose timestamp echoed one
+    // sent by the guest, and segments that had no timestamp.
+    size_t tsEchoed() const { return mTsEchoed; }
+    size_t tsMissing() const { return mTsMissing; }
+
+private:
+    void parseOptions(const uint8_t* p, size_t len, bool syn);
+    bool send(uint8_t flags, uint32_t seq, const uint8_t* data,
+              size_t dataLen, const uint8_t* options, size_t optLen);
+
+    uint16_t mPort;
+    bool mRfc1323;
+    SendFrameFunc mSendFrame;
+    void* mOpaque;
+    uint32_t mSndNxt;
+    uint32_t mSndUna;
+    uint32_t mSndWnd;
+    uint32_t mMaxSndWnd;
+    int mSndShift;
+    uint32_t mRcvNxt;
+    size_t mReceived;
+    size_t mSent;
+    bool mConnected;
+    bool mNeedAck;
+    bool mSynAckWindowScale;
+    bool mTimestamps;
+    uint32_t mTsVal;
+    uint32_t mTsRecent;
+    size_t mTsEchoed;
+    size_t mTsMissing;
+};
+
+// The host side: a loopback socket that accepts one connection, then
+// writes (|upload| false) or reads and checks kTcpTransferSize bytes on
+// it from a thread.
+class HostTcpPeer {
+public:
+    explicit HostTcpPeer(bool upload);
+    ~HostTcpPeer();
+
+    // Listen and start the thread, return false on error.
+    bool start();
+    // Wait for the thread to complete.
+    void join();
+
+    uint16_t port() const { return mPort; }
+    size_t transferred() const { return mTransferred; }
+    bool dataOk() const { return mDataOk; }
+
+private:
+    static void* threadMain(void* opaque);
+
+    bool mUpload;
+    int mListenFd;
+    uint16_t mPort;
+    pthread_t mThread;
+    bool mStarted;
+    volatile size_t mTransferred;
+    bool mDataOk;
+};
+
+// Transfer kTcpTransferSize bytes between |guest| and |host|, with
+// |poll| run between each batch of guest frames. Returns the elapsed
+// time in seconds, or -1 if the transfer stalled.
+double runTcpTransfer(GuestTcp* guest, HostTcpPeer* host, bool upload,
+                      void (*poll)(GuestTcp* guest));
+
+}  // namespace testing
+}  // namespace android
+
+#endif  // SLIRP_ANDROID_TESTING_TCP_TEST_PEERS_H
@@ -0,0 +1,57 @@
+/* Copyright (C) 2014 The Android Open Source Project
+**
+** This software is licensed under the terms of the GNU General Public
+** License version 2, as published by the Free Software Foundation, and
+** may be copied, distributed, and modified under those terms.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+*/
+
+/* Stand-ins for the parts of QEMU that the slirp stack references but
+ * that its unit tests do not need: snapshots, the monitor, character
+ * devices and the proxy manager. */
+
+#include "migration/qemu-file.h"
+#include "migration/vmstate.h"
+#include "monitor/monitor.h"
+#include "proxy_common.h"
+#include "sysemu/char.h"
+
+Monitor* cur_mon;
+
+void monitor_vprintf(Monitor* mon, const char* fmt, va_list ap) {}
+
+int register_savevm(DeviceState* dev,
+                    const char* idstr,
+                    int instance_id,
+                    int version_id,
+                    SaveStateHandler* save_state,
+                    LoadStateHandler* load_state,
+                    void* opaque) {
+    return 0;
+}
+
+void qemu_put_buffer(QEMUFile* f, const uint8_t* buf, int size) {}
+void qemu_put_byte(QEMUFile* f, int v) {}
+void qemu_put_be16(QEMUFile* f, unsigned int v) {}
+void qemu_put_be32(QEMUFile* f, unsigned int v) {}
+int qemu_get_buffer(QEMUFile* f, uint8_t* buf, int size) { return 0; }
+int qemu_get_byte(QEMUFile* f) { return 0; }
+unsigned int qemu_get_be16(QEMUFile* f) { return 0; }
+unsigned int qemu_get_be32(QEMUFile* f) { return 0; }
+
+int qemu_chr_write(CharDriverState* s, const uint8_t* buf, int len) {
+    return len;
+}
+
+int proxy_manager_add(SockAddress* address,
+                      SocketType sock_type,
+                      ProxyEventFunc ev_func,
+                      void* ev_opaque) {
+    return -1;
+}
+
+void proxy_manager_del(void* ev_opaque) {}
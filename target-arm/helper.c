@@ -1162,7 +1162,7 @@ do_fault:
 
 static int get_phys_addr_v6(CPUARMState *env, uint32_t address, int access_type,
 			    int is_user, uint32_t *phys_ptr, int *prot,
-                            target_ulong *page_size)
+                            target_ulong *page_size, int *global)
 {
     int code;
     uint32_t table;
@@ -1210,6 +1210,7 @@ static int get_phys_addr_v6(CPUARMState *env, uint32_t address, int access_type,
         }
         ap = ((desc >> 10) & 3) | ((desc >> 13) & 4);
         xn = desc & (1 << 4);
+        *global = !(desc & (1 << 17));
         code = 13;
     } else {
         /* Lookup l2 entry.  */
@@ -1234,6 +1235,7 @@ static int get_phys_addr_v6(CPUARMState *env, uint32_t address, int access_type,
             /* Never happens, but compiler isn't smart enough to tell.  */
             abort();
         }
+        *global = !(desc & (1 << 11));
         code = 15;
     }
     if (domain == 3) {
@@ -1327,19 +1329,22 @@ static int get_phys_addr_mpu(CPUARMState *env, uint32_t address, int access_type
 int get_phys_addr(CPUARMState *env, uint32_t address,
                   int access_type, int is_user,
                   uint32_t *phys_ptr, int *prot,
-                  target_ulong *page_size);
+                  target_ulong *page_size, int *global);
 #else
 static
 #endif
 int get_phys_addr(CPUARMState *env, uint32_t address,
                   int access_type, int is_user,
                   uint32_t *phys_ptr, int *prot,
-                  target_ulong *page_size)
+                  target_ulong *page_size, int *global)
 {
     /* Fast Context Switch Extension.  */
     if (address < 0x02000000)
         address += env->cp15.c13_fcse;
 
+    /* Only the v6 page table format has non-global translations.  */
+    *global = 1;
+
     if ((env->cp15.c1_sys & 1) == 0) {
         /* MMU/MPU disabled.  */
         *phys_ptr = address;
@@ -1352,7 +1357,7 @@ int get_phys_addr(CPUARMState *env, uint32_t address,
                              prot);
     } else if (env->cp15.c1_sys & (1 << 23)) {
         return get_phys_addr_v6(env, address, access_type, is_user, phys_ptr,
-                                prot, page_size);
+                                prot, page_size, global);
     } else {
         return get_phys_addr_v5(env, address, access_type, is_user, phys_ptr,
                                 prot, page_size);
@@ -1364,18 +1369,19 @@ int cpu_arm_handle_mmu_fault (CPUARMState *env, target_ulong address,
 {
     uint32_t phys_addr;
     target_ulong page_size;
-    int prot;
+    int prot, global;
     int ret, is_user;
 
     is_user = mmu_idx == MMU_USER_IDX;
     ret = get_phys_addr(env, address, access_type, is_user, &phys_addr, &prot,
-                        &page_size);
+                        &page_size, &global);
     if (ret == 0) {
         /* Map a single [sub]page.  */
         phys_addr &= ~(uint32_t)0x3ff;
         address &= ~(uint32_t)0x3ff;
-        tlb_set_page (env, address, phys_addr, prot | PAGE_EXEC, mmu_idx,
-                      page_size);
+        tlb_set_page_asid(env, address, phys_addr, prot | PAGE_EXEC, mmu_idx,
+                          page_size, global ? TLB_ASID_GLOBAL
+                                            : (env->cp15.c13_context & 0xff));
         return 0;
     }
 
@@ -1397,10 +1403,11 @@ hwaddr cpu_get_phys_page_debug(CPUARMState *env, target_ulong addr)
 {
     uint32_t phys_addr;
     target_ulong page_size;
-    int prot;
+    int prot, global;
     int ret;
 
-    ret = get_phys_addr(env, addr, 0, 0, &phys_addr, &prot, &page_size);
+    ret = get_phys_addr(env, addr, 0, 0, &phys_addr, &prot, &page_size,
+                        &global);
 
     if (ret != 0)
         return -1;
@@ -1626,7 +1633,7 @@ void HELPER(set_cp15)(CPUARMState *env, uint32_t insn, uint32_t val)
             case 8: {
                 uint32_t phys_addr;
                 target_ulong page_size;
-                int prot;
+                int prot, global;
                 int ret, is_user = op2 & 2;
                 int access_type = op2 & 1;
 
@@ -1635,7 +1642,7 @@ void HELPER(set_cp15)(CPUARMState *env, uint32_t insn, uint32_t val)
                     goto bad_reg;
                 }
                 ret = get_phys_addr(env, val, access_type, is_user,
-                                    &phys_addr, &prot, &page_size);
+                                    &phys_addr, &prot, &page_size, &global);
                 if (ret == 0) {
                     /* We do not set any attribute bits in the PAR */
                     if (page_size == (1 << 24)
@@ -1663,11 +1670,11 @@ void HELPER(set_cp15)(CPUARMState *env, uint32_t insn, uint32_t val)
             tlb_flush_page(env, val & TARGET_PAGE_MASK);
             break;
         case 2: /* Invalidate on ASID.  */
-            tlb_flush(env, val == 0);
+            tlb_flush_asid(env, val & 0xff);
             break;
         case 3: /* Invalidate single entry on MVA.  */
-            /* ??? This is like case 1, but ignores ASID.  */
-            tlb_flush(env, 1);
+            /* Like case 1, but ignores ASID.  */
+            tlb_flush_page(env, val & TARGET_PAGE_MASK);
             break;
         default:
             goto bad_reg;
@@ -1827,10 +1834,10 @@ void HELPER(set_cp15)(CPUARMState *env, uint32_t insn, uint32_t val)
             env->cp15.c13_fcse = val;
             break;
         case 1:
-            /* This changes the ASID, so do a TLB flush.  */
+            /* This changes the ASID: drop the non-global TLB entries.  */
             if (env->cp15.c13_context != val
                 && !arm_feature(env, ARM_FEATURE_MPU))
-              tlb_flush(env, 0);
+              tlb_switch_asid(env, val & 0xff);
             env->cp15.c13_context = val;
             break;
         default:
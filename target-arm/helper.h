@@ -1,5 +1,7 @@
 #include "exec/def-helper.h"
 
+DEF_HELPER_FLAGS_1(lookup_tb_ptr, TCG_CALL_NO_WG, ptr, env)
+
 DEF_HELPER_1(clz, i32, i32)
 DEF_HELPER_1(sxtb16, i32, i32)
 DEF_HELPER_1(uxtb16, i32, i32)
@@ -721,7 +721,7 @@ static inline void gen_bx_im(DisasContext *s, uint32_t addr)
 {
     TCGv tmp;
 
-    s->is_jmp = DISAS_UPDATE;
+    s->is_jmp = DISAS_JUMP;
     if (s->thumb != (addr & 1)) {
         tmp = tcg_temp_new_i32();
         tcg_gen_movi_i32(tmp, addr & 1);
@@ -734,7 +734,7 @@ static inline void gen_bx_im(DisasContext *s, uint32_t addr)
 /* Set PC and Thumb state from var.  var is marked as dead.  */
 static inline void gen_bx(DisasContext *s, TCGv var)
 {
-    s->is_jmp = DISAS_UPDATE;
+    s->is_jmp = DISAS_JUMP;
     tcg_gen_andi_i32(cpu_R[15], var, ~1);
     tcg_gen_andi_i32(var, var, 1);
     store_cpu_field(var, thumb);
@@ -3518,6 +3518,22 @@ static inline void gen_goto_tb(DisasContext *s, int n, uint32_t dest)
     }
 }
 
+/* Jump to the TB for the PC already stored in env.  The lookup is done
+   through tb_jmp_cache by a helper, so indirect branches only return to
+   cpu_exec on a miss.  Blocks with an instruction count limit must stop
+   at their end, so they always go back to cpu_exec.  */
+static inline void gen_goto_ptr(DisasContext *s)
+{
+    if (TCG_TARGET_HAS_goto_ptr && !(s->tb->cflags & CF_COUNT_MASK)) {
+        TCGv_ptr ptr = tcg_temp_new_ptr();
+        gen_helper_lookup_tb_ptr(ptr, cpu_env);
+        tcg_gen_goto_ptr(ptr);
+        tcg_temp_free_ptr(ptr);
+    } else {
+        tcg_gen_exit_tb(0);
+    }
+}
+
 static inline void gen_jmp (DisasContext *s, uint32_t dest)
 {
     if (unlikely(s->singlestep_enabled)) {
@@ -4489,6 +4505,67 @@ static const uint8_t neon_2rm_sizes[] = {
     [NEON_2RM_VCVT_UF] = 0x4,
 };
 
+/* Translate the integer "three registers of the same length" insns that
+   map directly onto a TCG vector op.  Return nonzero if the insn was
+   handled, zero if it must go through the per-pass code.  */
+static int gen_neon_3r_vec(int op, int u, int size, int q,
+                           int rd, int rn, int rm)
+{
+    TCGOpcode opc;
+    int vece = size;
+
+    switch (op) {
+    case NEON_3R_LOGIC:
+        vece = MO_64;
+        switch ((u << 2) | size) {
+        case 0: /* VAND */
+            opc = INDEX_op_vec_and;
+            break;
+        case 1: /* VBIC */
+            opc = INDEX_op_vec_andc;
+            break;
+        case 2: /* VORR */
+            opc = INDEX_op_vec_or;
+            break;
+        case 4: /* VEOR */
+            opc = INDEX_op_vec_xor;
+            break;
+        default:
+            return 0;
+        }
+        break;
+    case NEON_3R_VADD_VSUB:
+        opc = u ? INDEX_op_vec_sub : INDEX_op_vec_add;
+        break;
+    case NEON_3R_VTST_VCEQ:
+        if (!u) {
+            return 0;
+        }
+        opc = INDEX_op_vec_cmpeq;
+        break;
+    case NEON_3R_VCGT:
+        if (u) {
+            return 0;
+        }
+        opc = INDEX_op_vec_cmpgt;
+        break;
+    case NEON_3R_VMUL:
+        if (u) {
+            return 0;
+        }
+        opc = INDEX_op_vec_mul;
+        break;
+    default:
+        return 0;
+    }
+    if (!tcg_can_emit_vec_op(opc, vece)) {
+        return 0;
+    }
+    tcg_gen_vec_op3(opc, vece, q ? 16 : 8, neon_reg_offset(rd, 0),
+                    neon_reg_offset(rn, 0), neon_reg_offset(rm, 0));
+    return 1;
+}
+
 /* Translate a NEON data processing instruction.  Return nonzero if the
    instruction is invalid.
    We process data in a mixture of 32-bit and 64-bit chunks.
@@ -4530,6 +4607,9 @@ static int disas_neon_data_insn(CPUARMState * env, DisasContext *s, uint32_t ins
         if (q && ((rd | rn | rm) & 1)) {
             return 1;
         }
+        if (gen_neon_3r_vec(op, u, size, q, rd, rn, rm)) {
+            return 0;
+        }
         if (size == 3 && op != NEON_3R_LOGIC) {
             /* 64-bit element instructions. */
             for (pass = 0; pass < (q ? 2 : 1); pass++) {
@@ -5007,6 +5087,20 @@ static int disas_neon_data_insn(CPUARMState * env, DisasContext *s, uint32_t ins
                     abort();
                 }
 
+                if (op == 0 || (op == 5 && !u)) {
+                    /* VSHR, VSHL */
+                    TCGOpcode opc = op == 5 ? INDEX_op_vec_shli
+                                    : u ? INDEX_op_vec_shri
+                                    : INDEX_op_vec_sari;
+                    if (tcg_can_emit_vec_op(opc, size)) {
+                        tcg_gen_vec_shifti(opc, size, q ? 16 : 8,
+                                           neon_reg_offset(rd, 0),
+                                           neon_reg_offset(rm, 0),
+                                           op == 5 ? shift : -shift);
+                        return 0;
+                    }
+                }
+
                 for (pass = 0; pass < count; pass++) {
                     if (size == 3) {
                         neon_load_reg64(cpu_V0, rm + pass);
@@ -6211,6 +6305,27 @@ static int disas_neon_data_insn(CPUARMState * env, DisasContext *s, uint32_t ins
                 if ((insn & (7 << 16)) == 0 || (q && (rd & 1))) {
                     return 1;
                 }
+                {
+                    /* Element size and byte offset of the scalar.  */
+                    int vece, ofs;
+
+                    if (insn & (1 << 16)) {
+                        vece = MO_8;
+                        ofs = (insn >> 17) & 3;
+                    } else if (insn & (1 << 17)) {
+                        vece = MO_16;
+                        ofs = ((insn >> 18) & 1) * 2;
+                    } else {
+                        vece = MO_32;
+                        ofs = 0;
+                    }
+                    ofs += neon_reg_offset(rm, (insn >> 19) & 1);
+                    if (tcg_can_emit_vec_op(INDEX_op_vec_dup, vece)) {
+                        tcg_gen_vec_dup(vece, q ? 16 : 8,
+                                        neon_reg_offset(rd, 0), ofs);
+                        return 0;
+                    }
+                }
                 if (insn & (1 << 19)) {
                     tmp = neon_load_reg(rm, 1);
                 } else {
@@ -9941,10 +10056,15 @@ static inline void gen_intermediate_code_internal(CPUARMState *env,
         case DISAS_NEXT:
             gen_goto_tb(dc, 1, dc->pc);
             break;
-        default:
         case DISAS_JUMP:
+            /* indirect branch: look the next TB up without leaving
+               the generated code */
+            gen_goto_ptr(dc);
+            break;
+        default:
         case DISAS_UPDATE:
-            /* indicate that the hash table must be used to find the next TB */
+            /* the CPU state changed (e.g. interrupts were unmasked), so
+               go back to cpu_exec to look at it */
             tcg_gen_exit_tb(0);
             break;
         case DISAS_TB_JUMP:
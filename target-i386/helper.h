@@ -1,5 +1,7 @@
 #include "exec/def-helper.h"
 
+DEF_HELPER_FLAGS_1(lookup_tb_ptr, TCG_CALL_NO_WG, ptr, env)
+
 DEF_HELPER_FLAGS_2(cc_compute_all, TCG_CALL_NO_SE, i32, env, int)
 DEF_HELPER_FLAGS_2(cc_compute_c, TCG_CALL_NO_SE, i32, env, int)
 
@@ -2866,12 +2866,16 @@ static void gen_debug(DisasContext *s, target_ulong cur_eip)
 }
 
 /* generate a generic end of block. Trace exception is also generated
-   if needed */
-static void gen_eob(DisasContext *s)
+   if needed. If 'jr' is true, the new eip is a run time value and the
+   next TB is looked up without going back to cpu_exec when possible. */
+static void gen_eob_worker(DisasContext *s, bool jr)
 {
     gen_update_cc_op(s);
     if (s->tb->flags & HF_INHIBIT_IRQ_MASK) {
         gen_helper_reset_inhibit_irq(cpu_env);
+        /* Interrupts were inhibited for this TB, go back to cpu_exec
+           so that they are checked before the next instruction.  */
+        jr = false;
     }
     if (s->tb->flags & HF_RF_MASK) {
         gen_helper_reset_rf(cpu_env);
@@ -2880,12 +2884,32 @@ static void gen_eob(DisasContext *s)
         gen_helper_debug(cpu_env);
     } else if (s->tf) {
 	gen_helper_single_step(cpu_env);
+    } else if (jr && TCG_TARGET_HAS_goto_ptr &&
+               !(s->tb->cflags & CF_COUNT_MASK)) {
+        /* Blocks with an instruction count limit need the exit to
+           cpu_exec too.  */
+        TCGv_ptr ptr = tcg_temp_new_ptr();
+        gen_helper_lookup_tb_ptr(ptr, cpu_env);
+        tcg_gen_goto_ptr(ptr);
+        tcg_temp_free_ptr(ptr);
     } else {
         tcg_gen_exit_tb(0);
     }
     s->is_jmp = 3;
 }
 
+static void gen_eob(DisasContext *s)
+{
+    gen_eob_worker(s, false);
+}
+
+/* end of block for an indirect jump, call or return to the eip set
+   by gen_op_jmp_T0() */
+static void gen_jr(DisasContext *s)
+{
+    gen_eob_worker(s, true);
+}
+
 /* generate a jump to eip. No segment change must happen before as a
    direct call to the next block may occur */
 static void gen_jmp_tb(DisasContext *s, target_ulong eip, int tb_num)
@@ -2941,6 +2965,10 @@ static inline void gen_sto_env_A0(int idx, int offset)
 
 static inline void gen_op_movo(int d_offset, int s_offset)
 {
+    if (tcg_can_emit_vec_op(INDEX_op_vec_mov, MO_64)) {
+        tcg_gen_vec_mov(16, d_offset, s_offset);
+        return;
+    }
     tcg_gen_ld_i64(cpu_tmp1_i64, cpu_env, s_offset);
     tcg_gen_st_i64(cpu_tmp1_i64, cpu_env, d_offset);
     tcg_gen_ld_i64(cpu_tmp1_i64, cpu_env, s_offset + 8);
@@ -3282,6 +3310,104 @@ static const struct SSEOpHelper_eppi sse_op_table7[256] = {
     [0x63] = SSE42_OP(pcmpistri),
 };
 
+/* Translate the integer MMX/SSE2 ops that map directly onto a TCG vector
+   op.  'b' is the opcode byte following 0x0f.  Return true if the insn was
+   handled, false if the helper must be called.  */
+static bool gen_sse_vec(int b, int is_xmm, int op1_offset, int op2_offset)
+{
+    TCGOpcode opc;
+    int vece, aofs = op1_offset, bofs = op2_offset;
+
+    switch (b) {
+    case 0xfc: /* paddb */
+    case 0xfd: /* paddw */
+    case 0xfe: /* paddl */
+        opc = INDEX_op_vec_add;
+        vece = b - 0xfc;
+        break;
+    case 0xd4: /* paddq */
+        opc = INDEX_op_vec_add;
+        vece = MO_64;
+        break;
+    case 0xf8: /* psubb */
+    case 0xf9: /* psubw */
+    case 0xfa: /* psubl */
+    case 0xfb: /* psubq */
+        opc = INDEX_op_vec_sub;
+        vece = b - 0xf8;
+        break;
+    case 0xd5: /* pmullw */
+        opc = INDEX_op_vec_mul;
+        vece = MO_16;
+        break;
+    case 0xdb: /* pand */
+        opc = INDEX_op_vec_and;
+        vece = MO_64;
+        break;
+    case 0xdf: /* pandn: the destination is complemented */
+        opc = INDEX_op_vec_andc;
+        vece = MO_64;
+        aofs = op2_offset;
+        bofs = op1_offset;
+        break;
+    case 0xeb: /* por */
+        opc = INDEX_op_vec_or;
+        vece = MO_64;
+        break;
+    case 0xef: /* pxor */
+        opc = INDEX_op_vec_xor;
+        vece = MO_64;
+        break;
+    case 0x74: /* pcmpeqb */
+    case 0x75: /* pcmpeqw */
+    case 0x76: /* pcmpeql */
+        opc = INDEX_op_vec_cmpeq;
+        vece = b - 0x74;
+        break;
+    case 0x64: /* pcmpgtb */
+    case 0x65: /* pcmpgtw */
+    case 0x66: /* pcmpgtl */
+        opc = INDEX_op_vec_cmpgt;
+        vece = b - 0x64;
+        break;
+    default:
+        return false;
+    }
+    if (!tcg_can_emit_vec_op(opc, vece)) {
+        return false;
+    }
+    tcg_gen_vec_op3(opc, vece, is_xmm ? 16 : 8, op1_offset, aofs, bofs);
+    return true;
+}
+
+/* Same for the shifts by immediate (0x71 to 0x73), 'op' is the reg field
+   of the modrm byte.  */
+static bool gen_sse_shift_vec(int b, int op, int is_xmm, int offset,
+                              int shift)
+{
+    TCGOpcode opc;
+    int vece = (b & 3) == 1 ? MO_16 : (b & 3) == 2 ? MO_32 : MO_64;
+
+    switch (op) {
+    case 2:
+        opc = INDEX_op_vec_shri;
+        break;
+    case 4:
+        opc = INDEX_op_vec_sari;
+        break;
+    case 6:
+        opc = INDEX_op_vec_shli;
+        break;
+    default: /* psrldq, pslldq */
+        return false;
+    }
+    if (!tcg_can_emit_vec_op(opc, vece)) {
+        return false;
+    }
+    tcg_gen_vec_shifti(opc, vece, is_xmm ? 16 : 8, offset, offset, shift);
+    return true;
+}
+
 static void gen_sse(CPUX86State *env, DisasContext *s, int b,
                     target_ulong pc_start, int rex_r)
 {
@@ -3662,6 +3788,10 @@ static void gen_sse(CPUX86State *env, DisasContext *s, int b,
                 rm = (modrm & 7);
                 op2_offset = offsetof(CPUX86State,fpregs[rm].mmx);
             }
+            if (gen_sse_shift_vec(b, (modrm >> 3) & 7, is_xmm,
+                                  op2_offset, val)) {
+                break;
+            }
             tcg_gen_addi_ptr(cpu_ptr0, cpu_env, op2_offset);
             tcg_gen_addi_ptr(cpu_ptr1, cpu_env, op1_offset);
             sse_fn_epp(cpu_env, cpu_ptr0, cpu_ptr1);
@@ -4255,6 +4385,9 @@ static void gen_sse(CPUX86State *env, DisasContext *s, int b,
             sse_fn_eppt(cpu_env, cpu_ptr0, cpu_ptr1, cpu_A0);
             break;
         default:
+            if (gen_sse_vec(b, is_xmm, op1_offset, op2_offset)) {
+                break;
+            }
             tcg_gen_addi_ptr(cpu_ptr0, cpu_env, op1_offset);
             tcg_gen_addi_ptr(cpu_ptr1, cpu_env, op2_offset);
             sse_fn_epp(cpu_env, cpu_ptr0, cpu_ptr1);
@@ -4828,7 +4961,7 @@ static target_ulong disas_insn(CPUX86State *env, DisasContext *s, target_ulong p
             gen_movtl_T1_im(next_eip);
             gen_push_T1(s);
             gen_op_jmp_T0();
-            gen_eob(s);
+            gen_jr(s);
             break;
         case 3: /* lcall Ev */
             gen_op_ld_T1_A0(ot + s->mem_index);
@@ -4854,7 +4987,7 @@ static target_ulong disas_insn(CPUX86State *env, DisasContext *s, target_ulong p
             if (s->dflag == 0)
                 gen_op_andl_T0_ffff();
             gen_op_jmp_T0();
-            gen_eob(s);
+            gen_jr(s);
             break;
         case 5: /* ljmp Ev */
             gen_op_ld_T1_A0(ot + s->mem_index);
@@ -6368,7 +6501,7 @@ static target_ulong disas_insn(CPUX86State *env, DisasContext *s, target_ulong p
         if (s->dflag == 0)
             gen_op_andl_T0_ffff();
         gen_op_jmp_T0();
-        gen_eob(s);
+        gen_jr(s);
         break;
     case 0xc3: /* ret */
         gen_pop_T0(s);
@@ -6376,7 +6509,7 @@ static target_ulong disas_insn(CPUX86State *env, DisasContext *s, target_ulong p
         if (s->dflag == 0)
             gen_op_andl_T0_ffff();
         gen_op_jmp_T0();
-        gen_eob(s);
+        gen_jr(s);
         break;
     case 0xca: /* lret im */
         val = cpu_ldsw_code(env, s->pc);
@@ -137,6 +137,13 @@ static bool have_movbe;
 /* We need this symbol in tcg-target.h, and we can't properly conditionalize
    it there.  Therefore we always define the variable.  */
 bool have_bmi1;
+bool have_sse2;
+
+#if defined(CONFIG_CPUID_H) && defined(bit_SSE4_1)
+static bool have_sse41;
+#else
+# define have_sse41 0
+#endif
 
 #if defined(CONFIG_CPUID_H) && defined(bit_BMI2)
 static bool have_bmi2;
@@ -356,6 +363,40 @@ static inline int tcg_target_const_match(tcg_target_long val,
 #define OPC_GRP3_Ev	(0xf7)
 #define OPC_GRP5	(0xff)
 
+/* SSE2 instructions, used for the vector ops.  */
+#define OPC_MOVD_VyEy   (0x6e | P_EXT | P_DATA16)
+#define OPC_MOVDQU_VxWx (0x6f | P_EXT | P_SIMDF3)
+#define OPC_MOVDQU_WxVx (0x7f | P_EXT | P_SIMDF3)
+#define OPC_MOVQ_VqWq   (0x7e | P_EXT | P_SIMDF3)
+#define OPC_MOVQ_WqVq   (0xd6 | P_EXT | P_DATA16)
+#define OPC_PADDB       (0xfc | P_EXT | P_DATA16)
+#define OPC_PADDW       (0xfd | P_EXT | P_DATA16)
+#define OPC_PADDD       (0xfe | P_EXT | P_DATA16)
+#define OPC_PADDQ       (0xd4 | P_EXT | P_DATA16)
+#define OPC_PAND        (0xdb | P_EXT | P_DATA16)
+#define OPC_PANDN       (0xdf | P_EXT | P_DATA16)
+#define OPC_PCMPEQB     (0x74 | P_EXT | P_DATA16)
+#define OPC_PCMPEQW     (0x75 | P_EXT | P_DATA16)
+#define OPC_PCMPEQD     (0x76 | P_EXT | P_DATA16)
+#define OPC_PCMPGTB     (0x64 | P_EXT | P_DATA16)
+#define OPC_PCMPGTW     (0x65 | P_EXT | P_DATA16)
+#define OPC_PCMPGTD     (0x66 | P_EXT | P_DATA16)
+#define OPC_PMULLW      (0xd5 | P_EXT | P_DATA16)
+#define OPC_PMULLD      (0x40 | P_EXT38 | P_DATA16)  /* SSE4.1 */
+#define OPC_POR         (0xeb | P_EXT | P_DATA16)
+#define OPC_PSHIFTW_Ib  (0x71 | P_EXT | P_DATA16)  /* /2 /4 /6 */
+#define OPC_PSHIFTD_Ib  (0x72 | P_EXT | P_DATA16)  /* /2 /4 /6 */
+#define OPC_PSHIFTQ_Ib  (0x73 | P_EXT | P_DATA16)  /* /2 /6 */
+#define OPC_PSHUFD      (0x70 | P_EXT | P_DATA16)
+#define OPC_PSHUFLW     (0x70 | P_EXT | P_SIMDF2)
+#define OPC_PSUBB       (0xf8 | P_EXT | P_DATA16)
+#define OPC_PSUBW       (0xf9 | P_EXT | P_DATA16)
+#define OPC_PSUBD       (0xfa | P_EXT | P_DATA16)
+#define OPC_PSUBQ       (0xfb | P_EXT | P_DATA16)
+#define OPC_PUNPCKLBW   (0x60 | P_EXT | P_DATA16)
+#define OPC_PUNPCKLQDQ  (0x6c | P_EXT | P_DATA16)
+#define OPC_PXOR        (0xef | P_EXT | P_DATA16)
+
 /* Group 1 opcode extensions for 0x80-0x83.
    These are also used as modifiers for OPC_ARITH.  */
 #define ARITH_ADD 0
@@ -367,6 +408,11 @@ static inline int tcg_target_const_match(tcg_target_long val,
 #define ARITH_XOR 6
 #define ARITH_CMP 7
 
+/* Group 12-14 opcode extensions for the SSE2 shifts by immediate.  */
+#define PSHIFT_SRL 2
+#define PSHIFT_SRA 4
+#define PSHIFT_SLL 6
+
 /* Group 2 opcode extensions for 0xc0, 0xc1, 0xd0-0xd3.  */
 #define SHIFT_ROL 0
 #define SHIFT_ROR 1
@@ -433,6 +479,11 @@ static void tcg_out_opc(TCGContext *s, int opc, int r, int rm, int x)
         assert((opc & P_REXW) == 0);
         tcg_out8(s, 0x66);
     }
+    if (opc & P_SIMDF3) {
+        tcg_out8(s, 0xf3);
+    } else if (opc & P_SIMDF2) {
+        tcg_out8(s, 0xf2);
+    }
     if (opc & P_ADDR32) {
         tcg_out8(s, 0x67);
     }
@@ -469,6 +520,11 @@ static void tcg_out_opc(TCGContext *s, int opc)
     if (opc & P_DATA16) {
         tcg_out8(s, 0x66);
     }
+    if (opc & P_SIMDF3) {
+        tcg_out8(s, 0xf3);
+    } else if (opc & P_SIMDF2) {
+        tcg_out8(s, 0xf2);
+    }
     if (opc & (P_EXT | P_EXT38)) {
         tcg_out8(s, 0x0f);
         if (opc & P_EXT38) {
@@ -1203,8 +1259,10 @@ static inline void tcg_out_tlb_load(TCGContext *s, TCGReg addrlo, TCGReg addrhi,
 
     tgen_arithi(s, ARITH_AND + trexw, r1,
                 TARGET_PAGE_MASK | ((1 << s_bits) - 1), 0);
-    tgen_arithi(s, ARITH_AND + hrexw, r0,
-                (CPU_TLB_SIZE - 1) << CPU_TLB_ENTRY_BITS, 0);
+    /* and tlb_mask[mem_index](env), r0 : the TLB size is dynamic */
+    tcg_out_modrm_offset(s, OPC_ARITH_GvEv + (ARITH_AND << 3) + hrexw, r0,
+                         TCG_AREG0,
+                         offsetof(CPUArchState, tlb_mask[mem_index]));
 
     tcg_out_modrm_sib_offset(s, OPC_LEA + hrexw, r0, TCG_AREG0, r0, 0,
                              offsetof(CPUArchState, tlb_table[mem_index][0])
@@ -1717,6 +1775,162 @@ static void tcg_out_qemu_st(TCGContext *s, const TCGArg *args, bool is64)
 #endif
 }
 
+/* The vector ops work on the CPU state in memory, through %xmm0 and %xmm1.
+   These are call-clobbered and not known to the register allocator, so
+   nothing is kept in them from one op to the next.  */
+static bool tcg_target_vec_supported(TCGOpcode opc, unsigned vece)
+{
+    if (!have_sse2) {
+        return false;
+    }
+    switch (opc) {
+    case INDEX_op_vec_mov:
+    case INDEX_op_vec_dup:
+    case INDEX_op_vec_add:
+    case INDEX_op_vec_sub:
+    case INDEX_op_vec_and:
+    case INDEX_op_vec_andc:
+    case INDEX_op_vec_or:
+    case INDEX_op_vec_xor:
+        return true;
+    case INDEX_op_vec_mul:
+        return vece == MO_16 || (vece == MO_32 && have_sse41);
+    case INDEX_op_vec_shli:
+    case INDEX_op_vec_shri:
+        return vece != MO_8;
+    case INDEX_op_vec_sari:
+        return vece == MO_16 || vece == MO_32;
+    case INDEX_op_vec_cmpeq:
+    case INDEX_op_vec_cmpgt:
+        return vece != MO_64;
+    default:
+        return false;
+    }
+}
+
+static void tcg_out_vec_ld(TCGContext *s, int xmm, unsigned oprsz,
+                           intptr_t ofs)
+{
+    tcg_out_modrm_offset(s, oprsz == 16 ? OPC_MOVDQU_VxWx : OPC_MOVQ_VqWq,
+                         xmm, TCG_AREG0, ofs);
+}
+
+static void tcg_out_vec_st(TCGContext *s, int xmm, unsigned oprsz,
+                           intptr_t ofs)
+{
+    tcg_out_modrm_offset(s, oprsz == 16 ? OPC_MOVDQU_WxVx : OPC_MOVQ_WqVq,
+                         xmm, TCG_AREG0, ofs);
+}
+
+/* Broadcast the element at 'ofs' into %xmm0.  */
+static void tcg_out_vec_dup(TCGContext *s, unsigned vece, intptr_t ofs)
+{
+    if (vece == MO_64) {
+        tcg_out_modrm_offset(s, OPC_MOVQ_VqWq, 0, TCG_AREG0, ofs);
+        tcg_out_modrm(s, OPC_PUNPCKLQDQ, 0, 0);
+        return;
+    }
+    tcg_out_modrm_offset(s, OPC_MOVD_VyEy, 0, TCG_AREG0, ofs);
+    if (vece == MO_32) {
+        tcg_out_modrm(s, OPC_PSHUFD, 0, 0);
+        tcg_out8(s, 0);
+        return;
+    }
+    if (vece == MO_8) {
+        tcg_out_modrm(s, OPC_PUNPCKLBW, 0, 0);
+    }
+    tcg_out_modrm(s, OPC_PSHUFLW, 0, 0);
+    tcg_out8(s, 0);
+    tcg_out_modrm(s, OPC_PUNPCKLQDQ, 0, 0);
+}
+
+static void tcg_out_vec_op(TCGContext *s, TCGOpcode opc, const TCGArg *args)
+{
+    static const int add_insn[4] = {
+        OPC_PADDB, OPC_PADDW, OPC_PADDD, OPC_PADDQ
+    };
+    static const int sub_insn[4] = {
+        OPC_PSUBB, OPC_PSUBW, OPC_PSUBD, OPC_PSUBQ
+    };
+    static const int cmpeq_insn[3] = {
+        OPC_PCMPEQB, OPC_PCMPEQW, OPC_PCMPEQD
+    };
+    static const int cmpgt_insn[3] = {
+        OPC_PCMPGTB, OPC_PCMPGTW, OPC_PCMPGTD
+    };
+    static const int shift_insn[4] = {
+        0, OPC_PSHIFTW_Ib, OPC_PSHIFTD_Ib, OPC_PSHIFTQ_Ib
+    };
+    unsigned oprsz = TCG_VEC_OPRSZ(args[3]);
+    unsigned vece = TCG_VEC_VECE(args[3]);
+    intptr_t aofs = args[1], bofs = args[2];
+    int insn, ext;
+
+    switch (opc) {
+    case INDEX_op_vec_mov:
+        tcg_out_vec_ld(s, 0, oprsz, aofs);
+        break;
+    case INDEX_op_vec_dup:
+        tcg_out_vec_dup(s, vece, aofs);
+        break;
+
+    case INDEX_op_vec_shli:
+        ext = PSHIFT_SLL;
+        goto do_shift;
+    case INDEX_op_vec_shri:
+        ext = PSHIFT_SRL;
+        goto do_shift;
+    case INDEX_op_vec_sari:
+        ext = PSHIFT_SRA;
+    do_shift:
+        tcg_out_vec_ld(s, 0, oprsz, aofs);
+        tcg_out_modrm(s, shift_insn[vece], ext, 0);
+        tcg_out8(s, TCG_VEC_IMM(args[3]));
+        break;
+
+    case INDEX_op_vec_andc:
+        /* pandn complements its destination operand.  */
+        insn = OPC_PANDN;
+        aofs = args[2];
+        bofs = args[1];
+        goto do_binop;
+    case INDEX_op_vec_add:
+        insn = add_insn[vece];
+        goto do_binop;
+    case INDEX_op_vec_sub:
+        insn = sub_insn[vece];
+        goto do_binop;
+    case INDEX_op_vec_mul:
+        insn = vece == MO_16 ? OPC_PMULLW : OPC_PMULLD;
+        goto do_binop;
+    case INDEX_op_vec_and:
+        insn = OPC_PAND;
+        goto do_binop;
+    case INDEX_op_vec_or:
+        insn = OPC_POR;
+        goto do_binop;
+    case INDEX_op_vec_xor:
+        insn = OPC_PXOR;
+        goto do_binop;
+    case INDEX_op_vec_cmpeq:
+        insn = cmpeq_insn[vece];
+        goto do_binop;
+    case INDEX_op_vec_cmpgt:
+        insn = cmpgt_insn[vece];
+    do_binop:
+        /* Legacy SSE memory operands must be aligned, which the CPU
+           state fields are not, so load both operands.  */
+        tcg_out_vec_ld(s, 0, oprsz, aofs);
+        tcg_out_vec_ld(s, 1, oprsz, bofs);
+        tcg_out_modrm(s, insn, 0, 1);
+        break;
+
+    default:
+        tcg_abort();
+    }
+    tcg_out_vec_st(s, 0, oprsz, args[0]);
+}
+
 static inline void tcg_out_op(TCGContext *s, TCGOpcode opc,
                               const TCGArg *args, const int *const_args)
 {
@@ -1750,6 +1964,10 @@ static inline void tcg_out_op(TCGContext *s, TCGOpcode opc,
         }
         s->tb_next_offset[args[0]] = s->code_ptr - s->code_buf;
         break;
+    case INDEX_op_goto_ptr:
+        /* jmp *reg */
+        tcg_out_modrm(s, OPC_GRP5, EXT5_JMPN_Ev, args[0]);
+        break;
     case INDEX_op_call:
         if (const_args[0]) {
             tcg_out_calli(s, args[0]);
@@ -2072,6 +2290,23 @@ static inline void tcg_out_op(TCGContext *s, TCGOpcode opc,
         }
         break;
 
+    case INDEX_op_vec_mov:
+    case INDEX_op_vec_dup:
+    case INDEX_op_vec_add:
+    case INDEX_op_vec_sub:
+    case INDEX_op_vec_mul:
+    case INDEX_op_vec_and:
+    case INDEX_op_vec_andc:
+    case INDEX_op_vec_or:
+    case INDEX_op_vec_xor:
+    case INDEX_op_vec_shli:
+    case INDEX_op_vec_shri:
+    case INDEX_op_vec_sari:
+    case INDEX_op_vec_cmpeq:
+    case INDEX_op_vec_cmpgt:
+        tcg_out_vec_op(s, opc, args);
+        break;
+
     default:
         tcg_abort();
     }
@@ -2082,6 +2317,7 @@ static inline void tcg_out_op(TCGContext *s, TCGOpcode opc,
 static const TCGTargetOpDef x86_op_defs[] = {
     { INDEX_op_exit_tb, { } },
     { INDEX_op_goto_tb, { } },
+    { INDEX_op_goto_ptr, { "r" } },
     { INDEX_op_call, { "ri" } },
     { INDEX_op_br, { } },
     { INDEX_op_mov_i32, { "r", "r" } },
@@ -2210,6 +2446,21 @@ static const TCGTargetOpDef x86_op_defs[] = {
     { INDEX_op_qemu_ld_i64, { "r", "r", "L", "L" } },
     { INDEX_op_qemu_st_i64, { "L", "L", "L", "L" } },
 #endif
+
+    { INDEX_op_vec_mov, { } },
+    { INDEX_op_vec_dup, { } },
+    { INDEX_op_vec_add, { } },
+    { INDEX_op_vec_sub, { } },
+    { INDEX_op_vec_mul, { } },
+    { INDEX_op_vec_and, { } },
+    { INDEX_op_vec_andc, { } },
+    { INDEX_op_vec_or, { } },
+    { INDEX_op_vec_xor, { } },
+    { INDEX_op_vec_shli, { } },
+    { INDEX_op_vec_shri, { } },
+    { INDEX_op_vec_sari, { } },
+    { INDEX_op_vec_cmpeq, { } },
+    { INDEX_op_vec_cmpgt, { } },
     { -1 },
 };
 
@@ -2279,6 +2530,11 @@ static void tcg_target_qemu_prologue(TCGContext *s)
     tcg_out_modrm(s, OPC_GRP5, EXT5_JMPN_Ev, tcg_target_call_iarg_regs[1]);
 #endif
 
+    /* Return path for goto_ptr.  Set TCG_REG_EAX to 0 so that cpu_exec
+       does not try to chain the last block to anything.  */
+    s->code_gen_epilogue = s->code_ptr;
+    tcg_out_movi(s, TCG_TYPE_REG, TCG_REG_EAX, 0);
+
     /* TB epilogue */
     tb_ret_addr = s->code_ptr;
 
@@ -2315,6 +2571,10 @@ static void tcg_target_init(TCGContext *s)
         /* MOVBE is only available on Intel Atom and Haswell CPUs, so we
            need to probe for it.  */
         have_movbe = (c & bit_MOVBE) != 0;
+#endif
+        have_sse2 = (d & bit_SSE2) != 0;
+#ifndef have_sse41
+        have_sse41 = (c & bit_SSE4_1) != 0;
 #endif
     }
 
@@ -2331,6 +2591,8 @@ static void tcg_target_init(TCGContext *s)
 #endif
 
     if (TCG_TARGET_REG_BITS == 64) {
+        /* SSE2 is part of the x86-64 baseline.  */
+        have_sse2 = true;
         tcg_regset_set32(tcg_target_available_regs[TCG_TYPE_I32], 0, 0xffff);
         tcg_regset_set32(tcg_target_available_regs[TCG_TYPE_I64], 0, 0xffff);
     } else {
@@ -75,6 +75,7 @@ typedef enum {
 #endif
 
 extern bool have_bmi1;
+extern bool have_sse2;
 /* optional instructions */
 #define TCG_TARGET_HAS_div2_i32         1
 #define TCG_TARGET_HAS_rot_i32          1
@@ -130,6 +131,8 @@ extern bool have_bmi1;
 #endif
 
 #define TCG_TARGET_HAS_new_ldst         1
+#define TCG_TARGET_HAS_goto_ptr         1
+#define TCG_TARGET_HAS_vec              have_sse2
 
 #define TCG_TARGET_deposit_i32_valid(ofs, len) \
     (((ofs) == 0 && (len) == 8) || ((ofs) == 8 && (len) == 8) || \
@@ -2618,6 +2618,47 @@ static inline void tcg_gen_muls2_i64(TCGv_i64 rl, TCGv_i64 rh,
 #define tcg_gen_qemu_st_tl tcg_gen_qemu_st_i64
 #endif
 
+/* Vector operations.  The operands are vectors of 'oprsz' (8 or 16) bytes
+   at offsets 'dofs', 'aofs' and 'bofs' in the CPU state, made of elements
+   of (8 << vece) bits.  They may only be used when tcg_can_emit_vec_op()
+   returns true, front ends fall back to their helpers otherwise.  */
+static inline void tcg_gen_vec_op3(TCGOpcode opc, unsigned vece,
+                                   unsigned oprsz, intptr_t dofs,
+                                   intptr_t aofs, intptr_t bofs)
+{
+    *tcg_ctx.gen_opc_ptr++ = opc;
+    *tcg_ctx.gen_opparam_ptr++ = dofs;
+    *tcg_ctx.gen_opparam_ptr++ = aofs;
+    *tcg_ctx.gen_opparam_ptr++ = bofs;
+    *tcg_ctx.gen_opparam_ptr++ = TCG_VEC_DESC(oprsz, vece, 0);
+}
+
+/* Shift by immediate, elements are zeroed (or filled with their sign bit
+   for vec_sari) when 'shift' is not smaller than their size.  */
+static inline void tcg_gen_vec_shifti(TCGOpcode opc, unsigned vece,
+                                      unsigned oprsz, intptr_t dofs,
+                                      intptr_t aofs, unsigned shift)
+{
+    *tcg_ctx.gen_opc_ptr++ = opc;
+    *tcg_ctx.gen_opparam_ptr++ = dofs;
+    *tcg_ctx.gen_opparam_ptr++ = aofs;
+    *tcg_ctx.gen_opparam_ptr++ = 0;
+    *tcg_ctx.gen_opparam_ptr++ = TCG_VEC_DESC(oprsz, vece, shift);
+}
+
+static inline void tcg_gen_vec_mov(unsigned oprsz, intptr_t dofs,
+                                   intptr_t aofs)
+{
+    tcg_gen_vec_op3(INDEX_op_vec_mov, MO_64, oprsz, dofs, aofs, 0);
+}
+
+/* Replicate the element at 'aofs' into all the elements of 'dofs'.  */
+static inline void tcg_gen_vec_dup(unsigned vece, unsigned oprsz,
+                                   intptr_t dofs, intptr_t aofs)
+{
+    tcg_gen_vec_op3(INDEX_op_vec_dup, vece, oprsz, dofs, aofs, 0);
+}
+
 /* debug info: write the PC of the corresponding QEMU CPU instruction */
 static inline void tcg_gen_debug_insn_start(uint64_t pc)
 {
@@ -2647,6 +2688,18 @@ static inline void tcg_gen_goto_tb(unsigned idx)
     tcg_gen_op1i(INDEX_op_goto_tb, idx);
 }
 
+/* Jump to the host code pointed to by DEST, which is either the tc_ptr
+   of a translated block or tcg_ctx.code_gen_epilogue, which returns 0
+   to cpu_exec.  Only valid when TCG_TARGET_HAS_goto_ptr.  */
+static inline void tcg_gen_goto_ptr(TCGv_ptr dest)
+{
+#if TCG_TARGET_REG_BITS == 32
+    tcg_gen_op1_i32(INDEX_op_goto_ptr, TCGV_PTR_TO_NAT(dest));
+#else
+    tcg_gen_op1_i64(INDEX_op_goto_ptr, TCGV_PTR_TO_NAT(dest));
+#endif
+}
+
 
 void tcg_gen_qemu_ld_i32(TCGv_i32, TCGv, TCGArg, TCGMemOp);
 void tcg_gen_qemu_st_i32(TCGv_i32, TCGv, TCGArg, TCGMemOp);
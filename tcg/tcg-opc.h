@@ -172,6 +172,26 @@ DEF(muls2_i64, 2, 2, 0, IMPL64 | IMPL(TCG_TARGET_HAS_muls2_i64))
 DEF(muluh_i64, 1, 2, 0, IMPL(TCG_TARGET_HAS_muluh_i64))
 DEF(mulsh_i64, 1, 2, 0, IMPL(TCG_TARGET_HAS_mulsh_i64))
 
+/* vector ops on the CPU state: dofs, aofs, bofs, desc */
+#define IMPL_VEC IMPL(TCG_TARGET_HAS_vec)
+
+DEF(vec_mov, 0, 0, 4, IMPL_VEC)
+DEF(vec_dup, 0, 0, 4, IMPL_VEC)
+DEF(vec_add, 0, 0, 4, IMPL_VEC)
+DEF(vec_sub, 0, 0, 4, IMPL_VEC)
+DEF(vec_mul, 0, 0, 4, IMPL_VEC)
+DEF(vec_and, 0, 0, 4, IMPL_VEC)
+DEF(vec_andc, 0, 0, 4, IMPL_VEC)
+DEF(vec_or, 0, 0, 4, IMPL_VEC)
+DEF(vec_xor, 0, 0, 4, IMPL_VEC)
+DEF(vec_shli, 0, 0, 4, IMPL_VEC)
+DEF(vec_shri, 0, 0, 4, IMPL_VEC)
+DEF(vec_sari, 0, 0, 4, IMPL_VEC)
+DEF(vec_cmpeq, 0, 0, 4, IMPL_VEC)
+DEF(vec_cmpgt, 0, 0, 4, IMPL_VEC)
+
+#undef IMPL_VEC
+
 /* QEMU specific */
 #if TARGET_LONG_BITS > TCG_TARGET_REG_BITS
 DEF(debug_insn_start, 0, 0, 2, TCG_OPF_NOT_PRESENT)
@@ -180,6 +200,7 @@ DEF(debug_insn_start, 0, 0, 1, TCG_OPF_NOT_PRESENT)
 #endif
 DEF(exit_tb, 0, 0, 1, TCG_OPF_BB_END)
 DEF(goto_tb, 0, 0, 1, TCG_OPF_BB_END)
+DEF(goto_ptr, 0, 1, 0, TCG_OPF_BB_END | IMPL(TCG_TARGET_HAS_goto_ptr))
 
 #define IMPL_NEW_LDST \
     (TCG_OPF_CALL_CLOBBER | TCG_OPF_SIDE_EFFECTS \
@@ -105,6 +105,7 @@ static int tcg_target_const_match(tcg_target_long val,
                                   const TCGArgConstraint *arg_ct);
 static void tcg_out_tb_init(TCGContext *s);
 static void tcg_out_tb_finalize(TCGContext *s);
+static bool tcg_target_vec_supported(TCGOpcode opc, unsigned vece);
 
 
 TCGOpDef tcg_op_defs[] = {
@@ -1390,6 +1391,14 @@ void tcg_add_target_add_op_defs(const TCGTargetOpDef *tdefs)
 #endif
 }
 
+/* Return true if the host implements the vector op 'opc' for elements of
+   (8 << vece) bits.  Front ends keep using their helpers otherwise.  */
+bool tcg_can_emit_vec_op(TCGOpcode opc, unsigned vece)
+{
+    return !(tcg_op_defs[opc].flags & TCG_OPF_NOT_PRESENT) &&
+           tcg_target_vec_supported(opc, vece);
+}
+
 #ifdef USE_LIVENESS_ANALYSIS
 
 /* set a nop for an operation using 'nb_args' */
@@ -520,6 +520,7 @@ struct TCGContext {
     /* Code generation */
     int code_gen_max_blocks;
     uint8_t *code_gen_prologue;
+    uint8_t *code_gen_epilogue;
     uint8_t *code_gen_buffer;
     size_t code_gen_buffer_size;
     /* threshold to flush the translated code buffer */
@@ -674,6 +675,17 @@ do {\
 
 void tcg_add_target_add_op_defs(const TCGTargetOpDef *tdefs);
 
+/* Constant argument of the vector ops: operation size in bytes (8 or 16),
+   log2 of the element size in bytes (a TCGMemOp size) and an immediate
+   used by the shifts.  */
+#define TCG_VEC_DESC(oprsz, vece, imm) \
+    ((TCGArg)(((oprsz) >> 4) | ((vece) << 1) | ((imm) << 3)))
+#define TCG_VEC_OPRSZ(desc)   ((desc) & 1 ? 16 : 8)
+#define TCG_VEC_VECE(desc)    (((desc) >> 1) & 3)
+#define TCG_VEC_IMM(desc)     ((desc) >> 3)
+
+bool tcg_can_emit_vec_op(TCGOpcode opc, unsigned vece);
+
 #if UINTPTR_MAX == UINT32_MAX
 #define TCGV_NAT_TO_PTR(n) MAKE_TCGV_PTR(GET_TCGV_I32(n))
 #define TCGV_PTR_TO_NAT(n) MAKE_TCGV_I32(GET_TCGV_PTR(n))
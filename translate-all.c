@@ -65,32 +65,6 @@ typedef struct PageDesc {
 #endif
 } PageDesc;
 
-/* In system mode we want L1_MAP to be based on ram offsets,
-   while in user mode we want it to be based on virtual addresses.  */
-#if !defined(CONFIG_USER_ONLY)
-#if HOST_LONG_BITS < TARGET_PHYS_ADDR_SPACE_BITS
-# define L1_MAP_ADDR_SPACE_BITS  HOST_LONG_BITS
-#else
-# define L1_MAP_ADDR_SPACE_BITS  TARGET_PHYS_ADDR_SPACE_BITS
-#endif
-#else
-# define L1_MAP_ADDR_SPACE_BITS  TARGET_VIRT_ADDR_SPACE_BITS
-#endif
-
-/* The bits remaining after N lower levels of page tables.  */
-#define V_L1_BITS_REM \
-    ((L1_MAP_ADDR_SPACE_BITS - TARGET_PAGE_BITS) % L2_BITS)
-
-#if V_L1_BITS_REM < 4
-#define V_L1_BITS  (V_L1_BITS_REM + L2_BITS)
-#else
-#define V_L1_BITS  V_L1_BITS_REM
-#endif
-
-#define V_L1_SIZE  ((target_ulong)1 << V_L1_BITS)
-
-#define V_L1_SHIFT (L1_MAP_ADDR_SPACE_BITS - TARGET_PAGE_BITS - V_L1_BITS)
-
 uintptr_t qemu_real_host_page_size;
 uintptr_t qemu_host_page_size;
 uintptr_t qemu_host_page_mask;
@@ -98,7 +72,6 @@ uintptr_t qemu_host_page_mask;
 /* This is a multi-level map on the virtual address space.
    The bottom level has pointers to PageDesc.  */
 static void *l1_map[V_L1_SIZE];
-static void* l1_phys_map[V_L1_SIZE];
 
 /* code generation context */
 TCGContext tcg_ctx;
@@ -431,50 +404,6 @@ static inline PageDesc *page_find(tb_page_addr_t index)
     return page_find_alloc(index, 0);
 }
 
-PhysPageDesc *phys_page_find_alloc(hwaddr index, int alloc)
-{
-    void **lp;
-    PhysPageDesc *pd;
-    int i;
-
-    /* Level 1. Always allocated. */
-    lp = l1_phys_map + ((index >> V_L1_SHIFT) & (V_L1_SIZE - 1));
-
-    /* Level 2..N-1 */
-    for (i = V_L1_SHIFT / L2_BITS - 1; i > 0; i--) {
-        void **p = *lp;
-
-        if (p == NULL) {
-            if (!alloc) {
-                return NULL;
-            }
-            p = g_malloc0(sizeof(void *) * L2_SIZE);
-            *lp = p;
-        }
-
-        lp = p + ((index >> (i * L2_BITS)) & (L2_SIZE - 1));
-    }
-
-    pd = *lp;
-    if (pd == NULL) {
-        if (!alloc) {
-            return NULL;
-        }
-        pd = g_malloc(sizeof(PhysPageDesc) * L2_SIZE);
-        *lp = pd;
-        for (i = 0; i < L2_SIZE; i++) {
-            pd[i].phys_offset = IO_MEM_UNASSIGNED;
-            pd[i].region_offset = (index + i) << TARGET_PAGE_BITS;
-        }
-    }
-    return ((PhysPageDesc *)pd) + (index & (L2_SIZE - 1));
-}
-
-PhysPageDesc *phys_page_find(hwaddr index)
-{
-    return phys_page_find_alloc(index, 0);
-}
-
 #if !defined(CONFIG_USER_ONLY)
 #define mmap_lock() do { } while (0)
 #define mmap_unlock() do { } while (0)
@@ -1585,6 +1514,28 @@ void dump_exec_info(FILE *f, fprintf_function cpu_fprintf)
     cpu_fprintf(f, "TB invalidate count %d\n",
             tcg_ctx.tb_ctx.tb_phys_invalidate_count);
     cpu_fprintf(f, "TLB flush count     %d\n", tlb_flush_count);
+    cpu_fprintf(f, "phys sections       %d (rebuilds %d)\n",
+                phys_dispatch_nb_sections(), phys_dispatch_rebuild_count);
+    cpu_fprintf(f, "TLB resize count    %d\n", tlb_resize_count);
+    for (i = 0; i < NB_MMU_MODES; i++) {
+        uint64_t misses = tlb_miss_count[i] + tlb_victim_hit_count[i];
+        cpu_fprintf(f, "TLB mode %d misses   %" PRId64
+                    " (victim hits %" PRId64 " %d%%)\n",
+                    i, misses, tlb_victim_hit_count[i],
+                    misses ? (int)(tlb_victim_hit_count[i] * 100 / misses) : 0);
+    }
+    cpu_fprintf(f, "TLB ASID switches   %d (entries kept %" PRId64
+                ", dropped %" PRId64 ")\n",
+                tlb_asid_switch_count, tlb_asid_kept_count,
+                tlb_asid_dropped_count);
+    cpu_fprintf(f, "TLB ASID flushes    %d\n", tlb_asid_flush_count);
+    cpu_fprintf(f, "TB exec count       %" PRId64 "\n", tb_exec_count);
+    cpu_fprintf(f, "TB ptr lookups      %" PRId64 " (hits %" PRId64 " %d%%)\n",
+                tb_lookup_ptr_hit_count + tb_lookup_ptr_miss_count,
+                tb_lookup_ptr_hit_count,
+                tb_lookup_ptr_hit_count + tb_lookup_ptr_miss_count ?
+                (int)(tb_lookup_ptr_hit_count * 100 /
+                      (tb_lookup_ptr_hit_count + tb_lookup_ptr_miss_count)) : 0);
     tcg_dump_info(f, cpu_fprintf);
 }
 
@@ -3955,6 +3955,8 @@ int main(int argc, char **argv, char **envp)
     while (dcl != NULL) {
         if (dcl->dpy_refresh != NULL) {
             ds->gui_timer = timer_new(QEMU_CLOCK_REALTIME, SCALE_MS, gui_update, ds);
+            /* a frame a little late is fine, let it share wakeups */
+            timer_set_slack_ns(ds->gui_timer, 2 * SCALE_MS);
             timer_mod(ds->gui_timer, qemu_clock_get_ms(QEMU_CLOCK_REALTIME));
         }
         dcl = dcl->next;
@@ -3962,6 +3964,7 @@ int main(int argc, char **argv, char **envp)
 
     if (display_type == DT_NOGRAPHIC || display_type == DT_VNC) {
         nographic_timer = timer_new(QEMU_CLOCK_REALTIME, SCALE_MS, nographic_update, NULL);
+        timer_set_slack_ns(nographic_timer, GUI_REFRESH_INTERVAL * SCALE_MS);
         timer_mod(nographic_timer, qemu_clock_get_ms(QEMU_CLOCK_REALTIME));
     }
 